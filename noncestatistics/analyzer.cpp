@@ -0,0 +1,534 @@
+#include "analyzer.hpp"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <unordered_map>
+#include <unordered_set>
+#include <string.h>
+#include "stats.hpp"
+#include "common.h"
+#include "profile.hpp"
+
+// Nonces and collisions of ApNonces and SepNonces, what -s always printed
+class CollisionAnalyzer : public Analyzer {
+public:
+    void consume(const RecordBatch& batch) override{
+        for (auto& record: batch.records) countNonces(record.apNonce, record.sepNonce, counts);
+    }
+    void report(const AnalysisContext& context) override{
+        printStatistics(counts, context.dictFilename);
+    }
+    void profileTables(Profile& profile) const override{
+        profile.addTable(orderedTableProfile("collisions.apnonces", counts.apNonces));
+        profile.addTable(orderedTableProfile("collisions.sepnonces", counts.sepNonces));
+        profile.addTable(orderedTableProfile("collisions.pairs", counts.pairs));
+    }
+
+private:
+    NonceCounts counts;
+};
+
+// The nonce space of every device model on its own, and the ApNonces that
+// more than one model produced, which no healthy generator should.
+class DeviceAnalyzer : public Analyzer {
+public:
+    void consume(const RecordBatch& batch) override{
+        for (auto& record: batch.records) {
+            if (record.apNonce.empty()) continue;
+            if (record.device >= estimators.size()) estimators.resize(record.device+1);
+            estimators[record.device].add(record.apNonce);
+            auto first = firstDevice.insert(std::make_pair(record.apNonce, (long)record.device)).first;
+            if (first->second >= 0 && first->second != (long)record.device) {
+                first->second = -1;
+                shared++;
+            }
+        }
+    }
+    void report(const AnalysisContext& context) override{
+        std::cout << "ApNonces per device model" << std::endl;
+        std::cout << "device                              nonces      distinct    collisions    est. space" << std::endl;
+        std::cout << "===========================================================================" << std::endl;
+        for (size_t i = 0; i < estimators.size(); i++) {
+            const SpaceEstimator& estimator = estimators[i];
+            if (!estimator.samples()) continue;
+            printf("%-30.30s  %10ld    %10ld    %10ld    ", context.devices[i].c_str(), estimator.samples(), estimator.distinct(), estimator.collisions());
+            if (estimator.collisions()) printf("%10.0f\n", estimator.estimate());
+            else printf("%10s\n", "-");
+        }
+        std::cout << "===========================================================================" << std::endl;
+        std::cout << shared << " ApNonces were seen on more than one device model" << std::endl;
+    }
+    void profileTables(Profile& profile) const override{
+        profile.addTable(hashTableProfile("devices.first", firstDevice));
+    }
+
+private:
+    std::vector<SpaceEstimator> estimators;
+    std::unordered_map<std::string, long> firstDevice;
+    long shared = 0;
+};
+
+// Counts how often every bit of the distinct ApNonces is set. A good
+// generator sets each of them in half of the nonces, so a bit is reported as
+// biased once its count is further from half than chance allows for all bits
+// together. Repeated nonces are left to the collisions, they would only make
+// the bits look more biased than the generator is.
+#define BITS_MAX_NONCE_SIZE  64
+#define BITS_SHOWN           10
+
+class BitBiasAnalyzer : public Analyzer {
+public:
+    BitBiasAnalyzer() : ones(8*BITS_MAX_NONCE_SIZE, 0), totals(BITS_MAX_NONCE_SIZE, 0) {}
+
+    void consume(const RecordBatch& batch) override{
+        for (auto& record: batch.records) {
+            if (record.apNonce.empty() || !seen.insert(record.apNonce).second) continue;
+            size_t size = std::min(record.apNonce.size(), (size_t)BITS_MAX_NONCE_SIZE);
+            for (size_t i = 0; i < size; i++) {
+                unsigned char byte = (unsigned char)record.apNonce[i];
+                totals[i]++;
+                for (int bit = 0; bit < 8; bit++) ones[8*i+bit] += (byte >> (7-bit)) & 1;
+            }
+        }
+    }
+    void report(const AnalysisContext&) override{
+        std::vector<std::pair<double, size_t> > scores;
+        long constant = 0;
+        for (size_t bit = 0; bit < ones.size(); bit++) {
+            double n = (double)totals[bit/8];
+            if (n < 2) continue;
+            if (ones[bit] == 0 || ones[bit] == totals[bit/8]) constant++;
+            scores.push_back(std::make_pair((ones[bit] - n/2)/std::sqrt(n/4), bit));
+        }
+        std::cout << "Bit bias of the distinct ApNonces" << std::endl;
+        if (scores.empty()) {
+            std::cout << "Not enough ApNonces to look at their bits" << std::endl;
+            return;
+        }
+
+        double limit = normalQuantile(1 - 0.01/scores.size());
+        long biased = 0;
+        for (auto& score: scores) if (std::fabs(score.first) > limit) biased++;
+        std::sort(scores.begin(), scores.end(), [] (const std::pair<double, size_t>& a, const std::pair<double, size_t>& b) -> bool{
+            return std::fabs(a.first) > std::fabs(b.first);
+        });
+
+        std::cout << "===========================================================================" << std::endl;
+        std::cout << "bits tested:                                 " << scores.size() << std::endl;
+        std::cout << "bits that never or always are set:           " << constant << std::endl;
+        char label[64];
+        snprintf(label, sizeof(label), "biased bits (|z| above %.2f):", limit);
+        printf("%-45s%ld\n", label, biased);
+        std::cout << "===========================================================================" << std::endl;
+        std::cout << "bit (byte.bit)         set      rel. frequency           z" << std::endl;
+        std::cout << "===========================================================================" << std::endl;
+        for (size_t i = 0; i < scores.size() && i < BITS_SHOWN; i++) {
+            size_t bit = scores[i].second;
+            printf("%4zu (%2zu.%zu)     %10ld           %7.3f%%    %8.2f\n", bit, bit/8, bit%8, ones[bit],
+                   100*((double)ones[bit]/totals[bit/8]), scores[i].first);
+        }
+        std::cout << "===========================================================================" << std::endl;
+        if (biased) std::cout << biased << " bits are biased, the ApNonces are not uniformly random" << std::endl;
+        else std::cout << "No bit is biased beyond chance" << std::endl;
+    }
+    void profileTables(Profile& profile) const override{
+        profile.addTable(hashTableProfile("bits.seen", seen));
+    }
+
+private:
+    std::unordered_set<std::string> seen;
+    std::vector<long> ones;
+    std::vector<long> totals;
+};
+
+// A generator that replays a fixed sequence shows up as nonces coming back
+// after the same number of reboots. Every collection in a log is a sequence
+// of its own, since nothing carries over between collections. Every nonce
+// gets a dense ID, and the candidate periods are the most frequent gaps
+// between a nonce and its previous occurrence and the shifts at which
+// PERIOD_WINDOW nonces in a row came back, found with a rolling hash over
+// the windows of the sequence. Each candidate is checked by comparing the
+// sequences with themselves shifted by it, and a period is only reported if
+// its longest replayed run is longer than repeats in a nonce space that
+// small would give by chance. All of it is linear in the length of the logs.
+#define PERIOD_CANDIDATES 10
+#define PERIOD_WINDOW     4
+#define PERIOD_ALPHA      0.01
+
+class PeriodicityAnalyzer : public Analyzer {
+public:
+    void consume(const RecordBatch& batch) override{
+        for (auto& record: batch.records) {
+            if (record.apNonce.empty()) continue;
+            if (record.log >= reboots.size()) reboots.resize(record.log+1, 0);
+            if (sequences.empty() || sequences.back().log != record.log || sequences.back().section != record.section) {
+                Sequence sequence;
+                sequence.log = record.log;
+                sequence.section = record.section;
+                sequence.firstReboot = reboots[record.log];
+                sequences.push_back(sequence);
+            }
+            reboots[record.log]++;
+            auto id = ids.insert(std::make_pair(record.apNonce, (uint32_t)ids.size())).first;
+            sequences.back().ids.push_back(id->second);
+            total++;
+        }
+    }
+    void report(const AnalysisContext& context) override{
+        // gap to the previous occurrence of the same nonce in the same sequence
+        std::vector<long> last(ids.size(), -1);
+        std::vector<long> occurrences(ids.size(), 0);
+        std::map<long, long> gaps;
+        std::map<long, long> windows;
+        long repeats = 0;
+        for (auto& sequence: sequences) {
+            const std::vector<uint32_t>& ids = sequence.ids;
+            for (size_t i = 0; i < ids.size(); i++) {
+                occurrences[ids[i]]++;
+                if (last[ids[i]] >= 0) {
+                    gaps[(long)i - last[ids[i]]]++;
+                    repeats++;
+                }
+                last[ids[i]] = (long)i;
+            }
+            for (auto id: ids) last[id] = -1;
+            countReplayedWindows(ids, windows);
+        }
+
+        std::cout << "Periodicity of the ApNonce sequence" << std::endl;
+        std::cout << "===========================================================================" << std::endl;
+        std::cout << "reboots:                                     " << total << std::endl;
+        std::cout << "collections:                                 " << sequences.size() << std::endl;
+        std::cout << "distinct nonces:                             " << ids.size() << std::endl;
+        std::cout << "nonces seen before in their collection:      " << repeats << std::endl;
+        std::cout << "===========================================================================" << std::endl << std::endl;
+        if (repeats == 0) {
+            std::cout << "No nonce ever repeated, there is nothing periodic about this sequence" << std::endl;
+            return;
+        }
+
+        std::vector<std::pair<long, long> > byCount(gaps.begin(), gaps.end());
+        std::vector<std::pair<long, long> > byWindows(windows.begin(), windows.end());
+        auto moreFirst = [] (const std::pair<long, long>& a, const std::pair<long, long>& b) -> bool{
+            return a.second > b.second;
+        };
+        std::stable_sort(byCount.begin(), byCount.end(), moreFirst);
+        std::stable_sort(byWindows.begin(), byWindows.end(), moreFirst);
+
+        long seen = 0, median = 0;
+        for (auto g: gaps) {
+            seen += g.second;
+            if (seen*2 >= repeats) {
+                median = g.first;
+                break;
+            }
+        }
+        std::cout << "Gaps between repeats (in reboots): shortest " << gaps.begin()->first << ", median " << median << ", longest " << gaps.rbegin()->first << std::endl;
+        std::cout << "gap               repeats    rel. frequency" << std::endl;
+        std::cout << "===========================================================================" << std::endl;
+        for (size_t i = 0; i < byCount.size() && i < PERIOD_CANDIDATES; i++) {
+            printf("%-12ld   %10ld          %2.3f%%\n", byCount[i].first, byCount[i].second, 100*((float)byCount[i].second/repeats));
+        }
+        std::cout << "===========================================================================" << std::endl << std::endl;
+
+        std::vector<long> periods;
+        for (size_t i = 0; i < byCount.size() && i < PERIOD_CANDIDATES; i++) periods.push_back(byCount[i].first);
+        for (size_t i = 0; i < byWindows.size() && i < PERIOD_CANDIDATES; i++) {
+            if (std::find(periods.begin(), periods.end(), byWindows[i].first) == periods.end()) periods.push_back(byWindows[i].first);
+        }
+
+        // a period p makes ids[i] == ids[i-p] hold for most i, a replayed
+        // subsequence is a run of consecutive positions where it holds
+        std::cout << "Candidate periods are the " << PERIOD_CANDIDATES << " most frequent gaps and the " << PERIOD_CANDIDATES
+                  << " shifts that most runs of " << PERIOD_WINDOW << " nonces came back after, other periods are not checked" << std::endl;
+        std::cout << "period         matching positions    longest replayed run (log, first reboot)" << std::endl;
+        std::cout << "===========================================================================" << std::endl;
+        long bestPeriod = 0, bestMatches = 0, bestPositions = 0, bestLongest = 0;
+        std::string bestWhere;
+        for (auto period: periods) {
+            long matches = 0, positions = 0, longest = 0;
+            std::string where;
+            for (auto& sequence: sequences) {
+                const std::vector<uint32_t>& ids = sequence.ids;
+                long run = 0;
+                if (ids.size() <= (size_t)period) continue;
+                positions += (long)ids.size() - period;
+                for (size_t i = period; i < ids.size(); i++) {
+                    if (ids[i] != ids[i-period]) {
+                        run = 0;
+                        continue;
+                    }
+                    matches++;
+                    if (++run > longest) {
+                        longest = run;
+                        where = context.logs[sequence.log] + ", " + std::to_string(sequence.firstReboot + i - run + 2);
+                    }
+                }
+            }
+            if (!positions) continue;
+            printf("%-12ld   %10ld (%6.2f%%)    %10ld (%s)\n", period, matches, 100*(double)matches/positions, longest, (longest) ? where.c_str() : "-");
+            if (longest > bestLongest) {
+                bestPeriod = period;
+                bestMatches = matches;
+                bestPositions = positions;
+                bestLongest = longest;
+                bestWhere = where;
+            }
+        }
+        std::cout << "===========================================================================" << std::endl << std::endl;
+
+        // two reboots give the same nonce with probability q, so a run of L matches
+        // starts at a given position with q^L; the run has to beat that at every
+        // position of every candidate
+        double q = 0;
+        for (auto count: occurrences) q += ((double)count/total)*((double)count/total);
+        if (ids.size() == 1) {
+            std::cout << "Every reboot gave the same ApNonce, there is no sequence to repeat" << std::endl;
+            return;
+        }
+        double chance = std::log((double)total*periods.size()/PERIOD_ALPHA)/std::log(1/q);
+        double rate = (double)bestMatches/bestPositions;
+        if (bestLongest > chance) {
+            printf("%s with a period of %ld reboots (%.2f%% of positions match)\n", (rate >= 0.5) ? "The sequence repeats" : "Part of the sequence is replayed",
+                   bestPeriod, 100*rate);
+            printf("%ld reboots in a row from (%s) repeat those %ld reboots before, chance gives runs of about %.0f\n", bestLongest, bestWhere.c_str(),
+                   bestPeriod, chance);
+        }else{
+            printf("No period found, no replayed run is longer than the %.0f reboots chance gives for these repeats\n", chance);
+        }
+    }
+
+    void profileTables(Profile& profile) const override{
+        profile.addTable(hashTableProfile("periodicity.ids", ids));
+    }
+
+private:
+    struct Sequence {
+        uint32_t log;
+        uint32_t section;
+        uint64_t firstReboot;  // reboots of the log before the sequence
+        std::vector<uint32_t> ids;
+    };
+
+    // counts the shifts at which the PERIOD_WINDOW nonces ending at a position
+    // were seen last, a polynomial rolling hash keeps every window O(1)
+    static void countReplayedWindows(const std::vector<uint32_t>& ids, std::map<long, long>& windows){
+        const uint64_t base = 0x100000001b3ULL;
+        std::unordered_map<uint64_t, size_t> lastStart;
+        uint64_t power = 1;
+        uint64_t hash = 0;
+
+        if (ids.size() <= PERIOD_WINDOW) return;
+        for (int i = 1; i < PERIOD_WINDOW; i++) power *= base;
+        for (size_t i = 0; i < ids.size(); i++) {
+            if (i >= PERIOD_WINDOW) hash -= power*(ids[i-PERIOD_WINDOW] + 1);
+            hash = hash*base + ids[i] + 1;
+            if (i+1 < PERIOD_WINDOW) continue;
+            size_t start = i+1 - PERIOD_WINDOW;
+            auto previous = lastStart.find(hash);
+            if (previous != lastStart.end() && std::equal(ids.begin()+start, ids.begin()+start+PERIOD_WINDOW, ids.begin()+previous->second)) {
+                windows[(long)(start - previous->second)]++;
+            }
+            lastStart[hash] = start;
+        }
+    }
+
+    std::unordered_map<std::string, uint32_t> ids;
+    std::vector<Sequence> sequences;
+    std::vector<uint64_t> reboots;  // per log
+    long total = 0;
+};
+
+template <class T> static Analyzer* createAnalyzer(){
+    return new T();
+}
+
+const std::vector<AnalyzerInfo>& analyzerList(){
+    static const std::vector<AnalyzerInfo> list = {
+        { "collisions",  "ApNonce and SepNonce collisions and the nonce space estimate", createAnalyzer<CollisionAnalyzer> },
+        { "devices",     "nonces, collisions and nonce space of every device model", createAnalyzer<DeviceAnalyzer> },
+        { "bits",        "how often every bit of the distinct ApNonces is set", createAnalyzer<BitBiasAnalyzer> },
+        { "periodicity", "nonces that repeat after a fixed number of reboots", createAnalyzer<PeriodicityAnalyzer> },
+    };
+    return list;
+}
+
+bool parseAnalyzers(const char* list, std::vector<const AnalyzerInfo*>& selected){
+    std::istringstream names(list);
+    std::string name;
+
+    while (std::getline(names, name, ',')) {
+        bool found = false;
+        for (auto& info: analyzerList()) {
+            if (name != "all" && name != info.name) continue;
+            if (std::find(selected.begin(), selected.end(), &info) == selected.end()) selected.push_back(&info);
+            found = true;
+        }
+        if (!found) {
+            std::cout << "Unknown analyzer '" << name << "'" << std::endl;
+            return false;
+        }
+    }
+    if (selected.empty()) {
+        std::cout << "No analyzer selected" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Hands the batches to one analyzer. Pushing blocks while the analyzer is
+// ANALYZER_QUEUE_DEPTH batches behind, so the slowest analyzer sets the pace
+// and the memory in flight stays bounded.
+class AnalyzerWorker {
+public:
+    AnalyzerWorker(Analyzer* analyzer) : analyzer(analyzer), thread(&AnalyzerWorker::run, this) {}
+
+    void push(const std::shared_ptr<const RecordBatch>& batch){
+        std::unique_lock<std::mutex> lock(mutex);
+        space.wait(lock, [this] { return queue.size() < ANALYZER_QUEUE_DEPTH; });
+        queue.push_back(batch);
+        ready.notify_one();
+    }
+    void finish(){
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            finished = true;
+            ready.notify_one();
+        }
+        thread.join();
+    }
+
+private:
+    void run(){
+        for (;;) {
+            std::shared_ptr<const RecordBatch> batch;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                ready.wait(lock, [this] { return !queue.empty() || finished; });
+                if (queue.empty()) return;
+                batch = queue.front();
+                queue.pop_front();
+                space.notify_one();
+            }
+            ProfileScope scope(PROFILE_INSERT, batch->records.size());
+            analyzer->consume(*batch);
+        }
+    }
+
+    Analyzer* analyzer;
+    std::deque<std::shared_ptr<const RecordBatch> > queue;
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::condition_variable space;
+    bool finished = false;
+    std::thread thread;
+};
+
+// The logs are read and decoded once on the calling thread while every
+// analyzer consumes the batches on a thread of its own.
+int runAnalyzers(const std::vector<const char*>& logs, const std::vector<const AnalyzerInfo*>& selected, const char* dictFilename){
+    const std::string header = "Identified device as ";
+    AnalysisContext context;
+    std::vector<std::unique_ptr<Analyzer> > analyzers;
+    std::vector<std::unique_ptr<AnalyzerWorker> > workers;
+    std::map<std::string, uint32_t> deviceIds;
+    std::shared_ptr<RecordBatch> batch(new RecordBatch());
+    uint64_t index = 0;
+    int result = 0;
+
+    context.dictFilename = dictFilename;
+    for (auto info: selected) {
+        analyzers.emplace_back(info->create());
+        workers.emplace_back(new AnalyzerWorker(analyzers.back().get()));
+    }
+    auto deviceId = [&](const std::string& device) -> uint32_t{
+        auto id = deviceIds.insert(std::make_pair(device, (uint32_t)context.devices.size()));
+        if (id.second) context.devices.push_back(device);
+        return id.first->second;
+    };
+    auto flush = [&](){
+        for (auto& worker: workers) worker->push(batch);
+        batch.reset(new RecordBatch());
+        batch->records.reserve(ANALYZER_BATCH_SIZE);
+    };
+
+    // lines go through the stages a batch at a time, which keeps the clocks of a profile off the lines
+    std::vector<std::string> lines(ANALYZER_BATCH_SIZE);
+    std::vector<std::vector<std::pair<size_t, size_t> > > tokens(ANALYZER_BATCH_SIZE);
+    std::vector<uint32_t> lineDevices(ANALYZER_BATCH_SIZE);
+    std::vector<uint32_t> lineSections(ANALYZER_BATCH_SIZE);
+    batch->records.reserve(ANALYZER_BATCH_SIZE);
+    for (auto filename: logs) {
+        std::ifstream log(filename);
+        if (!log) {
+            error("ERROR: Unable to read %s\n", filename);
+            result = -1;
+            break;
+        }
+        uint32_t logId = (uint32_t)context.logs.size();
+        uint32_t device = deviceId("unknown");
+        uint32_t section = 0;
+        context.logs.push_back(filename);
+
+        for (;;) {
+            size_t count = 0;
+            {
+                ProfileScope scope(PROFILE_READ);
+                while (count < lines.size() && std::getline(log, lines[count])) scope.addItems(lines[count++].size()+1);
+            }
+            if (count == 0) break;
+            {
+                ProfileScope scope(PROFILE_TOKENIZE, count);
+                for (size_t i = 0; i < count; i++) {
+                    tokens[i].clear();
+                    if (lines[i].compare(0, header.size(), header) == 0) {
+                        std::string model = lines[i].substr(header.size());
+                        model.erase(model.find_last_not_of(' ')+1);
+                        device = deviceId(model);
+                        section++;
+                        continue;
+                    }
+                    tokenizeNonceLine(lines[i], tokens[i]);
+                    lineDevices[i] = device;
+                    lineSections[i] = section;
+                }
+            }
+            {
+                size_t decoded = batch->records.size();
+                ProfileScope scope(PROFILE_DECODE);
+                for (size_t i = 0; i < count; i++) {
+                    NonceRecord record;
+                    if (tokens[i].empty() || !decodeNonceTokens(lines[i], tokens[i], record.apNonce, record.sepNonce)) continue;
+                    record.index = index++;
+                    record.log = logId;
+                    record.device = lineDevices[i];
+                    record.section = lineSections[i];
+                    batch->records.push_back(std::move(record));
+                }
+                scope.addItems(batch->records.size() - decoded);
+            }
+            if (batch->records.size() >= ANALYZER_BATCH_SIZE) flush();
+        }
+    }
+    if (!batch->records.empty()) flush();
+    for (auto& worker: workers) worker->finish();
+    if (result < 0) return result;
+
+    for (size_t i = 0; i < analyzers.size(); i++) {
+        if (i) std::cout << std::endl;
+        ProfileScope scope(PROFILE_OUTPUT);
+        analyzers[i]->report(context);
+    }
+    if (statsProfile) {
+        for (auto& analyzer: analyzers) analyzer->profileTables(*statsProfile);
+    }
+    return 0;
+}
@@ -0,0 +1,59 @@
+#ifndef analyzer_hpp
+#define analyzer_hpp
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "profile.hpp"
+
+#define ANALYZER_BATCH_SIZE   4096
+#define ANALYZER_QUEUE_DEPTH  8
+
+// A line of a log with nonces in it, decoded once for all analyzers. The
+// nonces are raw bytes, either of them may be empty.
+struct NonceRecord {
+    std::string apNonce;
+    std::string sepNonce;
+    uint64_t index;     // position among the records of all logs
+    uint32_t log;       // index into AnalysisContext::logs
+    uint32_t device;    // index into AnalysisContext::devices
+    uint32_t section;   // collections of the log before it, each starts with "Identified device as ..."
+};
+
+struct RecordBatch {
+    std::vector<NonceRecord> records;
+};
+
+// What the records refer to. A record belongs to the device model that the
+// last "Identified device as ..." line before it names.
+struct AnalysisContext {
+    std::vector<std::string> logs;
+    std::vector<std::string> devices;
+    const char* dictFilename = NULL;
+};
+
+// One kind of statistics. Each analyzer consumes the batches in log order
+// from a thread of its own, so it needs no locking, and reports on the main
+// thread once all of them were read.
+class Analyzer {
+public:
+    virtual ~Analyzer() {}
+    virtual void consume(const RecordBatch& batch) = 0;
+    virtual void report(const AnalysisContext& context) = 0;
+    // adds the tables it counts in to a --profile
+    virtual void profileTables(Profile&) const {}
+};
+
+struct AnalyzerInfo {
+    const char* name;
+    const char* description;
+    Analyzer* (*create)();
+};
+
+const std::vector<AnalyzerInfo>& analyzerList();
+// LIST is a comma separated list of analyzer names, or all
+bool parseAnalyzers(const char* list, std::vector<const AnalyzerInfo*>& selected);
+// reads the logs once and feeds every record to all of the selected analyzers
+int runAnalyzers(const std::vector<const char*>& logs, const std::vector<const AnalyzerInfo*>& selected, const char* dictFilename = NULL);
+
+#endif /* analyzer_hpp */
@@ -23,10 +23,15 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <string.h>
 #include <errno.h>
 #include <libgen.h>
 #include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
 
 #include "common.h"
 
@@ -43,8 +48,40 @@ struct idevicerestore_mode_t idevicerestore_modes[] = {
 
 int idevicerestore_debug = 0;
 
+/*
+ * Logging: every call formats into a per-thread line buffer, and each
+ * complete line is pushed as one record onto an intrusive MPSC queue
+ * (Vyukov), so lines of different threads never mix. A single sink thread
+ * pops the records and writes them, so callers never block on a stream or a
+ * lock. The sink sleeps on a pipe when the queue is empty, producers only
+ * write to it after winning the race to clear the sleeping flag.
+ */
+#define LOG_LINE_SIZE 1024
+#define LOG_TAG_SIZE 64
 #define idevicerestore_err_buff_size 256
-static char idevicerestore_err_buff[idevicerestore_err_buff_size] = {0, };
+
+struct log_record_t {
+	struct log_record_t* next;
+	FILE* stream;
+	size_t length;
+	char text[1];
+};
+
+static __thread char log_line[LOG_LINE_SIZE];
+static __thread size_t log_line_length = 0;
+static __thread FILE* log_line_stream = NULL;
+static __thread char log_tag[LOG_TAG_SIZE] = {0, };
+static __thread char idevicerestore_err_buff[idevicerestore_err_buff_size] = {0, };
+
+static struct log_record_t log_stub = { NULL, NULL, 0, {0} };
+static struct log_record_t* log_head = &log_stub;
+static struct log_record_t* log_tail = &log_stub;
+static unsigned long log_produced = 0;
+static unsigned long log_consumed = 0;
+static int log_sink_sleeping = 0;
+static int log_wakeup[2] = { -1, -1 };
+static int log_sink_running = 0;
+static pthread_once_t log_sink_once = PTHREAD_ONCE_INIT;
 
 static FILE* info_stream = NULL;
 static FILE* error_stream = NULL;
@@ -54,40 +91,251 @@ static int info_disabled = 0;
 static int error_disabled = 0;
 static int debug_disabled = 0;
 
+static void log_push(struct log_record_t* record) {
+	struct log_record_t* prev = NULL;
+	record->next = NULL;
+	prev = __atomic_exchange_n(&log_head, record, __ATOMIC_ACQ_REL);
+	__atomic_store_n(&prev->next, record, __ATOMIC_RELEASE);
+}
+
+/* only ever called by the sink thread */
+static struct log_record_t* log_pop(void) {
+	struct log_record_t* tail = log_tail;
+	struct log_record_t* next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+	if (tail == &log_stub) {
+		if (!next) {
+			return NULL;
+		}
+		log_tail = tail = next;
+		next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+	}
+	if (next) {
+		log_tail = next;
+		return tail;
+	}
+	if (tail != __atomic_load_n(&log_head, __ATOMIC_ACQUIRE)) {
+		/* a producer is between its exchange and its store, try again later */
+		return NULL;
+	}
+	log_push(&log_stub);
+	next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+	if (next) {
+		log_tail = next;
+		return tail;
+	}
+	return NULL;
+}
+
+static void* log_sink(void* arg) {
+	struct log_record_t* record = NULL;
+	struct pollfd pfd;
+	char drain[64];
+
+	pfd.fd = log_wakeup[0];
+	pfd.events = POLLIN;
+
+	while (1) {
+		while ((record = log_pop()) != NULL) {
+			fwrite(record->text, 1, record->length, record->stream);
+			free(record);
+			__atomic_add_fetch(&log_consumed, 1, __ATOMIC_RELEASE);
+		}
+		fflush(stdout);
+		fflush(stderr);
+
+		__atomic_store_n(&log_sink_sleeping, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&log_consumed, __ATOMIC_ACQUIRE) != __atomic_load_n(&log_produced, __ATOMIC_ACQUIRE)) {
+			__atomic_store_n(&log_sink_sleeping, 0, __ATOMIC_SEQ_CST);
+			continue;
+		}
+		/* the timeout covers a producer that is still between its exchange and its store */
+		if (poll(&pfd, 1, 100) > 0) {
+			while (read(log_wakeup[0], drain, sizeof(drain)) == sizeof(drain));
+		}
+		__atomic_store_n(&log_sink_sleeping, 0, __ATOMIC_SEQ_CST);
+	}
+
+	return NULL;
+}
+
+static void log_sink_start(void) {
+	pthread_t thread;
+
+	if (pipe(log_wakeup) < 0) {
+		return;
+	}
+	fcntl(log_wakeup[0], F_SETFL, O_NONBLOCK);
+	fcntl(log_wakeup[1], F_SETFL, O_NONBLOCK);
+	if (pthread_create(&thread, NULL, log_sink, NULL) != 0) {
+		return;
+	}
+	pthread_detach(thread);
+	log_sink_running = 1;
+	atexit(idevicerestore_log_flush);
+}
+
+static struct log_record_t* log_record_new(FILE* stream, size_t length) {
+	struct log_record_t* record = (struct log_record_t*)malloc(sizeof(struct log_record_t) + length);
+	if (record) {
+		record->stream = stream;
+		record->length = length;
+	}
+	return record;
+}
+
+static void log_emit(struct log_record_t* record) {
+	int expected = 1;
+
+	pthread_once(&log_sink_once, log_sink_start);
+	if (!log_sink_running) {
+		fwrite(record->text, 1, record->length, record->stream);
+		free(record);
+		return;
+	}
+
+	__atomic_add_fetch(&log_produced, 1, __ATOMIC_RELEASE);
+	log_push(record);
+	if (__atomic_compare_exchange_n(&log_sink_sleeping, &expected, 0, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+		if (write(log_wakeup[1], "", 1) < 0) {
+			/* the pipe is full, so the sink is about to wake up anyway */
+		}
+	}
+}
+
+static void log_line_flush(void) {
+	struct log_record_t* record = NULL;
+
+	if (log_line_length == 0) {
+		return;
+	}
+	record = log_record_new(log_line_stream, log_line_length);
+	if (record) {
+		memcpy(record->text, log_line, log_line_length);
+		log_emit(record);
+	}
+	log_line_length = 0;
+}
+
+static void log_vformat(FILE* stream, const char* format, va_list vargs) {
+	struct log_record_t* record = NULL;
+	va_list vargs2;
+	int length = 0;
+
+	if (stream != log_line_stream) {
+		log_line_flush();
+		log_line_stream = stream;
+	}
+	if (log_line_length == 0 && log_tag[0]) {
+		/* the tag goes in front of every line, not in front of every call */
+		log_line_length = snprintf(log_line, LOG_LINE_SIZE, "[%s] ", log_tag);
+	}
+
+	va_copy(vargs2, vargs);
+	length = vsnprintf(log_line + log_line_length, LOG_LINE_SIZE - log_line_length, format, vargs);
+	if (length < 0) {
+		va_end(vargs2);
+		return;
+	}
+
+	if (log_line_length + length >= LOG_LINE_SIZE) {
+		/* too long for the line buffer, the whole line becomes one record of its own */
+		record = log_record_new(stream, log_line_length + length + 1);
+		if (record) {
+			memcpy(record->text, log_line, log_line_length);
+			vsnprintf(record->text + log_line_length, length + 1, format, vargs2);
+			record->length--;
+			log_emit(record);
+		}
+		log_line_length = 0;
+	} else {
+		log_line_length += length;
+		if (log_line[log_line_length - 1] == '\n') {
+			log_line_flush();
+		}
+	}
+	va_end(vargs2);
+}
+
+static void log_vlog(int level, const char* format, va_list vargs) {
+	va_list vargs2;
+
+	if (level == LOG_LEVEL_ERROR) {
+		va_copy(vargs2, vargs);
+		vsnprintf(idevicerestore_err_buff, idevicerestore_err_buff_size, format, vargs2);
+		va_end(vargs2);
+		if (!error_disabled) {
+			log_vformat((error_stream) ? error_stream : stderr, format, vargs);
+		}
+	} else if (level == LOG_LEVEL_INFO) {
+		if (!info_disabled) {
+			log_vformat((info_stream) ? info_stream : stdout, format, vargs);
+		}
+	} else {
+		if (!debug_disabled && idevicerestore_debug) {
+			log_vformat((debug_stream) ? debug_stream : stderr, format, vargs);
+		}
+	}
+}
+
 void info(const char* format, ...)
 {
-	if (info_disabled) return;
 	va_list vargs;
 	va_start(vargs, format);
-	vfprintf((info_stream) ? info_stream : stdout, format, vargs);
+	log_vlog(LOG_LEVEL_INFO, format, vargs);
 	va_end(vargs);
 }
 
 void error(const char* format, ...)
 {
-	va_list vargs, vargs2;
+	va_list vargs;
 	va_start(vargs, format);
-	va_copy(vargs2, vargs);
-	vsnprintf(idevicerestore_err_buff, idevicerestore_err_buff_size, format, vargs);
+	log_vlog(LOG_LEVEL_ERROR, format, vargs);
 	va_end(vargs);
-	if (!error_disabled) {
-		vfprintf((error_stream) ? error_stream : stderr, format, vargs2);
-	}
-	va_end(vargs2);
 }
 
 void debug(const char* format, ...)
 {
-	if (debug_disabled) return;
-	if (!idevicerestore_debug) {
-		return;
-	}
 	va_list vargs;
 	va_start(vargs, format);
-	vfprintf((debug_stream) ? debug_stream : stderr, format, vargs);
+	log_vlog(LOG_LEVEL_DEBUG, format, vargs);
 	va_end(vargs);
 }
 
+/* tags every line logged by the calling thread, e.g. with the ECID of the device it handles */
+void idevicerestore_log_set_tag(const char* tag)
+{
+	if (tag) {
+		snprintf(log_tag, LOG_TAG_SIZE, "%s", tag);
+	} else {
+		log_tag[0] = '\0';
+	}
+}
+
+/* waits until everything logged so far has been written, including the caller's unfinished line */
+void idevicerestore_log_flush(void)
+{
+	unsigned long target = 0;
+	int expected = 1;
+
+	log_line_flush();
+	target = __atomic_load_n(&log_produced, __ATOMIC_ACQUIRE);
+	if (!log_sink_running) {
+		return;
+	}
+	while (__atomic_load_n(&log_consumed, __ATOMIC_ACQUIRE) < target) {
+		if (__atomic_compare_exchange_n(&log_sink_sleeping, &expected, 0, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+			if (write(log_wakeup[1], "", 1) < 0) {
+				/* the pipe is full, so the sink is about to wake up anyway */
+			}
+		}
+		expected = 1;
+		usleep(100);
+	}
+	fflush(stdout);
+	fflush(stderr);
+}
+
 void idevicerestore_set_info_stream(FILE* strm)
 {
 	if (strm) {
@@ -118,6 +366,7 @@ void idevicerestore_set_debug_stream(FILE* strm)
 	}
 }
 
+/* the last error of the calling thread */
 const char* idevicerestore_get_error(void)
 {
 	if (idevicerestore_err_buff[0] == 0) {
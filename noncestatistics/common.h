@@ -28,6 +28,7 @@
 extern "C" {
 #endif
 
+#include <stdio.h>
 #include <plist/plist.h>
 #include <libirecovery.h>
 
@@ -42,6 +43,10 @@ extern "C" {
 
 #define FLAG_QUIT            1
 
+#define LOG_LEVEL_ERROR      0
+#define LOG_LEVEL_INFO       1
+#define LOG_LEVEL_DEBUG      2
+
 #define CPFM_FLAG_SECURITY_MODE 1 << 0
 #define CPFM_FLAG_PRODUCTION_MODE 1 << 1
 
@@ -53,6 +58,7 @@ struct dfu_client_t;
 struct normal_client_t;
 struct restore_client_t;
 struct recovery_client_t;
+struct discovery_table_t;
 
 struct idevicerestore_mode_t {
 	int index;
@@ -88,6 +94,7 @@ struct idevicerestore_client_t {
 	struct normal_client_t* normal;
 	struct restore_client_t* restore;
 	struct recovery_client_t* recovery;
+	struct discovery_table_t* discovery;
 	irecv_device_t device;
 	struct idevicerestore_entry_t** entries;
 	struct idevicerestore_mode_t* mode;
@@ -107,7 +114,15 @@ extern int idevicerestore_debug;
 void info(const char* format, ...);
 void error(const char* format, ...);
 void debug(const char* format, ...);
+void idevicerestore_log_set_tag(const char* tag);
+void idevicerestore_log_flush(void);
+void idevicerestore_set_info_stream(FILE* strm);
+void idevicerestore_set_error_stream(FILE* strm);
+void idevicerestore_set_debug_stream(FILE* strm);
+const char* idevicerestore_get_error(void);
 char *generate_guid(void);
+int write_file(const char* filename, const void* data, size_t size);
+int read_file(const char* filename, void** data, size_t* size);
 
 void idevicerestore_progress(struct idevicerestore_client_t* client, int step, double progress);
 
@@ -0,0 +1,491 @@
+/*
+ * control.c
+ * Metrics and control commands of a running collection over a Unix socket
+ *
+ * A collection runs for days, this lets other tools look at it and steer it
+ * while it does. The collector only bumps counters with relaxed atomics; a
+ * thread of its own accepts connections on the socket, builds the answers
+ * from the counters and sets the flags the collector checks between cycles.
+ *
+ * A connection sends one request and gets one answer. A request is a line
+ * with a command: "metrics" for the metrics in the Prometheus text format,
+ * "pause", "resume", "stop" to stop after the current cycle or "target N" to
+ * collect N nonces in total, 0 for no limit. The same commands work as HTTP
+ * paths, so curl --unix-socket PATH http://localhost/metrics and
+ * http://localhost/target/500 do the same, and a scraper behind a Unix
+ * socket proxy can use the socket as is.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "common.h"
+#include "control.h"
+
+#define CONTROL_MAX_DEVICES   64
+#define CONTROL_REQUEST_SIZE  256
+#define CONTROL_BUCKETS       11
+/* a connection gets this long for its request and the answer, however slowly it sends */
+#define CONTROL_REQUEST_MS    1000
+
+#ifndef MSG_NOSIGNAL
+/* macOS has no MSG_NOSIGNAL, SO_NOSIGPIPE is set on the connection instead */
+#define MSG_NOSIGNAL 0
+#endif
+
+struct control_device_t {
+	char ecid[24];
+	char model[32];
+	int state;
+	uint64_t cycles;
+	uint64_t reconnect_failures;
+	uint64_t full_boots;
+};
+
+struct control_buffer_t {
+	char* data;
+	size_t length;
+	size_t capacity;
+};
+
+static const char* control_states[] = { "connecting", "reading", "resetting", "paused", "done" };
+/* upper bounds of the cycle duration histogram in seconds */
+static const double control_bounds[CONTROL_BUCKETS] = { 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30, 60, 300 };
+
+static struct control_device_t control_devices[CONTROL_MAX_DEVICES];
+static int control_device_count = 0;
+static uint64_t control_cycles = 0;
+static uint64_t control_nonces = 0;
+static uint64_t control_collisions = 0;
+static uint64_t control_distinct = 0;
+static uint64_t control_buckets[CONTROL_BUCKETS + 1];
+static uint64_t control_cycle_us = 0;
+static unsigned int control_target = 0;
+static int control_target_changed = 0;
+static int control_paused = 0;
+static int control_stop_flag = 0;
+static time_t control_started = 0;
+
+static pthread_mutex_t control_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t control_resumed = PTHREAD_COND_INITIALIZER;
+static pthread_t control_thread;
+static int control_socket = -1;
+static int control_wakeup[2] = { -1, -1 };
+static char control_path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+
+static uint64_t control_load(const uint64_t* value) {
+	return __atomic_load_n(value, __ATOMIC_RELAXED);
+}
+
+static void control_add(uint64_t* value, uint64_t amount) {
+	__atomic_add_fetch(value, amount, __ATOMIC_RELAXED);
+}
+
+int control_device_add(uint64_t ecid, const char* model) {
+	int device = -1;
+
+	pthread_mutex_lock(&control_lock);
+	if (control_device_count < CONTROL_MAX_DEVICES) {
+		device = control_device_count;
+		snprintf(control_devices[device].ecid, sizeof(control_devices[device].ecid), "0x%llx", (unsigned long long)ecid);
+		snprintf(control_devices[device].model, sizeof(control_devices[device].model), "%s", (model) ? model : "unknown");
+		/* the server thread only looks at devices below the count */
+		__atomic_store_n(&control_device_count, device + 1, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&control_lock);
+	return device;
+}
+
+void control_device_state(int device, int state) {
+	if (device >= 0) {
+		__atomic_store_n(&control_devices[device].state, state, __ATOMIC_RELAXED);
+	}
+}
+
+void control_cycle_done(int device, double seconds) {
+	int bucket = 0;
+
+	while (bucket < CONTROL_BUCKETS && seconds > control_bounds[bucket]) {
+		bucket++;
+	}
+	control_add(&control_buckets[bucket], 1);
+	control_add(&control_cycle_us, (uint64_t)(seconds * 1000000));
+	control_add(&control_cycles, 1);
+	if (device >= 0) {
+		control_add(&control_devices[device].cycles, 1);
+	}
+}
+
+void control_nonce(int device, int collision, uint64_t distinct) {
+	control_add(&control_nonces, 1);
+	if (collision) {
+		control_add(&control_collisions, 1);
+	}
+	__atomic_store_n(&control_distinct, distinct, __ATOMIC_RELAXED);
+}
+
+void control_reconnect_failed(int device) {
+	if (device >= 0) {
+		control_add(&control_devices[device].reconnect_failures, 1);
+	}
+}
+
+void control_full_boot(int device) {
+	if (device >= 0) {
+		control_add(&control_devices[device].full_boots, 1);
+	}
+}
+
+void control_set_target(unsigned int target) {
+	__atomic_store_n(&control_target, target, __ATOMIC_RELAXED);
+}
+
+int control_take_target(unsigned int* target) {
+	if (!__atomic_exchange_n(&control_target_changed, 0, __ATOMIC_ACQUIRE)) {
+		return 0;
+	}
+	*target = __atomic_load_n(&control_target, __ATOMIC_RELAXED);
+	return 1;
+}
+
+int control_stop_requested(void) {
+	return __atomic_load_n(&control_stop_flag, __ATOMIC_RELAXED);
+}
+
+void control_wait_while_paused(int device, const volatile int* running) {
+	int state = 0;
+
+	if (!__atomic_load_n(&control_paused, __ATOMIC_RELAXED)) {
+		return;
+	}
+	if (device >= 0) {
+		state = __atomic_load_n(&control_devices[device].state, __ATOMIC_RELAXED);
+		control_device_state(device, CONTROL_STATE_PAUSED);
+	}
+	info("Collection paused\n");
+	pthread_mutex_lock(&control_lock);
+	while (control_paused && *running && !control_stop_flag) {
+		/* wakes up now and then to notice a cancellation by the signal handler */
+		struct timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec++;
+		pthread_cond_timedwait(&control_resumed, &control_lock, &deadline);
+	}
+	pthread_mutex_unlock(&control_lock);
+	info("Collection resumed\n");
+	control_device_state(device, state);
+}
+
+static void control_printf(struct control_buffer_t* buffer, const char* format, ...) {
+	va_list args;
+	int length = 0;
+
+	for (;;) {
+		va_start(args, format);
+		length = vsnprintf(buffer->data + buffer->length, buffer->capacity - buffer->length, format, args);
+		va_end(args);
+		if (length < 0) {
+			return;
+		}
+		if (buffer->length + length < buffer->capacity) {
+			buffer->length += length;
+			return;
+		}
+		{
+			size_t capacity = 2 * buffer->capacity + length;
+			char* data = (char*)realloc(buffer->data, capacity);
+			if (!data) {
+				return;
+			}
+			buffer->data = data;
+			buffer->capacity = capacity;
+		}
+	}
+}
+
+static void control_metric(struct control_buffer_t* buffer, const char* name, const char* type, const char* help) {
+	control_printf(buffer, "# HELP noncestatistics_%s %s\n# TYPE noncestatistics_%s %s\n", name, help, name, type);
+}
+
+static void control_metrics(struct control_buffer_t* buffer) {
+	int devices = __atomic_load_n(&control_device_count, __ATOMIC_ACQUIRE);
+	uint64_t cumulative = 0;
+	int i, s;
+
+	control_metric(buffer, "cycles_total", "counter", "Reboot cycles completed.");
+	control_printf(buffer, "noncestatistics_cycles_total %llu\n", (unsigned long long)control_load(&control_cycles));
+	control_metric(buffer, "nonces_total", "counter", "ApNonces collected.");
+	control_printf(buffer, "noncestatistics_nonces_total %llu\n", (unsigned long long)control_load(&control_nonces));
+	control_metric(buffer, "collisions_total", "counter", "ApNonces that had been collected before.");
+	control_printf(buffer, "noncestatistics_collisions_total %llu\n", (unsigned long long)control_load(&control_collisions));
+	control_metric(buffer, "distinct_nonces", "gauge", "Distinct ApNonces collected.");
+	control_printf(buffer, "noncestatistics_distinct_nonces %llu\n", (unsigned long long)control_load(&control_distinct));
+	control_metric(buffer, "target_nonces", "gauge", "ApNonces to collect in total, 0 for no limit.");
+	control_printf(buffer, "noncestatistics_target_nonces %u\n", __atomic_load_n(&control_target, __ATOMIC_RELAXED));
+	control_metric(buffer, "paused", "gauge", "1 while the collection is paused.");
+	control_printf(buffer, "noncestatistics_paused %d\n", __atomic_load_n(&control_paused, __ATOMIC_RELAXED));
+	control_metric(buffer, "start_time_seconds", "gauge", "Start of the collection since the epoch.");
+	control_printf(buffer, "noncestatistics_start_time_seconds %lld\n", (long long)control_started);
+
+	control_metric(buffer, "cycle_seconds", "histogram", "Duration of a reboot cycle.");
+	for (i = 0; i <= CONTROL_BUCKETS; i++) {
+		cumulative += control_load(&control_buckets[i]);
+		if (i < CONTROL_BUCKETS) {
+			control_printf(buffer, "noncestatistics_cycle_seconds_bucket{le=\"%g\"} %llu\n", control_bounds[i], (unsigned long long)cumulative);
+		} else {
+			control_printf(buffer, "noncestatistics_cycle_seconds_bucket{le=\"+Inf\"} %llu\n", (unsigned long long)cumulative);
+		}
+	}
+	control_printf(buffer, "noncestatistics_cycle_seconds_sum %.6f\n", control_load(&control_cycle_us) / 1e6);
+	control_printf(buffer, "noncestatistics_cycle_seconds_count %llu\n", (unsigned long long)cumulative);
+
+	control_metric(buffer, "device_state", "gauge", "Current state of a device, 1 for the state it is in.");
+	for (i = 0; i < devices; i++) {
+		int state = __atomic_load_n(&control_devices[i].state, __ATOMIC_RELAXED);
+		for (s = 0; s <= CONTROL_STATE_DONE; s++) {
+			control_printf(buffer, "noncestatistics_device_state{ecid=\"%s\",model=\"%s\",state=\"%s\"} %d\n",
+			               control_devices[i].ecid, control_devices[i].model, control_states[s], state == s);
+		}
+	}
+	control_metric(buffer, "device_cycles_total", "counter", "Reboot cycles completed by a device.");
+	for (i = 0; i < devices; i++) {
+		control_printf(buffer, "noncestatistics_device_cycles_total{ecid=\"%s\",model=\"%s\"} %llu\n",
+		               control_devices[i].ecid, control_devices[i].model, (unsigned long long)control_load(&control_devices[i].cycles));
+	}
+	control_metric(buffer, "reconnect_failures_total", "counter", "Times a device did not come back in time after a reboot.");
+	for (i = 0; i < devices; i++) {
+		control_printf(buffer, "noncestatistics_reconnect_failures_total{ecid=\"%s\",model=\"%s\"} %llu\n",
+		               control_devices[i].ecid, control_devices[i].model, (unsigned long long)control_load(&control_devices[i].reconnect_failures));
+	}
+	control_metric(buffer, "full_boots_total", "counter", "Times a device booted into iOS by accident.");
+	for (i = 0; i < devices; i++) {
+		control_printf(buffer, "noncestatistics_full_boots_total{ecid=\"%s\",model=\"%s\"} %llu\n",
+		               control_devices[i].ecid, control_devices[i].model, (unsigned long long)control_load(&control_devices[i].full_boots));
+	}
+}
+
+/* runs a command and writes the answer, returns 0 if the command is unknown */
+static int control_command(char* command, struct control_buffer_t* answer) {
+	char* argument = NULL;
+
+	while (*command == ' ' || *command == '/') {
+		command++;
+	}
+	argument = command + strcspn(command, " /?=");
+	if (*argument) {
+		*(argument++) = '\0';
+		argument += strspn(argument, " /?=");
+	}
+
+	if (!strcmp(command, "metrics")) {
+		control_metrics(answer);
+	} else if (!strcmp(command, "pause")) {
+		__atomic_store_n(&control_paused, 1, __ATOMIC_RELAXED);
+		control_printf(answer, "OK paused\n");
+	} else if (!strcmp(command, "resume")) {
+		pthread_mutex_lock(&control_lock);
+		control_paused = 0;
+		pthread_cond_broadcast(&control_resumed);
+		pthread_mutex_unlock(&control_lock);
+		control_printf(answer, "OK resumed\n");
+	} else if (!strcmp(command, "stop")) {
+		pthread_mutex_lock(&control_lock);
+		control_stop_flag = 1;
+		pthread_cond_broadcast(&control_resumed);
+		pthread_mutex_unlock(&control_lock);
+		control_printf(answer, "OK stopping after the current cycle\n");
+	} else if (!strcmp(command, "target") && *argument >= '0' && *argument <= '9') {
+		control_set_target((unsigned int)strtoul(argument, NULL, 10));
+		__atomic_store_n(&control_target_changed, 1, __ATOMIC_RELEASE);
+		control_printf(answer, "OK target %u\n", __atomic_load_n(&control_target, __ATOMIC_RELAXED));
+	} else {
+		control_printf(answer, "ERROR unknown command, use metrics, pause, resume, stop or target N\n");
+		return 0;
+	}
+	return 1;
+}
+
+static int control_remaining_ms(const struct timespec* deadline) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int)((deadline->tv_sec - now.tv_sec) * 1000 + (deadline->tv_nsec - now.tv_nsec) / 1000000);
+}
+
+static void control_serve(int client) {
+	struct control_buffer_t answer = { NULL, 0, 0 };
+	struct pollfd pfd = { client, POLLIN, 0 };
+	struct timespec deadline;
+	struct timeval timeout;
+	char request[CONTROL_REQUEST_SIZE];
+	size_t length = 0;
+	char* command = request;
+	int http = 0;
+	int known = 0;
+	int remaining = 0;
+
+	/* connections are answered one at a time, so the deadline is for the whole of one, not per read */
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += CONTROL_REQUEST_MS / 1000;
+	deadline.tv_nsec += (CONTROL_REQUEST_MS % 1000) * 1000000;
+	if (deadline.tv_nsec >= 1000000000) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+
+	/* one line is enough */
+	while (length < sizeof(request) - 1 && !memchr(request, '\n', length) &&
+	       (remaining = control_remaining_ms(&deadline)) > 0 && poll(&pfd, 1, remaining) > 0) {
+		ssize_t received = recv(client, request + length, sizeof(request) - 1 - length, 0);
+		if (received <= 0) {
+			break;
+		}
+		length += received;
+	}
+	request[length] = '\0';
+	request[strcspn(request, "\r\n")] = '\0';
+
+	if (!strncmp(request, "GET ", 4) || !strncmp(request, "POST ", 5)) {
+		http = 1;
+		command = strchr(request, ' ') + 1;
+		command[strcspn(command, " ")] = '\0';
+	}
+	known = control_command(command, &answer);
+
+	/* a client that doesn't read its answer can't hold up the next one either */
+	remaining = control_remaining_ms(&deadline);
+	if (remaining < 1) {
+		remaining = 1;
+	}
+	timeout.tv_sec = remaining / 1000;
+	timeout.tv_usec = (remaining % 1000) * 1000;
+	setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+	if (http) {
+		char header[160];
+		int size = snprintf(header, sizeof(header), "HTTP/1.0 %s\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+		                    (known) ? "200 OK" : "404 Not Found", answer.length);
+		send(client, header, size, MSG_NOSIGNAL);
+	}
+	if (answer.length) {
+		send(client, answer.data, answer.length, MSG_NOSIGNAL);
+	}
+	free(answer.data);
+}
+
+static void* control_server(void* data) {
+	struct pollfd pfds[2];
+
+	pfds[0].fd = control_socket;
+	pfds[0].events = POLLIN;
+	pfds[1].fd = control_wakeup[0];
+	pfds[1].events = POLLIN;
+	for (;;) {
+		int client = -1;
+		if (poll(pfds, 2, -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+		if (pfds[1].revents) {
+			break;
+		}
+		client = accept(control_socket, NULL, NULL);
+		if (client >= 0) {
+#ifdef SO_NOSIGPIPE
+			int on = 1;
+			setsockopt(client, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+			control_serve(client);
+			close(client);
+		}
+	}
+	return NULL;
+}
+
+/* 0 if nobody listens on the socket at address any more, -1 if it is in use or its state is unknown */
+static int control_socket_stale(const struct sockaddr_un* address) {
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	int result = -1;
+
+	if (fd < 0) {
+		error("ERROR: Unable to check %s: %s\n", address->sun_path, strerror(errno));
+		return -1;
+	}
+	if (connect(fd, (const struct sockaddr*)address, sizeof(*address)) == 0) {
+		error("ERROR: %s is in use by another collector\n", address->sun_path);
+	} else if (errno == ECONNREFUSED) {
+		result = 0;
+	} else {
+		error("ERROR: Unable to check %s: %s\n", address->sun_path, strerror(errno));
+	}
+	close(fd);
+	return result;
+}
+
+int control_start(const char* path) {
+	struct sockaddr_un address;
+	struct stat st;
+
+	if (strlen(path) >= sizeof(address.sun_path)) {
+		error("ERROR: Control socket path %s is too long\n", path);
+		return -1;
+	}
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, path);
+
+	/* a socket left behind by a collector that was killed is replaced, anything else is not touched */
+	if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+		if (control_socket_stale(&address) < 0) {
+			return -1;
+		}
+		unlink(path);
+	}
+	control_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (control_socket < 0 || bind(control_socket, (struct sockaddr*)&address, sizeof(address)) < 0 || listen(control_socket, 8) < 0) {
+		error("ERROR: Unable to listen on %s: %s\n", path, strerror(errno));
+		if (control_socket >= 0) {
+			close(control_socket);
+		}
+		control_socket = -1;
+		return -1;
+	}
+	strcpy(control_path, path);
+	control_started = time(NULL);
+
+	if (pipe(control_wakeup) < 0 || pthread_create(&control_thread, NULL, control_server, NULL) != 0) {
+		error("ERROR: Unable to start the control thread\n");
+		close(control_socket);
+		control_socket = -1;
+		unlink(control_path);
+		return -1;
+	}
+	info("Serving metrics and control commands on %s\n", path);
+	return 0;
+}
+
+void control_stop(void) {
+	if (control_socket < 0) {
+		return;
+	}
+	if (write(control_wakeup[1], "", 1) == 1) {
+		pthread_join(control_thread, NULL);
+	}
+	close(control_wakeup[0]);
+	close(control_wakeup[1]);
+	close(control_socket);
+	control_socket = -1;
+	unlink(control_path);
+}
@@ -0,0 +1,46 @@
+/*
+ * control.h
+ * Metrics and control commands of a running collection over a Unix socket
+ */
+
+#ifndef IDEVICERESTORE_CONTROL_H
+#define IDEVICERESTORE_CONTROL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#define CONTROL_STATE_CONNECTING  0
+#define CONTROL_STATE_READING     1
+#define CONTROL_STATE_RESETTING   2
+#define CONTROL_STATE_PAUSED      3
+#define CONTROL_STATE_DONE        4
+
+/* listens on path from a thread of its own, the collector only updates counters */
+int control_start(const char* path);
+void control_stop(void);
+
+/* returns the device number for the other calls, -1 if there are too many */
+int control_device_add(uint64_t ecid, const char* model);
+void control_device_state(int device, int state);
+/* a reboot cycle ended with a reset after seconds */
+void control_cycle_done(int device, double seconds);
+void control_nonce(int device, int collision, uint64_t distinct);
+void control_reconnect_failed(int device);
+void control_full_boot(int device);
+
+void control_set_target(unsigned int target);
+/* 1 and the new target (0 for no limit) if a client changed it since the last call */
+int control_take_target(unsigned int* target);
+/* 1 once a client asked to stop after the current cycle */
+int control_stop_requested(void);
+/* blocks while a client has paused the collection, returns early once *running is 0 */
+void control_wait_while_paused(int device, const volatile int* running);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -31,45 +31,47 @@
 #include "recovery.h"
 #include "idevicerestore.h"
 #include "common.h"
+#include "transport.h"
 
-int dfu_progress_callback(irecv_client_t client, const irecv_event_t* event) {
-//	if (event->type == IRECV_PROGRESS) {
-//		print_progress_bar(event->progress);
-//	}
-	return 0;
+int dfu_client_new(struct idevicerestore_client_t* client) {
+	return dfu_client_new_with_timeout(client, 10000);
 }
 
-int dfu_client_new(struct idevicerestore_client_t* client) {
+int dfu_client_new_with_timeout(struct idevicerestore_client_t* client, unsigned int timeout_ms) {
 	int i = 0;
-	int attempts = 10;
-	irecv_client_t dfu = NULL;
+	int attempts = timeout_ms / 50;
+	transport_client_t dfu = NULL;
 	irecv_error_t dfu_error = IRECV_E_UNKNOWN_ERROR;
 
 	if (client->dfu == NULL) {
 		client->dfu = (struct dfu_client_t*)malloc(sizeof(struct dfu_client_t));
-		memset(client->dfu, 0, sizeof(struct dfu_client_t));
 		if (client->dfu == NULL) {
 			error("ERROR: Out of memory\n");
 			return -1;
 		}
+		memset(client->dfu, 0, sizeof(struct dfu_client_t));
 	}
 
-	for (i = 1; i <= attempts; i++) {
-		dfu_error = irecv_open_with_ecid(&dfu, client->ecid);
+	for (i = 1; !attempts || i <= attempts; i++) {
+		dfu_error = transport_open_with_ecid(&dfu, client->ecid);
 		if (dfu_error == IRECV_E_SUCCESS) {
 			break;
 		}
 
-		if (i >= attempts) {
-			error("ERROR: Unable to connect to device in DFU mode\n");
+		if (transport_exhausted()) {
+			debug("No more devices available from transport %s\n", transport_get_backend()->name);
 			return -1;
 		}
 
-		sleep(1);
+		if (attempts && i >= attempts) {
+			debug("Device did not show up in DFU mode within %u ms\n", timeout_ms);
+			return -1;
+		}
+
+		transport_usleep(50000);
 		debug("Retrying connection...\n");
 	}
 
-	irecv_event_subscribe(dfu, IRECV_PROGRESS, &dfu_progress_callback, NULL);
 	client->dfu->client = dfu;
 	return 0;
 }
@@ -78,7 +80,7 @@ void dfu_client_free(struct idevicerestore_client_t* client) {
 	if(client != NULL) {
 		if (client->dfu != NULL) {
 			if(client->dfu->client != NULL) {
-				irecv_close(client->dfu->client);
+				transport_close(client->dfu->client);
 				client->dfu->client = NULL;
 			}
 			free(client->dfu);
@@ -88,48 +90,47 @@ void dfu_client_free(struct idevicerestore_client_t* client) {
 }
 
 int dfu_check_mode(struct idevicerestore_client_t* client, int* mode) {
-	irecv_client_t dfu = NULL;
+	transport_client_t dfu = NULL;
 	irecv_error_t dfu_error = IRECV_E_SUCCESS;
 	int probe_mode = -1;
 
-	irecv_init();
-	dfu_error = irecv_open_with_ecid(&dfu, client->ecid);
+	transport_init();
+	dfu_error = transport_open_with_ecid(&dfu, client->ecid);
 	if (dfu_error != IRECV_E_SUCCESS) {
 		return -1;
 	}
 
-	irecv_get_mode(dfu, &probe_mode);
+	transport_get_mode(dfu, &probe_mode);
 
 	if ((probe_mode != IRECV_K_DFU_MODE) && (probe_mode != IRECV_K_WTF_MODE)) {
-		irecv_close(dfu);
+		transport_close(dfu);
 		return -1;
 	}
 
 	*mode = (probe_mode == IRECV_K_WTF_MODE) ? MODE_WTF : MODE_DFU;
 
-	irecv_close(dfu);
+	transport_close(dfu);
 
 	return 0;
 }
 
 const char* dfu_check_hardware_model(struct idevicerestore_client_t* client) {
-	irecv_client_t dfu = NULL;
+	transport_client_t dfu = NULL;
 	irecv_error_t dfu_error = IRECV_E_SUCCESS;
 	irecv_device_t device = NULL;
 
-	irecv_init();
-	dfu_error = irecv_open_with_ecid(&dfu, client->ecid);
+	transport_init();
+	dfu_error = transport_open_with_ecid(&dfu, client->ecid);
 	if (dfu_error != IRECV_E_SUCCESS) {
 		return NULL;
 	}
 
-	dfu_error = irecv_devices_get_device_by_client(dfu, &device);
+	dfu_error = transport_devices_get_device_by_client(dfu, &device);
+	transport_close(dfu);
 	if (dfu_error != IRECV_E_SUCCESS) {
 		return NULL;
 	}
 
-	irecv_close(dfu);
-
 	return device->hardware_model;
 }
 
@@ -139,7 +140,7 @@ int dfu_send_buffer(struct idevicerestore_client_t* client, unsigned char* buffe
 
 	info("Sending data (%d bytes)...\n", size);
 
-	err = irecv_send_buffer(client->dfu->client, buffer, size, 1);
+	err = transport_send_buffer(client->dfu->client, buffer, size);
 	if (err != IRECV_E_SUCCESS) {
 		error("ERROR: Unable to send data: %s\n", irecv_strerror(err));
 		return -1;
@@ -157,7 +158,7 @@ int dfu_get_cpid(struct idevicerestore_client_t* client, unsigned int* cpid) {
 		}
 	}
 
-	const struct irecv_device_info *device_info = irecv_get_device_info(client->dfu->client);
+	const struct irecv_device_info *device_info = transport_get_device_info(client->dfu->client);
 	if (!device_info) {
 		return -1;
 	}
@@ -174,7 +175,7 @@ int dfu_get_ecid(struct idevicerestore_client_t* client, uint64_t* ecid) {
 		}
 	}
 
-	const struct irecv_device_info *device_info = irecv_get_device_info(client->dfu->client);
+	const struct irecv_device_info *device_info = transport_get_device_info(client->dfu->client);
 	if (!device_info) {
 		return -1;
 	}
@@ -192,7 +193,7 @@ int dfu_is_image4_supported(struct idevicerestore_client_t* client)
 		}
 	}
 
-	const struct irecv_device_info *device_info = irecv_get_device_info(client->dfu->client);
+	const struct irecv_device_info *device_info = transport_get_device_info(client->dfu->client);
 	if (!device_info) {
 		return 0;
 	}
@@ -207,7 +208,7 @@ int dfu_get_ap_nonce(struct idevicerestore_client_t* client, unsigned char** non
 		}
 	}
 
-	const struct irecv_device_info *device_info = irecv_get_device_info(client->dfu->client);
+	const struct irecv_device_info *device_info = transport_get_device_info(client->dfu->client);
 	if (!device_info) {
 		return -1;
 	}
@@ -231,7 +232,7 @@ int dfu_get_sep_nonce(struct idevicerestore_client_t* client, unsigned char** no
 		}
 	}
 
-	const struct irecv_device_info *device_info = irecv_get_device_info(client->dfu->client);
+	const struct irecv_device_info *device_info = transport_get_device_info(client->dfu->client);
 	if (!device_info) {
 		return -1;
 	}
@@ -247,3 +248,31 @@ int dfu_get_sep_nonce(struct idevicerestore_client_t* client, unsigned char** no
 
 	return 0;
 }
+
+/* both nonces come from a single device info, like in recovery mode */
+int dfu_get_nonces(struct idevicerestore_client_t* client, unsigned char** ap_nonce, int* ap_nonce_size, unsigned char** sep_nonce, int* sep_nonce_size) {
+	*ap_nonce = NULL;
+	*sep_nonce = NULL;
+	if(client->dfu == NULL) {
+		if (dfu_client_new(client) < 0) {
+			return -1;
+		}
+	}
+
+	const struct irecv_device_info *device_info = transport_get_device_info(client->dfu->client);
+	if (!device_info) {
+		return -1;
+	}
+
+	return recovery_copy_nonces(device_info, ap_nonce, ap_nonce_size, sep_nonce, sep_nonce_size);
+}
+
+/* DFU mode has no "reset" command, a USB reset makes the device re-enumerate with a new nonce */
+int dfu_send_reset(struct idevicerestore_client_t* client) {
+	irecv_error_t err = transport_reset(client->dfu->client);
+	if (err != IRECV_E_SUCCESS && err != IRECV_E_NO_DEVICE) {
+		error("ERROR: Unable to reset device: %s\n", irecv_strerror(err));
+		return -1;
+	}
+	return 0;
+}
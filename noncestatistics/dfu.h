@@ -30,14 +30,16 @@ extern "C" {
 
 #include <libirecovery.h>
 #include "common.h"
+#include "transport.h"
 
 struct dfu_client_t {
-	irecv_client_t client;
+	transport_client_t client;
 	const char* ipsw;
 	plist_t tss;
 };
 
 int dfu_client_new(struct idevicerestore_client_t* client);
+int dfu_client_new_with_timeout(struct idevicerestore_client_t* client, unsigned int timeout_ms);
 void dfu_client_free(struct idevicerestore_client_t* client);
 int dfu_check_mode(struct idevicerestore_client_t* client, int* mode);
 const char* dfu_check_hardware_model(struct idevicerestore_client_t* client);
@@ -45,6 +47,8 @@ int dfu_get_cpid(struct idevicerestore_client_t* client, unsigned int* cpid);
 int dfu_get_ecid(struct idevicerestore_client_t* client, uint64_t* ecid);
 int dfu_get_ap_nonce(struct idevicerestore_client_t* client, unsigned char** nonce, int* nonce_size);
 int dfu_get_sep_nonce(struct idevicerestore_client_t* client, unsigned char** nonce, int* nonce_size);
+int dfu_get_nonces(struct idevicerestore_client_t* client, unsigned char** ap_nonce, int* ap_nonce_size, unsigned char** sep_nonce, int* sep_nonce_size);
+int dfu_send_reset(struct idevicerestore_client_t* client);
 int dfu_enter_recovery(struct idevicerestore_client_t* client, plist_t build_identity);
 
 
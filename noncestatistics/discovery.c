@@ -0,0 +1,162 @@
+/*
+ * discovery.c
+ * Single pass discovery of all attached devices
+ *
+ * Probing each mode on its own opens the device once per mode and every open
+ * is a full USB scan. Here the transport reports all recovery and DFU mode
+ * devices in one go, normal mode devices are listed by usbmuxd and looked up
+ * in the identity cache, with one lockdown request for each unknown UDID.
+ * check_mode(), check_hardware_model() and get_ecid() then answer from the
+ * table.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libirecovery.h>
+#include <libimobiledevice/libimobiledevice.h>
+
+#include "common.h"
+#include "normal.h"
+#include "identity.h"
+#include "transport.h"
+#include "discovery.h"
+
+static struct discovery_device_t* discovery_add(struct discovery_table_t* table) {
+	struct discovery_device_t* devices = (struct discovery_device_t*)realloc(table->devices, (table->count + 1) * sizeof(struct discovery_device_t));
+	if (!devices) {
+		error("ERROR: Out of memory\n");
+		return NULL;
+	}
+	table->devices = devices;
+	memset(&devices[table->count], 0, sizeof(struct discovery_device_t));
+	return &devices[table->count++];
+}
+
+static int discovery_mode(int mode) {
+	switch (mode) {
+	case TRANSPORT_MODE_NORMAL:
+		return MODE_NORMAL;
+	case IRECV_K_WTF_MODE:
+		return MODE_WTF;
+	case IRECV_K_DFU_MODE:
+		return MODE_DFU;
+	case IRECV_K_RECOVERY_MODE_1:
+	case IRECV_K_RECOVERY_MODE_2:
+	case IRECV_K_RECOVERY_MODE_3:
+	case IRECV_K_RECOVERY_MODE_4:
+		return MODE_RECOVERY;
+	default:
+		return MODE_UNKNOWN;
+	}
+}
+
+static void discovery_transport_device(const struct irecv_device_info* device_info, int mode, void* user_data) {
+	struct discovery_table_t* table = (struct discovery_table_t*)user_data;
+	struct discovery_device_t* entry = NULL;
+
+	if (discovery_mode(mode) == MODE_UNKNOWN) {
+		debug("Ignoring device with ECID 0x%llx in unknown mode 0x%x\n", (unsigned long long)device_info->ecid, mode);
+		return;
+	}
+
+	entry = discovery_add(table);
+	if (!entry) {
+		return;
+	}
+	entry->mode = discovery_mode(mode);
+	entry->ecid = device_info->ecid;
+	entry->srnm = (device_info->srnm) ? strdup(device_info->srnm) : NULL;
+	transport_devices_get_device_by_info(device_info, &entry->device);
+}
+
+static void discovery_normal_device(struct discovery_table_t* table, const char* udid) {
+	struct discovery_device_t* entry = NULL;
+	struct identity_t identity;
+
+	if (normal_get_identity(udid, &identity) < 0) {
+		debug("Unable to query identity of device with UDID %s\n", udid);
+		return;
+	}
+
+	entry = discovery_add(table);
+	if (!entry) {
+		identity_free(&identity);
+		return;
+	}
+	entry->mode = MODE_NORMAL;
+	entry->ecid = identity.ecid;
+	entry->udid = strdup(udid);
+	if (identity.hardware_model) {
+		irecv_devices_get_device_by_hardware_model(identity.hardware_model, &entry->device);
+	}
+	entry->srnm = identity.srnm;
+	identity.srnm = NULL;
+	identity_free(&identity);
+}
+
+struct discovery_table_t* discovery_scan(void) {
+	struct discovery_table_t* table = NULL;
+	char** udids = NULL;
+	int num_udids = 0;
+	int i = 0;
+
+	table = (struct discovery_table_t*)malloc(sizeof(struct discovery_table_t));
+	if (!table) {
+		error("ERROR: Out of memory\n");
+		return NULL;
+	}
+	memset(table, 0, sizeof(struct discovery_table_t));
+
+	transport_init();
+	if (transport_enumerate(discovery_transport_device, table) < 0) {
+		discovery_free(table);
+		return NULL;
+	}
+
+	/* backends that handle normal mode themselves already reported those devices */
+	if (!transport_get_backend()->normal_probe) {
+		idevice_get_device_list(&udids, &num_udids);
+		for (i = 0; i < num_udids; i++) {
+			discovery_normal_device(table, udids[i]);
+		}
+		if (udids) {
+			idevice_device_list_free(udids);
+		}
+	}
+
+	for (i = 0; i < (int)table->count; i++) {
+		struct discovery_device_t* entry = &table->devices[i];
+		debug("Discovered %s mode device with ECID 0x%llx (%s, %s)\n", idevicerestore_modes[entry->mode].string,
+		      (unsigned long long)entry->ecid, (entry->device) ? entry->device->hardware_model : "unknown",
+		      (entry->device) ? entry->device->product_type : "unknown");
+	}
+
+	return table;
+}
+
+void discovery_free(struct discovery_table_t* table) {
+	unsigned int i;
+	if (!table) {
+		return;
+	}
+	for (i = 0; i < table->count; i++) {
+		free(table->devices[i].srnm);
+		free(table->devices[i].udid);
+	}
+	free(table->devices);
+	free(table);
+}
+
+struct discovery_device_t* discovery_find(struct discovery_table_t* table, uint64_t ecid) {
+	unsigned int i;
+	if (!table) {
+		return NULL;
+	}
+	for (i = 0; i < table->count; i++) {
+		if (ecid == 0 || table->devices[i].ecid == ecid) {
+			return &table->devices[i];
+		}
+	}
+	return NULL;
+}
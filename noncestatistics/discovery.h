@@ -0,0 +1,39 @@
+/*
+ * discovery.h
+ * Single pass discovery of all attached devices
+ */
+
+#ifndef IDEVICERESTORE_DISCOVERY_H
+#define IDEVICERESTORE_DISCOVERY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <libirecovery.h>
+
+struct discovery_device_t {
+	int mode;
+	uint64_t ecid;
+	irecv_device_t device;
+	char* srnm;
+	char* udid;
+};
+
+struct discovery_table_t {
+	struct discovery_device_t* devices;
+	unsigned int count;
+};
+
+/* returns NULL if the transport can't enumerate, callers then probe each mode on their own */
+struct discovery_table_t* discovery_scan(void);
+void discovery_free(struct discovery_table_t* table);
+/* ecid 0 matches the first device, like irecv_open_with_ecid() */
+struct discovery_device_t* discovery_find(struct discovery_table_t* table, uint64_t ecid);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
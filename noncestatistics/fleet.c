@@ -0,0 +1,431 @@
+/*
+ * fleet.c
+ * Coordination of the collectors of a rig of devices
+ *
+ * Every device of a rig has a collector process of its own. When devices on
+ * the same host controller reset at once, their re-enumerations get in each
+ * other's way and every cycle gets slower, so the collectors of a rig share
+ * a directory and take turns.
+ *
+ * Devices are grouped by the USB port they were last seen at: "1-2.3" is
+ * port 3 of the hub at "1-2" on bus 1, and a bus is a host controller. Each
+ * controller has a reset ledger, a file locked with flock() while a
+ * collector changes it. A collector that wants to reset adds itself as
+ * waiting and gets a slot once fewer than resets=N devices of the controller
+ * are between their reset and their reconnect. Among the waiting devices
+ * the one with the shortest measured reconnect latency goes first, less
+ * the time it has waited already so nobody starves, and devices behind a
+ * hub that has a reset in flight are held back a little more.
+ *
+ * Each collector also publishes its count, its target and its rate in a
+ * state file. The targets of all collectors add up to the target of the
+ * rig, and whatever the rig still lacks is split over the active
+ * collectors by their rate, so a fast device takes over what a slow or
+ * stopped one would have taken much longer for. A fresh directory belongs
+ * to every run of the rig, the counts of finished collectors stay in it.
+ *
+ * All times are on the monotonic clock, which only works for collectors on
+ * the same host.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include "common.h"
+#include "fleet.h"
+#include "usb_location.h"
+
+#define FLEET_NAME_SIZE        64
+/* the directory plus a file name */
+#define FLEET_PATH_SIZE        (PATH_MAX + 2*FLEET_NAME_SIZE)
+#define FLEET_MAX_ENTRIES      256
+#define FLEET_POLL_US          20000
+/* a ledger entry or a state its collector hasn't touched for this long belongs to one that hangs */
+#define FLEET_STALE_MS         (10*60*1000)
+#define FLEET_HUB_PENALTY_MS   1000
+#define FLEET_LATENCY_WEIGHT   0.2
+
+struct fleet_entry_t {
+	int pid;
+	uint64_t ecid;
+	char state; /* 'W' waiting or 'R' resetting */
+	uint64_t since; /* when it started waiting or resetting, waiting counts towards the priority */
+	uint64_t heartbeat; /* when its collector last wrote it */
+	uint64_t expected;
+	char hub[FLEET_NAME_SIZE];
+};
+
+static int fleet_enabled = 0;
+static char fleet_dir[PATH_MAX];
+static unsigned int fleet_resets = 1;
+static uint64_t fleet_ecid = 0;
+static unsigned int fleet_target = 0;
+static unsigned int fleet_collected = 0;
+static uint64_t fleet_started = 0;
+static double fleet_latency = 0;
+static char fleet_controller[FLEET_NAME_SIZE];
+static char fleet_hub[FLEET_NAME_SIZE];
+/* where the slot was taken and when, 0 while there is none */
+static char fleet_slot_controller[FLEET_NAME_SIZE];
+static uint64_t fleet_slot_since = 0;
+
+static uint64_t fleet_now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int fleet_alive(int pid) {
+	return kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+static void fleet_topology(void) {
+	char port[FLEET_NAME_SIZE];
+	char* dot = NULL;
+	int bus = 0;
+
+	if (usb_location_port(fleet_ecid, port, sizeof(port)) < 0) {
+		/* without a port all devices count as one controller, which is the safe side */
+		snprintf(fleet_controller, sizeof(fleet_controller), "unknown");
+		snprintf(fleet_hub, sizeof(fleet_hub), "unknown");
+		return;
+	}
+	bus = (int)strcspn(port, "-");
+	snprintf(fleet_controller, sizeof(fleet_controller), "usb%.*s", bus, port);
+	dot = strrchr(port, '.');
+	if (dot) {
+		*dot = '\0';
+		snprintf(fleet_hub, sizeof(fleet_hub), "%s", port);
+	} else {
+		snprintf(fleet_hub, sizeof(fleet_hub), "%s", fleet_controller);
+	}
+}
+
+/* opens and locks the reset ledger of a controller */
+static int fleet_ledger_open(const char* controller) {
+	char path[FLEET_PATH_SIZE];
+	int fd = -1;
+
+	snprintf(path, sizeof(path), "%s/%s.resets", fleet_dir, controller);
+	fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0) {
+		error("ERROR: Unable to open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	if (flock(fd, LOCK_EX) < 0) {
+		error("ERROR: Unable to lock %s: %s\n", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void fleet_ledger_close(int fd) {
+	flock(fd, LOCK_UN);
+	close(fd);
+}
+
+/* reads the entries of the ledger and drops those of collectors that are gone */
+static int fleet_ledger_read(int fd, struct fleet_entry_t* entries) {
+	char buffer[FLEET_MAX_ENTRIES * 128];
+	char* line = NULL;
+	ssize_t length = pread(fd, buffer, sizeof(buffer) - 1, 0);
+	uint64_t now = fleet_now_ms();
+	int count = 0;
+
+	if (length < 0) return 0;
+	buffer[length] = '\0';
+	for (line = strtok(buffer, "\n"); line && count < FLEET_MAX_ENTRIES; line = strtok(NULL, "\n")) {
+		struct fleet_entry_t* entry = &entries[count];
+		unsigned long long ecid = 0, since = 0, heartbeat = 0, expected = 0;
+		if (sscanf(line, "%d %llx %c %llu %llu %llu %63s", &entry->pid, &ecid, &entry->state, &since, &heartbeat, &expected, entry->hub) != 7) continue;
+		if (!fleet_alive(entry->pid) || now - heartbeat > FLEET_STALE_MS) continue;
+		entry->ecid = ecid;
+		entry->since = since;
+		entry->heartbeat = heartbeat;
+		entry->expected = expected;
+		count++;
+	}
+	return count;
+}
+
+static void fleet_ledger_write(int fd, const struct fleet_entry_t* entries, int count) {
+	char buffer[FLEET_MAX_ENTRIES * 128];
+	size_t length = 0;
+	int i = 0;
+
+	for (i = 0; i < count; i++) {
+		length += snprintf(buffer + length, sizeof(buffer) - length, "%d %016llx %c %llu %llu %llu %s\n", entries[i].pid,
+		                   (unsigned long long)entries[i].ecid, entries[i].state, (unsigned long long)entries[i].since,
+		                   (unsigned long long)entries[i].heartbeat, (unsigned long long)entries[i].expected, entries[i].hub);
+	}
+	if (ftruncate(fd, 0) < 0 || pwrite(fd, buffer, length, 0) != (ssize_t)length) {
+		error("ERROR: Unable to write the reset ledger: %s\n", strerror(errno));
+	}
+}
+
+/* removes the entry of this collector from a ledger, returns it in removed if there was one */
+static void fleet_ledger_leave(const char* controller, struct fleet_entry_t* removed) {
+	struct fleet_entry_t entries[FLEET_MAX_ENTRIES];
+	int count = 0, kept = 0, i = 0;
+	int fd = fleet_ledger_open(controller);
+
+	if (fd < 0) return;
+	count = fleet_ledger_read(fd, entries);
+	for (i = 0; i < count; i++) {
+		if (entries[i].pid == getpid()) {
+			if (removed) *removed = entries[i];
+			continue;
+		}
+		entries[kept++] = entries[i];
+	}
+	fleet_ledger_write(fd, entries, kept);
+	fleet_ledger_close(fd);
+}
+
+/* lower goes first */
+static double fleet_priority(const struct fleet_entry_t* entry, const struct fleet_entry_t* entries, int count, uint64_t now) {
+	double priority = (double)entry->expected - (double)(now - entry->since);
+	int i = 0;
+
+	for (i = 0; i < count; i++) {
+		if (entries[i].state == 'R' && !strcmp(entries[i].hub, entry->hub)) {
+			priority += FLEET_HUB_PENALTY_MS;
+			break;
+		}
+	}
+	return priority;
+}
+
+/* 1 if this collector got a slot, 0 if it has to wait, -1 if the ledger is unusable */
+static int fleet_try_acquire(void) {
+	struct fleet_entry_t entries[FLEET_MAX_ENTRIES];
+	uint64_t now = fleet_now_ms();
+	unsigned int resetting = 0;
+	int count = 0, own = -1, best = -1, i = 0;
+	int fd = fleet_ledger_open(fleet_controller);
+
+	if (fd < 0) return -1;
+	count = fleet_ledger_read(fd, entries);
+	for (i = 0; i < count; i++) {
+		if (entries[i].pid == getpid()) own = i;
+		if (entries[i].state == 'R') resetting++;
+	}
+	if (own < 0 && count < FLEET_MAX_ENTRIES) {
+		own = count++;
+		memset(&entries[own], 0, sizeof(struct fleet_entry_t));
+		entries[own].pid = getpid();
+		entries[own].ecid = fleet_ecid;
+		entries[own].state = 'W';
+		entries[own].since = now;
+		entries[own].expected = (uint64_t)fleet_latency;
+		snprintf(entries[own].hub, sizeof(entries[own].hub), "%s", fleet_hub);
+	}
+	if (own < 0) {
+		fleet_ledger_close(fd);
+		return -1;
+	}
+	/* a long wait keeps its age, only an entry nobody looks after any more goes stale */
+	entries[own].heartbeat = now;
+
+	if (resetting < fleet_resets) {
+		for (i = 0; i < count; i++) {
+			if (entries[i].state != 'W') continue;
+			if (best < 0 || fleet_priority(&entries[i], entries, count, now) < fleet_priority(&entries[best], entries, count, now)) best = i;
+		}
+	}
+	if (best == own) {
+		entries[own].state = 'R';
+		entries[own].since = now;
+		fleet_slot_since = now;
+		snprintf(fleet_slot_controller, sizeof(fleet_slot_controller), "%s", fleet_controller);
+	}
+	fleet_ledger_write(fd, entries, count);
+	fleet_ledger_close(fd);
+	return (best == own) ? 1 : 0;
+}
+
+static void fleet_write_state(int done) {
+	char path[FLEET_PATH_SIZE];
+	char temp[FLEET_PATH_SIZE + 8];
+	uint64_t now = fleet_now_ms();
+	double hours = (now - fleet_started) / 3600000.0;
+	FILE* file = NULL;
+
+	snprintf(path, sizeof(path), "%s/%016llx.device", fleet_dir, (unsigned long long)fleet_ecid);
+	snprintf(temp, sizeof(temp), "%s.tmp", path);
+	file = fopen(temp, "w");
+	if (!file) {
+		error("ERROR: Unable to write %s: %s\n", temp, strerror(errno));
+		return;
+	}
+	fprintf(file, "%d %u %u %.3f %.0f %llu %d %s %s\n", (int)getpid(), fleet_target, fleet_collected,
+	        (hours > 0) ? fleet_collected / hours : 0, fleet_latency, (unsigned long long)now, done, fleet_controller, fleet_hub);
+	if (fclose(file) != 0 || rename(temp, path) < 0) {
+		error("ERROR: Unable to write %s: %s\n", path, strerror(errno));
+		unlink(temp);
+	}
+}
+
+struct fleet_totals_t {
+	unsigned int devices;
+	unsigned int active;
+	uint64_t target;
+	uint64_t collected;
+	double rate;
+};
+
+static void fleet_read_totals(struct fleet_totals_t* totals) {
+	struct dirent* entry = NULL;
+	uint64_t now = fleet_now_ms();
+	DIR* dir = opendir(fleet_dir);
+
+	memset(totals, 0, sizeof(struct fleet_totals_t));
+	while (dir && (entry = readdir(dir)) != NULL) {
+		char path[FLEET_PATH_SIZE];
+		FILE* file = NULL;
+		int pid = 0, done = 0;
+		unsigned int target = 0, collected = 0;
+		double rate = 0, latency = 0;
+		unsigned long long updated = 0;
+		size_t length = strlen(entry->d_name);
+
+		if (length < 7 || strcmp(entry->d_name + length - 7, ".device")) continue;
+		snprintf(path, sizeof(path), "%s/%s", fleet_dir, entry->d_name);
+		file = fopen(path, "r");
+		if (!file) continue;
+		if (fscanf(file, "%d %u %u %lf %lf %llu %d", &pid, &target, &collected, &rate, &latency, &updated, &done) == 7) {
+			totals->devices++;
+			totals->target += target;
+			totals->collected += collected;
+			if (!done && fleet_alive(pid) && now - updated < FLEET_STALE_MS) {
+				totals->active++;
+				totals->rate += rate;
+			}
+		}
+		fclose(file);
+	}
+	if (dir) closedir(dir);
+}
+
+int fleet_start(const char* spec, uint64_t ecid, unsigned int target) {
+	char* options = strdup(spec);
+	char* token = NULL;
+	char* save = NULL;
+
+	if (!options) return -1;
+	fleet_dir[0] = '\0';
+	for (token = strtok_r(options, ",", &save); token; token = strtok_r(NULL, ",", &save)) {
+		char* value = strchr(token, '=');
+		if (!value) {
+			snprintf(fleet_dir, sizeof(fleet_dir), "%s", token);
+			continue;
+		}
+		*value++ = '\0';
+		if (!strcmp(token, "dir")) {
+			snprintf(fleet_dir, sizeof(fleet_dir), "%s", value);
+		} else if (!strcmp(token, "resets")) {
+			fleet_resets = (unsigned int)strtoul(value, NULL, 0);
+		} else {
+			error("ERROR: Unknown fleet option %s\n", token);
+			free(options);
+			return -1;
+		}
+	}
+	free(options);
+	if (!fleet_dir[0] || fleet_resets == 0) {
+		error("ERROR: The fleet needs a directory and at least one reset at a time\n");
+		return -1;
+	}
+	if (mkdir(fleet_dir, 0755) < 0 && errno != EEXIST) {
+		error("ERROR: Unable to create %s: %s\n", fleet_dir, strerror(errno));
+		return -1;
+	}
+
+	fleet_ecid = ecid;
+	fleet_target = target;
+	fleet_collected = 0;
+	fleet_started = fleet_now_ms();
+	fleet_topology();
+	fleet_enabled = 1;
+	fleet_write_state(0);
+	info("Joined the fleet in %s on controller %s, hub %s, %u reset%s at a time\n", fleet_dir, fleet_controller, fleet_hub,
+	     fleet_resets, (fleet_resets == 1) ? "" : "s");
+	return 0;
+}
+
+void fleet_stop(unsigned int collected) {
+	struct fleet_totals_t totals;
+
+	if (!fleet_enabled) return;
+	fleet_reset_release();
+	fleet_ledger_leave(fleet_controller, NULL);
+	fleet_collected = collected;
+	fleet_write_state(1);
+	fleet_read_totals(&totals);
+	info("Fleet: %llu of %llu nonces from %u devices, %u still collecting\n", (unsigned long long)totals.collected,
+	     (unsigned long long)totals.target, totals.devices, totals.active);
+	fleet_enabled = 0;
+}
+
+int fleet_reset_acquire(const volatile int* running) {
+	int result = 0;
+
+	if (!fleet_enabled) return 0;
+	fleet_topology();
+	while (*running) {
+		result = fleet_try_acquire();
+		/* a broken ledger must not stop the collection, it only loses the schedule */
+		if (result != 0) return 0;
+		usleep(FLEET_POLL_US);
+	}
+	fleet_ledger_leave(fleet_controller, NULL);
+	return -1;
+}
+
+void fleet_reset_release(void) {
+	double measured = 0;
+
+	if (!fleet_enabled || !fleet_slot_since) return;
+	measured = (double)(fleet_now_ms() - fleet_slot_since);
+	fleet_latency = (fleet_latency > 0) ? (1 - FLEET_LATENCY_WEIGHT) * fleet_latency + FLEET_LATENCY_WEIGHT * measured : measured;
+	fleet_ledger_leave(fleet_slot_controller, NULL);
+	fleet_slot_since = 0;
+}
+
+unsigned int fleet_update(unsigned int collected, unsigned int target) {
+	struct fleet_totals_t totals;
+	double hours = 0, rate = 0;
+	int64_t remaining = 0;
+
+	if (!fleet_enabled) return target;
+	fleet_collected = collected;
+	fleet_write_state(0);
+	/* a collector without a target runs until it is stopped, there is nothing to split */
+	if (!fleet_target) return target;
+
+	fleet_read_totals(&totals);
+	remaining = (int64_t)totals.target - (int64_t)totals.collected;
+	if (remaining <= 0) return collected;
+	hours = (fleet_now_ms() - fleet_started) / 3600000.0;
+	rate = (hours > 0) ? collected / hours : 0;
+	if (rate <= 0 || totals.rate <= 0) return target;
+	return collected + (unsigned int)ceil(remaining * rate / totals.rate);
+}
+
+void fleet_set_target(unsigned int target) {
+	if (!fleet_enabled) return;
+	fleet_target = target;
+	fleet_write_state(0);
+}
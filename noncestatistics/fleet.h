@@ -0,0 +1,32 @@
+/*
+ * fleet.h
+ * Coordination of the collectors of a rig of devices
+ */
+
+#ifndef IDEVICERESTORE_FLEET_H
+#define IDEVICERESTORE_FLEET_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/* SPEC is a directory or a comma separated list of dir=PATH resets=N, shared by all collectors of the rig */
+int fleet_start(const char* spec, uint64_t ecid, unsigned int target);
+/* publishes the final count and leaves the reset schedule */
+void fleet_stop(unsigned int collected);
+/* blocks until the controller of the device has a free reset slot for it, -1 once *running is 0 */
+int fleet_reset_acquire(const volatile int* running);
+/* the device is back on the bus, frees its slot and learns how long the reconnect took */
+void fleet_reset_release(void);
+/* publishes the count and returns the target of this device with the rest of the rig's target split by rate */
+unsigned int fleet_update(unsigned int collected, unsigned int target);
+/* the target of this device changed from outside, like from the control socket */
+void fleet_set_target(unsigned int target);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
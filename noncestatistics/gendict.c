@@ -0,0 +1,399 @@
+/*
+ * gendict.c
+ * Precomputed table from nonces to the generators that produce them
+ *
+ * Hashing a generator family takes seconds to hours, looking a nonce up in
+ * the result takes a few memory reads. The dictionary is built once with the
+ * generator search families and then mapped as a whole: a header and one
+ * table per hash, each a bucket directory followed by the entries.
+ *
+ * A nonce is identified by its first 8 bytes read as a big endian key. The
+ * top bucket_bits of the key select a bucket, about 16 entries on average,
+ * and the directory holds the offset of every bucket. An entry is the next
+ * 40 bits of the key in 5 big endian bytes, which leaves a chance of about
+ * 2^-40 for a false match, followed by the generator as a LEB128 varint, so
+ * generators with little entropy take only a few bytes. Entries of a bucket
+ * are sorted and scanned until the key is passed.
+ *
+ * Like the nonce index, the file uses the byte order of the host that built
+ * it and is rejected on a host with a different one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "common.h"
+#include "gendict.h"
+
+#define GENDICT_BYTE_ORDER       0x01020304
+#define GENDICT_BUCKET_ENTRIES   16
+#define GENDICT_REMAINDER_BYTES  5
+#define GENDICT_MAX_ENTRIES      (1ULL << 32)
+
+struct gendict_entry_t {
+	uint64_t key;
+	uint64_t generator;
+};
+
+static int gendict_compare_entries(const void* a, const void* b) {
+	const struct gendict_entry_t* x = (const struct gendict_entry_t*)a;
+	const struct gendict_entry_t* y = (const struct gendict_entry_t*)b;
+	if (x->key != y->key) {
+		return (x->key < y->key) ? -1 : 1;
+	}
+	if (x->generator != y->generator) {
+		return (x->generator < y->generator) ? -1 : 1;
+	}
+	return 0;
+}
+
+static uint64_t gendict_align(uint64_t offset) {
+	return (offset + 7) & ~7ULL;
+}
+
+static size_t gendict_varint_size(uint64_t value) {
+	size_t size = 1;
+	while (value >= 0x80) {
+		value >>= 7;
+		size++;
+	}
+	return size;
+}
+
+static uint64_t gendict_remainder(uint64_t key, uint32_t bucket_bits) {
+	return (key << bucket_bits) >> (64 - 8 * GENDICT_REMAINDER_BYTES);
+}
+
+/* hashes every generator of the families, sorted by key without duplicates */
+static int gendict_collect(const struct gensearch_config_t* config, int hash, struct gendict_entry_t** entries, uint64_t* count) {
+	uint64_t generators[GENSEARCH_BATCH];
+	uint64_t keys[GENSEARCH_BATCH];
+	uint64_t total = 0;
+	uint64_t merged = 0;
+	uint64_t i;
+	unsigned int f;
+
+	for (f = 0; f < config->family_count; f++) {
+		total += gensearch_family_size(&config->families[f]);
+	}
+	if (total > GENDICT_MAX_ENTRIES) {
+		error("ERROR: %llu generators are too many for a dictionary\n", (unsigned long long)total);
+		return -1;
+	}
+	*entries = (struct gendict_entry_t*)malloc((total) ? total * sizeof(struct gendict_entry_t) : 1);
+	if (!*entries) {
+		error("ERROR: Out of memory\n");
+		return -1;
+	}
+
+	total = 0;
+	for (f = 0; f < config->family_count; f++) {
+		const struct gensearch_family_t* family = &config->families[f];
+		uint64_t size = gensearch_family_size(family);
+		info("Hashing %llu generators with %s\n", (unsigned long long)size, gensearch_hash_name(hash));
+		for (i = 0; i < size; i += GENSEARCH_BATCH) {
+			unsigned int lanes = (size - i < GENSEARCH_BATCH) ? (unsigned int)(size - i) : GENSEARCH_BATCH;
+			unsigned int l;
+			for (l = 0; l < GENSEARCH_BATCH; l++) {
+				generators[l] = gensearch_family_generator(family, i + ((l < lanes) ? l : 0));
+			}
+			gensearch_keys(hash, generators, keys);
+			for (l = 0; l < lanes; l++) {
+				(*entries)[total].key = keys[l];
+				(*entries)[total].generator = generators[l];
+				total++;
+			}
+		}
+	}
+
+	/* families may overlap, 0x1111111111111111 is known and a repeated pattern */
+	qsort(*entries, total, sizeof(struct gendict_entry_t), gendict_compare_entries);
+	for (i = 0; i < total; i++) {
+		if (merged > 0 && !gendict_compare_entries(&(*entries)[merged - 1], &(*entries)[i])) {
+			continue;
+		}
+		(*entries)[merged++] = (*entries)[i];
+	}
+	*count = merged;
+	return 0;
+}
+
+/* fills in the table header and the bucket directory for sorted entries */
+static uint64_t* gendict_directory(struct gendict_table_header_t* table, const struct gendict_entry_t* entries, uint64_t count) {
+	uint64_t* directory = NULL;
+	uint64_t buckets = 0;
+	uint64_t i;
+
+	table->entry_count = count;
+	table->bucket_bits = 1;
+	while (table->bucket_bits < 32 && ((uint64_t)GENDICT_BUCKET_ENTRIES << table->bucket_bits) < count) {
+		table->bucket_bits++;
+	}
+	buckets = 1ULL << table->bucket_bits;
+
+	directory = (uint64_t*)calloc(buckets + 1, sizeof(uint64_t));
+	if (!directory) {
+		error("ERROR: Out of memory\n");
+		return NULL;
+	}
+	for (i = 0; i < count; i++) {
+		directory[(entries[i].key >> (64 - table->bucket_bits)) + 1] += GENDICT_REMAINDER_BYTES + gendict_varint_size(entries[i].generator);
+	}
+	for (i = 0; i < buckets; i++) {
+		directory[i + 1] += directory[i];
+	}
+	table->entries_size = directory[buckets];
+	return directory;
+}
+
+static int gendict_write_entries(FILE* file, const struct gendict_table_header_t* table, const struct gendict_entry_t* entries) {
+	unsigned char buffer[GENDICT_REMAINDER_BYTES + 10];
+	uint64_t i;
+
+	for (i = 0; i < table->entry_count; i++) {
+		uint64_t remainder = gendict_remainder(entries[i].key, table->bucket_bits);
+		uint64_t generator = entries[i].generator;
+		size_t size = 0;
+		int b;
+		for (b = GENDICT_REMAINDER_BYTES - 1; b >= 0; b--) {
+			buffer[size++] = (unsigned char)(remainder >> (8 * b));
+		}
+		while (generator >= 0x80) {
+			buffer[size++] = (unsigned char)(generator | 0x80);
+			generator >>= 7;
+		}
+		buffer[size++] = (unsigned char)generator;
+		if (fwrite(buffer, 1, size, file) != size) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int gendict_write(const char* filename, const struct gendict_header_t* header, struct gendict_entry_t* const* entries, uint64_t* const* directories) {
+	FILE* file = NULL;
+	char* tmp = NULL;
+	int result = 0;
+	int t;
+
+	/* write next to the old dictionary and replace it once complete, readers may have it mapped */
+	tmp = (char*)malloc(strlen(filename) + 5);
+	if (!tmp) {
+		return -1;
+	}
+	sprintf(tmp, "%s.tmp", filename);
+	file = fopen(tmp, "wb");
+	if (!file) {
+		error("ERROR: Unable to open %s: %s\n", tmp, strerror(errno));
+		free(tmp);
+		return -1;
+	}
+
+	if (fwrite(header, sizeof(struct gendict_header_t), 1, file) != 1) {
+		result = -1;
+	}
+	for (t = 0; t < 2 && result == 0; t++) {
+		const struct gendict_table_header_t* table = &header->tables[t];
+		uint64_t buckets = 1ULL << table->bucket_bits;
+		if (fseek(file, (long)table->directory_offset, SEEK_SET) != 0 ||
+		    fwrite(directories[t], sizeof(uint64_t), buckets + 1, file) != buckets + 1 ||
+		    fseek(file, (long)table->entries_offset, SEEK_SET) != 0 ||
+		    gendict_write_entries(file, table, entries[t]) < 0) {
+			result = -1;
+		}
+	}
+	if (fclose(file) != 0) {
+		result = -1;
+	}
+	if (result == 0 && rename(tmp, filename) < 0) {
+		result = -1;
+	}
+	if (result < 0) {
+		error("ERROR: Unable to write dictionary %s\n", filename);
+		unlink(tmp);
+	}
+
+	free(tmp);
+	return result;
+}
+
+int gendict_build(const char* filename, const struct gensearch_config_t* config) {
+	const int hashes[2] = { GENSEARCH_SHA1, GENSEARCH_SHA384 };
+	struct gendict_header_t header;
+	struct gendict_entry_t* entries[2] = { NULL, NULL };
+	uint64_t* directories[2] = { NULL, NULL };
+	uint64_t offset = 0;
+	int result = 0;
+	int t;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, GENDICT_MAGIC, sizeof(header.magic));
+	header.version = GENDICT_VERSION;
+	header.byte_order = GENDICT_BYTE_ORDER;
+
+	offset = gendict_align(sizeof(header));
+	for (t = 0; t < 2 && result == 0; t++) {
+		struct gendict_table_header_t* table = &header.tables[t];
+		uint64_t count = 0;
+
+		table->hash = hashes[t];
+		if ((config->hashes & hashes[t]) && gendict_collect(config, hashes[t], &entries[t], &count) < 0) {
+			result = -1;
+			break;
+		}
+		directories[t] = gendict_directory(table, entries[t], count);
+		if (!directories[t]) {
+			result = -1;
+			break;
+		}
+		table->directory_offset = offset;
+		table->entries_offset = gendict_align(offset + ((1ULL << table->bucket_bits) + 1) * sizeof(uint64_t));
+		offset = gendict_align(table->entries_offset + table->entries_size);
+	}
+
+	if (result == 0) {
+		result = gendict_write(filename, &header, entries, directories);
+	}
+	if (result == 0) {
+		info("Wrote %llu SHA-1 and %llu SHA-384 nonces to %s (%llu bytes)\n", (unsigned long long)header.tables[0].entry_count,
+		     (unsigned long long)header.tables[1].entry_count, filename, (unsigned long long)(header.tables[1].entries_offset + header.tables[1].entries_size));
+	}
+
+	for (t = 0; t < 2; t++) {
+		free(entries[t]);
+		free(directories[t]);
+	}
+	return result;
+}
+
+struct gendict_t* gendict_open(const char* filename) {
+	struct gendict_t* dict = NULL;
+	const struct gendict_header_t* header = NULL;
+	struct stat st;
+	void* map = NULL;
+	int fd = -1;
+	int t;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		error("ERROR: Unable to open dictionary %s: %s\n", filename, strerror(errno));
+		return NULL;
+	}
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(struct gendict_header_t)) {
+		error("ERROR: %s is not a generator dictionary\n", filename);
+		close(fd);
+		return NULL;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		error("ERROR: Unable to map dictionary %s: %s\n", filename, strerror(errno));
+		return NULL;
+	}
+
+	header = (const struct gendict_header_t*)map;
+	if (memcmp(header->magic, GENDICT_MAGIC, sizeof(header->magic)) || header->version != GENDICT_VERSION) {
+		error("ERROR: %s is not a generator dictionary\n", filename);
+		munmap(map, st.st_size);
+		return NULL;
+	}
+	if (header->byte_order != GENDICT_BYTE_ORDER) {
+		error("ERROR: %s was built on a host with a different byte order\n", filename);
+		munmap(map, st.st_size);
+		return NULL;
+	}
+	for (t = 0; t < 2; t++) {
+		const struct gendict_table_header_t* table = &header->tables[t];
+		if (table->bucket_bits == 0 || table->bucket_bits > 32 ||
+		    table->directory_offset + ((1ULL << table->bucket_bits) + 1) * sizeof(uint64_t) > (uint64_t)st.st_size ||
+		    table->entries_offset + table->entries_size > (uint64_t)st.st_size) {
+			error("ERROR: Dictionary %s is truncated\n", filename);
+			munmap(map, st.st_size);
+			return NULL;
+		}
+	}
+	/* lookups jump around the file, readahead only wastes page cache */
+	madvise(map, st.st_size, MADV_RANDOM);
+
+	dict = (struct gendict_t*)malloc(sizeof(struct gendict_t));
+	if (!dict) {
+		munmap(map, st.st_size);
+		return NULL;
+	}
+	dict->map = map;
+	dict->map_size = st.st_size;
+	dict->header = header;
+	return dict;
+}
+
+void gendict_close(struct gendict_t* dict) {
+	if (!dict) {
+		return;
+	}
+	munmap(dict->map, dict->map_size);
+	free(dict);
+}
+
+int gendict_lookup(const struct gendict_t* dict, const unsigned char* nonce, size_t size, uint64_t* generator, int* hash) {
+	const struct gendict_table_header_t* table = NULL;
+	const uint64_t* directory = NULL;
+	const unsigned char* entry = NULL;
+	const unsigned char* end = NULL;
+	uint64_t key = 0;
+	uint64_t bucket = 0;
+	uint64_t remainder = 0;
+	int t, i;
+
+	for (t = 0; t < 2; t++) {
+		size_t nonce_size = (dict->header->tables[t].hash == GENSEARCH_SHA1) ? GENSEARCH_SHA1_SIZE : GENSEARCH_SHA384_SIZE;
+		if (nonce_size == size) {
+			table = &dict->header->tables[t];
+		}
+	}
+	if (!table || table->entry_count == 0) {
+		return 0;
+	}
+
+	for (i = 0; i < 8; i++) {
+		key = (key << 8) | nonce[i];
+	}
+	bucket = key >> (64 - table->bucket_bits);
+	remainder = gendict_remainder(key, table->bucket_bits);
+
+	directory = (const uint64_t*)((const char*)dict->map + table->directory_offset);
+	if (directory[bucket] > directory[bucket + 1] || directory[bucket + 1] > table->entries_size) {
+		return 0;
+	}
+	entry = (const unsigned char*)dict->map + table->entries_offset + directory[bucket];
+	end = (const unsigned char*)dict->map + table->entries_offset + directory[bucket + 1];
+
+	while (end - entry > GENDICT_REMAINDER_BYTES) {
+		uint64_t value = 0;
+		int shift = 0;
+		for (i = 0; i < GENDICT_REMAINDER_BYTES; i++) {
+			value = (value << 8) | *(entry++);
+		}
+		if (value > remainder) {
+			break;
+		}
+		*generator = 0;
+		while (entry < end && shift < 64) {
+			*generator |= (uint64_t)(*entry & 0x7f) << shift;
+			shift += 7;
+			if (!(*(entry++) & 0x80)) {
+				break;
+			}
+		}
+		if (value == remainder) {
+			*hash = table->hash;
+			return 1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,55 @@
+/*
+ * gendict.h
+ * Precomputed table from nonces to the generators that produce them
+ */
+
+#ifndef IDEVICERESTORE_GENDICT_H
+#define IDEVICERESTORE_GENDICT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "gensearch.h"
+
+#define GENDICT_MAGIC    "NONCEGEN"
+#define GENDICT_VERSION  1
+
+/* all nonces of one hash, see gendict.c for the encoding */
+struct gendict_table_header_t {
+	uint64_t entry_count;
+	uint32_t hash;
+	uint32_t bucket_bits;
+	uint64_t directory_offset;
+	uint64_t entries_offset;
+	uint64_t entries_size;
+};
+
+struct gendict_header_t {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	struct gendict_table_header_t tables[2];
+};
+
+struct gendict_t {
+	void* map;
+	size_t map_size;
+	const struct gendict_header_t* header;
+};
+
+/* hashes every generator of the configured families with both hashes and writes the table to filename */
+int gendict_build(const char* filename, const struct gensearch_config_t* config);
+struct gendict_t* gendict_open(const char* filename);
+void gendict_close(struct gendict_t* dict);
+/* 1 and the generator and hash if the nonce is in the dictionary, 0 otherwise */
+int gendict_lookup(const struct gendict_t* dict, const unsigned char* nonce, size_t size, uint64_t* generator, int* hash);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
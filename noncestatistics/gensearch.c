@@ -0,0 +1,714 @@
+/*
+ * gensearch.c
+ * Brute force search for the generators of collected nonces
+ *
+ * From A7 to A11 the ApNonce is a hash of the 64 bit generator: SHA-1 of its
+ * 8 little endian bytes, or SHA-384 of them truncated to 32 bytes. A nonce
+ * that keeps coming back may therefore come from a generator that tools set
+ * by default or from one with little entropy. This hashes whole families of
+ * generators and checks each result against the collected nonces.
+ *
+ * The message is always one block with only the first 8 bytes changing, so
+ * many generators are hashed side by side, one per vector lane: 16 (SHA-1)
+ * or 8 (SHA-384) with AVX-512, 8 or 4 with AVX2 and 4 or 2 with plain
+ * vectors of the compiler everywhere else. The lanes are written once with
+ * GCC/clang vector extensions and instantiated per instruction set, which is
+ * picked at runtime. Only the first 8 bytes of each hash are looked up in a
+ * hash table of the collected nonces; a hit is hashed again in full and
+ * compared to the whole nonce before it is reported. The generator space is
+ * split into chunks that all cores take from a shared counter.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "common.h"
+#include "gensearch.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define GENSEARCH_X86 1
+#endif
+
+/* generators a thread takes at a time */
+#define GENSEARCH_CHUNK     (1 << 20)
+/* seconds between progress messages */
+#define GENSEARCH_PROGRESS  10
+
+typedef void (*gensearch_keys_t)(const uint64_t* generators, uint64_t* keys);
+
+static const uint64_t gensearch_known[] = {
+	0x1111111111111111ULL,	/* set by most jailbreak tools and futurerestore */
+	0xbd34a880be0b53f3ULL,	/* electra and chimera */
+	0x0000000000000000ULL,
+};
+
+static const uint32_t gensearch_sha1_iv[5] = {
+	0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0
+};
+
+static const uint64_t gensearch_sha384_iv[8] = {
+	0xcbbb9d5dc1059ed8ULL, 0x629a292a367cd507ULL, 0x9159015a3070dd17ULL, 0x152fecd8f70e5939ULL,
+	0x67332667ffc00b31ULL, 0x8eb44a8768581511ULL, 0xdb0c2e0d64f98fa7ULL, 0x47b5481dbefa4fa4ULL
+};
+
+static const uint64_t gensearch_sha512_k[80] = {
+	0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL, 0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL,
+	0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL, 0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
+	0xd807aa98a3030242ULL, 0x12835b0145706fbeULL, 0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+	0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL, 0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
+	0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL, 0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
+	0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL, 0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+	0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL, 0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL,
+	0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL, 0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
+	0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL, 0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+	0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL, 0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
+	0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL, 0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL,
+	0xd192e819d6ef5218ULL, 0xd69906245565a910ULL, 0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+	0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL, 0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL,
+	0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL, 0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
+	0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL, 0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+	0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL, 0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
+	0xca273eceea26619cULL, 0xd186b8c721c0c207ULL, 0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL,
+	0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL, 0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+	0x28db77f523047d84ULL, 0x32caab7b40c72493ULL, 0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL,
+	0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL, 0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL
+};
+
+#define GENSEARCH_ROL32(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define GENSEARCH_ROR64(x, n) (((x) >> (n)) | ((x) << (64 - (n))))
+
+/*
+ * SHA-1 of LANES generators at once, writing the first 8 bytes of each hash
+ * as a big endian key. T is a vector of LANES 32 bit words. The message is
+ * the generator, the 0x80 padding byte and the bit length 64.
+ */
+#define GENSEARCH_SHA1_ROUNDS(first, last, F, K) \
+	for (t = first; t < last; t++) { \
+		if (t >= 16) { \
+			w[t & 15] = GENSEARCH_ROL32(w[(t - 3) & 15] ^ w[(t - 8) & 15] ^ w[(t - 14) & 15] ^ w[t & 15], 1); \
+		} \
+		tmp = GENSEARCH_ROL32(a, 5) + (F) + e + (K) + w[t & 15]; \
+		e = d; \
+		d = c; \
+		c = GENSEARCH_ROL32(b, 30); \
+		b = a; \
+		a = tmp; \
+	}
+
+#define GENSEARCH_SHA1_KEYS(name, attributes, T, LANES) \
+attributes static void name(const uint64_t* generators, uint64_t* keys) { \
+	int base, i, t; \
+	for (base = 0; base < GENSEARCH_BATCH; base += LANES) { \
+		const T zero = { 0 }; \
+		T w[16]; \
+		T a, b, c, d, e, tmp; \
+		for (i = 0; i < LANES; i++) { \
+			w[0][i] = __builtin_bswap32((uint32_t)generators[base + i]); \
+			w[1][i] = __builtin_bswap32((uint32_t)(generators[base + i] >> 32)); \
+		} \
+		w[2] = zero + 0x80000000U; \
+		for (t = 3; t < 15; t++) { \
+			w[t] = zero; \
+		} \
+		w[15] = zero + 64U; \
+		a = zero + gensearch_sha1_iv[0]; \
+		b = zero + gensearch_sha1_iv[1]; \
+		c = zero + gensearch_sha1_iv[2]; \
+		d = zero + gensearch_sha1_iv[3]; \
+		e = zero + gensearch_sha1_iv[4]; \
+		GENSEARCH_SHA1_ROUNDS(0, 20, (b & c) | (~b & d), 0x5a827999U) \
+		GENSEARCH_SHA1_ROUNDS(20, 40, b ^ c ^ d, 0x6ed9eba1U) \
+		GENSEARCH_SHA1_ROUNDS(40, 60, (b & c) | (b & d) | (c & d), 0x8f1bbcdcU) \
+		GENSEARCH_SHA1_ROUNDS(60, 80, b ^ c ^ d, 0xca62c1d6U) \
+		a += gensearch_sha1_iv[0]; \
+		b += gensearch_sha1_iv[1]; \
+		for (i = 0; i < LANES; i++) { \
+			keys[base + i] = ((uint64_t)a[i] << 32) | b[i]; \
+		} \
+	} \
+}
+
+/* SHA-384 of LANES generators at once, T is a vector of LANES 64 bit words */
+#define GENSEARCH_SHA384_KEYS(name, attributes, T, LANES) \
+attributes static void name(const uint64_t* generators, uint64_t* keys) { \
+	int base, i, t; \
+	for (base = 0; base < GENSEARCH_BATCH; base += LANES) { \
+		const T zero = { 0 }; \
+		T w[16]; \
+		T a, b, c, d, e, f, g, h, t1, t2; \
+		for (i = 0; i < LANES; i++) { \
+			w[0][i] = __builtin_bswap64(generators[base + i]); \
+		} \
+		w[1] = zero + 0x8000000000000000ULL; \
+		for (t = 2; t < 15; t++) { \
+			w[t] = zero; \
+		} \
+		w[15] = zero + 64ULL; \
+		a = zero + gensearch_sha384_iv[0]; \
+		b = zero + gensearch_sha384_iv[1]; \
+		c = zero + gensearch_sha384_iv[2]; \
+		d = zero + gensearch_sha384_iv[3]; \
+		e = zero + gensearch_sha384_iv[4]; \
+		f = zero + gensearch_sha384_iv[5]; \
+		g = zero + gensearch_sha384_iv[6]; \
+		h = zero + gensearch_sha384_iv[7]; \
+		for (t = 0; t < 80; t++) { \
+			if (t >= 16) { \
+				T w15 = w[(t - 15) & 15]; \
+				T w2 = w[(t - 2) & 15]; \
+				w[t & 15] += (GENSEARCH_ROR64(w2, 19) ^ GENSEARCH_ROR64(w2, 61) ^ (w2 >> 6)) + w[(t - 7) & 15] + \
+				             (GENSEARCH_ROR64(w15, 1) ^ GENSEARCH_ROR64(w15, 8) ^ (w15 >> 7)); \
+			} \
+			t1 = h + (GENSEARCH_ROR64(e, 14) ^ GENSEARCH_ROR64(e, 18) ^ GENSEARCH_ROR64(e, 41)) + ((e & f) ^ (~e & g)) + \
+			     gensearch_sha512_k[t] + w[t & 15]; \
+			t2 = (GENSEARCH_ROR64(a, 28) ^ GENSEARCH_ROR64(a, 34) ^ GENSEARCH_ROR64(a, 39)) + ((a & b) ^ (a & c) ^ (b & c)); \
+			h = g; \
+			g = f; \
+			f = e; \
+			e = d + t1; \
+			d = c; \
+			c = b; \
+			b = a; \
+			a = t1 + t2; \
+		} \
+		a += gensearch_sha384_iv[0]; \
+		for (i = 0; i < LANES; i++) { \
+			keys[base + i] = a[i]; \
+		} \
+	} \
+}
+
+typedef uint32_t gensearch_u32x4 __attribute__((vector_size(16)));
+typedef uint64_t gensearch_u64x2 __attribute__((vector_size(16)));
+GENSEARCH_SHA1_KEYS(gensearch_sha1_generic, , gensearch_u32x4, 4)
+GENSEARCH_SHA384_KEYS(gensearch_sha384_generic, , gensearch_u64x2, 2)
+
+#ifdef GENSEARCH_X86
+typedef uint32_t gensearch_u32x8 __attribute__((vector_size(32)));
+typedef uint64_t gensearch_u64x4 __attribute__((vector_size(32)));
+typedef uint32_t gensearch_u32x16 __attribute__((vector_size(64)));
+typedef uint64_t gensearch_u64x8 __attribute__((vector_size(64)));
+GENSEARCH_SHA1_KEYS(gensearch_sha1_avx2, __attribute__((target("avx2"))), gensearch_u32x8, 8)
+GENSEARCH_SHA384_KEYS(gensearch_sha384_avx2, __attribute__((target("avx2"))), gensearch_u64x4, 4)
+GENSEARCH_SHA1_KEYS(gensearch_sha1_avx512, __attribute__((target("avx512f"))), gensearch_u32x16, 16)
+GENSEARCH_SHA384_KEYS(gensearch_sha384_avx512, __attribute__((target("avx512f"))), gensearch_u64x8, 8)
+#endif
+
+static gensearch_keys_t gensearch_sha1_keys = gensearch_sha1_generic;
+static gensearch_keys_t gensearch_sha384_keys = gensearch_sha384_generic;
+static const char* gensearch_isa = "generic";
+static pthread_once_t gensearch_once = PTHREAD_ONCE_INIT;
+
+static void gensearch_init(void) {
+#ifdef GENSEARCH_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) {
+		gensearch_sha1_keys = gensearch_sha1_avx512;
+		gensearch_sha384_keys = gensearch_sha384_avx512;
+		gensearch_isa = "AVX-512";
+	} else if (__builtin_cpu_supports("avx2")) {
+		gensearch_sha1_keys = gensearch_sha1_avx2;
+		gensearch_sha384_keys = gensearch_sha384_avx2;
+		gensearch_isa = "AVX2";
+	}
+#endif
+}
+
+/* full hashes, only used to confirm a match */
+static void gensearch_sha1(uint64_t generator, unsigned char* digest) {
+	uint32_t w[80];
+	uint32_t a, b, c, d, e, tmp;
+	int t;
+
+	memset(w, 0, sizeof(w));
+	w[0] = __builtin_bswap32((uint32_t)generator);
+	w[1] = __builtin_bswap32((uint32_t)(generator >> 32));
+	w[2] = 0x80000000U;
+	w[15] = 64;
+	for (t = 16; t < 80; t++) {
+		w[t] = GENSEARCH_ROL32(w[t - 3] ^ w[t - 8] ^ w[t - 14] ^ w[t - 16], 1);
+	}
+	a = gensearch_sha1_iv[0];
+	b = gensearch_sha1_iv[1];
+	c = gensearch_sha1_iv[2];
+	d = gensearch_sha1_iv[3];
+	e = gensearch_sha1_iv[4];
+	for (t = 0; t < 80; t++) {
+		uint32_t f, k;
+		if (t < 20) {
+			f = (b & c) | (~b & d);
+			k = 0x5a827999U;
+		} else if (t < 40) {
+			f = b ^ c ^ d;
+			k = 0x6ed9eba1U;
+		} else if (t < 60) {
+			f = (b & c) | (b & d) | (c & d);
+			k = 0x8f1bbcdcU;
+		} else {
+			f = b ^ c ^ d;
+			k = 0xca62c1d6U;
+		}
+		tmp = GENSEARCH_ROL32(a, 5) + f + e + k + w[t];
+		e = d;
+		d = c;
+		c = GENSEARCH_ROL32(b, 30);
+		b = a;
+		a = tmp;
+	}
+	{
+		uint32_t state[5] = { a, b, c, d, e };
+		for (t = 0; t < 5; t++) {
+			uint32_t word = state[t] + gensearch_sha1_iv[t];
+			digest[4*t] = word >> 24;
+			digest[4*t + 1] = word >> 16;
+			digest[4*t + 2] = word >> 8;
+			digest[4*t + 3] = word;
+		}
+	}
+}
+
+static void gensearch_sha384(uint64_t generator, unsigned char* digest) {
+	uint64_t w[80];
+	uint64_t s[8];
+	int t, i;
+
+	memset(w, 0, sizeof(w));
+	w[0] = __builtin_bswap64(generator);
+	w[1] = 0x8000000000000000ULL;
+	w[15] = 64;
+	for (t = 16; t < 80; t++) {
+		w[t] = (GENSEARCH_ROR64(w[t - 2], 19) ^ GENSEARCH_ROR64(w[t - 2], 61) ^ (w[t - 2] >> 6)) + w[t - 7] +
+		       (GENSEARCH_ROR64(w[t - 15], 1) ^ GENSEARCH_ROR64(w[t - 15], 8) ^ (w[t - 15] >> 7)) + w[t - 16];
+	}
+	memcpy(s, gensearch_sha384_iv, sizeof(s));
+	for (t = 0; t < 80; t++) {
+		uint64_t t1 = s[7] + (GENSEARCH_ROR64(s[4], 14) ^ GENSEARCH_ROR64(s[4], 18) ^ GENSEARCH_ROR64(s[4], 41)) +
+		              ((s[4] & s[5]) ^ (~s[4] & s[6])) + gensearch_sha512_k[t] + w[t];
+		uint64_t t2 = (GENSEARCH_ROR64(s[0], 28) ^ GENSEARCH_ROR64(s[0], 34) ^ GENSEARCH_ROR64(s[0], 39)) +
+		              ((s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]));
+		memmove(s + 1, s, 7 * sizeof(uint64_t));
+		s[4] += t1;
+		s[0] = t1 + t2;
+	}
+	for (i = 0; i < 6; i++) {
+		uint64_t word = s[i] + gensearch_sha384_iv[i];
+		int j;
+		for (j = 0; j < 8; j++) {
+			digest[8*i + j] = word >> (56 - 8*j);
+		}
+	}
+}
+
+void gensearch_nonce(uint64_t generator, int hash, unsigned char* nonce) {
+	unsigned char digest[48];
+	if (hash == GENSEARCH_SHA1) {
+		gensearch_sha1(generator, nonce);
+	} else {
+		gensearch_sha384(generator, digest);
+		memcpy(nonce, digest, GENSEARCH_SHA384_SIZE);
+	}
+}
+
+void gensearch_keys(int hash, const uint64_t* generators, uint64_t* keys) {
+	pthread_once(&gensearch_once, gensearch_init);
+	if (hash == GENSEARCH_SHA1) {
+		gensearch_sha1_keys(generators, keys);
+	} else {
+		gensearch_sha384_keys(generators, keys);
+	}
+}
+
+const char* gensearch_hash_name(int hash) {
+	return (hash == GENSEARCH_SHA1) ? "SHA-1" : "SHA-384";
+}
+
+uint64_t gensearch_family_size(const struct gensearch_family_t* family) {
+	switch (family->type) {
+	case GENSEARCH_FAMILY_KNOWN:
+		return sizeof(gensearch_known) / sizeof(gensearch_known[0]);
+	case GENSEARCH_FAMILY_REPEAT8:
+		return 1ULL << 8;
+	case GENSEARCH_FAMILY_REPEAT16:
+		return 1ULL << 16;
+	case GENSEARCH_FAMILY_REPEAT32:
+		return 1ULL << 32;
+	default:
+		return family->to - family->from + 1;
+	}
+}
+
+uint64_t gensearch_family_generator(const struct gensearch_family_t* family, uint64_t i) {
+	switch (family->type) {
+	case GENSEARCH_FAMILY_KNOWN:
+		return gensearch_known[i];
+	case GENSEARCH_FAMILY_REPEAT8:
+		return i * 0x0101010101010101ULL;
+	case GENSEARCH_FAMILY_REPEAT16:
+		return i * 0x0001000100010001ULL;
+	case GENSEARCH_FAMILY_REPEAT32:
+		return i * 0x0000000100000001ULL;
+	default:
+		return family->from + i;
+	}
+}
+
+static const char* gensearch_family_name(const struct gensearch_family_t* family) {
+	switch (family->type) {
+	case GENSEARCH_FAMILY_KNOWN:
+		return "known generators";
+	case GENSEARCH_FAMILY_REPEAT8:
+		return "repeated 8 bit patterns";
+	case GENSEARCH_FAMILY_REPEAT16:
+		return "repeated 16 bit patterns";
+	case GENSEARCH_FAMILY_REPEAT32:
+		return "repeated 32 bit patterns";
+	default:
+		return "generator range";
+	}
+}
+
+static int gensearch_add_family(struct gensearch_config_t* config, int type, uint64_t from, uint64_t to) {
+	if (config->family_count == GENSEARCH_MAX_FAMILIES) {
+		error("ERROR: Too many generator families\n");
+		return -1;
+	}
+	config->families[config->family_count].type = type;
+	config->families[config->family_count].from = from;
+	config->families[config->family_count].to = to;
+	config->family_count++;
+	return 0;
+}
+
+int gensearch_parse_config(const char* spec, struct gensearch_config_t* config) {
+	char* copy = NULL;
+	char* token = NULL;
+	char* saveptr = NULL;
+	int result = 0;
+
+	memset(config, 0, sizeof(struct gensearch_config_t));
+	config->hashes = GENSEARCH_SHA1 | GENSEARCH_SHA384;
+	config->threads = (unsigned int)sysconf(_SC_NPROCESSORS_ONLN);
+
+	copy = strdup((spec) ? spec : "");
+	for (token = strtok_r(copy, ",", &saveptr); token && result == 0; token = strtok_r(NULL, ",", &saveptr)) {
+		char* value = strchr(token, '=');
+		if (value) {
+			*(value++) = '\0';
+		}
+
+		if (!strcmp(token, "known")) {
+			result = gensearch_add_family(config, GENSEARCH_FAMILY_KNOWN, 0, 0);
+		} else if (!strcmp(token, "repeat8")) {
+			result = gensearch_add_family(config, GENSEARCH_FAMILY_REPEAT8, 0, 0);
+		} else if (!strcmp(token, "repeat16")) {
+			result = gensearch_add_family(config, GENSEARCH_FAMILY_REPEAT16, 0, 0);
+		} else if (!strcmp(token, "repeat32")) {
+			result = gensearch_add_family(config, GENSEARCH_FAMILY_REPEAT32, 0, 0);
+		} else if (!strcmp(token, "low") && value) {
+			unsigned long bits = strtoul(value, NULL, 0);
+			if (bits == 0 || bits > 48) {
+				error("ERROR: low needs between 1 and 48 bits\n");
+				result = -1;
+			} else {
+				result = gensearch_add_family(config, GENSEARCH_FAMILY_RANGE, 0, (1ULL << bits) - 1);
+			}
+		} else if (!strcmp(token, "range") && value && strchr(value, '-')) {
+			uint64_t from = strtoull(value, NULL, 0);
+			uint64_t to = strtoull(strchr(value, '-') + 1, NULL, 0);
+			if (to < from || to - from >= (1ULL << 48)) {
+				error("ERROR: Invalid generator range %s\n", value);
+				result = -1;
+			} else {
+				result = gensearch_add_family(config, GENSEARCH_FAMILY_RANGE, from, to);
+			}
+		} else if (!strcmp(token, "hash") && value) {
+			if (!strcmp(value, "sha1")) {
+				config->hashes = GENSEARCH_SHA1;
+			} else if (!strcmp(value, "sha384")) {
+				config->hashes = GENSEARCH_SHA384;
+			} else if (!strcmp(value, "auto")) {
+				config->hashes = GENSEARCH_SHA1 | GENSEARCH_SHA384;
+			} else {
+				error("ERROR: Unknown hash '%s'\n", value);
+				result = -1;
+			}
+		} else if (!strcmp(token, "threads") && value) {
+			config->threads = (unsigned int)strtoul(value, NULL, 0);
+		} else {
+			error("ERROR: Invalid generator search option '%s'\n", token);
+			result = -1;
+		}
+	}
+	free(copy);
+
+	if (result == 0 && config->family_count == 0) {
+		gensearch_add_family(config, GENSEARCH_FAMILY_KNOWN, 0, 0);
+		gensearch_add_family(config, GENSEARCH_FAMILY_REPEAT8, 0, 0);
+		gensearch_add_family(config, GENSEARCH_FAMILY_REPEAT16, 0, 0);
+		gensearch_add_family(config, GENSEARCH_FAMILY_RANGE, 0, (1ULL << 24) - 1);
+	}
+	if (config->threads == 0) {
+		config->threads = 1;
+	}
+	return result;
+}
+
+/*
+ * open addressing table of the first 8 bytes of every target of one hash
+ * size. Nearly every lookup misses, it is kept at most a quarter full so that
+ * a miss almost always ends at the first slot.
+ */
+struct gensearch_table_t {
+	uint64_t* slots;
+	uint64_t mask;
+	int has_zero;
+	size_t count;
+};
+
+/* the keys are hash output, their low bits are already uniformly distributed */
+static size_t gensearch_table_slot(const struct gensearch_table_t* table, uint64_t key) {
+	return (size_t)(key & table->mask);
+}
+
+static int gensearch_table_build(struct gensearch_table_t* table, const struct nonce_set_t* targets, size_t size) {
+	size_t i, capacity = 16;
+
+	memset(table, 0, sizeof(struct gensearch_table_t));
+	for (i = 0; i < targets->count; i++) {
+		if (targets->sizes[i] == size) {
+			table->count++;
+		}
+	}
+	while (capacity < 4 * table->count) {
+		capacity *= 2;
+	}
+	table->slots = (uint64_t*)calloc(capacity, sizeof(uint64_t));
+	if (!table->slots) {
+		error("ERROR: Out of memory\n");
+		return -1;
+	}
+	table->mask = capacity - 1;
+
+	for (i = 0; i < targets->count; i++) {
+		size_t slot;
+		if (targets->sizes[i] != size) {
+			continue;
+		}
+		if (targets->keys[i] == 0) {
+			table->has_zero = 1;
+			continue;
+		}
+		for (slot = gensearch_table_slot(table, targets->keys[i]); table->slots[slot] && table->slots[slot] != targets->keys[i]; slot = (slot + 1) & table->mask);
+		table->slots[slot] = targets->keys[i];
+	}
+	return 0;
+}
+
+static int gensearch_table_contains(const struct gensearch_table_t* table, uint64_t key) {
+	size_t slot;
+	if (key == 0) {
+		return table->has_zero;
+	}
+	for (slot = gensearch_table_slot(table, key); table->slots[slot]; slot = (slot + 1) & table->mask) {
+		if (table->slots[slot] == key) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+struct gensearch_job_t {
+	const struct gensearch_family_t* family;
+	const struct nonce_set_t* targets;
+	const struct gensearch_table_t* table;
+	gensearch_keys_t keys;
+	int hash;
+	size_t nonce_size;
+	uint64_t size;
+	uint64_t chunks;
+	uint64_t next_chunk;
+	uint64_t hashed;
+	unsigned int running;
+	gensearch_match_cb_t callback;
+	void* user_data;
+	pthread_mutex_t lock;
+	pthread_cond_t done;
+};
+
+/* binary search on the keys, then a comparison of the whole nonce */
+static int gensearch_targets_contain(const struct nonce_set_t* targets, const unsigned char* nonce, size_t size) {
+	uint8_t padded[NONCE_SET_NONCE_SIZE];
+	uint64_t key = 0;
+	size_t lo = 0, hi = targets->count;
+	int i;
+
+	memset(padded, 0, sizeof(padded));
+	memcpy(padded, nonce, size);
+	for (i = 0; i < 8; i++) {
+		key = (key << 8) | padded[i];
+	}
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (targets->keys[mid] < key) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	for (; lo < targets->count && targets->keys[lo] == key; lo++) {
+		if (targets->sizes[lo] == size && !memcmp(targets->nonces[lo], padded, NONCE_SET_NONCE_SIZE)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void* gensearch_worker(void* data) {
+	struct gensearch_job_t* job = (struct gensearch_job_t*)data;
+	uint64_t generators[GENSEARCH_BATCH];
+	uint64_t keys[GENSEARCH_BATCH];
+	uint64_t chunk;
+
+	while ((chunk = __atomic_fetch_add(&job->next_chunk, 1, __ATOMIC_RELAXED)) < job->chunks) {
+		uint64_t start = chunk * GENSEARCH_CHUNK;
+		uint64_t end = (job->size - start > GENSEARCH_CHUNK) ? start + GENSEARCH_CHUNK : job->size;
+		uint64_t i;
+
+		for (i = start; i < end; i += GENSEARCH_BATCH) {
+			unsigned int lanes = (end - i < GENSEARCH_BATCH) ? (unsigned int)(end - i) : GENSEARCH_BATCH;
+			unsigned int l;
+			if (job->family->type == GENSEARCH_FAMILY_RANGE) {
+				for (l = 0; l < GENSEARCH_BATCH; l++) {
+					generators[l] = job->family->from + i + l;
+				}
+			} else {
+				for (l = 0; l < GENSEARCH_BATCH; l++) {
+					generators[l] = gensearch_family_generator(job->family, i + ((l < lanes) ? l : 0));
+				}
+			}
+			job->keys(generators, keys);
+			for (l = 0; l < lanes; l++) {
+				unsigned char nonce[GENSEARCH_SHA384_SIZE];
+				if (!gensearch_table_contains(job->table, keys[l])) {
+					continue;
+				}
+				gensearch_nonce(generators[l], job->hash, nonce);
+				if (gensearch_targets_contain(job->targets, nonce, job->nonce_size)) {
+					pthread_mutex_lock(&job->lock);
+					job->callback(generators[l], job->hash, nonce, job->nonce_size, job->user_data);
+					pthread_mutex_unlock(&job->lock);
+				}
+			}
+		}
+		__atomic_add_fetch(&job->hashed, end - start, __ATOMIC_RELAXED);
+	}
+
+	pthread_mutex_lock(&job->lock);
+	if (--job->running == 0) {
+		pthread_cond_signal(&job->done);
+	}
+	pthread_mutex_unlock(&job->lock);
+	return NULL;
+}
+
+static uint64_t gensearch_now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+uint64_t gensearch_run(const struct gensearch_config_t* config, const struct nonce_set_t* targets, gensearch_match_cb_t callback, void* user_data) {
+	const int hashes[2] = { GENSEARCH_SHA1, GENSEARCH_SHA384 };
+	pthread_t* threads = NULL;
+	uint64_t total = 0;
+	unsigned int f, h, i;
+
+	pthread_once(&gensearch_once, gensearch_init);
+	threads = (pthread_t*)malloc(config->threads * sizeof(pthread_t));
+	if (!threads) {
+		error("ERROR: Out of memory\n");
+		return 0;
+	}
+
+	for (h = 0; h < 2; h++) {
+		struct gensearch_table_t table;
+		size_t nonce_size = (hashes[h] == GENSEARCH_SHA1) ? GENSEARCH_SHA1_SIZE : GENSEARCH_SHA384_SIZE;
+
+		if (!(config->hashes & hashes[h]) || gensearch_table_build(&table, targets, nonce_size) < 0) {
+			continue;
+		}
+		if (table.count == 0) {
+			debug("No %u byte nonces, skipping %s\n", (unsigned int)nonce_size, gensearch_hash_name(hashes[h]));
+			free(table.slots);
+			continue;
+		}
+
+		for (f = 0; f < config->family_count; f++) {
+			struct gensearch_job_t job;
+			uint64_t started = gensearch_now_ms();
+			uint64_t elapsed = 0;
+			unsigned int created = 0;
+
+			memset(&job, 0, sizeof(job));
+			job.family = &config->families[f];
+			job.targets = targets;
+			job.table = &table;
+			job.keys = (hashes[h] == GENSEARCH_SHA1) ? gensearch_sha1_keys : gensearch_sha384_keys;
+			job.hash = hashes[h];
+			job.nonce_size = nonce_size;
+			job.size = gensearch_family_size(job.family);
+			job.chunks = (job.size + GENSEARCH_CHUNK - 1) / GENSEARCH_CHUNK;
+			job.callback = callback;
+			job.user_data = user_data;
+			pthread_mutex_init(&job.lock, NULL);
+			pthread_cond_init(&job.done, NULL);
+
+			info("Searching %llu %s for %zu %s nonces with %u threads (%s)\n", (unsigned long long)job.size, gensearch_family_name(job.family),
+			     table.count, gensearch_hash_name(job.hash), config->threads, gensearch_isa);
+			pthread_mutex_lock(&job.lock);
+			for (i = 0; i < config->threads; i++) {
+				if (pthread_create(&threads[created], NULL, gensearch_worker, &job) == 0) {
+					created++;
+					job.running++;
+				}
+			}
+			if (created == 0) {
+				/* no threads at all, do the work right here */
+				job.running = 1;
+				pthread_mutex_unlock(&job.lock);
+				gensearch_worker(&job);
+				pthread_mutex_lock(&job.lock);
+			}
+			while (job.running > 0) {
+				struct timespec deadline;
+				clock_gettime(CLOCK_REALTIME, &deadline);
+				deadline.tv_sec += GENSEARCH_PROGRESS;
+				if (pthread_cond_timedwait(&job.done, &job.lock, &deadline) != 0 && job.running > 0) {
+					uint64_t hashed = __atomic_load_n(&job.hashed, __ATOMIC_RELAXED);
+					uint64_t now = gensearch_now_ms();
+					info("Hashed %llu of %llu generators (%.1f M/s)\n", (unsigned long long)hashed, (unsigned long long)job.size,
+					     hashed / 1000.0 / (now - started));
+				}
+			}
+			pthread_mutex_unlock(&job.lock);
+			for (i = 0; i < created; i++) {
+				pthread_join(threads[i], NULL);
+			}
+			pthread_cond_destroy(&job.done);
+			pthread_mutex_destroy(&job.lock);
+
+			elapsed = gensearch_now_ms() - started;
+			info("Hashed %llu generators in %.3f seconds (%.1f M/s)\n", (unsigned long long)job.hashed, elapsed / 1000.0,
+			     (elapsed) ? job.hashed / 1000.0 / elapsed : 0);
+			total += job.hashed;
+		}
+		free(table.slots);
+	}
+
+	free(threads);
+	return total;
+}
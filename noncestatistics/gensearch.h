@@ -0,0 +1,65 @@
+/*
+ * gensearch.h
+ * Brute force search for the generators of collected nonces
+ */
+
+#ifndef IDEVICERESTORE_GENSEARCH_H
+#define IDEVICERESTORE_GENSEARCH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "nonce_set.h"
+
+#define GENSEARCH_SHA1       1
+#define GENSEARCH_SHA384     2
+
+#define GENSEARCH_SHA1_SIZE    20
+#define GENSEARCH_SHA384_SIZE  32
+
+#define GENSEARCH_FAMILY_RANGE     0
+#define GENSEARCH_FAMILY_KNOWN     1
+#define GENSEARCH_FAMILY_REPEAT8   2
+#define GENSEARCH_FAMILY_REPEAT16  3
+#define GENSEARCH_FAMILY_REPEAT32  4
+
+#define GENSEARCH_MAX_FAMILIES     8
+
+/* generators hashed per call of gensearch_keys */
+#define GENSEARCH_BATCH            16
+
+struct gensearch_family_t {
+	int type;
+	uint64_t from;
+	uint64_t to;
+};
+
+struct gensearch_config_t {
+	int hashes;
+	unsigned int threads;
+	unsigned int family_count;
+	struct gensearch_family_t families[GENSEARCH_MAX_FAMILIES];
+};
+
+typedef void (*gensearch_match_cb_t)(uint64_t generator, int hash, const unsigned char* nonce, size_t size, void* user_data);
+
+int gensearch_parse_config(const char* spec, struct gensearch_config_t* config);
+/* hashes every generator of the configured families and reports those whose nonce is in targets, returns the number of hashes */
+uint64_t gensearch_run(const struct gensearch_config_t* config, const struct nonce_set_t* targets, gensearch_match_cb_t callback, void* user_data);
+/* the ApNonce of a generator: SHA-1, or SHA-384 truncated to 32 bytes, of its 8 little endian bytes */
+void gensearch_nonce(uint64_t generator, int hash, unsigned char* nonce);
+const char* gensearch_hash_name(int hash);
+/* the first 8 bytes of the nonces of GENSEARCH_BATCH generators as big endian numbers */
+void gensearch_keys(int hash, const uint64_t* generators, uint64_t* keys);
+uint64_t gensearch_family_size(const struct gensearch_family_t* family);
+uint64_t gensearch_family_generator(const struct gensearch_family_t* family, uint64_t i);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,254 @@
+/*
+ * hex.c
+ * Hex encoding and decoding shared by the collector and the analyzer
+ *
+ * Nonces are printed and parsed as hex everywhere, a statistics run decodes
+ * millions of them. On x86 the work is done 16 (SSSE3) or 32 (AVX2) bytes at
+ * a time: encoding splits every byte into nibbles and looks the digits up
+ * with pshufb, decoding checks all characters of a block at once and merges
+ * nibble pairs with pmaddubsw. The instruction set is picked at runtime, so
+ * the binary doesn't need to be built for a particular CPU. Everything else,
+ * and the tails shorter than a block, goes through lookup tables.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "hex.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define HEX_X86 1
+#include <immintrin.h>
+#endif
+
+static const char hex_digits[] = "0123456789abcdef";
+
+/* value of every character, -1 for characters that aren't hex digits */
+static const int8_t hex_values[256] = {
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	 0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1,
+	-1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
+
+/* each block function handles as many whole blocks as it can and returns how many bytes it did */
+struct hex_impl_t {
+	size_t (*encode)(char* out, const unsigned char* data, size_t size);
+	size_t (*decode)(unsigned char* out, const char* hex, size_t size);
+	size_t (*span)(const char* hex, size_t length);
+};
+
+/* without vector support every byte goes through the tables */
+static size_t hex_encode_none(char* out, const unsigned char* data, size_t size) {
+	return 0;
+}
+
+static size_t hex_decode_none(unsigned char* out, const char* hex, size_t size) {
+	return 0;
+}
+
+static size_t hex_span_none(const char* hex, size_t length) {
+	return 0;
+}
+
+static struct hex_impl_t hex_impl = { hex_encode_none, hex_decode_none, hex_span_none };
+static pthread_once_t hex_impl_once = PTHREAD_ONCE_INIT;
+
+#ifdef HEX_X86
+/* returns a mask with 0xff for every character of v that is a hex digit, and the nibble values in *values */
+__attribute__((target("ssse3")))
+static __m128i hex_classify_ssse3(__m128i v, __m128i* values) {
+	__m128i digit = _mm_sub_epi8(v, _mm_set1_epi8('0'));
+	__m128i letter = _mm_sub_epi8(_mm_or_si128(v, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+	__m128i is_digit = _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+	__m128i is_letter = _mm_cmpeq_epi8(_mm_min_epu8(letter, _mm_set1_epi8(5)), letter);
+
+	*values = _mm_or_si128(_mm_and_si128(is_digit, digit), _mm_and_si128(is_letter, _mm_add_epi8(letter, _mm_set1_epi8(10))));
+	return _mm_or_si128(is_digit, is_letter);
+}
+
+__attribute__((target("ssse3")))
+static size_t hex_encode_ssse3(char* out, const unsigned char* data, size_t size) {
+	const __m128i table = _mm_loadu_si128((const __m128i*)hex_digits);
+	const __m128i mask = _mm_set1_epi8(0x0f);
+	size_t i = 0;
+
+	for (i = 0; i + 16 <= size; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+		__m128i hi = _mm_shuffle_epi8(table, _mm_and_si128(_mm_srli_epi16(v, 4), mask));
+		__m128i lo = _mm_shuffle_epi8(table, _mm_and_si128(v, mask));
+		_mm_storeu_si128((__m128i*)(out + 2*i), _mm_unpacklo_epi8(hi, lo));
+		_mm_storeu_si128((__m128i*)(out + 2*i + 16), _mm_unpackhi_epi8(hi, lo));
+	}
+	return i;
+}
+
+__attribute__((target("ssse3")))
+static size_t hex_decode_ssse3(unsigned char* out, const char* hex, size_t size) {
+	const __m128i weights = _mm_set1_epi16(0x0110);
+	size_t i = 0;
+
+	for (i = 0; i + 16 <= size; i += 16) {
+		__m128i v0, v1;
+		__m128i valid0 = hex_classify_ssse3(_mm_loadu_si128((const __m128i*)(hex + 2*i)), &v0);
+		__m128i valid1 = hex_classify_ssse3(_mm_loadu_si128((const __m128i*)(hex + 2*i + 16)), &v1);
+		if (_mm_movemask_epi8(_mm_and_si128(valid0, valid1)) != 0xffff) {
+			break;
+		}
+		/* high nibble * 16 + low nibble for every pair, then narrow the words back to bytes */
+		v0 = _mm_maddubs_epi16(v0, weights);
+		v1 = _mm_maddubs_epi16(v1, weights);
+		_mm_storeu_si128((__m128i*)(out + i), _mm_packus_epi16(v0, v1));
+	}
+	return i;
+}
+
+__attribute__((target("ssse3")))
+static size_t hex_span_ssse3(const char* hex, size_t length) {
+	size_t i = 0;
+
+	for (i = 0; i + 16 <= length; i += 16) {
+		__m128i values;
+		unsigned int valid = _mm_movemask_epi8(hex_classify_ssse3(_mm_loadu_si128((const __m128i*)(hex + i)), &values));
+		if (valid != 0xffff) {
+			return i + __builtin_ctz(~valid);
+		}
+	}
+	return i;
+}
+
+__attribute__((target("avx2")))
+static __m256i hex_classify_avx2(__m256i v, __m256i* values) {
+	__m256i digit = _mm256_sub_epi8(v, _mm256_set1_epi8('0'));
+	__m256i letter = _mm256_sub_epi8(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+	__m256i is_digit = _mm256_cmpeq_epi8(_mm256_min_epu8(digit, _mm256_set1_epi8(9)), digit);
+	__m256i is_letter = _mm256_cmpeq_epi8(_mm256_min_epu8(letter, _mm256_set1_epi8(5)), letter);
+
+	*values = _mm256_or_si256(_mm256_and_si256(is_digit, digit), _mm256_and_si256(is_letter, _mm256_add_epi8(letter, _mm256_set1_epi8(10))));
+	return _mm256_or_si256(is_digit, is_letter);
+}
+
+__attribute__((target("avx2")))
+static size_t hex_encode_avx2(char* out, const unsigned char* data, size_t size) {
+	const __m256i table = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)hex_digits));
+	const __m256i mask = _mm256_set1_epi8(0x0f);
+	size_t i = 0;
+
+	for (i = 0; i + 32 <= size; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i*)(data + i));
+		__m256i hi = _mm256_shuffle_epi8(table, _mm256_and_si256(_mm256_srli_epi16(v, 4), mask));
+		__m256i lo = _mm256_shuffle_epi8(table, _mm256_and_si256(v, mask));
+		/* the unpacks work per 128 bit lane, put the lanes back in order */
+		__m256i a = _mm256_unpacklo_epi8(hi, lo);
+		__m256i b = _mm256_unpackhi_epi8(hi, lo);
+		_mm256_storeu_si256((__m256i*)(out + 2*i), _mm256_permute2x128_si256(a, b, 0x20));
+		_mm256_storeu_si256((__m256i*)(out + 2*i + 32), _mm256_permute2x128_si256(a, b, 0x31));
+	}
+	return i + hex_encode_ssse3(out + 2*i, data + i, size - i);
+}
+
+__attribute__((target("avx2")))
+static size_t hex_decode_avx2(unsigned char* out, const char* hex, size_t size) {
+	const __m256i weights = _mm256_set1_epi16(0x0110);
+	size_t i = 0;
+
+	for (i = 0; i + 32 <= size; i += 32) {
+		__m256i v0, v1;
+		__m256i valid0 = hex_classify_avx2(_mm256_loadu_si256((const __m256i*)(hex + 2*i)), &v0);
+		__m256i valid1 = hex_classify_avx2(_mm256_loadu_si256((const __m256i*)(hex + 2*i + 32)), &v1);
+		if ((unsigned int)_mm256_movemask_epi8(_mm256_and_si256(valid0, valid1)) != 0xffffffff) {
+			break;
+		}
+		v0 = _mm256_maddubs_epi16(v0, weights);
+		v1 = _mm256_maddubs_epi16(v1, weights);
+		_mm256_storeu_si256((__m256i*)(out + i), _mm256_permute4x64_epi64(_mm256_packus_epi16(v0, v1), 0xd8));
+	}
+	return i + hex_decode_ssse3(out + i, hex + 2*i, size - i);
+}
+
+__attribute__((target("avx2")))
+static size_t hex_span_avx2(const char* hex, size_t length) {
+	size_t i = 0;
+
+	for (i = 0; i + 32 <= length; i += 32) {
+		__m256i values;
+		unsigned int valid = _mm256_movemask_epi8(hex_classify_avx2(_mm256_loadu_si256((const __m256i*)(hex + i)), &values));
+		if (valid != 0xffffffff) {
+			return i + __builtin_ctz(~valid);
+		}
+	}
+	return i + hex_span_ssse3(hex + i, length - i);
+}
+#endif
+
+static void hex_impl_init(void) {
+#ifdef HEX_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		hex_impl.encode = hex_encode_avx2;
+		hex_impl.decode = hex_decode_avx2;
+		hex_impl.span = hex_span_avx2;
+	} else if (__builtin_cpu_supports("ssse3")) {
+		hex_impl.encode = hex_encode_ssse3;
+		hex_impl.decode = hex_decode_ssse3;
+		hex_impl.span = hex_span_ssse3;
+	}
+#endif
+}
+
+void hex_encode(char* out, const unsigned char* data, size_t size) {
+	size_t i = 0;
+
+	pthread_once(&hex_impl_once, hex_impl_init);
+	for (i = hex_impl.encode(out, data, size); i < size; i++) {
+		out[2*i] = hex_digits[data[i] >> 4];
+		out[2*i + 1] = hex_digits[data[i] & 0x0f];
+	}
+	out[2*size] = '\0';
+}
+
+int hex_decode(unsigned char* out, const char* hex, size_t length) {
+	size_t size = length / 2;
+	size_t i = 0;
+
+	if (length % 2) {
+		return -1;
+	}
+
+	pthread_once(&hex_impl_once, hex_impl_init);
+	/* the vector loop stops at the first block with an invalid character, the tables report it */
+	for (i = hex_impl.decode(out, hex, size); i < size; i++) {
+		int hi = hex_values[(unsigned char)hex[2*i]];
+		int lo = hex_values[(unsigned char)hex[2*i + 1]];
+		if (hi < 0 || lo < 0) {
+			return -1;
+		}
+		out[i] = (unsigned char)((hi << 4) | lo);
+	}
+	return 0;
+}
+
+size_t hex_span(const char* hex, size_t length) {
+	size_t i = 0;
+
+	pthread_once(&hex_impl_once, hex_impl_init);
+	for (i = hex_impl.span(hex, length); i < length; i++) {
+		if (hex_values[(unsigned char)hex[i]] < 0) {
+			break;
+		}
+	}
+	return i;
+}
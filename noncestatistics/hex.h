@@ -0,0 +1,26 @@
+/*
+ * hex.h
+ * Hex encoding and decoding shared by the collector and the analyzer
+ */
+
+#ifndef IDEVICERESTORE_HEX_H
+#define IDEVICERESTORE_HEX_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+/* writes 2*size lowercase hex digits and a terminating NUL to out */
+void hex_encode(char* out, const unsigned char* data, size_t size);
+/* decodes length hex digits of either case into length/2 bytes, -1 if length is odd or a character isn't a hex digit */
+int hex_decode(unsigned char* out, const char* hex, size_t length);
+/* returns how many of the first length characters of hex are hex digits before the first one that isn't */
+size_t hex_span(const char* hex, size_t length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
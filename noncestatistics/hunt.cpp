@@ -0,0 +1,106 @@
+#include "hunt.hpp"
+#include <iostream>
+#include <sstream>
+#include <cmath>
+#include <stdlib.h>
+#include <string.h>
+#include <plist/plist.h>
+#include "common.h"
+
+// The nonce a blob was signed for is the BNCH property of the IM4M manifest,
+// an IA5String tag followed by an OCTET STRING with the nonce.
+static bool findBNCH(const char* im4m, size_t size, std::string& nonce){
+    for (size_t i = 0; i + 6 <= size; i++) {
+        if (memcmp(im4m+i, "BNCH", 4)) continue;
+        size_t j = i + 4;
+        size_t len = (unsigned char)im4m[j+1];
+        if (im4m[j] != 0x04 || len >= 0x80 || j+2+len > size) continue;
+        nonce.assign(im4m+j+2, len);
+        return true;
+    }
+    return false;
+}
+
+bool HuntTargets::loadBlob(const char* data, size_t size){
+    plist_t blob = NULL;
+    if (size >= 8 && !memcmp(data, "bplist00", 8)) plist_from_bin(data, (uint32_t)size, &blob);
+    else plist_from_xml(data, (uint32_t)size, &blob);
+    if (!blob || plist_get_node_type(blob) != PLIST_DICT) {
+        if (blob) plist_free(blob);
+        return false;
+    }
+
+    bool found = false;
+    const char* keys[] = { "ApImg4Ticket", "ApNonce", NULL };
+    for (int i = 0; keys[i]; i++) {
+        plist_t node = plist_dict_get_item(blob, keys[i]);
+        if (!node || plist_get_node_type(node) != PLIST_DATA) continue;
+
+        char* value = NULL;
+        uint64_t length = 0;
+        plist_get_data_val(node, &value, &length);
+        std::string nonce;
+        if (i == 0 && findBNCH(value, length, nonce)) {
+            targets.insert(nonce);
+            found = true;
+        } else if (i == 1 && length) {
+            targets.insert(std::string(value, length));
+            found = true;
+        }
+        free(value);
+    }
+    plist_free(blob);
+    return found;
+}
+
+bool HuntTargets::loadText(const char* data, size_t size){
+    std::istringstream tokens(std::string(data, size));
+    std::string token;
+    size_t before = targets.size();
+
+    while (tokens >> token) {
+        std::string nonce;
+        bool isSep = false;
+        if (parseNonceToken(token, nonce, isSep) && !isSep) targets.insert(nonce);
+    }
+    return targets.size() > before;
+}
+
+bool HuntTargets::load(const char* filename){
+    char* data = NULL;
+    size_t size = 0;
+    if (read_file(filename, (void**)&data, &size) < 0) {
+        error("ERROR: Unable to read hunt targets from %s\n", filename);
+        return false;
+    }
+
+    bool isPlist = (size >= 8 && !memcmp(data, "bplist00", 8)) || (size >= 1 && data[0] == '<');
+    bool loaded = (isPlist) ? loadBlob(data, size) : loadText(data, size);
+    free(data);
+    if (!loaded) {
+        error("ERROR: No ApNonce found in %s\n", filename);
+    }
+    return loaded;
+}
+
+double HuntTargets::expectedCycles(const SpaceEstimator& estimator) const{
+    long n = estimator.samples();
+    if (n == 0) return INFINITY;
+
+    // targets seen before come back at their observed frequency. The rest
+    // share the mass of the unseen nonces, which Good-Turing puts at
+    // singletons/n, evenly over the nonces not seen yet.
+    double p = 0;
+    long unseenTargets = 0;
+    for (auto& target: targets) {
+        long k = estimator.count(target);
+        if (k) p += (double)k/n;
+        else unseenTargets++;
+    }
+    double space = estimator.estimate();
+    if (unseenTargets && std::isfinite(space)) {
+        double unseenNonces = std::max(space - estimator.distinct(), (double)unseenTargets);
+        p += unseenTargets * ((double)estimator.singletons()/n) / unseenNonces;
+    }
+    return (p > 0) ? 1/p : INFINITY;
+}
@@ -0,0 +1,25 @@
+#ifndef hunt_hpp
+#define hunt_hpp
+
+#include <string>
+#include <unordered_set>
+#include "stats.hpp"
+
+// The set of ApNonces a hunt waits for, kept as raw bytes.
+class HuntTargets {
+public:
+    // FILE is either a blob plist, whose IM4M names the nonce it was signed for,
+    // or a text file with one nonce per line like the collector writes them
+    bool load(const char* filename);
+    bool contains(const std::string& nonce) const { return targets.count(nonce) != 0; }
+    size_t size() const { return targets.size(); }
+    // expected number of further reboots until a target shows up, INFINITY if unknown
+    double expectedCycles(const SpaceEstimator& estimator) const;
+
+private:
+    bool loadBlob(const char* data, size_t size);
+    bool loadText(const char* data, size_t size);
+    std::unordered_set<std::string> targets;
+};
+
+#endif /* hunt_hpp */
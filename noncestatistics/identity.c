@@ -0,0 +1,199 @@
+/*
+ * identity.c
+ * On-disk cache of normal mode device identities keyed by UDID
+ *
+ * Finding the device with a given ECID in normal mode means asking lockdownd
+ * of every attached device for its UniqueChipID. The UDID never changes for
+ * a device, so the answer is cached in identity.plist and a lookup only has
+ * to check that the UDID is listed by usbmuxd. Unknown UDIDs are queried
+ * once and added; an entry that turns out to be wrong is removed and
+ * queried again the next time.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <plist/plist.h>
+
+#include "common.h"
+#include "identity.h"
+
+#define IDENTITY_CACHE_FILE "identity.plist"
+
+static char* identity_dir = NULL;
+static plist_t identity_cache = NULL;
+static pthread_mutex_t identity_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static char* identity_cache_path(void) {
+	const char* home = NULL;
+	char* path = NULL;
+
+	if (identity_dir) {
+		path = (char*)malloc(strlen(identity_dir) + strlen(IDENTITY_CACHE_FILE) + 2);
+		if (path) {
+			sprintf(path, "%s/%s", identity_dir, IDENTITY_CACHE_FILE);
+		}
+		return path;
+	}
+
+	home = getenv("HOME");
+	if (!home) {
+		return NULL;
+	}
+	identity_dir = (char*)malloc(strlen(home) + strlen("/.noncestatistics") + 1);
+	if (!identity_dir) {
+		return NULL;
+	}
+	sprintf(identity_dir, "%s/.noncestatistics", home);
+	return identity_cache_path();
+}
+
+/* must be called with identity_lock held */
+static void identity_cache_load(void) {
+	char* path = NULL;
+	char* data = NULL;
+	size_t size = 0;
+
+	if (identity_cache) {
+		return;
+	}
+
+	path = identity_cache_path();
+	if (path && access(path, R_OK) == 0 && read_file(path, (void**)&data, &size) == 0) {
+		plist_from_xml(data, (uint32_t)size, &identity_cache);
+		free(data);
+		if (identity_cache && plist_get_node_type(identity_cache) != PLIST_DICT) {
+			debug("Ignoring malformed identity cache %s\n", path);
+			plist_free(identity_cache);
+			identity_cache = NULL;
+		}
+	}
+	free(path);
+
+	if (!identity_cache) {
+		identity_cache = plist_new_dict();
+	}
+}
+
+/* must be called with identity_lock held */
+static void identity_cache_save(void) {
+	char* path = identity_cache_path();
+	char* tmp = NULL;
+	char* xml = NULL;
+	uint32_t size = 0;
+
+	if (!path) {
+		return;
+	}
+	if (mkdir(identity_dir, 0755) < 0 && errno != EEXIST) {
+		debug("Unable to create %s: %s\n", identity_dir, strerror(errno));
+		free(path);
+		return;
+	}
+
+	plist_to_xml(identity_cache, &xml, &size);
+	tmp = (char*)malloc(strlen(path) + 5);
+	if (xml && tmp) {
+		/* other instances may read the cache at the same time, so replace it atomically */
+		sprintf(tmp, "%s.tmp", path);
+		if (write_file(tmp, xml, size) == (int)size) {
+			rename(tmp, path);
+		}
+	}
+	free(tmp);
+	free(xml);
+	free(path);
+}
+
+static char* identity_get_string(plist_t dict, const char* key) {
+	plist_t node = plist_dict_get_item(dict, key);
+	char* value = NULL;
+	if (node && plist_get_node_type(node) == PLIST_STRING) {
+		plist_get_string_val(node, &value);
+	}
+	return value;
+}
+
+void identity_cache_set_dir(const char* dir) {
+	pthread_mutex_lock(&identity_lock);
+	free(identity_dir);
+	identity_dir = (dir) ? strdup(dir) : NULL;
+	if (identity_cache) {
+		plist_free(identity_cache);
+		identity_cache = NULL;
+	}
+	pthread_mutex_unlock(&identity_lock);
+}
+
+int identity_cache_get(const char* udid, struct identity_t* identity) {
+	plist_t entry = NULL;
+	plist_t node = NULL;
+
+	memset(identity, 0, sizeof(struct identity_t));
+
+	pthread_mutex_lock(&identity_lock);
+	identity_cache_load();
+	entry = plist_dict_get_item(identity_cache, udid);
+	node = (entry && plist_get_node_type(entry) == PLIST_DICT) ? plist_dict_get_item(entry, "UniqueChipID") : NULL;
+	if (!node || plist_get_node_type(node) != PLIST_UINT) {
+		pthread_mutex_unlock(&identity_lock);
+		return -1;
+	}
+	plist_get_uint_val(node, &identity->ecid);
+	identity->hardware_model = identity_get_string(entry, "HardwareModel");
+	identity->product_type = identity_get_string(entry, "ProductType");
+	identity->srnm = identity_get_string(entry, "SerialNumber");
+	pthread_mutex_unlock(&identity_lock);
+
+	return 0;
+}
+
+int identity_cache_put(const char* udid, plist_t lockdown_values) {
+	const char* keys[] = { "HardwareModel", "ProductType", "SerialNumber", NULL };
+	plist_t entry = NULL;
+	plist_t node = NULL;
+	int i = 0;
+
+	node = plist_dict_get_item(lockdown_values, "UniqueChipID");
+	if (!node || plist_get_node_type(node) != PLIST_UINT) {
+		return -1;
+	}
+
+	entry = plist_new_dict();
+	plist_dict_set_item(entry, "UniqueChipID", plist_copy(node));
+	for (i = 0; keys[i]; i++) {
+		node = plist_dict_get_item(lockdown_values, keys[i]);
+		if (node && plist_get_node_type(node) == PLIST_STRING) {
+			plist_dict_set_item(entry, keys[i], plist_copy(node));
+		}
+	}
+
+	pthread_mutex_lock(&identity_lock);
+	identity_cache_load();
+	plist_dict_set_item(identity_cache, udid, entry);
+	identity_cache_save();
+	pthread_mutex_unlock(&identity_lock);
+
+	return 0;
+}
+
+void identity_cache_remove(const char* udid) {
+	pthread_mutex_lock(&identity_lock);
+	identity_cache_load();
+	if (plist_dict_get_item(identity_cache, udid)) {
+		plist_dict_remove_item(identity_cache, udid);
+		identity_cache_save();
+	}
+	pthread_mutex_unlock(&identity_lock);
+}
+
+void identity_free(struct identity_t* identity) {
+	free(identity->hardware_model);
+	free(identity->product_type);
+	free(identity->srnm);
+	memset(identity, 0, sizeof(struct identity_t));
+}
@@ -0,0 +1,35 @@
+/*
+ * identity.h
+ * On-disk cache of normal mode device identities keyed by UDID
+ */
+
+#ifndef IDEVICERESTORE_IDENTITY_H
+#define IDEVICERESTORE_IDENTITY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <plist/plist.h>
+
+struct identity_t {
+	uint64_t ecid;
+	char* hardware_model;
+	char* product_type;
+	char* srnm;
+};
+
+/* directory holding identity.plist, NULL selects $HOME/.noncestatistics */
+void identity_cache_set_dir(const char* dir);
+int identity_cache_get(const char* udid, struct identity_t* identity);
+/* stores UniqueChipID, HardwareModel, ProductType and SerialNumber from lockdown values */
+int identity_cache_put(const char* udid, plist_t lockdown_values);
+void identity_cache_remove(const char* udid);
+void identity_free(struct identity_t* identity);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -38,6 +38,7 @@
 #include "common.h"
 #include "normal.h"
 #include "recovery.h"
+#include "discovery.h"
 #include "idevicerestore.h"
 
 struct idevicerestore_client_t* idevicerestore_client_new(void)
@@ -87,6 +88,7 @@ void idevicerestore_client_free(struct idevicerestore_client_t* client)
 	if (client->cache_dir) {
 		free(client->cache_dir);
 	}
+	discovery_free(client->discovery);
 	free(client);
 }
 
@@ -94,23 +96,38 @@ void idevicerestore_client_free(struct idevicerestore_client_t* client)
 int check_mode(struct idevicerestore_client_t* client) {
 	int mode = MODE_UNKNOWN;
 	int dfumode = MODE_UNKNOWN;
+	struct discovery_device_t* entry = NULL;
 
-	if (recovery_check_mode(client) == 0) {
-		mode = MODE_RECOVERY;
+	if (client->discovery == NULL) {
+		client->discovery = discovery_scan();
 	}
 
-	else if (dfu_check_mode(client, &dfumode) == 0) {
-		mode = dfumode;
+	if (client->discovery) {
+		entry = discovery_find(client->discovery, client->ecid);
 	}
 
-	else if (normal_check_mode(client) == 0) {
-		mode = MODE_NORMAL;
+	if (entry) {
+		mode = entry->mode;
+		if (entry->udid && !client->udid) {
+			client->udid = strdup(entry->udid);
+		}
+		if (entry->srnm && !client->srnm) {
+			client->srnm = strdup(entry->srnm);
+		}
+	} else {
+		/* the device enumerated after the scan settled or lockdown didn't answer, ask every mode directly */
+		if (recovery_check_mode(client) == 0) {
+			mode = MODE_RECOVERY;
+		} else if (dfu_check_mode(client, &dfumode) == 0) {
+			mode = dfumode;
+		} else if (normal_check_mode(client) == 0) {
+			mode = MODE_NORMAL;
+		}
+//		else if (restore_check_mode(client) == 0) {
+//			mode = MODE_RESTORE;
+//		}
 	}
 
-//	else if (restore_check_mode(client) == 0) {
-//		mode = MODE_RESTORE;
-//	}
-
 	if (mode == MODE_UNKNOWN) {
 		client->mode = NULL;
 	} else {
@@ -122,6 +139,12 @@ int check_mode(struct idevicerestore_client_t* client) {
 const char* check_hardware_model(struct idevicerestore_client_t* client) {
 	const char* hw_model = NULL;
 	int mode = MODE_UNKNOWN;
+	struct discovery_device_t* entry = discovery_find(client->discovery, client->ecid);
+
+	if (entry) {
+		client->device = entry->device;
+		return (entry->device) ? entry->device->hardware_model : NULL;
+	}
 
 	if (client->mode) {
 		mode = client->mode->index;
@@ -153,6 +176,12 @@ const char* check_hardware_model(struct idevicerestore_client_t* client) {
 
 int get_ecid(struct idevicerestore_client_t* client, uint64_t* ecid) {
 	int mode = MODE_UNKNOWN;
+	struct discovery_device_t* entry = discovery_find(client->discovery, client->ecid);
+
+	if (entry) {
+		*ecid = entry->ecid;
+		return 0;
+	}
 
 	if (client->mode) {
 		mode = client->mode->index;
@@ -3,8 +3,10 @@
 #include <iostream>
 #include <unistd.h>
 #include <getopt.h>
+#include <string.h>
 #include "idevicerestore.h"
 #include "recovery.h"
+#include "dfu.h"
 #include "common.h"
 #include "normal.h"
 #include <signal.h>
@@ -13,6 +15,21 @@
 #include <fstream>
 #include <unistd.h>
 #include "stats.hpp"
+#include "transport_sim.h"
+#include "transport_trace.h"
+#include "identity.h"
+#include "hex.h"
+#include "hunt.hpp"
+#include "watch.hpp"
+#include "control.h"
+#include "analyzer.hpp"
+#include "profile.hpp"
+#include "timeline.h"
+#include "fleet.h"
+#include <chrono>
+#include <cmath>
+#include <thread>
+#include <atomic>
 #include "all_noncestatistics.h"
 
 #define USEC_PER_SEC 1000000
@@ -22,6 +39,34 @@ static struct option longopts[] = {
     { "times",      required_argument,       NULL, 't'},
     { "abort",      no_argument,       NULL, 'a'},
     { "statistics", required_argument,       NULL, 's'},
+    { "simulate",   required_argument,       NULL, 'S'},
+    { "record",     required_argument,       NULL, 'r'},
+    { "replay",     required_argument,       NULL, 'R'},
+    { "fast",       no_argument,       NULL, 'f'},
+    { "wait",       required_argument,       NULL, 'w'},
+    { "mode",       required_argument,       NULL, 'm'},
+    { "cache",      required_argument,       NULL, 'C'},
+    { "stop",       required_argument,       NULL, 'p'},
+    { "hunt",       required_argument,       NULL, 'H'},
+    { "index-build", required_argument,      NULL, 'b'},
+    { "index-query", required_argument,      NULL, 'q'},
+    { "compare",    no_argument,       NULL, 'c'},
+    { "periodicity", required_argument,      NULL, 'P'},
+    { "generators", required_argument,       NULL, 'g'},
+    { "dict-build", required_argument,       NULL, 'G'},
+    { "dict",       required_argument,       NULL, 'D'},
+    { "snapshot",   required_argument,       NULL, 'z'},
+    { "merge",      required_argument,       NULL, 'M'},
+    { "sample",     required_argument,       NULL, 'n'},
+    { "analyze",    required_argument,       NULL, 'A'},
+    { "profile",    no_argument,       NULL, 'o'},
+    { "profile-json", required_argument,     NULL, 'O'},
+    { "watch",      required_argument,       NULL, 'W'},
+    { "control",    required_argument,       NULL, 'k'},
+    { "timeline",   required_argument,       NULL, 'T'},
+    { "fleet",      required_argument,       NULL, 'F'},
+    { "load",       no_argument,       NULL, 'l'},
+    { "debug",      no_argument,       NULL, 'd' },
     { "help",       no_argument,       NULL, 'h' },
     { NULL, 0, NULL, 0 }
 };
@@ -36,15 +81,68 @@ inline bool exist(const std::string& name)
 }
 
 void cmd_help(){
+    idevicerestore_log_flush();
     printf("Usage: noncestatistics [OPTIONS] FILE\n");
     printf("tool to get a lot of nonces from various iOS devices/versions\n\n");
     
 
     printf("  -h, --help             prints usage information\n");
+    printf("  -d, --debug            print debug output\n");
     printf("  -e, --ecid ECID        manually specify ECID of the device. Uses any device if not specified\n");
     printf("  -t, --times amount     speficy how many NONCES are collected. If not specified it will collect nonces until you enter ctrl+c\n");
     printf("  -a, --abort            resets device to normal mode\n");
-    printf("  -s, --statistics FILE  print statistics from nonce file\n");
+    printf("  -s, --statistics FILE  print statistics from nonce file or snapshot\n");
+    printf("  -A, --analyze LIST     with -s, run the comma separated list of analyzers, or all of them, in one pass over\n");
+    printf("                         nonce file and the further nonce files given as arguments (default collisions):\n");
+    for (auto& info: analyzerList()) printf("                             %-12s %s\n", info.name, info.description);
+    printf("  -o, --profile          with -s or -P, print the time, throughput and memory of every stage of the statistics\n");
+    printf("                         and the fill of their tables\n");
+    printf("  -O, --profile-json JSON  as --profile, and also write the profile to the file JSON (- for stdout)\n");
+    printf("  -n, --sample SPEC      with -s, estimate the nonce space from records drawn at random from the log instead\n");
+    printf("                         of reading all of it. SPEC is a sample size or a comma separated list of: size=N\n");
+    printf("                         (default 100000) time=SECONDS (default 10) confidence=P (default 0.95) seed=N\n");
+    printf("  -W, --watch FILE       keep the statistics of nonce file on screen and update them as nonces are added\n");
+    printf("  -D, --dict DICT        with -s, name the generator of every nonce found in the generator dictionary DICT\n");
+    printf("  -P, --periodicity FILE look for nonces that repeat after a fixed number of reboots in nonce file\n");
+    printf("  -S, --simulate SPEC    collect from simulated devices instead of real hardware. SPEC is a comma separated\n");
+    printf("                         list of: devices=N latency=MS jitter=MS nonce=random|fixed|cycle bits=N period=N\n");
+    printf("                         size=BYTES fail-open=P fail-info=P fail-command=P autoboot=BOOL ios-boot=MS\n");
+    printf("                         fail-autoboot=P mode=recovery|dfu dfu-latency=MS seed=N\n");
+    printf("  -l, --load             with -S, collect from all simulated devices at once, each on a thread of its own\n");
+    printf("                         and into FILE with its ECID added to the name. Not with -e, -r, -R or -F, the\n");
+    printf("                         fleet coordinates collector processes and --load runs all devices in one\n");
+    printf("  -r, --record TRACE     record every device interaction with timestamps to TRACE\n");
+    printf("  -R, --replay TRACE     replay a recorded TRACE instead of talking to a device\n");
+    printf("  -f, --fast             replay as fast as possible instead of at recorded speed\n");
+    printf("  -w, --wait MS          time to wait for the device to come back in recovery before checking whether\n");
+    printf("                         it booted into iOS by accident (default 30000)\n");
+    printf("  -m, --mode MODE        collect in recovery or dfu mode. auto (default) uses the mode the device is in\n");
+    printf("  -C, --cache DIR        directory of the device identity cache (default ~/.noncestatistics)\n");
+    printf("  -p, --stop SPEC        stop collecting as soon as the nonce space is known well enough. SPEC is a comma\n");
+    printf("                         separated list of: precision=P confidence=P (default 0.95) to stop once the\n");
+    printf("                         confidence interval is within +-P of the estimate, weak=N strong=N (default 4*weak)\n");
+    printf("                         alpha=P beta=P (default 0.01) to stop once a space of N nonces is accepted or rejected\n");
+    printf("  -k, --control PATH     serve metrics in the Prometheus text format and accept the commands pause, resume,\n");
+    printf("                         stop and target N on the Unix socket PATH while collecting\n");
+    printf("  -T, --timeline FILE    append what the collector does to FILE in the Chrome trace event format, one track\n");
+    printf("                         per device. Collectors of several devices can share FILE\n");
+    printf("  -F, --fleet SPEC       share the directory of SPEC with the collectors of the other devices of a rig:\n");
+    printf("                         take turns resetting per USB controller, fastest reconnect first, and split the\n");
+    printf("                         sum of the targets by nonce rate. SPEC is a directory or a comma separated list of\n");
+    printf("                         dir=PATH resets=N (devices resetting at once per controller, default 1)\n");
+    printf("  -H, --hunt FILE        reboot until an ApNonce from FILE shows up and leave the device there. FILE is a\n");
+    printf("                         blob plist or a list of nonces, can be given more than once\n");
+    printf("  -b, --index-build INDEX  compact the nonce files given as arguments into the nonce index INDEX\n");
+    printf("  -q, --index-query INDEX  look up the nonces given as arguments in the nonce index INDEX\n");
+    printf("  -z, --snapshot SNAP    count the nonce files given as arguments into the snapshot SNAP\n");
+    printf("  -M, --merge SNAP       merge the snapshots given as arguments into the snapshot SNAP\n");
+    printf("  -c, --compare          compare the nonce files given as arguments: common nonces, differences and\n");
+    printf("                         Jaccard similarity of every pair\n");
+    printf("  -g, --generators SPEC  look for the generators of the nonces in the files given as arguments. SPEC is a\n");
+    printf("                         comma separated list of: known repeat8 repeat16 repeat32 low=BITS range=FROM-TO\n");
+    printf("                         hash=sha1|sha384|auto threads=N (default known,repeat8,repeat16,low=24)\n");
+    printf("  -G, --dict-build DICT  write the nonces of the generators of SPEC given as argument to the generator\n");
+    printf("                         dictionary DICT, SPEC as for -g (default known,repeat8,repeat16)\n");
     printf("  FILE                   File to write nonces to\n");
     printf("\n");
     printf("Examples:\n\n");
@@ -52,41 +150,74 @@ void cmd_help(){
     printf("\tnoncestatistics -t 500 nonces.txt\n\n");
     printf("Do statistics on the nonces collected in nonces.txt\n");
     printf("\tnoncestatistics -s nonces.txt\n\n");
+    printf("Look for collisions, per device differences, bit bias and periods in the logs of two devices in one read:\n");
+    printf("\tnoncestatistics -s device1.txt device2.txt -A all\n\n");
+    printf("Find out which stage of the statistics of a huge log takes the time:\n");
+    printf("\tnoncestatistics -s huge.txt -O profile.json\n\n");
+    printf("Estimate the nonce space of a huge log from 20000 of its nonces or 5 seconds of sampling:\n");
+    printf("\tnoncestatistics -s huge.txt -n size=20000,time=5\n\n");
+    printf("Watch the collisions of a running collection from another terminal:\n");
+    printf("\tnoncestatistics -W nonces.txt\n\n");
+    printf("Collect 1000 nonces from a simulated device with a 16 bit nonce space and 200ms reboots:\n");
+    printf("\tnoncestatistics -S nonce=random,bits=16,latency=200 -t 1000 sim.txt\n\n");
+    printf("Load test the collector with 1000 simulated devices collecting 100 nonces each:\n");
+    printf("\tnoncestatistics -S devices=1000,latency=200,jitter=50 -l -t 100 sim.txt\n\n");
+    printf("Record a session and replay it later without hardware:\n");
+    printf("\tnoncestatistics -r session.trace -t 500 nonces.txt\n");
+    printf("\tnoncestatistics -R session.trace -f replayed.txt\n\n");
+    printf("Collect 500 nonces from a device that is in DFU mode:\n");
+    printf("\tnoncestatistics -m dfu -t 500 dfu.txt\n\n");
+    printf("Collect until the nonce space is known within 10%% or is shown to be smaller or larger than 2^20:\n");
+    printf("\tnoncestatistics -p precision=0.1,weak=1048576 nonces.txt\n\n");
+    printf("Collect with a control socket, then look at the metrics and stop after 1000 nonces:\n");
+    printf("\tnoncestatistics -k /tmp/nonces.sock nonces.txt\n");
+    printf("\tcurl --unix-socket /tmp/nonces.sock http://localhost/metrics\n");
+    printf("\techo target 1000 | nc -U /tmp/nonces.sock\n\n");
+    printf("Collect from two devices into one timeline and open it in chrome://tracing or ui.perfetto.dev:\n");
+    printf("\tnoncestatistics -e 0x1234567890 -T rig.json device1.txt &\n");
+    printf("\tnoncestatistics -e 0x0987654321 -T rig.json device2.txt\n\n");
+    printf("Collect 2000 nonces with a rig of two devices, resetting two devices per USB controller at a time:\n");
+    printf("\tnoncestatistics -e 0x1234567890 -F /tmp/rig,resets=2 -t 1000 device1.txt &\n");
+    printf("\tnoncestatistics -e 0x0987654321 -F /tmp/rig,resets=2 -t 1000 device2.txt\n\n");
+    printf("Reboot until the device has the nonce one of the saved blobs was signed for:\n");
+    printf("\tnoncestatistics -H blob1.shsh2 -H blob2.shsh2 nonces.txt\n\n");
+    printf("Index all collected nonces and check whether a nonce was ever seen:\n");
+    printf("\tnoncestatistics -b nonces.idx logs/*.txt\n");
+    printf("\tnoncestatistics -q nonces.idx 0123456789abcdef0123456789abcdef01234567\n\n");
+    printf("Count the logs of two hosts into snapshots, merge them and do statistics on everything:\n");
+    printf("\tnoncestatistics -z host1.snap host1/*.txt\n");
+    printf("\tnoncestatistics -M all.snap host1.snap host2.snap\n");
+    printf("\tnoncestatistics -s all.snap\n\n");
+    printf("Check whether two devices ever produced the same nonces:\n");
+    printf("\tnoncestatistics -c device1.txt device2.txt\n\n");
+    printf("Check whether the collected nonces come from well known or low entropy generators:\n");
+    printf("\tnoncestatistics -g known,repeat16,low=32 nonces.txt\n\n");
+    printf("Build a dictionary of well known and low entropy generators once and name them in the statistics:\n");
+    printf("\tnoncestatistics -G generators.dict known,repeat8,repeat16,low=24\n");
+    printf("\tnoncestatistics -s nonces.txt -D generators.dict\n\n");
     
 }
 
 int64_t parseECID(const char *ecid){
-    const char *ecidBK = ecid;
-    int isHex = 0;
-    int64_t ret = 0;
+    size_t len = strlen(ecid);
     
-    while (*ecid && !isHex) {
-        char c = *(ecid++);
-        if (c >= '0' && c<='9') {
-            ret *=10;
-            ret += c - '0';
-        }else{
-            isHex = 1;
-            ret = 0;
-        }
-    }
+    if (len && strspn(ecid, "0123456789") == len) return strtoll(ecid, NULL, 10);
     
-    if (isHex) {
-        while (*ecidBK) {
-            char c = *(ecidBK++);
-            ret *=16;
-            if (c >= '0' && c<='9') {
-                ret += c - '0';
-            }else if (c >= 'a' && c <= 'f'){
-                ret += 10 + c - 'a';
-            }else if (c >= 'A' && c <= 'F'){
-                ret += 10 + c - 'A';
-            }else{
-                return 0; //ERROR parsing failed
-            }
-        }
+    if (len > 2 && ecid[0] == '0' && (ecid[1] == 'x' || ecid[1] == 'X')) {
+        ecid += 2;
+        len -= 2;
     }
+    if (len == 0 || len > 16 || hex_span(ecid, len) != len) return 0; //ERROR parsing failed
     
+    // left pad to a whole 64 bit big endian number
+    char padded[16];
+    unsigned char bytes[8];
+    memset(padded, '0', sizeof(padded));
+    memcpy(padded + sizeof(padded) - len, ecid, len);
+    hex_decode(bytes, padded, sizeof(padded));
+    
+    int64_t ret = 0;
+    for (int i = 0; i < 8; i++) ret = (ret << 8) | bytes[i];
     return ret;
 }
 
@@ -94,26 +225,368 @@ struct idevicerestore_client_t* client;
 FILE *fp;
 static int running = 1;
 
+static unsigned int reconnectTimeout = 30000;
+// per thread, --load collects from every simulated device on a thread of its own
+static thread_local unsigned int fullBoots = 0;
+static thread_local double fullBootSeconds = 0;
+static bool dfuMode = false;
+static StopRule stopRule;
+static bool useStopRule = false;
+static HuntTargets huntTargets;
+static thread_local int controlDevice = -1;
+
 static void cancelNonceCollection(int signo){
     printf("\nUser cancelled nonce collection\n");
-    if (running == 0) fclose(fp),exit(-1);
+    if (running == 0) {
+        if (fp) fclose(fp);
+        exit(-1);
+    }
     running = 0;
 }
 
+static int pinAutoboot(struct idevicerestore_client_t* client){
+    if (recovery_set_autoboot(client, false) < 0) return -1;
+    if (recovery_get_autoboot(client) != 0) {
+        error("ERROR: auto-boot is still enabled after setting it to false\n");
+        return -1;
+    }
+    return 0;
+}
+
+// Waits for the device to come back in recovery mode. If it doesn't show up in time it most likely
+// booted all the way into iOS, so it gets sent back to recovery and auto-boot is pinned off again.
+static int reconnectRecovery(struct idevicerestore_client_t* client, bool interruptible){
+    if (client->recovery && client->recovery->client) return 0;
+    
+    auto start = std::chrono::steady_clock::now();
+    while (running || !interruptible) {
+        if (recovery_client_new_with_timeout(client, reconnectTimeout) == 0) return 0;
+        if (transport_exhausted()) return -1;
+        control_reconnect_failed(controlDevice);
+        timeline_instant("retry", "{\"mode\":\"recovery\"}");
+        if (normal_check_mode(client) < 0) {
+            debug("Device is neither in recovery nor in normal mode, still waiting...\n");
+            continue;
+        }
+        info("Device booted into iOS instead of staying in recovery. Sending it back to recovery...\n");
+        if (normal_enter_recovery(client) < 0 || pinAutoboot(client) < 0) continue;
+        fullBoots++;
+        control_full_boot(controlDevice);
+        timeline_instant("full boot", NULL);
+        fullBootSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return 0;
+    }
+    return -1;
+}
+
+// DFU mode has no environment and no "reset" command. A USB reset makes the device
+// re-enumerate with a new nonce, so all there is to do is wait for it to show up again.
+static int reconnectDFU(struct idevicerestore_client_t* client, bool interruptible){
+    if (client->dfu && client->dfu->client) return 0;
+    
+    while (running || !interruptible) {
+        if (dfu_client_new_with_timeout(client, reconnectTimeout) == 0) return 0;
+        if (transport_exhausted()) return -1;
+        control_reconnect_failed(controlDevice);
+        timeline_instant("retry", "{\"mode\":\"dfu\"}");
+        debug("Device did not come back in DFU mode yet, still waiting...\n");
+    }
+    return -1;
+}
+
+static int reconnectDevice(struct idevicerestore_client_t* client, bool interruptible){
+    return (dfuMode) ? reconnectDFU(client, interruptible) : reconnectRecovery(client, interruptible);
+}
+
+static int getNonces(struct idevicerestore_client_t* client, unsigned char** nonce, int* nonce_size, unsigned char** sep_nonce, int* sep_nonce_size){
+    if (dfuMode) return dfu_get_nonces(client, nonce, nonce_size, sep_nonce, sep_nonce_size);
+    return recovery_get_nonces(client, nonce, nonce_size, sep_nonce, sep_nonce_size);
+}
+
+static void resetDevice(struct idevicerestore_client_t* client){
+    if (dfuMode) {
+        dfu_send_reset(client);
+        dfu_client_free(client);
+    }else{
+        recovery_send_reset(client);
+        recovery_client_free(client);
+    }
+}
+
+// one device of a collection, --load runs one per simulated device
+struct Collection {
+    struct idevicerestore_client_t* client = NULL;
+    FILE* fp = NULL;
+    unsigned int target = 0; // 0 collects until cancelled
+    unsigned int noncesCreated = 0;
+    bool huntFound = false;
+    // the control socket has one target, only the collector of a single device follows it
+    bool controlTarget = true;
+};
+
+// every line logged for a device starts with its ECID, as in the names of the --load logs
+static void tagLog(uint64_t ecid){
+    char tag[24];
+    snprintf(tag, sizeof(tag), "%016llx", (unsigned long long)ecid);
+    idevicerestore_log_set_tag(tag);
+}
+
+// reboots the device until the target, the stop rule or a hunted nonce is reached and prints how it went
+static void collectNonces(Collection& collection){
+    struct idevicerestore_client_t* client = collection.client;
+    FILE* fp = collection.fp;
+    unsigned int& target = collection.target;
+    unsigned int& noncesCreated = collection.noncesCreated;
+    SpaceEstimator estimator;
+    int stopReason = STOP_CONTINUE;
+    tagLog(client->ecid);
+    if (huntTargets.size()) info("Hunting for %zu ApNonce%s\n", huntTargets.size(), (huntTargets.size() == 1) ? "" : "s");
+    auto collectionStart = std::chrono::steady_clock::now();
+    for (unsigned int i=0; (target == 0 || i < target) && running; i++) {
+        unsigned char* nonce = NULL;
+        unsigned char* sep_nonce = NULL;
+        int nonce_size = 0;
+        int sep_nonce_size = 0;
+        
+        control_wait_while_paused(controlDevice, &running);
+        if (!running || control_stop_requested()) break;
+        auto cycleStart = std::chrono::steady_clock::now();
+        control_device_state(controlDevice, CONTROL_STATE_CONNECTING);
+        uint64_t spanStart = timeline_now();
+        if (reconnectDevice(client, true) < 0) break;
+        fleet_reset_release();
+        timeline_span("wait for device", spanStart, NULL);
+        control_device_state(controlDevice, CONTROL_STATE_READING);
+        spanStart = timeline_now();
+        // a device the backend has nothing more for ends its own collection, the others go on
+        bool exhausted = false;
+        while (running && getNonces(client, &nonce, &nonce_size, &sep_nonce, &sep_nonce_size)< 0) {
+            if ((exhausted = transport_exhausted())) break;
+            transport_usleep(100);
+        }
+        if (!nonce && (!running || exhausted)) break;
+        timeline_span("get info", spanStart, NULL);
+        std::vector<char> apHex(2*nonce_size+1);
+        std::vector<char> sepHex(2*sep_nonce_size+1);
+        hex_encode(apHex.data(), nonce, nonce_size);
+        hex_encode(sepHex.data(), sep_nonce, sep_nonce_size);
+        spanStart = timeline_now();
+        if (sep_nonce) {
+            // the SEP nonce goes on the same line so both nonces of a boot stay paired
+            info("%06u\tApNonce=%s SepNonce=%s\n", ++noncesCreated, apHex.data(), sepHex.data());
+            fprintf(fp, "%s %s\n", apHex.data(), sepHex.data());
+        } else {
+            info("%06u\tApNonce=%s\n", ++noncesCreated, apHex.data());
+            fprintf(fp, "%s\n", apHex.data());
+        }
+        if (i%10 == 0) fflush(fp);
+        timeline_span("write", spanStart, NULL);
+        unsigned int fleetTarget = fleet_update(noncesCreated, target);
+        if (fleetTarget != target) {
+            debug("The fleet moved the target from %u to %u nonces\n", target, fleetTarget);
+            target = fleetTarget;
+            control_set_target(target);
+        }
+        std::string rawNonce((const char*)nonce, nonce_size);
+        estimator.add(rawNonce);
+        control_nonce(controlDevice, estimator.count(rawNonce) > 1, estimator.distinct());
+        if (estimator.count(rawNonce) > 1) {
+            std::string args = "{\"nonce\":\"" + std::string(apHex.data()) + "\",\"count\":" + std::to_string(estimator.count(rawNonce)) + "}";
+            timeline_instant("collision", args.c_str());
+        }
+        free(nonce);
+        free(sep_nonce);
+        
+        // no reset here, the device has to keep the nonce the blob was signed for
+        if (huntTargets.contains(rawNonce)) {
+            info("Found target ApNonce %s after %u reboots, leaving the device with it\n", apHex.data(), noncesCreated);
+            collection.huntFound = true;
+            break;
+        }
+        if (huntTargets.size() && noncesCreated % 50 == 0) {
+            double cycles = huntTargets.expectedCycles(estimator);
+            if (std::isfinite(cycles)) info("Expecting a target ApNonce in about %.0f more reboots\n", cycles);
+            else info("No estimate of the remaining reboots yet, there are no repeated nonces\n");
+        }
+        if (!running || control_stop_requested()) break;
+        if (useStopRule && (stopReason = estimator.check(stopRule)) != STOP_CONTINUE) break;
+        control_device_state(controlDevice, CONTROL_STATE_RESETTING);
+        spanStart = timeline_now();
+        if (fleet_reset_acquire(&running) < 0) break;
+        timeline_span("reset slot", spanStart, NULL);
+        spanStart = timeline_now();
+        resetDevice(client);
+        // a DFU device drops off the bus right away, there is no need to give it time to shut down
+        if (!dfuMode) transport_usleep(USEC_PER_SEC*0.5);
+        timeline_span("reset", spanStart, NULL);
+        control_cycle_done(controlDevice, std::chrono::duration<double>(std::chrono::steady_clock::now() - cycleStart).count());
+        if (collection.controlTarget && control_take_target(&target)) {
+            info("Target changed to %u nonces\n", target);
+            fleet_set_target(target);
+        }
+    }
+    control_device_state(controlDevice, CONTROL_STATE_DONE);
+    fleet_stop(noncesCreated);
+    if (control_stop_requested()) info("Stopped on request of a control client\n");
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - collectionStart).count();
+    info("Collected %u nonces in %s mode in %.3f seconds (%.2f nonces/s)\n", noncesCreated, (dfuMode) ? "DFU" : "recovery", elapsed, (elapsed > 0) ? noncesCreated/elapsed : 0);
+    if (fullBoots) info("Recovered from %u accidental iOS boots, losing %.1f seconds\n", fullBoots, fullBootSeconds);
+    if (huntTargets.size() && !collection.huntFound) {
+        double cycles = huntTargets.expectedCycles(estimator);
+        if (std::isfinite(cycles)) info("No target ApNonce found, expecting one in about %.0f more reboots\n", cycles);
+        else info("No target ApNonce found\n");
+    }
+    if (useStopRule) {
+        info("%s\n", estimateSummary(estimator, stopRule.confidence).c_str());
+        switch (stopReason) {
+            case STOP_PRECISION:
+                info("Stopped early: the estimate reached a precision of %.1f%%\n", 100*stopRule.precision);
+                break;
+            case STOP_WEAK:
+                info("Stopped early: the nonce space is about %.0f or smaller (weak)\n", stopRule.weak);
+                break;
+            case STOP_STRONG:
+                info("Stopped early: the nonce space is about %.0f or larger (strong)\n", stopRule.strong);
+                break;
+            default:
+                info("The stop rule was not met\n");
+                break;
+        }
+    }
+}
+
+// leaves the device with auto-boot on again, booting into iOS
+static void releaseDevice(struct idevicerestore_client_t* client){
+    if (client->mode->index == MODE_DFU) {
+        info("Device is in DFU mode, leaving it there\n");
+    }else if (reconnectRecovery(client, false) == 0) {
+        info("Resetting autoboot...\n");
+        recovery_set_autoboot(client, true);
+        recovery_send_reset(client);
+    }
+}
+
+// nonces.txt becomes nonces-0005100000000001.txt
+static std::string deviceFilename(const char* filename, uint64_t ecid){
+    std::string name(filename);
+    size_t slash = name.find_last_of('/');
+    size_t dot = name.find_last_of('.');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) dot = name.size();
+    char suffix[24];
+    snprintf(suffix, sizeof(suffix), "-%016llx", (unsigned long long)ecid);
+    return name.insert(dot, suffix);
+}
+
+// runs the collector of a single device for every simulated device at once. Each one has a thread and
+// with it a clock of its own, so the whole reboot pipeline is exercised without waiting for latencies.
+static int collectLoad(unsigned int devices, const char* filename, unsigned int target, bool control){
+    std::vector<std::thread> threads;
+    std::atomic<unsigned int> nonces(0);
+    std::atomic<unsigned int> failed(0);
+    auto start = std::chrono::steady_clock::now();
+
+    signal(SIGINT, cancelNonceCollection);
+    for (unsigned int i = 0; i < devices; i++) {
+        threads.emplace_back([&, i]{
+            struct idevicerestore_client_t* client = idevicerestore_client_new();
+            client->ecid = SIM_ECID_BASE + i;
+            tagLog(client->ecid);
+            if (check_mode(client) < 0 || !client->mode || check_hardware_model(client) == NULL || client->device == NULL) {
+                error("ERROR: Unable to discover simulated device 0x%llx\n", (unsigned long long)client->ecid);
+                idevicerestore_client_free(client);
+                failed++;
+                return;
+            }
+            std::string name = deviceFilename(filename, client->ecid);
+            Collection collection;
+            collection.client = client;
+            collection.target = target;
+            collection.controlTarget = false;
+            collection.fp = fopen(name.c_str(), "a");
+            if (!collection.fp) {
+                error("ERROR: Unable to open %s\n", name.c_str());
+                idevicerestore_client_free(client);
+                failed++;
+                return;
+            }
+            fprintf(collection.fp, "Identified device as %s, %s \n", client->device->hardware_model, client->device->product_type);
+            if (!dfuMode && (recovery_client_new(client) < 0 || pinAutoboot(client) < 0)) {
+                error("ERROR: Unable to disable auto-boot of simulated device 0x%llx\n", (unsigned long long)client->ecid);
+                failed++;
+            } else {
+                if (control) controlDevice = control_device_add(client->ecid, client->device->product_type);
+                timeline_track(client->ecid, client->device->product_type);
+                collectNonces(collection);
+                nonces += collection.noncesCreated;
+                recovery_client_free(client);
+                dfu_client_free(client);
+                if (!collection.huntFound) releaseDevice(client);
+            }
+            recovery_client_free(client);
+            dfu_client_free(client);
+            fclose(collection.fp);
+            idevicerestore_client_free(client);
+        });
+    }
+    for (auto& thread: threads) thread.join();
+
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    info("Collected %u nonces from %u simulated devices in %.3f seconds (%.2f nonces/s)\n", nonces.load(), devices - failed.load(),
+         elapsed, (elapsed > 0) ? nonces/elapsed : 0);
+    return (failed) ? -1 : 0;
+}
+
+// prints the --profile of a statistics command and writes it as JSON if asked to
+static int finishProfile(int result, const char* jsonFilename){
+    if (!statsProfile) return result;
+    statsProfile->print();
+    if (jsonFilename && !statsProfile->writeJson(jsonFilename)) result = -1;
+    delete statsProfile;
+    statsProfile = NULL;
+    return result;
+}
+
 int main(int argc, const char * argv[]) {
     printf("Version: " VERSION_COMMIT_SHA_NONCESTATISTICS" - " VERSION_COMMIT_COUNT_NONCESTATISTICS"\n");
 
     char* statFilename = 0;
+    char* watchFilename = 0;
+    SampleSpec sample;
+    bool useSample = false;
+    std::vector<const AnalyzerInfo*> analyzers;
+    bool profile = false;
+    const char* profileJson = 0;
+    char* controlPath = 0;
+    char* timelineFilename = 0;
+    char* fleetSpec = 0;
+    bool load = false;
+    char* periodFilename = 0;
+    char* generatorSpec = 0;
+    char* dictBuildFilename = 0;
+    char* dictFilename = 0;
+    char* snapshotFilename = 0;
+    char* mergeFilename = 0;
+    char* indexBuildFilename = 0;
+    char* indexQueryFilename = 0;
+    char* simSpec = 0;
+    char* recordFilename = 0;
+    char* replayFilename = 0;
+    bool replayFast = false;
     bool only_abort = false;
+    bool compare = false;
     char *ecid = 0;
+    const char *mode = "auto";
     int times = 0;
     int optindex = 0;
     int opt = 0;
-    while ((opt = getopt_long(argc, (char* const *)argv, "he:t:as:", longopts, &optindex)) > 0) {
+    while ((opt = getopt_long(argc, (char* const *)argv, "hde:t:as:S:r:R:fw:m:C:p:H:b:q:cP:g:G:D:z:M:W:k:n:A:oO:T:F:l", longopts, &optindex)) > 0) {
         switch (opt) {
             case 'h': // long option: "help"; can be called as short option
                 cmd_help();
                 return 0;
+            case 'd': // long option: "debug"; can be called as short option
+                idevicerestore_debug = 1;
+                break;
             case 'e': // long option: "ecid"; can be called as short option
                 ecid = optarg;
                 break;
@@ -126,23 +599,231 @@ int main(int argc, const char * argv[]) {
             case 's': // long option: "statistics"; can be called ad short option
                 statFilename = optarg;
                 break;
+            case 'n': // long option: "sample"; can be called as short option
+                if (!parseSampleSpec(optarg, sample)) {
+                    cmd_help();
+                    return -1;
+                }
+                useSample = true;
+                break;
+            case 'A': // long option: "analyze"; can be called as short option
+                if (!parseAnalyzers(optarg, analyzers)) {
+                    cmd_help();
+                    return -1;
+                }
+                break;
+            case 'o': // long option: "profile"; can be called as short option
+                profile = true;
+                break;
+            case 'O': // long option: "profile-json"; can be called as short option
+                profile = true;
+                profileJson = optarg;
+                break;
+            case 'W': // long option: "watch"; can be called as short option
+                watchFilename = optarg;
+                break;
+            case 'S': // long option: "simulate"; can be called as short option
+                simSpec = optarg;
+                break;
+            case 'r': // long option: "record"; can be called as short option
+                recordFilename = optarg;
+                break;
+            case 'R': // long option: "replay"; can be called as short option
+                replayFilename = optarg;
+                break;
+            case 'f': // long option: "fast"; can be called as short option
+                replayFast = true;
+                break;
+            case 'w': // long option: "wait"; can be called as short option
+                reconnectTimeout = atoi(optarg);
+                break;
+            case 'm': // long option: "mode"; can be called as short option
+                mode = optarg;
+                break;
+            case 'C': // long option: "cache"; can be called as short option
+                identity_cache_set_dir(optarg);
+                break;
+            case 'p': // long option: "stop"; can be called as short option
+                if (!parseStopRule(optarg, stopRule)) {
+                    cmd_help();
+                    return -1;
+                }
+                useStopRule = true;
+                break;
+            case 'k': // long option: "control"; can be called as short option
+                controlPath = optarg;
+                break;
+            case 'T': // long option: "timeline"; can be called as short option
+                timelineFilename = optarg;
+                break;
+            case 'F': // long option: "fleet"; can be called as short option
+                fleetSpec = optarg;
+                break;
+            case 'l': // long option: "load"; can be called as short option
+                load = true;
+                break;
+            case 'H': // long option: "hunt"; can be called as short option
+                if (!huntTargets.load(optarg)) return -1;
+                break;
+            case 'b': // long option: "index-build"; can be called as short option
+                indexBuildFilename = optarg;
+                break;
+            case 'q': // long option: "index-query"; can be called as short option
+                indexQueryFilename = optarg;
+                break;
+            case 'c': // long option: "compare"; can be called as short option
+                compare = true;
+                break;
+            case 'P': // long option: "periodicity"; can be called as short option
+                periodFilename = optarg;
+                break;
+            case 'g': // long option: "generators"; can be called as short option
+                generatorSpec = optarg;
+                break;
+            case 'G': // long option: "dict-build"; can be called as short option
+                dictBuildFilename = optarg;
+                break;
+            case 'D': // long option: "dict"; can be called as short option
+                dictFilename = optarg;
+                break;
+            case 'z': // long option: "snapshot"; can be called as short option
+                snapshotFilename = optarg;
+                break;
+            case 'M': // long option: "merge"; can be called as short option
+                mergeFilename = optarg;
+                break;
             default:
                 cmd_help();
                 return -1;
         }
     }
+    if (strcmp(mode, "auto") && strcmp(mode, "recovery") && strcmp(mode, "dfu")) {
+        std::cout << "Unknown mode " << mode << ", use recovery, dfu or auto!" << std::endl;
+        cmd_help();
+        return -1;
+    }
+    if (compare) {
+        if (argc - optind < 2) {
+            std::cout << "You must give at least two nonce files to compare!" << std::endl;
+            cmd_help();
+            return -1;
+        }
+        return (cmd_compare(std::vector<const char*>(argv+optind, argv+argc)) < 0) ? -1 : 0;
+    }
+    if (generatorSpec) {
+        if (argc - optind < 1) {
+            std::cout << "You must give the nonce files to search generators for as arguments!" << std::endl;
+            cmd_help();
+            return -1;
+        }
+        return (cmd_generator_search(generatorSpec, std::vector<const char*>(argv+optind, argv+argc)) < 0) ? -1 : 0;
+    }
+    if (snapshotFilename || mergeFilename) {
+        std::vector<const char*> arguments(argv+optind, argv+argc);
+        if (arguments.empty()) {
+            std::cout << "You must give the " << ((snapshotFilename) ? "nonce files to count" : "snapshots to merge") << " as arguments!" << std::endl;
+            cmd_help();
+            return -1;
+        }
+        return ((snapshotFilename) ? cmd_snapshot(snapshotFilename, arguments) : cmd_merge(mergeFilename, arguments)) < 0 ? -1 : 0;
+    }
+    if (dictBuildFilename) {
+        if (argc - optind > 1) {
+            std::cout << "You must give at most one generator SPEC as argument!" << std::endl;
+            cmd_help();
+            return -1;
+        }
+        return (cmd_dict_build(dictBuildFilename, (argc > optind) ? argv[optind] : "known,repeat8,repeat16") < 0) ? -1 : 0;
+    }
+    if (indexBuildFilename || indexQueryFilename) {
+        std::vector<const char*> arguments(argv+optind, argv+argc);
+        if (arguments.empty()) {
+            std::cout << "You must give the " << ((indexBuildFilename) ? "nonce files to index" : "nonces to look up") << " as arguments!" << std::endl;
+            cmd_help();
+            return -1;
+        }
+        return (indexBuildFilename) ? cmd_index_build(indexBuildFilename, arguments) : cmd_index_query(indexQueryFilename, arguments);
+    }
+    if (periodFilename) {
+        if (!exist(std::string(periodFilename))) {
+            std::cout << "You must specify a valid filename as argument next to -P or --periodicity!" << std::endl;
+            cmd_help();
+            return -1;
+        }
+        if (profile) statsProfile = new Profile();
+        cmd_periodicity(periodFilename);
+        return finishProfile(0, profileJson);
+    }
+    if (watchFilename) {
+        // the log doesn't have to exist yet, watching can start before the collection
+        return (cmd_watch(watchFilename) < 0) ? -1 : 0;
+    }
     if (statFilename) {
         if (!exist(std::string(statFilename))) {
             std::cout << "You must specify a valid filename as argument next to -s or --statistics!" << std::endl;
             cmd_help();
             return -1;
         }
-        cmd_statistics(statFilename);
-        return 0;
+        if (useSample) {
+            if (snapshot_detect(statFilename)) {
+                std::cout << "A snapshot holds the counts already, use -s without -n or --sample!" << std::endl;
+                return -1;
+            }
+            return (cmd_sample(statFilename, sample) < 0) ? -1 : 0;
+        }
+        if (!analyzers.empty()) {
+            if (snapshot_detect(statFilename)) {
+                std::cout << "A snapshot only holds the counts of the nonces, the analyzers need nonce files!" << std::endl;
+                return -1;
+            }
+            std::vector<const char*> logs(1, statFilename);
+            logs.insert(logs.end(), argv+optind, argv+argc);
+            if (profile) statsProfile = new Profile();
+            return finishProfile((runAnalyzers(logs, analyzers, dictFilename) < 0) ? -1 : 0, profileJson);
+        }
+        if (profile) statsProfile = new Profile();
+        cmd_statistics(statFilename, dictFilename);
+        return finishProfile(0, profileJson);
     }
     
-    client = idevicerestore_client_new();
+    if (load && (!simSpec || ecid || fleetSpec || recordFilename || replayFilename)) {
+        std::cout << "--load needs -S and drives all simulated devices, it doesn't go with -e, -F, -r or -R!" << std::endl;
+        cmd_help();
+        return -1;
+    }
+    struct transport_sim_config_t simConfig;
+    if (simSpec) {
+        if (transport_sim_parse_config(simSpec, &simConfig) < 0 || transport_sim_configure(&simConfig) < 0) {
+            cmd_help();
+            return -1;
+        }
+        transport_set_backend(&transport_sim_backend);
+    }
+    if (replayFilename && transport_trace_replay_start(replayFilename, !replayFast) < 0) {
+        return -1;
+    }
+    if (recordFilename && transport_trace_record_start(recordFilename) < 0) {
+        return -1;
+    }
+    if (timelineFilename && timeline_start(timelineFilename) < 0) {
+        return -1;
+    }
+    if (load) {
+        dfuMode = simConfig.dfu;
+        if ((dfuMode && !strcmp(mode, "recovery")) || (!dfuMode && !strcmp(mode, "dfu"))) {
+            error("ERROR: The simulated devices are in %s mode\n", (dfuMode) ? "DFU" : "recovery");
+            return -1;
+        }
+        if (controlPath && control_start(controlPath) < 0) return -1;
+        int result = collectLoad(simConfig.devices, argv[argc-1], times, controlPath != NULL);
+        control_stop();
+        timeline_stop();
+        return result;
+    }
     
+    client = idevicerestore_client_new();
+    // with an ECID given, discovery picks that device out of everything that is attached
+    if (ecid) client->ecid = parseECID(ecid);
 
     if (check_mode(client) < 0 || client->mode->index == MODE_UNKNOWN ||
         (client->mode->index != MODE_DFU && client->mode->index != MODE_RECOVERY && client->mode->index != MODE_NORMAL)) {
@@ -161,14 +842,26 @@ int main(int argc, const char * argv[]) {
         
         switch (client->mode->index) {
             case MODE_NORMAL:
+                if (!strcmp(mode, "dfu")) {
+                    info("in normal mode... Please put the device in DFU mode yourself to collect in DFU mode!\n");
+                    return -1;
+                }
                 info("in normal mode... Trying to get in recovery...\n");
                 normal_enter_recovery(client);
                 break;
             case MODE_DFU:
-                info("in dfu mode... This mode is NOT supported!\n");
-                return -1;
+                if (!strcmp(mode, "recovery")) {
+                    info("in dfu mode... Can't get to recovery from here, use -m dfu or auto!\n");
+                    return -1;
+                }
+                info("in dfu mode... Collecting in DFU mode.\n");
+                dfuMode = true;
                 break;
             case MODE_RECOVERY:
+                if (!strcmp(mode, "dfu")) {
+                    info("in recovery mode... Please put the device in DFU mode yourself to collect in DFU mode!\n");
+                    return -1;
+                }
                 info("in recovery mode... This is correct.\n");
                 break;
                 
@@ -181,65 +874,66 @@ int main(int argc, const char * argv[]) {
         
         
         if (!ecid) {
-            std::cout << "No ECID was specified. Checking if any device is connected." <<std::endl;
+            info("No ECID was specified. Checking if any device is connected.\n");
             if(get_ecid(client, &client->ecid)<0){
-                std::cout << "It seems like no device is connected :(" <<std::endl;
+                info("It seems like no device is connected :(\n");
                 cmd_help();
                 return -1;
             }
-        }else{
-            client->ecid = parseECID(ecid);
         }
         
         
         
         
-        std::cout << "Getting nonce statistics for device with ECID: " << client->ecid << std::endl;
+        info("Getting nonce statistics for device with ECID: %llu\n", (unsigned long long)client->ecid);
         
         
         fp = fopen(filename, "a");
         fprintf(fp, "Identified device as %s, %s \n", client->device->hardware_model, client->device->product_type);
-        unsigned int noncesCreated = 0;
-        int increment = 1;
-        if (times==0) {
-            times++;
-            increment=0;
-        }
+        Collection collection;
+        collection.client = client;
+        collection.fp = fp;
+        collection.target = times;
         signal(SIGINT, cancelNonceCollection);
         
-        recovery_client_free(client);
-        for (int i=0; i<times && running; i+=increment) {
-            unsigned char* nonce = NULL;
-            int nonce_size = 0;
-            
-            while (running && recovery_get_ap_nonce(client, &nonce, &nonce_size)< 0) usleep(100);
-            printf("%06u\t",++noncesCreated);
-            info("ApNonce=");
-            for (int i = 0; i < nonce_size; i++) {
-                info("%02x", nonce[i]);
-                fprintf(fp, "%02x", nonce[i]);
-            }
-            fprintf(fp, "\n");
-            info("\n");
-            free(nonce);
-            
-            if (!running) break;
-            if (i%10 == 0) fflush(fp);
-            recovery_send_reset(client);
+        if (!dfuMode && (recovery_client_new(client) < 0 || pinAutoboot(client) < 0)) {
+            error("ERROR: Unable to disable auto-boot, refusing to collect nonces\n");
+            return -1;
+        }
+        
+        if (controlPath) {
+            if (control_start(controlPath) < 0) return -1;
+            controlDevice = control_device_add(client->ecid, client->device->product_type);
+            control_set_target(collection.target);
+        }
+        timeline_track(client->ecid, client->device->product_type);
+        if (fleetSpec && fleet_start(fleetSpec, client->ecid, collection.target) < 0) return -1;
+        
+        collectNonces(collection);
+        if (collection.huntFound) {
+            // saving the environment doesn't reboot, the nonce stays live
+            if (!dfuMode) recovery_set_autoboot(client, true);
             recovery_client_free(client);
-            usleep(USEC_PER_SEC*0.5);
+            dfu_client_free(client);
+            info("Done\n");
+            control_stop();
+            timeline_stop();
+            transport_trace_stop();
+            if (fp) fclose(fp);
+            return 0;
         }
-        std::cout << "Waiting for device to reboot..." << std::endl;
+        info("Waiting for device to reboot...\n");
         
         recovery_client_free(client);
+        dfu_client_free(client);
     }
-    while (recovery_client_new(client) <0);
-    std::cout << "Resetting autoboot..." << std::endl;
-    recovery_set_autoboot(client, true);
-    recovery_send_reset(client);
-    std::cout << "Done" << std::endl;
+    releaseDevice(client);
+    info("Done\n");
     
-    fclose(fp);
+    control_stop();
+    timeline_stop();
+    transport_trace_stop();
+    if (fp) fclose(fp);
     
     return 0;
 }
@@ -0,0 +1,320 @@
+/*
+ * nonce_index.c
+ * Sorted on-disk index of every nonce ever collected
+ *
+ * The index is built from collector logs and answers "was this nonce ever
+ * seen, how often and on which device model" without reading the logs again.
+ * It is one file that is mapped as a whole: a header, the device model names,
+ * a Bloom filter over the nonces and the entries sorted by nonce. A lookup
+ * checks the Bloom filter first, so most nonces that were never seen cost a
+ * few memory reads. Otherwise an interpolation search on the first 8 bytes of
+ * the nonce, which are close to uniform, finds the entries in a handful of
+ * probes; it falls back to binary search if the keys turn out to be skewed.
+ *
+ * The file uses the byte order of the host that built it and is rejected on
+ * a host with a different one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "common.h"
+#include "nonce_index.h"
+
+#define NONCE_INDEX_BYTE_ORDER     0x01020304
+#define NONCE_INDEX_BLOOM_BITS     10
+#define NONCE_INDEX_BLOOM_HASHES   7
+#define NONCE_INDEX_INTERPOLATIONS 8
+
+static uint64_t nonce_index_mix(uint64_t h) {
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+/* the two base hashes of the double hashing scheme */
+static void nonce_index_hash(const unsigned char* nonce, size_t size, uint64_t* h1, uint64_t* h2) {
+	uint64_t h = 0xcbf29ce484222325ULL;
+	size_t i;
+	for (i = 0; i < size; i++) {
+		h = (h ^ nonce[i]) * 0x100000001b3ULL;
+	}
+	*h1 = nonce_index_mix(h);
+	*h2 = nonce_index_mix(h ^ 0x9e3779b97f4a7c15ULL) | 1;
+}
+
+/* the first 8 bytes of a padded nonce as a big endian number, so keys sort like the nonces */
+static uint64_t nonce_index_key(const uint8_t* nonce) {
+	uint64_t key = 0;
+	int i;
+	for (i = 0; i < 8; i++) {
+		key = (key << 8) | nonce[i];
+	}
+	return key;
+}
+
+static int nonce_index_compare_nonce(const struct nonce_index_entry_t* entry, const uint8_t* nonce, uint8_t size) {
+	int result = memcmp(entry->nonce, nonce, NONCE_INDEX_NONCE_SIZE);
+	if (result == 0) {
+		result = (int)entry->nonce_size - (int)size;
+	}
+	return result;
+}
+
+static int nonce_index_compare_entries(const void* a, const void* b) {
+	const struct nonce_index_entry_t* x = (const struct nonce_index_entry_t*)a;
+	const struct nonce_index_entry_t* y = (const struct nonce_index_entry_t*)b;
+	int result = nonce_index_compare_nonce(x, y->nonce, y->nonce_size);
+	if (result == 0) {
+		result = (int)x->device - (int)y->device;
+	}
+	return result;
+}
+
+static uint64_t nonce_index_align(uint64_t offset) {
+	return (offset + 7) & ~7ULL;
+}
+
+int nonce_index_write(const char* filename, struct nonce_index_entry_t* entries, uint64_t count, const char (*devices)[NONCE_INDEX_DEVICE_SIZE], uint32_t device_count) {
+	struct nonce_index_header_t header;
+	uint8_t* bloom = NULL;
+	uint64_t merged = 0;
+	uint64_t i = 0;
+	char* tmp = NULL;
+	FILE* file = NULL;
+	int result = -1;
+
+	/* sort, then fold equal (nonce, device) pairs into one entry */
+	qsort(entries, count, sizeof(struct nonce_index_entry_t), nonce_index_compare_entries);
+	for (i = 0; i < count; i++) {
+		if (merged > 0 && nonce_index_compare_entries(&entries[merged - 1], &entries[i]) == 0) {
+			struct nonce_index_entry_t* entry = &entries[merged - 1];
+			entry->count = (entry->count > UINT32_MAX - entries[i].count) ? UINT32_MAX : entry->count + entries[i].count;
+			if (entries[i].first_seen < entry->first_seen) {
+				entry->first_seen = entries[i].first_seen;
+			}
+			continue;
+		}
+		entries[merged++] = entries[i];
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, NONCE_INDEX_MAGIC, sizeof(header.magic));
+	header.version = NONCE_INDEX_VERSION;
+	header.byte_order = NONCE_INDEX_BYTE_ORDER;
+	header.entry_count = merged;
+	header.bloom_bits = ((merged * NONCE_INDEX_BLOOM_BITS + 63) / 64) * 64;
+	if (header.bloom_bits == 0) {
+		header.bloom_bits = 64;
+	}
+	header.bloom_hashes = NONCE_INDEX_BLOOM_HASHES;
+	header.device_count = device_count;
+	header.devices_offset = nonce_index_align(sizeof(header));
+	header.bloom_offset = nonce_index_align(header.devices_offset + (uint64_t)device_count * NONCE_INDEX_DEVICE_SIZE);
+	header.entries_offset = nonce_index_align(header.bloom_offset + header.bloom_bits / 8);
+
+	bloom = (uint8_t*)calloc(1, header.bloom_bits / 8);
+	if (!bloom) {
+		error("ERROR: Out of memory\n");
+		return -1;
+	}
+	for (i = 0; i < merged; i++) {
+		uint64_t h1, h2;
+		uint32_t k;
+		nonce_index_hash(entries[i].nonce, entries[i].nonce_size, &h1, &h2);
+		for (k = 0; k < header.bloom_hashes; k++) {
+			uint64_t bit = (h1 + k * h2) % header.bloom_bits;
+			bloom[bit / 8] |= 1 << (bit % 8);
+		}
+	}
+
+	/* write next to the old index and replace it once complete, readers may have it mapped */
+	tmp = (char*)malloc(strlen(filename) + 5);
+	if (!tmp) {
+		free(bloom);
+		return -1;
+	}
+	sprintf(tmp, "%s.tmp", filename);
+	file = fopen(tmp, "wb");
+	if (!file) {
+		error("ERROR: Unable to open %s: %s\n", tmp, strerror(errno));
+		free(bloom);
+		free(tmp);
+		return -1;
+	}
+
+	if (fwrite(&header, sizeof(header), 1, file) == 1 &&
+	    fseek(file, (long)header.devices_offset, SEEK_SET) == 0 &&
+	    fwrite(devices, NONCE_INDEX_DEVICE_SIZE, device_count, file) == device_count &&
+	    fseek(file, (long)header.bloom_offset, SEEK_SET) == 0 &&
+	    fwrite(bloom, 1, header.bloom_bits / 8, file) == header.bloom_bits / 8 &&
+	    fseek(file, (long)header.entries_offset, SEEK_SET) == 0 &&
+	    fwrite(entries, sizeof(struct nonce_index_entry_t), merged, file) == merged) {
+		result = 0;
+	}
+	if (fclose(file) != 0) {
+		result = -1;
+	}
+	if (result == 0 && rename(tmp, filename) < 0) {
+		result = -1;
+	}
+	if (result < 0) {
+		error("ERROR: Unable to write index %s\n", filename);
+		unlink(tmp);
+	}
+
+	free(bloom);
+	free(tmp);
+	return result;
+}
+
+struct nonce_index_t* nonce_index_open(const char* filename) {
+	struct nonce_index_t* index = NULL;
+	const struct nonce_index_header_t* header = NULL;
+	struct stat st;
+	void* map = NULL;
+	int fd = -1;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		error("ERROR: Unable to open index %s: %s\n", filename, strerror(errno));
+		return NULL;
+	}
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(struct nonce_index_header_t)) {
+		error("ERROR: %s is not a nonce index\n", filename);
+		close(fd);
+		return NULL;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		error("ERROR: Unable to map index %s: %s\n", filename, strerror(errno));
+		return NULL;
+	}
+
+	header = (const struct nonce_index_header_t*)map;
+	if (memcmp(header->magic, NONCE_INDEX_MAGIC, sizeof(header->magic)) || header->version != NONCE_INDEX_VERSION) {
+		error("ERROR: %s is not a nonce index\n", filename);
+		munmap(map, st.st_size);
+		return NULL;
+	}
+	if (header->byte_order != NONCE_INDEX_BYTE_ORDER) {
+		error("ERROR: %s was built on a host with a different byte order\n", filename);
+		munmap(map, st.st_size);
+		return NULL;
+	}
+	if (header->bloom_bits == 0 || header->devices_offset + (uint64_t)header->device_count * NONCE_INDEX_DEVICE_SIZE > (uint64_t)st.st_size ||
+	    header->bloom_offset + header->bloom_bits / 8 > (uint64_t)st.st_size ||
+	    header->entries_offset + header->entry_count * sizeof(struct nonce_index_entry_t) > (uint64_t)st.st_size) {
+		error("ERROR: Index %s is truncated\n", filename);
+		munmap(map, st.st_size);
+		return NULL;
+	}
+	/* lookups jump around the file, readahead only wastes page cache */
+	madvise(map, st.st_size, MADV_RANDOM);
+
+	index = (struct nonce_index_t*)malloc(sizeof(struct nonce_index_t));
+	if (!index) {
+		munmap(map, st.st_size);
+		return NULL;
+	}
+	index->map = map;
+	index->map_size = st.st_size;
+	index->header = header;
+	index->devices = (const char (*)[NONCE_INDEX_DEVICE_SIZE])((const char*)map + header->devices_offset);
+	index->bloom = (const uint8_t*)map + header->bloom_offset;
+	index->entries = (const struct nonce_index_entry_t*)((const char*)map + header->entries_offset);
+	return index;
+}
+
+void nonce_index_close(struct nonce_index_t* index) {
+	if (!index) {
+		return;
+	}
+	munmap(index->map, index->map_size);
+	free(index);
+}
+
+int nonce_index_may_contain(const struct nonce_index_t* index, const unsigned char* nonce, size_t size) {
+	uint64_t h1, h2;
+	uint32_t k;
+
+	nonce_index_hash(nonce, size, &h1, &h2);
+	for (k = 0; k < index->header->bloom_hashes; k++) {
+		uint64_t bit = (h1 + k * h2) % index->header->bloom_bits;
+		if (!(index->bloom[bit / 8] & (1 << (bit % 8)))) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+uint64_t nonce_index_find(const struct nonce_index_t* index, const unsigned char* nonce, size_t size, const struct nonce_index_entry_t** first) {
+	const struct nonce_index_entry_t* entries = index->entries;
+	uint8_t padded[NONCE_INDEX_NONCE_SIZE];
+	uint64_t lo = 0;
+	uint64_t hi = index->header->entry_count;
+	uint64_t key = 0;
+	uint64_t found = 0;
+	int step = 0;
+
+	*first = NULL;
+	if (size == 0 || size > NONCE_INDEX_NONCE_SIZE) {
+		return 0;
+	}
+	memset(padded, 0, sizeof(padded));
+	memcpy(padded, nonce, size);
+	key = nonce_index_key(padded);
+
+	/* the first entry not below the nonce is in [lo, hi] */
+	for (step = 0; step < NONCE_INDEX_INTERPOLATIONS && hi - lo > 16; step++) {
+		uint64_t key_lo = nonce_index_key(entries[lo].nonce);
+		uint64_t key_hi = nonce_index_key(entries[hi - 1].nonce);
+		uint64_t pos = 0;
+		if (key <= key_lo || key_lo == key_hi) {
+			break;
+		}
+		if (key > key_hi) {
+			lo = hi;
+			break;
+		}
+		pos = lo + (uint64_t)((long double)(key - key_lo) / (long double)(key_hi - key_lo) * (hi - 1 - lo));
+		if (nonce_index_compare_nonce(&entries[pos], padded, (uint8_t)size) < 0) {
+			lo = pos + 1;
+		} else {
+			hi = pos;
+		}
+	}
+	while (lo < hi) {
+		uint64_t mid = lo + (hi - lo) / 2;
+		if (nonce_index_compare_nonce(&entries[mid], padded, (uint8_t)size) < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	while (lo + found < index->header->entry_count && nonce_index_compare_nonce(&entries[lo + found], padded, (uint8_t)size) == 0) {
+		found++;
+	}
+	if (found) {
+		*first = &entries[lo];
+	}
+	return found;
+}
+
+const char* nonce_index_device(const struct nonce_index_t* index, uint16_t device) {
+	if (device >= index->header->device_count) {
+		return "unknown";
+	}
+	return index->devices[device];
+}
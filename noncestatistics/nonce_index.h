@@ -0,0 +1,67 @@
+/*
+ * nonce_index.h
+ * Sorted on-disk index of every nonce ever collected
+ */
+
+#ifndef IDEVICERESTORE_NONCE_INDEX_H
+#define IDEVICERESTORE_NONCE_INDEX_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define NONCE_INDEX_MAGIC        "NONCEIDX"
+#define NONCE_INDEX_VERSION      1
+#define NONCE_INDEX_NONCE_SIZE   32
+#define NONCE_INDEX_DEVICE_SIZE  32
+
+/* one nonce as produced by one device model; nonces are zero padded */
+struct nonce_index_entry_t {
+	uint8_t nonce[NONCE_INDEX_NONCE_SIZE];
+	uint64_t first_seen;
+	uint32_t count;
+	uint16_t device;
+	uint8_t nonce_size;
+	uint8_t reserved;
+};
+
+struct nonce_index_header_t {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint64_t entry_count;
+	uint64_t bloom_bits;
+	uint32_t bloom_hashes;
+	uint32_t device_count;
+	uint64_t devices_offset;
+	uint64_t bloom_offset;
+	uint64_t entries_offset;
+};
+
+struct nonce_index_t {
+	void* map;
+	size_t map_size;
+	const struct nonce_index_header_t* header;
+	const char (*devices)[NONCE_INDEX_DEVICE_SIZE];
+	const uint8_t* bloom;
+	const struct nonce_index_entry_t* entries;
+};
+
+/* sorts and merges the entries in place and writes them with a Bloom filter to filename */
+int nonce_index_write(const char* filename, struct nonce_index_entry_t* entries, uint64_t count, const char (*devices)[NONCE_INDEX_DEVICE_SIZE], uint32_t device_count);
+struct nonce_index_t* nonce_index_open(const char* filename);
+void nonce_index_close(struct nonce_index_t* index);
+/* 0 if the nonce is certainly not in the index */
+int nonce_index_may_contain(const struct nonce_index_t* index, const unsigned char* nonce, size_t size);
+/* returns how many entries (one per device model) the nonce has, the first one in *first */
+uint64_t nonce_index_find(const struct nonce_index_t* index, const unsigned char* nonce, size_t size, const struct nonce_index_entry_t** first);
+const char* nonce_index_device(const struct nonce_index_t* index, uint16_t device);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
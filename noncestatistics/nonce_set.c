@@ -0,0 +1,430 @@
+/*
+ * nonce_set.c
+ * Sorted sets of nonces for comparing collections
+ *
+ * Comparing logs of tens of millions of nonces has to avoid per nonce
+ * allocations and comparisons of whole nonces. A set keeps the nonces in one
+ * array and sorts them with a radix sort on their first 8 bytes. Nonces are
+ * hashes, so those 8 bytes are almost always unique, and the intersection of
+ * two sets then is a merge of two sorted arrays of 64 bit keys. With AVX2 the
+ * merge compares blocks of 4 keys against 4 keys at once; only keys that
+ * match get their whole nonces compared. A set where two nonces share a key,
+ * which a broken generator can cause, is merged one nonce at a time.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "common.h"
+#include "hex.h"
+#include "nonce_set.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define NONCE_SET_X86 1
+#include <immintrin.h>
+#endif
+
+/* the shortest hex run that counts as a nonce, like in the statistics */
+#define NONCE_SET_MIN_HEX 40
+
+struct nonce_set_sort_t {
+	uint64_t key;
+	size_t index;
+};
+
+static size_t (*nonce_set_intersect_keys)(const struct nonce_set_t* a, const struct nonce_set_t* b, size_t* matches) = NULL;
+static pthread_once_t nonce_set_once = PTHREAD_ONCE_INIT;
+
+static uint64_t nonce_set_key(const uint8_t* nonce) {
+	uint64_t key = 0;
+	int i;
+	for (i = 0; i < 8; i++) {
+		key = (key << 8) | nonce[i];
+	}
+	return key;
+}
+
+static int nonce_set_compare(const struct nonce_set_t* a, size_t i, const struct nonce_set_t* b, size_t j) {
+	int result = 0;
+	if (a->keys[i] != b->keys[j]) {
+		return (a->keys[i] < b->keys[j]) ? -1 : 1;
+	}
+	result = memcmp(a->nonces[i], b->nonces[j], NONCE_SET_NONCE_SIZE);
+	if (result == 0) {
+		result = (int)a->sizes[i] - (int)b->sizes[j];
+	}
+	return result;
+}
+
+static int nonce_set_equal(const struct nonce_set_t* a, size_t i, const struct nonce_set_t* b, size_t j) {
+	return a->sizes[i] == b->sizes[j] && memcmp(a->nonces[i], b->nonces[j], NONCE_SET_NONCE_SIZE) == 0;
+}
+
+struct nonce_set_t* nonce_set_new(void) {
+	struct nonce_set_t* set = (struct nonce_set_t*)malloc(sizeof(struct nonce_set_t));
+	if (!set) {
+		error("ERROR: Out of memory\n");
+		return NULL;
+	}
+	memset(set, 0, sizeof(struct nonce_set_t));
+	set->unique_keys = 1;
+	return set;
+}
+
+void nonce_set_free(struct nonce_set_t* set) {
+	if (!set) {
+		return;
+	}
+	free(set->keys);
+	free(set->nonces);
+	free(set->sizes);
+	free(set);
+}
+
+int nonce_set_add(struct nonce_set_t* set, const unsigned char* nonce, size_t size) {
+	if (size == 0 || size > NONCE_SET_NONCE_SIZE) {
+		return -1;
+	}
+	if (set->count == set->capacity) {
+		size_t capacity = (set->capacity) ? set->capacity * 2 : 4096;
+		uint64_t* keys = (uint64_t*)realloc(set->keys, capacity * sizeof(uint64_t));
+		uint8_t (*nonces)[NONCE_SET_NONCE_SIZE] = NULL;
+		uint8_t* sizes = NULL;
+		if (keys) {
+			set->keys = keys;
+		}
+		nonces = (uint8_t (*)[NONCE_SET_NONCE_SIZE])realloc(set->nonces, capacity * NONCE_SET_NONCE_SIZE);
+		if (nonces) {
+			set->nonces = nonces;
+		}
+		sizes = (uint8_t*)realloc(set->sizes, capacity);
+		if (sizes) {
+			set->sizes = sizes;
+		}
+		if (!keys || !nonces || !sizes) {
+			error("ERROR: Out of memory\n");
+			return -1;
+		}
+		set->capacity = capacity;
+	}
+
+	memset(set->nonces[set->count], 0, NONCE_SET_NONCE_SIZE);
+	memcpy(set->nonces[set->count], nonce, size);
+	set->sizes[set->count] = (uint8_t)size;
+	set->keys[set->count] = nonce_set_key(set->nonces[set->count]);
+	set->count++;
+	return 0;
+}
+
+/* orders nonces that share a key, qsort has no context argument everywhere */
+static const struct nonce_set_t* nonce_set_sorting = NULL;
+static pthread_mutex_t nonce_set_sorting_lock = PTHREAD_MUTEX_INITIALIZER;
+static int nonce_set_compare_run(const void* x, const void* y) {
+	return nonce_set_compare(nonce_set_sorting, *(const size_t*)x, nonce_set_sorting, *(const size_t*)y);
+}
+
+void nonce_set_finish(struct nonce_set_t* set) {
+	struct nonce_set_sort_t* sorted = NULL;
+	struct nonce_set_sort_t* buffer = NULL;
+	uint8_t (*nonces)[NONCE_SET_NONCE_SIZE] = NULL;
+	uint8_t* sizes = NULL;
+	size_t* order = NULL;
+	size_t* histogram = NULL;
+	size_t i = 0;
+	size_t kept = 0;
+	int shift = 0;
+
+	if (set->count == 0) {
+		return;
+	}
+
+	sorted = (struct nonce_set_sort_t*)malloc(set->count * sizeof(struct nonce_set_sort_t));
+	buffer = (struct nonce_set_sort_t*)malloc(set->count * sizeof(struct nonce_set_sort_t));
+	order = (size_t*)malloc(set->count * sizeof(size_t));
+	nonces = (uint8_t (*)[NONCE_SET_NONCE_SIZE])malloc(set->count * NONCE_SET_NONCE_SIZE);
+	sizes = (uint8_t*)malloc(set->count);
+	histogram = (size_t*)malloc(65536 * sizeof(size_t));
+	if (!sorted || !buffer || !order || !nonces || !sizes || !histogram) {
+		error("ERROR: Out of memory\n");
+		free(histogram);
+		free(sorted);
+		free(buffer);
+		free(order);
+		free(nonces);
+		free(sizes);
+		return;
+	}
+
+	/* LSD radix sort on 16 bit digits, a digit that is the same everywhere needs no pass */
+	for (i = 0; i < set->count; i++) {
+		sorted[i].key = set->keys[i];
+		sorted[i].index = i;
+	}
+	for (shift = 0; shift < 64; shift += 16) {
+		size_t position = 0;
+		int skip = 0;
+		memset(histogram, 0, 65536 * sizeof(size_t));
+		for (i = 0; i < set->count; i++) {
+			histogram[(sorted[i].key >> shift) & 0xffff]++;
+		}
+		for (i = 0; i < 65536; i++) {
+			size_t bucket = histogram[i];
+			if (bucket == set->count) {
+				skip = 1;
+				break;
+			}
+			histogram[i] = position;
+			position += bucket;
+		}
+		if (skip) {
+			continue;
+		}
+		for (i = 0; i < set->count; i++) {
+			buffer[histogram[(sorted[i].key >> shift) & 0xffff]++] = sorted[i];
+		}
+		memcpy(sorted, buffer, set->count * sizeof(struct nonce_set_sort_t));
+	}
+	for (i = 0; i < set->count; i++) {
+		order[i] = sorted[i].index;
+	}
+
+	/* runs of equal keys are ordered by the whole nonce */
+	set->unique_keys = 1;
+	pthread_mutex_lock(&nonce_set_sorting_lock);
+	nonce_set_sorting = set;
+	for (i = 0; i < set->count; ) {
+		size_t end = i + 1;
+		while (end < set->count && sorted[end].key == sorted[i].key) {
+			end++;
+		}
+		if (end - i > 1) {
+			qsort(order + i, end - i, sizeof(size_t), nonce_set_compare_run);
+		}
+		i = end;
+	}
+	nonce_set_sorting = NULL;
+	pthread_mutex_unlock(&nonce_set_sorting_lock);
+
+	/* apply the order and drop duplicates */
+	for (i = 0; i < set->count; i++) {
+		size_t from = order[i];
+		if (kept > 0 && sorted[i].key == set->keys[kept - 1] && sizes[kept - 1] == set->sizes[from] &&
+		    memcmp(nonces[kept - 1], set->nonces[from], NONCE_SET_NONCE_SIZE) == 0) {
+			continue;
+		}
+		if (kept > 0 && sorted[i].key == set->keys[kept - 1]) {
+			set->unique_keys = 0;
+		}
+		memcpy(nonces[kept], set->nonces[from], NONCE_SET_NONCE_SIZE);
+		sizes[kept] = set->sizes[from];
+		/* keys are rewritten behind the reads, sorted still has the original ones */
+		set->keys[kept] = sorted[i].key;
+		kept++;
+	}
+
+	free(set->nonces);
+	free(set->sizes);
+	set->nonces = nonces;
+	set->sizes = sizes;
+	set->count = kept;
+	set->capacity = set->count;
+	free(sorted);
+	free(buffer);
+	free(order);
+	free(histogram);
+}
+
+/* the first nonce on a line that isn't marked as SepNonce, as in the statistics */
+static void nonce_set_parse_line(struct nonce_set_t* set, const char* line, const char* end) {
+	unsigned char nonce[NONCE_SET_NONCE_SIZE];
+	const char* token = line;
+
+	while (token < end) {
+		const char* token_end = token;
+		const char* start = token;
+		const char* eq = NULL;
+		size_t span = 0;
+
+		while (token < end && (*token == ' ' || *token == '\t' || *token == '\r')) {
+			token++;
+		}
+		token_end = token;
+		while (token_end < end && *token_end != ' ' && *token_end != '\t' && *token_end != '\r') {
+			token_end++;
+		}
+		if (token == token_end) {
+			break;
+		}
+
+		eq = (const char*)memchr(token, '=', token_end - token);
+		start = (eq) ? eq + 1 : token;
+		span = hex_span(start, token_end - start);
+		if (span >= NONCE_SET_MIN_HEX && span % 2 == 0) {
+			if (eq && eq - token == 8 && !memcmp(token, "SepNonce", 8)) {
+				token = token_end;
+				continue;
+			}
+			if (span / 2 <= NONCE_SET_NONCE_SIZE && hex_decode(nonce, start, span) == 0) {
+				nonce_set_add(set, nonce, span / 2);
+			}
+			return;
+		}
+		token = token_end;
+	}
+}
+
+int nonce_set_load(struct nonce_set_t* set, const char* filename) {
+	const char* data = NULL;
+	const char* line = NULL;
+	const char* end = NULL;
+	struct stat st;
+	int fd = -1;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		error("ERROR: Unable to open %s: %s\n", filename, strerror(errno));
+		if (fd >= 0) {
+			close(fd);
+		}
+		return -1;
+	}
+	if (st.st_size == 0) {
+		close(fd);
+		return 0;
+	}
+	data = (const char*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == (const char*)MAP_FAILED) {
+		error("ERROR: Unable to map %s: %s\n", filename, strerror(errno));
+		return -1;
+	}
+	madvise((void*)data, st.st_size, MADV_SEQUENTIAL);
+
+	end = data + st.st_size;
+	for (line = data; line < end; ) {
+		const char* line_end = (const char*)memchr(line, '\n', end - line);
+		if (!line_end) {
+			line_end = end;
+		}
+		nonce_set_parse_line(set, line, line_end);
+		line = line_end + 1;
+	}
+	munmap((void*)data, st.st_size);
+
+	nonce_set_finish(set);
+	return 0;
+}
+
+static size_t nonce_set_intersect_scalar(const struct nonce_set_t* a, const struct nonce_set_t* b, size_t* matches) {
+	size_t i = 0;
+	size_t j = 0;
+	size_t found = 0;
+
+	while (i < a->count && j < b->count) {
+		int result = nonce_set_compare(a, i, b, j);
+		if (result < 0) {
+			i++;
+		} else if (result > 0) {
+			j++;
+		} else {
+			if (matches) {
+				matches[found] = i;
+			}
+			found++;
+			i++;
+			j++;
+		}
+	}
+	return found;
+}
+
+#ifdef NONCE_SET_X86
+__attribute__((target("avx2")))
+static size_t nonce_set_intersect_avx2(const struct nonce_set_t* a, const struct nonce_set_t* b, size_t* matches) {
+	size_t i = 0;
+	size_t j = 0;
+	size_t found = 0;
+
+	while (i + 4 <= a->count && j + 4 <= b->count) {
+		__m256i va = _mm256_loadu_si256((const __m256i*)(a->keys + i));
+		__m256i vb = _mm256_loadu_si256((const __m256i*)(b->keys + j));
+		/* compare every key of the a block with every key of the b block by rotating b */
+		__m256i eq = _mm256_cmpeq_epi64(va, vb);
+		eq = _mm256_or_si256(eq, _mm256_cmpeq_epi64(va, _mm256_permute4x64_epi64(vb, 0x39)));
+		eq = _mm256_or_si256(eq, _mm256_cmpeq_epi64(va, _mm256_permute4x64_epi64(vb, 0x4e)));
+		eq = _mm256_or_si256(eq, _mm256_cmpeq_epi64(va, _mm256_permute4x64_epi64(vb, 0x93)));
+		int mask = _mm256_movemask_pd(_mm256_castsi256_pd(eq));
+		uint64_t a_last = a->keys[i + 3];
+		uint64_t b_last = b->keys[j + 3];
+
+		while (mask) {
+			int lane = __builtin_ctz(mask);
+			size_t k;
+			mask &= mask - 1;
+			/* keys are unique on both sides, the equal key is in this b block */
+			for (k = j; k < j + 4; k++) {
+				if (b->keys[k] == a->keys[i + lane]) {
+					if (nonce_set_equal(a, i + lane, b, k)) {
+						if (matches) {
+							matches[found] = i + lane;
+						}
+						found++;
+					}
+					break;
+				}
+			}
+		}
+
+		if (a_last <= b_last) {
+			i += 4;
+		}
+		if (b_last <= a_last) {
+			j += 4;
+		}
+	}
+
+	/* the tails are merged one key at a time */
+	while (i < a->count && j < b->count) {
+		if (a->keys[i] < b->keys[j]) {
+			i++;
+		} else if (a->keys[i] > b->keys[j]) {
+			j++;
+		} else {
+			if (nonce_set_equal(a, i, b, j)) {
+				if (matches) {
+					matches[found] = i;
+				}
+				found++;
+			}
+			i++;
+			j++;
+		}
+	}
+	return found;
+}
+#endif
+
+static void nonce_set_init(void) {
+	nonce_set_intersect_keys = nonce_set_intersect_scalar;
+#ifdef NONCE_SET_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		nonce_set_intersect_keys = nonce_set_intersect_avx2;
+	}
+#endif
+}
+
+size_t nonce_set_intersect(const struct nonce_set_t* a, const struct nonce_set_t* b, size_t* matches) {
+	pthread_once(&nonce_set_once, nonce_set_init);
+	if (!a->unique_keys || !b->unique_keys) {
+		return nonce_set_intersect_scalar(a, b, matches);
+	}
+	return nonce_set_intersect_keys(a, b, matches);
+}
@@ -0,0 +1,47 @@
+/*
+ * nonce_set.h
+ * Sorted sets of nonces for comparing collections
+ */
+
+#ifndef IDEVICERESTORE_NONCE_SET_H
+#define IDEVICERESTORE_NONCE_SET_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define NONCE_SET_NONCE_SIZE 32
+
+/*
+ * The distinct ApNonces of a log, sorted by the first 8 bytes read as a big
+ * endian number (keys) and then by the whole nonce. nonces are zero padded
+ * to NONCE_SET_NONCE_SIZE, sizes holds their real length.
+ */
+struct nonce_set_t {
+	uint64_t* keys;
+	uint8_t (*nonces)[NONCE_SET_NONCE_SIZE];
+	uint8_t* sizes;
+	size_t count;
+	size_t capacity;
+	/* no two nonces share a key, the fast intersection only works then */
+	int unique_keys;
+};
+
+struct nonce_set_t* nonce_set_new(void);
+void nonce_set_free(struct nonce_set_t* set);
+int nonce_set_add(struct nonce_set_t* set, const unsigned char* nonce, size_t size);
+/* sorts the set and removes duplicates, must be called before comparing */
+void nonce_set_finish(struct nonce_set_t* set);
+/* adds every ApNonce of a collector log and finishes the set */
+int nonce_set_load(struct nonce_set_t* set, const char* filename);
+/* returns the size of the intersection and, if matches isn't NULL, the positions in a of the common nonces */
+size_t nonce_set_intersect(const struct nonce_set_t* a, const struct nonce_set_t* b, size_t* matches);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -32,6 +32,8 @@
 #include "common.h"
 #include "normal.h"
 #include "recovery.h"
+#include "transport.h"
+#include "identity.h"
 
 static int normal_device_connected = 0;
 
@@ -104,57 +106,25 @@ static int normal_idevice_new(struct idevicerestore_client_t* client, idevice_t*
 	if (num_devices == 0) {
 		return -1;
 	}
-	lockdownd_client_t lockdown = NULL;
 	int j;
 	for (j = 0; j < num_devices; j++) {
-		if (lockdown != NULL) {
-			lockdownd_client_free(lockdown);
-			lockdown = NULL;
-		}
-		if (dev != NULL) {
-			idevice_free(dev);
-			dev = NULL;
-		}
-		device_error = idevice_new(&dev, devices[j]);
-		if (device_error != IDEVICE_E_SUCCESS) {
-			error("ERROR: %s: can't open device with UDID %s\n", __func__, devices[j]);
+		struct identity_t identity;
+		if (normal_get_identity(devices[j], &identity) < 0) {
 			continue;
 		}
+		uint64_t this_ecid = identity.ecid;
+		identity_free(&identity);
 
-		if (lockdownd_client_new(dev, &lockdown, "idevicerestore") != LOCKDOWN_E_SUCCESS) {
-			error("ERROR: %s: can't connect to lockdownd on device with UDID %s\n", __func__, devices[j]);
-			continue;
-
-		}
-		char* type = NULL;
-		if (lockdownd_query_type(lockdown, &type) != LOCKDOWN_E_SUCCESS) {
-			continue;
-		}
-		if (strcmp(type, "com.apple.mobile.lockdown") != 0) {
-			free(type);
+		if (client->ecid != 0 && this_ecid != client->ecid) {
 			continue;
 		}
-		free(type);
 
-		plist_t node = NULL;
-		if ((lockdownd_get_value(lockdown, NULL, "UniqueChipID", &node) != LOCKDOWN_E_SUCCESS) || !node || (plist_get_node_type(node) != PLIST_UINT)){
-			if (node) {
-				plist_free(node);
-			}
+		device_error = idevice_new(&dev, devices[j]);
+		if (device_error != IDEVICE_E_SUCCESS) {
+			error("ERROR: %s: can't open device with UDID %s\n", __func__, devices[j]);
 			continue;
 		}
-		lockdownd_client_free(lockdown);
-		lockdown = NULL;
-
-		uint64_t this_ecid = 0;
-		plist_get_uint_val(node, &this_ecid);
-		plist_free(node);
-
-		if (client->ecid != 0) {
-			if (this_ecid != client->ecid) {
-				continue;
-			}
-		} else {
+		if (client->ecid == 0) {
 			client->ecid = this_ecid;
 		}
 		client->udid = strdup(devices[j]);
@@ -168,8 +138,14 @@ static int normal_idevice_new(struct idevicerestore_client_t* client, idevice_t*
 
 int normal_check_mode(struct idevicerestore_client_t* client) {
 	idevice_t device = NULL;
+	int probe = transport_normal_probe(client->ecid);
+
+	if (probe >= 0) {
+		return (probe) ? 0 : -1;
+	}
 
 	normal_idevice_new(client, &device);
+	transport_normal_probed(client->ecid, (device) ? 1 : 0);
 	if (!device) {
 		return -1;
 	}
@@ -178,7 +154,7 @@ int normal_check_mode(struct idevicerestore_client_t* client) {
 	return 0;
 }
 
-int normal_enter_recovery(struct idevicerestore_client_t* client) {
+static int normal_lockdown_enter_recovery(struct idevicerestore_client_t* client) {
     idevice_t device = NULL;
     lockdownd_client_t lockdown = NULL;
     idevice_error_t device_error = IDEVICE_E_SUCCESS;
@@ -209,9 +185,29 @@ int normal_enter_recovery(struct idevicerestore_client_t* client) {
     idevice_free(device);
     lockdown = NULL;
     device = NULL;
+    return 0;
+}
+
+int normal_enter_recovery(struct idevicerestore_client_t* client) {
+    irecv_error_t transport_error = transport_normal_enter_recovery(client->ecid);
+    
+    if (transport_error == IRECV_E_UNSUPPORTED) {
+        int lockdown_result = normal_lockdown_enter_recovery(client);
+        transport_normal_entered_recovery(client->ecid, (lockdown_result < 0) ? IRECV_E_UNKNOWN_ERROR : IRECV_E_SUCCESS);
+        if (lockdown_result < 0) {
+            return -1;
+        }
+    } else if (transport_error != IRECV_E_SUCCESS) {
+        error("ERROR: Unable to place device in recovery mode\n");
+        return -1;
+    }
     
     if (recovery_client_new(client) < 0) {
         error("ERROR: Unable to enter recovery mode\n");
+        /* the device we sent to recovery isn't the ECID we wait for, the cached identity is stale */
+        if (transport_error == IRECV_E_UNSUPPORTED && client->udid) {
+            identity_cache_remove(client->udid);
+        }
         return -1;
     }
     
@@ -265,12 +261,21 @@ const char* normal_check_hardware_model(struct idevicerestore_client_t* client)
 	irecv_device_t irecv_device = NULL;
 	lockdownd_client_t lockdown = NULL;
 	lockdownd_error_t lockdown_error = LOCKDOWN_E_SUCCESS;
+	struct identity_t identity;
 
 	normal_idevice_new(client, &device);
 	if (!device) {
 		return product_type;
 	}
 
+	if (client->udid && identity_cache_get(client->udid, &identity) == 0 && identity.hardware_model) {
+		irecv_devices_get_device_by_hardware_model(identity.hardware_model, &irecv_device);
+		identity_free(&identity);
+		idevice_free(device);
+		return (irecv_device) ? irecv_device->hardware_model : NULL;
+	}
+	identity_free(&identity);
+
 	lockdown_error = lockdownd_client_new_with_handshake(device, &lockdown, "idevicerestore");
 	if (lockdown_error != LOCKDOWN_E_SUCCESS) {
 		lockdown_error = lockdownd_client_new(device, &lockdown, "idevicerestore");
@@ -358,6 +363,13 @@ int normal_get_ecid(struct idevicerestore_client_t* client, uint64_t* ecid) {
 	lockdownd_client_t lockdown = NULL;
 	idevice_error_t device_error = IDEVICE_E_SUCCESS;
 	lockdownd_error_t lockdown_error = LOCKDOWN_E_SUCCESS;
+	struct identity_t identity;
+
+	if (client->udid && identity_cache_get(client->udid, &identity) == 0) {
+		*ecid = identity.ecid;
+		identity_free(&identity);
+		return 0;
+	}
 
 	device_error = idevice_new(&device, client->udid);
 	if (device_error != IDEVICE_E_SUCCESS) {
@@ -394,3 +406,65 @@ int normal_get_ecid(struct idevicerestore_client_t* client, uint64_t* ecid) {
 	device = NULL;
 	return 0;
 }
+
+/* fetches the whole lockdown value dictionary in one request instead of one connection per key */
+int normal_get_lockdown_values(const char* udid, plist_t* values) {
+	idevice_t device = NULL;
+	lockdownd_client_t lockdown = NULL;
+	lockdownd_error_t lockdown_error = LOCKDOWN_E_SUCCESS;
+
+	*values = NULL;
+	if (idevice_new(&device, udid) != IDEVICE_E_SUCCESS) {
+		return -1;
+	}
+
+	lockdown_error = lockdownd_client_new_with_handshake(device, &lockdown, "idevicerestore");
+	if (lockdown_error != LOCKDOWN_E_SUCCESS) {
+		lockdown_error = lockdownd_client_new(device, &lockdown, "idevicerestore");
+	}
+	if (lockdown_error != LOCKDOWN_E_SUCCESS) {
+		idevice_free(device);
+		return -1;
+	}
+
+	char* type = NULL;
+	if (lockdownd_query_type(lockdown, &type) != LOCKDOWN_E_SUCCESS || strcmp(type, "com.apple.mobile.lockdown") != 0) {
+		free(type);
+		lockdownd_client_free(lockdown);
+		idevice_free(device);
+		return -1;
+	}
+	free(type);
+
+	lockdown_error = lockdownd_get_value(lockdown, NULL, NULL, values);
+	lockdownd_client_free(lockdown);
+	idevice_free(device);
+
+	if (lockdown_error != LOCKDOWN_E_SUCCESS || !*values || plist_get_node_type(*values) != PLIST_DICT) {
+		if (*values) {
+			plist_free(*values);
+			*values = NULL;
+		}
+		return -1;
+	}
+
+	return 0;
+}
+
+/* identity of the device with the given UDID, lockdownd is only asked if the cache doesn't know it yet */
+int normal_get_identity(const char* udid, struct identity_t* identity) {
+	plist_t values = NULL;
+
+	if (identity_cache_get(udid, identity) == 0) {
+		return 0;
+	}
+
+	debug("Querying identity of device with UDID %s\n", udid);
+	if (normal_get_lockdown_values(udid, &values) < 0) {
+		return -1;
+	}
+	identity_cache_put(udid, values);
+	plist_free(values);
+
+	return identity_cache_get(udid, identity);
+}
@@ -32,6 +32,8 @@ extern "C" {
 #include <libimobiledevice/lockdown.h>
 #include <libimobiledevice/libimobiledevice.h>
 
+#include "identity.h"
+
 struct normal_client_t {
 	idevice_t device;
 	lockdownd_client_t client;
@@ -49,6 +51,8 @@ int normal_get_ecid(struct idevicerestore_client_t* client, uint64_t* ecid);
 int normal_get_ap_nonce(struct idevicerestore_client_t* client, unsigned char** nonce, int* nonce_size);
 int normal_get_sep_nonce(struct idevicerestore_client_t* client, unsigned char** nonce, int* nonce_size);
 int normal_enter_recovery(struct idevicerestore_client_t* client);
+int normal_get_lockdown_values(const char* udid, plist_t* values);
+int normal_get_identity(const char* udid, struct identity_t* identity);
     
 #ifdef __cplusplus
 }
@@ -0,0 +1,154 @@
+#include "profile.hpp"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "common.h"
+
+static const char* stageNames[PROFILE_STAGES] = { "read", "tokenize", "decode", "insert", "sort", "output" };
+static const char* stageUnits[PROFILE_STAGES] = { "bytes", "lines", "nonces", "nonces", "entries", "" };
+
+Profile* statsProfile = NULL;
+thread_local ProfileScope* ProfileScope::current = NULL;
+
+static double wallSeconds(){
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static double threadCpuSeconds(){
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) < 0) return 0;
+    return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+ProfileScope::ProfileScope(int stage, uint64_t items) : stage(stage), items(items){
+    if (!statsProfile) return;
+    parent = current;
+    if (parent) parent->pause();
+    current = this;
+    resume();
+}
+
+ProfileScope::~ProfileScope(){
+    if (!statsProfile) return;
+    pause();
+    statsProfile->add(stage, wall, cpu, items);
+    current = parent;
+    if (parent) parent->resume();
+}
+
+void ProfileScope::pause(){
+    wall += wallSeconds() - wallStart;
+    cpu += threadCpuSeconds() - cpuStart;
+}
+
+void ProfileScope::resume(){
+    wallStart = wallSeconds();
+    cpuStart = threadCpuSeconds();
+}
+
+Profile::Profile() : start(std::chrono::steady_clock::now()){
+}
+
+void Profile::add(int stage, double wall, double cpu, uint64_t items){
+    std::lock_guard<std::mutex> lock(mutex);
+    stages[stage].wall += wall;
+    stages[stage].cpu += cpu;
+    stages[stage].calls++;
+    stages[stage].items += items;
+}
+
+void Profile::addTable(const TableProfile& table){
+    std::lock_guard<std::mutex> lock(mutex);
+    tables.push_back(table);
+}
+
+double Profile::elapsed(){
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// in MB, ru_maxrss is in bytes on macOS and in kilobytes elsewhere
+double Profile::peakRss(){
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) < 0) return 0;
+#ifdef __APPLE__
+    return usage.ru_maxrss/1048576.0;
+#else
+    return usage.ru_maxrss/1024.0;
+#endif
+}
+
+void Profile::print(){
+    std::lock_guard<std::mutex> lock(mutex);
+    double total = elapsed();
+    uint64_t bytes = stages[PROFILE_READ].items;
+    uint64_t nonces = stages[PROFILE_DECODE].items;
+
+    printf("\nProfile\n");
+    printf("stage          wall (s)      cpu (s)      calls            items        items/s\n");
+    printf("===========================================================================\n");
+    for (int i = 0; i < PROFILE_STAGES; i++) {
+        const Stage& stage = stages[i];
+        printf("%-10s  %11.3f  %11.3f  %9llu", stageNames[i], stage.wall, stage.cpu, (unsigned long long)stage.calls);
+        double rate = (stage.wall > 0) ? stage.items/stage.wall : 0;
+        if (!stage.items) printf("\n");
+        else if (i == PROFILE_READ) printf("  %15llu  %13.1f MB\n", (unsigned long long)stage.items, rate/1048576);
+        else printf("  %15llu  %13.0f %s\n", (unsigned long long)stage.items, rate, stageUnits[i]);
+    }
+    printf("===========================================================================\n");
+    printf("elapsed %.3f s, %llu bytes (%.1f MB/s), %llu nonces (%.0f nonces/s)\n", total, (unsigned long long)bytes,
+           (total > 0) ? bytes/total/1048576 : 0, (unsigned long long)nonces, (total > 0) ? nonces/total : 0);
+    printf("peak RSS %.1f MB\n", peakRss());
+
+    if (tables.empty()) return;
+    printf("\ntable                             entries      buckets  load factor   avg probes  max probes\n");
+    printf("===========================================================================\n");
+    for (auto& table: tables) {
+        if (table.hashed) {
+            printf("%-28.28s  %11zu  %11zu  %11.3f  %11.3f  %10zu\n", table.name.c_str(), table.entries, table.buckets,
+                   table.loadFactor, table.meanProbes, table.maxProbes);
+        } else {
+            printf("%-28.28s  %11zu      ordered\n", table.name.c_str(), table.entries);
+        }
+    }
+    printf("===========================================================================\n");
+}
+
+bool Profile::writeJson(const char* filename){
+    std::lock_guard<std::mutex> lock(mutex);
+    double total = elapsed();
+    FILE* fp = (strcmp(filename, "-") == 0) ? stdout : fopen(filename, "w");
+    if (!fp) {
+        error("ERROR: Unable to open %s: %s\n", filename, strerror(errno));
+        return false;
+    }
+
+    fprintf(fp, "{\n  \"elapsed_seconds\": %.6f,\n  \"bytes\": %llu,\n  \"nonces\": %llu,\n", total,
+            (unsigned long long)stages[PROFILE_READ].items, (unsigned long long)stages[PROFILE_DECODE].items);
+    fprintf(fp, "  \"bytes_per_second\": %.1f,\n  \"nonces_per_second\": %.1f,\n",
+            (total > 0) ? stages[PROFILE_READ].items/total : 0, (total > 0) ? stages[PROFILE_DECODE].items/total : 0);
+    fprintf(fp, "  \"peak_rss_bytes\": %.0f,\n  \"stages\": {\n", peakRss()*1048576);
+    for (int i = 0; i < PROFILE_STAGES; i++) {
+        const Stage& stage = stages[i];
+        fprintf(fp, "    \"%s\": { \"wall_seconds\": %.6f, \"cpu_seconds\": %.6f, \"calls\": %llu, \"items\": %llu, \"unit\": \"%s\" }%s\n",
+                stageNames[i], stage.wall, stage.cpu, (unsigned long long)stage.calls, (unsigned long long)stage.items, stageUnits[i],
+                (i+1 < PROFILE_STAGES) ? "," : "");
+    }
+    fprintf(fp, "  },\n  \"tables\": [\n");
+    for (size_t i = 0; i < tables.size(); i++) {
+        const TableProfile& table = tables[i];
+        fprintf(fp, "    { \"name\": \"%s\", \"kind\": \"%s\", \"entries\": %zu", table.name.c_str(), (table.hashed) ? "hash" : "ordered", table.entries);
+        if (table.hashed) {
+            fprintf(fp, ", \"buckets\": %zu, \"load_factor\": %.6f, \"mean_probes\": %.6f, \"max_probes\": %zu", table.buckets,
+                    table.loadFactor, table.meanProbes, table.maxProbes);
+        }
+        fprintf(fp, " }%s\n", (i+1 < tables.size()) ? "," : "");
+    }
+    fprintf(fp, "  ]\n}\n");
+
+    bool ok = !ferror(fp);
+    if (fp != stdout && fclose(fp) != 0) ok = false;
+    if (!ok) error("ERROR: Unable to write %s\n", filename);
+    return ok;
+}
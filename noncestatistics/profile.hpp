@@ -0,0 +1,106 @@
+#ifndef profile_hpp
+#define profile_hpp
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <stdint.h>
+
+#define PROFILE_READ      0
+#define PROFILE_TOKENIZE  1
+#define PROFILE_DECODE    2
+#define PROFILE_INSERT    3
+#define PROFILE_SORT      4
+#define PROFILE_OUTPUT    5
+#define PROFILE_STAGES    6
+
+// How full a table of the statistics got. Probes are the entries a lookup
+// of an entry compares, counted along the chain of its bucket. Ordered maps
+// have no buckets and only report their entries.
+struct TableProfile {
+    std::string name;
+    bool hashed = false;
+    size_t entries = 0;
+    size_t buckets = 0;
+    double loadFactor = 0;
+    double meanProbes = 0;
+    size_t maxProbes = 0;
+};
+
+template <class Table> TableProfile hashTableProfile(const std::string& name, const Table& table){
+    TableProfile profile;
+    double probes = 0;
+    profile.name = name;
+    profile.hashed = true;
+    profile.entries = table.size();
+    profile.buckets = table.bucket_count();
+    profile.loadFactor = table.load_factor();
+    for (size_t b = 0; b < table.bucket_count(); b++) {
+        size_t chain = table.bucket_size(b);
+        probes += (double)chain*(chain+1)/2;
+        if (chain > profile.maxProbes) profile.maxProbes = chain;
+    }
+    profile.meanProbes = (table.size()) ? probes/table.size() : 0;
+    return profile;
+}
+
+template <class Table> TableProfile orderedTableProfile(const std::string& name, const Table& table){
+    TableProfile profile;
+    profile.name = name;
+    profile.entries = table.size();
+    return profile;
+}
+
+// Time spent in every stage of a statistics run. Stages that run on several
+// threads at once add up their time, so the stages can take longer than the
+// whole run. CPU time is the time of the threads that ran the stage.
+class Profile {
+public:
+    Profile();
+    void add(int stage, double wall, double cpu, uint64_t items);
+    void addTable(const TableProfile& table);
+    void print();
+    bool writeJson(const char* filename);
+
+private:
+    struct Stage {
+        double wall = 0;
+        double cpu = 0;
+        uint64_t calls = 0;
+        uint64_t items = 0;
+    };
+    std::mutex mutex;
+    std::chrono::steady_clock::time_point start;
+    Stage stages[PROFILE_STAGES];
+    std::vector<TableProfile> tables;
+    double elapsed();
+    double peakRss();
+};
+
+// set while --profile is given
+extern Profile* statsProfile;
+
+// Adds the time until it goes out of scope to a stage of statsProfile, if
+// there is one. A scope opened inside another pauses the outer one, so a sort
+// while printing counts as sort only.
+class ProfileScope {
+public:
+    ProfileScope(int stage, uint64_t items = 0);
+    ~ProfileScope();
+    void addItems(uint64_t count) { items += count; }
+
+private:
+    void pause();
+    void resume();
+    int stage;
+    uint64_t items;
+    ProfileScope* parent = NULL;
+    double wallStart = 0;
+    double cpuStart = 0;
+    double wall = 0;
+    double cpu = 0;
+    static thread_local ProfileScope* current;
+};
+
+#endif /* profile_hpp */
@@ -31,19 +31,13 @@
 
 #include "idevicerestore.h"
 #include "recovery.h"
-
-int recovery_progress_callback(irecv_client_t client, const irecv_event_t* event) {
-	if (event->type == IRECV_PROGRESS) {
-		//print_progress_bar(event->progress);
-	}
-	return 0;
-}
+#include "transport.h"
 
 void recovery_client_free(struct idevicerestore_client_t* client) {
 	if(client) {
 		if (client->recovery) {
 			if(client->recovery->client) {
-				irecv_close(client->recovery->client);
+				transport_close(client->recovery->client);
 				client->recovery->client = NULL;
 			}
 			free(client->recovery);
@@ -53,9 +47,13 @@ void recovery_client_free(struct idevicerestore_client_t* client) {
 }
 
 int recovery_client_new(struct idevicerestore_client_t* client) {
+	return recovery_client_new_with_timeout(client, 0);
+}
+
+int recovery_client_new_with_timeout(struct idevicerestore_client_t* client, unsigned int timeout_ms) {
 	int i = 0;
-	int attempts = 20000;
-	irecv_client_t recovery = NULL;
+	int attempts = timeout_ms / 50;
+	transport_client_t recovery = NULL;
 	irecv_error_t recovery_error = IRECV_E_UNKNOWN_ERROR;
 
 	if(client->recovery == NULL) {
@@ -67,55 +65,58 @@ int recovery_client_new(struct idevicerestore_client_t* client) {
 		memset(client->recovery, 0, sizeof(struct recovery_client_t));
 	}
 
-	//for (i = 1; i <= attempts; i++) {
-    while(1){
-		recovery_error = irecv_open_with_ecid(&recovery, client->ecid);
+	for (i = 1; !attempts || i <= attempts; i++) {
+		recovery_error = transport_open_with_ecid(&recovery, client->ecid);
 		if (recovery_error == IRECV_E_SUCCESS) {
 			break;
 		}
 
-		if (i >= attempts) {
-			error("ERROR: Unable to connect to device in recovery mode\n");
+		if (transport_exhausted()) {
+			debug("No more devices available from transport %s\n", transport_get_backend()->name);
 			return -1;
 		}
 
-		usleep(50000);
+		if (attempts && i >= attempts) {
+			debug("Device did not show up in recovery mode within %u ms\n", timeout_ms);
+			return -1;
+		}
+
+		transport_usleep(50000);
 		debug("Retrying connection...\n");
 	}
 
 	if (client->srnm == NULL) {
-		const struct irecv_device_info *device_info = irecv_get_device_info(recovery);
+		const struct irecv_device_info *device_info = transport_get_device_info(recovery);
 		if (device_info && device_info->srnm) {
 			client->srnm = strdup(device_info->srnm);
 			info("INFO: device serial number is %s\n", client->srnm);
 		}
 	}
 
-	irecv_event_subscribe(recovery, IRECV_PROGRESS, &recovery_progress_callback, NULL);
 	client->recovery->client = recovery;
 	return 0;
 }
 
 int recovery_check_mode(struct idevicerestore_client_t* client) {
-	irecv_client_t recovery = NULL;
+	transport_client_t recovery = NULL;
 	irecv_error_t recovery_error = IRECV_E_SUCCESS;
 	int mode = 0;
 
-	irecv_init();
-	recovery_error=irecv_open_with_ecid(&recovery, client->ecid);
+	transport_init();
+	recovery_error=transport_open_with_ecid(&recovery, client->ecid);
 
 	if (recovery_error != IRECV_E_SUCCESS) {
 		return -1;
 	}
 
-	irecv_get_mode(recovery, &mode);
+	transport_get_mode(recovery, &mode);
 
 	if ((mode == IRECV_K_DFU_MODE) || (mode == IRECV_K_WTF_MODE)) {
-		irecv_close(recovery);
+		transport_close(recovery);
 		return -1;
 	}
 
-	irecv_close(recovery);
+	transport_close(recovery);
 	recovery = NULL;
 
 	return 0;
@@ -129,7 +130,7 @@ int recovery_get_ecid(struct idevicerestore_client_t* client, uint64_t* ecid) {
 		}
 	}
 
-	const struct irecv_device_info *device_info = irecv_get_device_info(client->recovery->client);
+	const struct irecv_device_info *device_info = transport_get_device_info(client->recovery->client);
 	if (!device_info) {
 		return -1;
 	}
@@ -146,7 +147,7 @@ int recovery_get_ap_nonce(struct idevicerestore_client_t* client, unsigned char*
 		}
 	}
 
-	const struct irecv_device_info *device_info = irecv_get_device_info(client->recovery->client);
+	const struct irecv_device_info *device_info = transport_get_device_info(client->recovery->client);
 	if (!device_info) {
 		return -1;
 	}
@@ -170,7 +171,7 @@ int recovery_get_sep_nonce(struct idevicerestore_client_t* client, unsigned char
 		}
 	}
 
-	const struct irecv_device_info *device_info = irecv_get_device_info(client->recovery->client);
+	const struct irecv_device_info *device_info = transport_get_device_info(client->recovery->client);
 	if (!device_info) {
 		return -1;
 	}
@@ -187,22 +188,81 @@ int recovery_get_sep_nonce(struct idevicerestore_client_t* client, unsigned char
 	return 0;
 }
 
+int recovery_get_autoboot(struct idevicerestore_client_t* client) {
+	char* value = NULL;
+	int enabled = 0;
+
+	if (transport_getenv(client->recovery->client, "auto-boot", &value) != IRECV_E_SUCCESS || !value) {
+		error("ERROR: Unable to read auto-boot environmental variable\n");
+		return -1;
+	}
+
+	enabled = (strcmp(value, "true") == 0);
+	free(value);
+	return enabled;
+}
+
+static int recovery_copy_nonce(const unsigned char* src, unsigned int src_size, unsigned char** nonce, int* nonce_size) {
+	*nonce = NULL;
+	*nonce_size = 0;
+	if (src && src_size > 0) {
+		*nonce = (unsigned char*)malloc(src_size);
+		if (!*nonce) {
+			return -1;
+		}
+		*nonce_size = src_size;
+		memcpy(*nonce, src, src_size);
+	}
+	return 0;
+}
+
+/* copies ApNonce and SEP nonce out of one device info, shared with DFU mode */
+int recovery_copy_nonces(const struct irecv_device_info* device_info, unsigned char** ap_nonce, int* ap_nonce_size, unsigned char** sep_nonce, int* sep_nonce_size) {
+	if (recovery_copy_nonce(device_info->ap_nonce, device_info->ap_nonce_size, ap_nonce, ap_nonce_size) < 0) {
+		return -1;
+	}
+	if (recovery_copy_nonce(device_info->sep_nonce, device_info->sep_nonce_size, sep_nonce, sep_nonce_size) < 0) {
+		free(*ap_nonce);
+		*ap_nonce = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+/* reads ApNonce and SEP nonce from the same device info so they belong to the same boot */
+int recovery_get_nonces(struct idevicerestore_client_t* client, unsigned char** ap_nonce, int* ap_nonce_size, unsigned char** sep_nonce, int* sep_nonce_size) {
+	*ap_nonce = NULL;
+	*sep_nonce = NULL;
+	if(client->recovery == NULL) {
+		if (recovery_client_new(client) < 0) {
+			return -1;
+		}
+	}
+
+	const struct irecv_device_info *device_info = transport_get_device_info(client->recovery->client);
+	if (!device_info) {
+		return -1;
+	}
+
+	return recovery_copy_nonces(device_info, ap_nonce, ap_nonce_size, sep_nonce, sep_nonce_size);
+}
+
 int recovery_send_reset(struct idevicerestore_client_t* client)
 {
-	irecv_send_command(client->recovery->client, "reset");
+	transport_send_command(client->recovery->client, "reset");
 	return 0;
 }
 
 int recovery_set_autoboot(struct idevicerestore_client_t* client, int enable) {
     irecv_error_t recovery_error = IRECV_E_SUCCESS;
     
-    recovery_error = irecv_send_command(client->recovery->client, (enable) ? "setenv auto-boot true" : "setenv auto-boot false");
+    recovery_error = transport_send_command(client->recovery->client, (enable) ? "setenv auto-boot true" : "setenv auto-boot false");
     if (recovery_error != IRECV_E_SUCCESS) {
         error("ERROR: Unable to set auto-boot environmental variable\n");
         return -1;
     }
     
-    recovery_error = irecv_send_command(client->recovery->client, "saveenv");
+    recovery_error = transport_send_command(client->recovery->client, "saveenv");
     if (recovery_error != IRECV_E_SUCCESS) {
         error("ERROR: Unable to save environmental variable\n");
         return -1;
@@ -33,20 +33,25 @@ extern "C" {
 #include <libirecovery.h>
 
 #include "common.h"
+#include "transport.h"
 
 struct recovery_client_t {
-	irecv_client_t client;
+	transport_client_t client;
 	const char* ipsw;
 	plist_t tss;
 };
 
 int recovery_check_mode(struct idevicerestore_client_t* client);
 int recovery_client_new(struct idevicerestore_client_t* client);
+int recovery_client_new_with_timeout(struct idevicerestore_client_t* client, unsigned int timeout_ms);
 void recovery_client_free(struct idevicerestore_client_t* client);
 int recovery_get_ecid(struct idevicerestore_client_t* client, uint64_t* ecid);
 int recovery_get_ap_nonce(struct idevicerestore_client_t* client, unsigned char** nonce, int* nonce_size);
 int recovery_get_sep_nonce(struct idevicerestore_client_t* client, unsigned char** nonce, int* nonce_size);
+int recovery_get_nonces(struct idevicerestore_client_t* client, unsigned char** ap_nonce, int* ap_nonce_size, unsigned char** sep_nonce, int* sep_nonce_size);
+int recovery_copy_nonces(const struct irecv_device_info* device_info, unsigned char** ap_nonce, int* ap_nonce_size, unsigned char** sep_nonce, int* sep_nonce_size);
 int recovery_set_autoboot(struct idevicerestore_client_t* client, int enable);
+int recovery_get_autoboot(struct idevicerestore_client_t* client);
 int recovery_send_reset(struct idevicerestore_client_t* client);
 
 #ifdef __cplusplus
@@ -0,0 +1,484 @@
+/*
+ * snapshot.c
+ * Compact, mergeable snapshots of the nonce counts of collector logs
+ *
+ * A snapshot holds what -s counts in a log, plus one segment per log that
+ * went into it. The collector writes the ApNonce and the SepNonce of a reboot
+ * on one line, so the counts are stored as how often every pair was seen and
+ * how often an ApNonce or a SepNonce was seen alone; the count of a nonce is
+ * the sum of both. Each of the three sections is a sorted run of records. A
+ * record is the nonce (and the SepNonce of a pair) prefixed with its length
+ * and followed by the count, lengths and counts as LEB128 varints. Most
+ * pairs are seen once, so a record takes little more than the raw nonces,
+ * about half the size of the log.
+ *
+ * Since every section is sorted, snapshots of any number of hosts are merged
+ * with one k-way merge per section that sums the counts of equal records.
+ * The result is again a snapshot, so merging is associative and can happen
+ * in stages. The file uses the byte order of the host that wrote it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "common.h"
+#include "snapshot.h"
+
+#define SNAPSHOT_BYTE_ORDER  0x01020304
+#define SNAPSHOT_MAX_NONCE   255
+
+struct snapshot_writer_t {
+	FILE* file;
+	char* filename;
+	char* tmp;
+	struct snapshot_header_t header;
+	struct snapshot_segment_t* segments;
+	size_t capacity;
+	uint64_t offset;
+	int section;
+	int failed;
+};
+
+static uint64_t snapshot_align(uint64_t offset) {
+	return (offset + 7) & ~7ULL;
+}
+
+static int snapshot_compare_bytes(const unsigned char* a, size_t a_size, const unsigned char* b, size_t b_size) {
+	int result = memcmp(a, b, (a_size < b_size) ? a_size : b_size);
+	if (result != 0 || a_size == b_size) {
+		return result;
+	}
+	return (a_size < b_size) ? -1 : 1;
+}
+
+int snapshot_record_compare(const struct snapshot_record_t* a, const struct snapshot_record_t* b) {
+	int result = snapshot_compare_bytes(a->nonce, a->size, b->nonce, b->size);
+	if (result != 0) {
+		return result;
+	}
+	return snapshot_compare_bytes(a->sep, a->sep_size, b->sep, b->sep_size);
+}
+
+static size_t snapshot_put_varint(unsigned char* buffer, uint64_t value) {
+	size_t size = 0;
+	while (value >= 0x80) {
+		buffer[size++] = (unsigned char)(value | 0x80);
+		value >>= 7;
+	}
+	buffer[size++] = (unsigned char)value;
+	return size;
+}
+
+static int snapshot_get_varint(const unsigned char** pos, const unsigned char* end, uint64_t* value) {
+	int shift = 0;
+	*value = 0;
+	while (*pos < end && shift < 64) {
+		unsigned char byte = *((*pos)++);
+		*value |= (uint64_t)(byte & 0x7f) << shift;
+		if (!(byte & 0x80)) {
+			return 0;
+		}
+		shift += 7;
+	}
+	return -1;
+}
+
+struct snapshot_writer_t* snapshot_writer_new(const char* filename) {
+	struct snapshot_writer_t* writer = (struct snapshot_writer_t*)calloc(1, sizeof(struct snapshot_writer_t));
+	if (!writer) {
+		error("ERROR: Out of memory\n");
+		return NULL;
+	}
+	writer->filename = strdup(filename);
+	writer->tmp = (char*)malloc(strlen(filename) + 5);
+	if (!writer->filename || !writer->tmp) {
+		error("ERROR: Out of memory\n");
+		free(writer->filename);
+		free(writer->tmp);
+		free(writer);
+		return NULL;
+	}
+	/* written next to the old snapshot and renamed once complete */
+	sprintf(writer->tmp, "%s.tmp", filename);
+	writer->file = fopen(writer->tmp, "wb");
+	if (!writer->file) {
+		error("ERROR: Unable to open %s: %s\n", writer->tmp, strerror(errno));
+		free(writer->filename);
+		free(writer->tmp);
+		free(writer);
+		return NULL;
+	}
+
+	memcpy(writer->header.magic, SNAPSHOT_MAGIC, sizeof(writer->header.magic));
+	writer->header.version = SNAPSHOT_VERSION;
+	writer->header.byte_order = SNAPSHOT_BYTE_ORDER;
+	writer->offset = snapshot_align(sizeof(struct snapshot_header_t));
+	writer->section = -1;
+	if (fseek(writer->file, (long)writer->offset, SEEK_SET) != 0) {
+		writer->failed = 1;
+	}
+	return writer;
+}
+
+int snapshot_writer_add_segment(struct snapshot_writer_t* writer, const struct snapshot_segment_t* segment) {
+	if (writer->header.segment_count == writer->capacity) {
+		size_t capacity = (writer->capacity) ? 2 * writer->capacity : 16;
+		struct snapshot_segment_t* segments = (struct snapshot_segment_t*)realloc(writer->segments, capacity * sizeof(struct snapshot_segment_t));
+		if (!segments) {
+			error("ERROR: Out of memory\n");
+			writer->failed = 1;
+			return -1;
+		}
+		writer->segments = segments;
+		writer->capacity = capacity;
+	}
+	writer->segments[writer->header.segment_count++] = *segment;
+	return 0;
+}
+
+static void snapshot_writer_end_section(struct snapshot_writer_t* writer) {
+	if (writer->section >= 0) {
+		writer->header.section_sizes[writer->section] = writer->offset - writer->header.section_offsets[writer->section];
+	}
+	writer->section = -1;
+}
+
+int snapshot_writer_begin_section(struct snapshot_writer_t* writer, int section) {
+	if (section < 0 || section >= SNAPSHOT_SECTIONS) {
+		return -1;
+	}
+	snapshot_writer_end_section(writer);
+	writer->section = section;
+	writer->header.section_offsets[section] = writer->offset;
+	writer->header.section_counts[section] = 0;
+	return 0;
+}
+
+int snapshot_writer_add(struct snapshot_writer_t* writer, const struct snapshot_record_t* record) {
+	unsigned char buffer[3 * 10 + 2 * SNAPSHOT_MAX_NONCE];
+	size_t size = 0;
+
+	if (writer->section < 0 || writer->failed) {
+		return -1;
+	}
+	if (record->size > SNAPSHOT_MAX_NONCE || record->sep_size > SNAPSHOT_MAX_NONCE) {
+		error("ERROR: Nonce of %zu bytes is too long for a snapshot\n", (record->size > record->sep_size) ? record->size : record->sep_size);
+		writer->failed = 1;
+		return -1;
+	}
+
+	size += snapshot_put_varint(buffer + size, record->size);
+	memcpy(buffer + size, record->nonce, record->size);
+	size += record->size;
+	if (writer->section == SNAPSHOT_PAIRS) {
+		size += snapshot_put_varint(buffer + size, record->sep_size);
+		memcpy(buffer + size, record->sep, record->sep_size);
+		size += record->sep_size;
+	}
+	size += snapshot_put_varint(buffer + size, record->count);
+
+	if (fwrite(buffer, 1, size, writer->file) != size) {
+		writer->failed = 1;
+		return -1;
+	}
+	writer->offset += size;
+	writer->header.section_counts[writer->section]++;
+	return 0;
+}
+
+int snapshot_writer_finish(struct snapshot_writer_t* writer) {
+	int result = 0;
+
+	snapshot_writer_end_section(writer);
+	writer->header.segments_offset = snapshot_align(writer->offset);
+	if (writer->failed ||
+	    fseek(writer->file, (long)writer->header.segments_offset, SEEK_SET) != 0 ||
+	    fwrite(writer->segments, sizeof(struct snapshot_segment_t), writer->header.segment_count, writer->file) != writer->header.segment_count ||
+	    fseek(writer->file, 0, SEEK_SET) != 0 ||
+	    fwrite(&writer->header, sizeof(struct snapshot_header_t), 1, writer->file) != 1) {
+		result = -1;
+	}
+	if (fclose(writer->file) != 0) {
+		result = -1;
+	}
+	if (result == 0 && rename(writer->tmp, writer->filename) < 0) {
+		result = -1;
+	}
+	if (result < 0) {
+		error("ERROR: Unable to write snapshot %s\n", writer->filename);
+		unlink(writer->tmp);
+	}
+
+	free(writer->segments);
+	free(writer->filename);
+	free(writer->tmp);
+	free(writer);
+	return result;
+}
+
+int snapshot_detect(const char* filename) {
+	char magic[8];
+	FILE* file = fopen(filename, "rb");
+	int result = 0;
+	if (!file) {
+		return 0;
+	}
+	if (fread(magic, 1, sizeof(magic), file) == sizeof(magic) && !memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic))) {
+		result = 1;
+	}
+	fclose(file);
+	return result;
+}
+
+struct snapshot_t* snapshot_open(const char* filename) {
+	struct snapshot_t* snapshot = NULL;
+	const struct snapshot_header_t* header = NULL;
+	struct stat st;
+	void* map = NULL;
+	int fd = -1;
+	int s;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		error("ERROR: Unable to open snapshot %s: %s\n", filename, strerror(errno));
+		return NULL;
+	}
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(struct snapshot_header_t)) {
+		error("ERROR: %s is not a snapshot\n", filename);
+		close(fd);
+		return NULL;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		error("ERROR: Unable to map snapshot %s: %s\n", filename, strerror(errno));
+		return NULL;
+	}
+
+	header = (const struct snapshot_header_t*)map;
+	if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) || header->version != SNAPSHOT_VERSION) {
+		error("ERROR: %s is not a snapshot\n", filename);
+		munmap(map, st.st_size);
+		return NULL;
+	}
+	if (header->byte_order != SNAPSHOT_BYTE_ORDER) {
+		error("ERROR: %s was written on a host with a different byte order\n", filename);
+		munmap(map, st.st_size);
+		return NULL;
+	}
+	for (s = 0; s < SNAPSHOT_SECTIONS; s++) {
+		if (header->section_offsets[s] + header->section_sizes[s] > (uint64_t)st.st_size) {
+			break;
+		}
+	}
+	if (s < SNAPSHOT_SECTIONS || header->segments_offset + header->segment_count * sizeof(struct snapshot_segment_t) > (uint64_t)st.st_size) {
+		error("ERROR: Snapshot %s is truncated\n", filename);
+		munmap(map, st.st_size);
+		return NULL;
+	}
+	/* every section is read front to back */
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	snapshot = (struct snapshot_t*)malloc(sizeof(struct snapshot_t));
+	if (!snapshot) {
+		munmap(map, st.st_size);
+		return NULL;
+	}
+	snapshot->map = map;
+	snapshot->map_size = st.st_size;
+	snapshot->header = header;
+	snapshot->segments = (const struct snapshot_segment_t*)((const char*)map + header->segments_offset);
+	return snapshot;
+}
+
+void snapshot_close(struct snapshot_t* snapshot) {
+	if (!snapshot) {
+		return;
+	}
+	munmap(snapshot->map, snapshot->map_size);
+	free(snapshot);
+}
+
+void snapshot_cursor_init(struct snapshot_cursor_t* cursor, const struct snapshot_t* snapshot, int section) {
+	memset(cursor, 0, sizeof(struct snapshot_cursor_t));
+	cursor->pos = (const unsigned char*)snapshot->map + snapshot->header->section_offsets[section];
+	cursor->end = cursor->pos + snapshot->header->section_sizes[section];
+	cursor->left = snapshot->header->section_counts[section];
+	cursor->section = section;
+}
+
+int snapshot_cursor_next(struct snapshot_cursor_t* cursor) {
+	struct snapshot_record_t* record = &cursor->record;
+	uint64_t size = 0;
+
+	if (cursor->left == 0) {
+		return 0;
+	}
+	if (snapshot_get_varint(&cursor->pos, cursor->end, &size) < 0 || size > (uint64_t)(cursor->end - cursor->pos)) {
+		return -1;
+	}
+	record->nonce = cursor->pos;
+	record->size = (size_t)size;
+	cursor->pos += size;
+	record->sep = NULL;
+	record->sep_size = 0;
+	if (cursor->section == SNAPSHOT_PAIRS) {
+		if (snapshot_get_varint(&cursor->pos, cursor->end, &size) < 0 || size > (uint64_t)(cursor->end - cursor->pos)) {
+			return -1;
+		}
+		record->sep = cursor->pos;
+		record->sep_size = (size_t)size;
+		cursor->pos += size;
+	}
+	if (snapshot_get_varint(&cursor->pos, cursor->end, &record->count) < 0) {
+		return -1;
+	}
+	cursor->left--;
+	return 1;
+}
+
+/* min-heap of the cursors by their current record */
+static void snapshot_heap_down(struct snapshot_cursor_t** heap, size_t size, size_t i) {
+	for (;;) {
+		size_t smallest = i;
+		size_t left = 2 * i + 1;
+		size_t right = left + 1;
+		struct snapshot_cursor_t* tmp = NULL;
+		if (left < size && snapshot_record_compare(&heap[left]->record, &heap[smallest]->record) < 0) {
+			smallest = left;
+		}
+		if (right < size && snapshot_record_compare(&heap[right]->record, &heap[smallest]->record) < 0) {
+			smallest = right;
+		}
+		if (smallest == i) {
+			return;
+		}
+		tmp = heap[i];
+		heap[i] = heap[smallest];
+		heap[smallest] = tmp;
+		i = smallest;
+	}
+}
+
+/* moves the top cursor on and restores the heap, -1 if its snapshot is corrupt */
+static int snapshot_heap_advance(struct snapshot_cursor_t** heap, size_t* size) {
+	int next = snapshot_cursor_next(heap[0]);
+	if (next < 0) {
+		error("ERROR: A snapshot is corrupt\n");
+		return -1;
+	}
+	if (next == 0) {
+		heap[0] = heap[--(*size)];
+	}
+	snapshot_heap_down(heap, *size, 0);
+	return 0;
+}
+
+static int snapshot_merge_section(struct snapshot_writer_t* writer, struct snapshot_t** snapshots, size_t count, int section) {
+	struct snapshot_cursor_t* cursors = NULL;
+	struct snapshot_cursor_t** heap = NULL;
+	size_t size = 0;
+	size_t i;
+	int result = 0;
+
+	cursors = (struct snapshot_cursor_t*)calloc(count, sizeof(struct snapshot_cursor_t));
+	heap = (struct snapshot_cursor_t**)calloc(count, sizeof(struct snapshot_cursor_t*));
+	if (!cursors || !heap) {
+		error("ERROR: Out of memory\n");
+		free(cursors);
+		free(heap);
+		return -1;
+	}
+
+	for (i = 0; i < count && result == 0; i++) {
+		int next = 0;
+		snapshot_cursor_init(&cursors[i], snapshots[i], section);
+		next = snapshot_cursor_next(&cursors[i]);
+		if (next < 0) {
+			error("ERROR: A snapshot is corrupt\n");
+			result = -1;
+		} else if (next > 0) {
+			heap[size++] = &cursors[i];
+		}
+	}
+	for (i = size; i-- > 0; ) {
+		snapshot_heap_down(heap, size, i);
+	}
+
+	snapshot_writer_begin_section(writer, section);
+	while (result == 0 && size > 0) {
+		/* the record points into the mapping, it stays valid when the cursor moves on */
+		struct snapshot_record_t record = heap[0]->record;
+		result = snapshot_heap_advance(heap, &size);
+		while (result == 0 && size > 0 && snapshot_record_compare(&heap[0]->record, &record) == 0) {
+			record.count += heap[0]->record.count;
+			result = snapshot_heap_advance(heap, &size);
+		}
+		if (result == 0) {
+			result = snapshot_writer_add(writer, &record);
+		}
+	}
+
+	free(cursors);
+	free(heap);
+	return result;
+}
+
+int snapshot_merge(const char* output, const char* const* inputs, size_t count) {
+	struct snapshot_t** snapshots = NULL;
+	struct snapshot_writer_t* writer = NULL;
+	size_t opened = 0;
+	size_t i;
+	int result = 0;
+	int s;
+
+	snapshots = (struct snapshot_t**)calloc(count, sizeof(struct snapshot_t*));
+	if (!snapshots) {
+		error("ERROR: Out of memory\n");
+		return -1;
+	}
+	for (opened = 0; opened < count; opened++) {
+		snapshots[opened] = snapshot_open(inputs[opened]);
+		if (!snapshots[opened]) {
+			result = -1;
+			break;
+		}
+	}
+
+	if (result == 0) {
+		writer = snapshot_writer_new(output);
+		if (!writer) {
+			result = -1;
+		}
+	}
+	if (writer) {
+		for (i = 0; i < count && result == 0; i++) {
+			uint64_t j;
+			for (j = 0; j < snapshots[i]->header->segment_count && result == 0; j++) {
+				result = snapshot_writer_add_segment(writer, &snapshots[i]->segments[j]);
+			}
+		}
+		for (s = 0; s < SNAPSHOT_SECTIONS && result == 0; s++) {
+			result = snapshot_merge_section(writer, snapshots, count, s);
+		}
+		if (result < 0) {
+			/* makes finish discard the file */
+			writer->failed = 1;
+		}
+		if (snapshot_writer_finish(writer) < 0) {
+			result = -1;
+		}
+	}
+
+	for (i = 0; i < opened; i++) {
+		snapshot_close(snapshots[i]);
+	}
+	free(snapshots);
+	return result;
+}
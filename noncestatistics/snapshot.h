@@ -0,0 +1,99 @@
+/*
+ * snapshot.h
+ * Compact, mergeable snapshots of the nonce counts of collector logs
+ */
+
+#ifndef IDEVICERESTORE_SNAPSHOT_H
+#define IDEVICERESTORE_SNAPSHOT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SNAPSHOT_MAGIC        "NONCESNP"
+#define SNAPSHOT_VERSION      1
+#define SNAPSHOT_SOURCE_SIZE  128
+#define SNAPSHOT_HOST_SIZE    64
+
+/* pairs of records with both nonces, then the ApNonces and SepNonces of records with only one of them */
+#define SNAPSHOT_PAIRS        0
+#define SNAPSHOT_APNONCES     1
+#define SNAPSHOT_SEPNONCES    2
+#define SNAPSHOT_SECTIONS     3
+
+/* where a part of the counts came from */
+struct snapshot_segment_t {
+	char source[SNAPSHOT_SOURCE_SIZE];
+	char host[SNAPSHOT_HOST_SIZE];
+	uint64_t created;
+	uint64_t records;
+	uint64_t sep_records;
+};
+
+struct snapshot_header_t {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint64_t segment_count;
+	uint64_t segments_offset;
+	uint64_t section_offsets[SNAPSHOT_SECTIONS];
+	uint64_t section_sizes[SNAPSHOT_SECTIONS];
+	uint64_t section_counts[SNAPSHOT_SECTIONS];
+};
+
+/* a nonce, or an ApNonce and SepNonce pair, and how often it was seen */
+struct snapshot_record_t {
+	const unsigned char* nonce;
+	size_t size;
+	const unsigned char* sep;
+	size_t sep_size;
+	uint64_t count;
+};
+
+struct snapshot_t {
+	void* map;
+	size_t map_size;
+	const struct snapshot_header_t* header;
+	const struct snapshot_segment_t* segments;
+};
+
+struct snapshot_cursor_t {
+	const unsigned char* pos;
+	const unsigned char* end;
+	uint64_t left;
+	int section;
+	struct snapshot_record_t record;
+};
+
+struct snapshot_writer_t;
+
+/* orders like the bytes of the nonce and then of the SepNonce, shorter first on a common prefix */
+int snapshot_record_compare(const struct snapshot_record_t* a, const struct snapshot_record_t* b);
+
+struct snapshot_writer_t* snapshot_writer_new(const char* filename);
+int snapshot_writer_add_segment(struct snapshot_writer_t* writer, const struct snapshot_segment_t* segment);
+/* sections are written one after the other, each with its records in snapshot_record_compare order */
+int snapshot_writer_begin_section(struct snapshot_writer_t* writer, int section);
+int snapshot_writer_add(struct snapshot_writer_t* writer, const struct snapshot_record_t* record);
+/* writes the segments and the header and frees the writer, the file only appears if everything worked */
+int snapshot_writer_finish(struct snapshot_writer_t* writer);
+
+/* 1 if the file starts like a snapshot */
+int snapshot_detect(const char* filename);
+struct snapshot_t* snapshot_open(const char* filename);
+void snapshot_close(struct snapshot_t* snapshot);
+void snapshot_cursor_init(struct snapshot_cursor_t* cursor, const struct snapshot_t* snapshot, int section);
+/* 1 and the next record in cursor->record, 0 at the end of the section, -1 if the snapshot is corrupt */
+int snapshot_cursor_next(struct snapshot_cursor_t* cursor);
+
+/* sums the counts of all snapshots into output with one k-way merge per section */
+int snapshot_merge(const char* output, const char* const* inputs, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
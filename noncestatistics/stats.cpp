@@ -1,52 +1,849 @@
 #include "stats.hpp"
 #include <iostream>
-#include <regex>
+#include <sstream>
 #include <fstream>
+#include <algorithm>
+#include <cmath>
+#include <chrono>
+#include <random>
+#include <unordered_set>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "hex.h"
+#include "common.h"
+#include "nonce_index.h"
+#include "nonce_set.h"
+#include "gensearch.h"
+#include "gendict.h"
+#include "snapshot.h"
+#include "analyzer.hpp"
+#include "profile.hpp"
 
 std::vector<std::pair<std::string, int> > sortNonceList(std::map < std::string, int>& nonceList){
     std::vector<std::pair<std::string, int> > sortedList;
-    
+
     for (auto p : nonceList){ sortedList.push_back(p); }
     std::sort(sortedList.begin(), sortedList.end(), [] (const std::pair < std::string, int> &a, const std::pair < std::string, int> &b) -> bool{
         return a.second < b.second;
     });
-    
+
     return sortedList;
 }
 
+// A nonce token is a run of at least 40 hex digits, optionally prefixed with
+// "ApNonce=" or "SepNonce=" like in the collector's stdout. The nonce is kept
+// as raw bytes, which halves the size of the keys and makes the case of the
+// digits irrelevant.
+bool parseNonceToken(const std::string& token, std::string& nonce, bool& isSep){
+    size_t start = token.find('=');
+    isSep = (start != std::string::npos && token.compare(0, start, "SepNonce") == 0);
+    start = (start == std::string::npos) ? 0 : start+1;
 
-void cmd_statistics(const char* filename){
-    int amount = 0;
-    std::ifstream myfile;
-    myfile.open(filename);
-    std::string line;
-    
-    std::map<std::string, int> nonceList;
-    
-    while ((myfile >> line)) {
-        std::regex r("[[:digit:]a-f]{40}");
-        std::smatch match;
-        if(std::regex_search(line, match, r)){
-            nonceList[match[0]]++;
-            amount++;
-        }
-    }
-    myfile.close();
-    
-    std::vector<std::pair<std::string, int> > sortedList = sortNonceList(nonceList);
-    
+    size_t len = hex_span(token.data()+start, token.size()-start);
+    if (len < 40 || len % 2) return false;
+
+    nonce.resize(len/2);
+    return hex_decode((unsigned char*)&nonce[0], token.data()+start, len) == 0;
+}
+
+std::string nonceToHex(const std::string& nonce){
+    std::vector<char> hex(2*nonce.size()+1);
+    hex_encode(hex.data(), (const unsigned char*)nonce.data(), nonce.size());
+    return std::string(hex.data());
+}
+
+// " generator 0x... (SHA-1)" if the dictionary knows where the nonce comes from
+static std::string generatorNote(const struct gendict_t* dict, const std::string& nonce){
+    uint64_t generator = 0;
+    int hash = 0;
+    char note[64];
+
+    if (!dict || nonce.size() < 8 || !gendict_lookup(dict, (const unsigned char*)nonce.data(), nonce.size(), &generator, &hash)) return "";
+    snprintf(note, sizeof(note), "    generator 0x%016llx (%s)", (unsigned long long)generator, gensearch_hash_name(hash));
+    return note;
+}
+
+static long printCollisions(const char *name, std::map<std::string, int>& nonceList, int amount, const struct gendict_t* dict = NULL){
+    std::vector<std::pair<std::string, int> > sortedList;
+    {
+        ProfileScope scope(PROFILE_SORT, nonceList.size());
+        sortedList = sortNonceList(nonceList);
+    }
+
+    std::cout << name << std::endl;
     std::cout << "nonce                                     abs. frequency    rel. frequency" << std::endl;
     std::cout << "===========================================================================" << std::endl;
     long collisions = 0;
     for (auto p: sortedList) {
         if (p.second == 1) continue;
         collisions++;
-        printf("%s         %4d             %2.3f%%\n",p.first.c_str(),p.second,100*((float)p.second/amount));
+        printf("%s         %4d             %2.3f%%%s\n",nonceToHex(p.first).c_str(),p.second,100*((float)p.second/amount),generatorNote(dict, p.first).c_str());
     }
     std::cout << "===========================================================================" << std::endl;
     std::cout << "nonce                                     abs. frequency    rel. frequency" << std::endl<<std::endl;
-    
+
     if (collisions == 0) std::cout <<  "There were no collisions found!"<<std::endl<<std::endl;
-    
+    return collisions;
+}
+
+double normalQuantile(double confidence){
+    double low = 0, high = 40;
+    for (int i = 0; i < 100; i++) {
+        double z = (low+high)/2;
+        if (std::erfc(z/std::sqrt(2.0)) > 1-confidence) low = z;
+        else high = z;
+    }
+    return (low+high)/2;
+}
+
+void SpaceEstimator::add(const std::string& nonce, long times){
+    // a nonce seen k times before forms k new equal pairs
+    long& seen = counts[nonce];
+    c += times*seen + times*(times-1)/2;
+    if (seen == 1) f1--;
+    seen += times;
+    if (seen == 1) f1++;
+    n += times;
+}
+
+long SpaceEstimator::count(const std::string& nonce) const{
+    auto it = counts.find(nonce);
+    return (it == counts.end()) ? 0 : it->second;
+}
+
+double SpaceEstimator::estimate() const{
+    if (c == 0) return INFINITY;
+    return (double)n*(n-1)/2/c;
+}
+
+void SpaceEstimator::interval(double confidence, double& low, double& high) const{
+    // C is about Poisson with mean n(n-1)/2N, bound the mean with the score interval and invert
+    double z = normalQuantile(confidence);
+    double pairs = (double)n*(n-1)/2;
+    double spread = z*std::sqrt(c + z*z/4);
+    double meanLow = c + z*z/2 - spread;
+    double meanHigh = c + z*z/2 + spread;
+    low = pairs/meanHigh;
+    high = (meanLow > 0) ? pairs/meanLow : INFINITY;
+}
+
+double SpaceEstimator::logLikelihoodRatio(double weak, double strong) const{
+    // Poisson likelihood of C collisions among n(n-1)/2 pairs, space weak against space strong
+    double pairs = (double)n*(n-1)/2;
+    return c*std::log(strong/weak) - pairs*(1/weak - 1/strong);
+}
+
+int SpaceEstimator::check(const StopRule& rule) const{
+    if (rule.weak > 0 && rule.strong > rule.weak) {
+        double llr = logLikelihoodRatio(rule.weak, rule.strong);
+        if (llr >= std::log((1-rule.beta)/rule.alpha)) return STOP_WEAK;
+        if (llr <= std::log(rule.beta/(1-rule.alpha))) return STOP_STRONG;
+    }
+    if (rule.precision > 0 && c > 0) {
+        double low, high;
+        interval(rule.confidence, low, high);
+        if (high-low <= 2*rule.precision*estimate()) return STOP_PRECISION;
+    }
+    return STOP_CONTINUE;
+}
+
+// SPEC is a comma separated list of precision=P confidence=P weak=N strong=N alpha=P beta=P
+bool parseStopRule(const char* spec, StopRule& rule){
+    std::istringstream tokens(spec);
+    std::string token;
+
+    while (std::getline(tokens, token, ',')) {
+        size_t split = token.find('=');
+        if (split == std::string::npos) {
+            std::cout << "Invalid stop rule option '" << token << "'" << std::endl;
+            return false;
+        }
+        std::string key = token.substr(0, split);
+        double value = strtod(token.c_str()+split+1, NULL);
+        if (key == "precision") rule.precision = value;
+        else if (key == "confidence") rule.confidence = value;
+        else if (key == "weak") rule.weak = value;
+        else if (key == "strong") rule.strong = value;
+        else if (key == "alpha") rule.alpha = value;
+        else if (key == "beta") rule.beta = value;
+        else {
+            std::cout << "Unknown stop rule option '" << key << "'" << std::endl;
+            return false;
+        }
+    }
+
+    if (rule.weak > 0 && rule.strong == 0) rule.strong = 4*rule.weak;
+    if (rule.confidence <= 0 || rule.confidence >= 1 || rule.alpha <= 0 || rule.alpha >= 1 || rule.beta <= 0 || rule.beta >= 1) {
+        std::cout << "confidence, alpha and beta must be between 0 and 1" << std::endl;
+        return false;
+    }
+    if (rule.weak > 0 && rule.strong <= rule.weak) {
+        std::cout << "strong must be larger than weak" << std::endl;
+        return false;
+    }
+    if (rule.precision <= 0 && rule.weak <= 0) {
+        std::cout << "The stop rule needs precision or weak" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// SPEC is a sample size, or a comma separated list of size=N time=SECONDS confidence=P seed=N
+bool parseSampleSpec(const char* spec, SampleSpec& sample){
+    std::istringstream tokens(spec);
+    std::string token;
+
+    while (std::getline(tokens, token, ',')) {
+        size_t split = token.find('=');
+        std::string key = (split == std::string::npos) ? "size" : token.substr(0, split);
+        const char* value = token.c_str() + ((split == std::string::npos) ? 0 : split+1);
+        if (key == "size") sample.size = strtol(value, NULL, 0);
+        else if (key == "time") sample.seconds = strtod(value, NULL);
+        else if (key == "confidence") sample.confidence = strtod(value, NULL);
+        else if (key == "seed") sample.seed = strtoull(value, NULL, 0);
+        else {
+            std::cout << "Unknown sample option '" << key << "'" << std::endl;
+            return false;
+        }
+    }
+
+    if (sample.size < 2 || sample.seconds <= 0) {
+        std::cout << "The sample needs a size of at least 2 and a time above 0" << std::endl;
+        return false;
+    }
+    if (sample.confidence <= 0 || sample.confidence >= 1) {
+        std::cout << "confidence must be between 0 and 1" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+std::string estimateSummary(const SpaceEstimator& estimator, double confidence){
+    char summary[256];
+    double low, high;
+    estimator.interval(confidence, low, high);
+    if (estimator.collisions() == 0) {
+        snprintf(summary, sizeof(summary), "Estimated nonce space: no collisions, at least %.0f (%.0f%% confidence)", low, 100*confidence);
+    }else{
+        snprintf(summary, sizeof(summary), "Estimated nonce space: %.0f, %.0f%% confidence interval %.0f to %.0f", estimator.estimate(), 100*confidence, low, high);
+    }
+    return summary;
+}
+
+void tokenizeNonceLine(const std::string& line, std::vector<std::pair<size_t, size_t> >& tokens){
+    const char* spaces = " \t\r\n\v\f";
+
+    tokens.clear();
+    for (size_t start = line.find_first_not_of(spaces), end; start != std::string::npos; start = line.find_first_not_of(spaces, end)) {
+        end = line.find_first_of(spaces, start);
+        size_t length = ((end == std::string::npos) ? line.size() : end) - start;
+        // anything shorter cannot hold the 40 hex digits of a nonce
+        if (length >= 40) tokens.push_back(std::make_pair(start, length));
+    }
+}
+
+bool decodeNonceTokens(const std::string& line, const std::vector<std::pair<size_t, size_t> >& tokens, std::string& apNonce, std::string& sepNonce){
+    std::string nonce;
+    bool isSep = false;
+
+    apNonce.clear();
+    sepNonce.clear();
+    for (auto& token: tokens) {
+        if (!parseNonceToken(line.substr(token.first, token.second), nonce, isSep)) continue;
+        if (!isSep && apNonce.empty()) apNonce = nonce;
+        else if (sepNonce.empty()) sepNonce = nonce;
+    }
+    return !apNonce.empty() || !sepNonce.empty();
+}
+
+bool splitNonceLine(const std::string& line, std::string& apNonce, std::string& sepNonce){
+    std::vector<std::pair<size_t, size_t> > tokens;
+
+    tokenizeNonceLine(line, tokens);
+    return decodeNonceTokens(line, tokens, apNonce, sepNonce);
+}
+
+void countNonces(const std::string& apNonce, const std::string& sepNonce, NonceCounts& counts){
+    if (!apNonce.empty()) {
+        counts.apNonces[apNonce]++;
+        counts.amount++;
+    }
+    if (!sepNonce.empty()) {
+        counts.sepNonces[sepNonce]++;
+        counts.sepAmount++;
+    }
+    if (!apNonce.empty() && !sepNonce.empty()) {
+        counts.pairs[std::make_pair(apNonce, sepNonce)]++;
+    }
+}
+
+std::string countNonceLine(const std::string& line, NonceCounts& counts){
+    std::string apNonce;
+    std::string sepNonce;
+
+    splitNonceLine(line, apNonce, sepNonce);
+    countNonces(apNonce, sepNonce, counts);
+    return apNonce;
+}
+
+bool loadNonceLog(const char* filename, NonceCounts& counts){
+    std::ifstream myfile(filename);
+    std::string line;
+
+    if (!myfile) return false;
+    while (std::getline(myfile, line)) countNonceLine(line, counts);
+    return true;
+}
+
+// The sections of a snapshot are sorted like std::string compares, so the
+// pairs and the ApNonces of the pairs go to the end of their maps.
+bool loadSnapshot(const char* filename, NonceCounts& counts, std::vector<struct snapshot_segment_t>* segments){
+    struct snapshot_t* snapshot = snapshot_open(filename);
+    struct snapshot_cursor_t cursor;
+    int next = 0;
+
+    if (!snapshot) return false;
+    if (segments) segments->assign(snapshot->segments, snapshot->segments + snapshot->header->segment_count);
+
+    for (int section = 0; next == 0 && section < SNAPSHOT_SECTIONS; section++) {
+        snapshot_cursor_init(&cursor, snapshot, section);
+        while ((next = snapshot_cursor_next(&cursor)) > 0) {
+            std::string nonce((const char*)cursor.record.nonce, cursor.record.size);
+            int count = (int)cursor.record.count;
+            if (section == SNAPSHOT_PAIRS) {
+                std::string sepNonce((const char*)cursor.record.sep, cursor.record.sep_size);
+                counts.pairs.emplace_hint(counts.pairs.end(), std::make_pair(nonce, sepNonce), count);
+                counts.apNonces.emplace_hint(counts.apNonces.end(), nonce, 0)->second += count;
+                counts.sepNonces[sepNonce] += count;
+                counts.amount += count;
+                counts.sepAmount += count;
+            } else if (section == SNAPSHOT_APNONCES) {
+                counts.apNonces[nonce] += count;
+                counts.amount += count;
+            } else {
+                counts.sepNonces[nonce] += count;
+                counts.sepAmount += count;
+            }
+        }
+    }
+    snapshot_close(snapshot);
+
+    if (next < 0) error("ERROR: Snapshot %s is corrupt\n", filename);
+    return next == 0;
+}
+
+void printStatistics(NonceCounts& counts, const char* dictFilename){
+    int amount = counts.amount;
+    int sepAmount = counts.sepAmount;
+    std::map<std::string, int>& nonceList = counts.apNonces;
+    std::map<std::string, int>& sepNonceList = counts.sepNonces;
+    std::map<std::pair<std::string, std::string>, int>& pairList = counts.pairs;
+
+    struct gendict_t* dict = NULL;
+    if (dictFilename && !(dict = gendict_open(dictFilename))) return;
+
+    printCollisions("ApNonce", nonceList, amount, dict);
+
+    if (dict) {
+        // nonces seen once are listed too, a known generator is worth knowing about even without a collision
+        long known = 0;
+        std::cout << "ApNonces with a known generator" << std::endl;
+        std::cout << "===========================================================================" << std::endl;
+        for (auto p: nonceList) {
+            std::string note = generatorNote(dict, p.first);
+            if (note.empty()) continue;
+            known++;
+            printf("%s    %4d%s\n", nonceToHex(p.first).c_str(), p.second, note.c_str());
+        }
+        std::cout << "===========================================================================" << std::endl;
+        std::cout << known << " of " << nonceList.size() << " distinct ApNonces have a known generator" << std::endl << std::endl;
+        gendict_close(dict);
+    }
+
+    SpaceEstimator estimator;
+    for (auto p: nonceList) estimator.add(p.first, p.second);
+    if (amount) std::cout << estimateSummary(estimator, 0.95) << std::endl << std::endl;
+
+    if (sepAmount) {
+        printCollisions("SepNonce", sepNonceList, sepAmount);
+
+        // joint distribution: a weak generator shared by AP and SEP shows up as pairs repeating together
+        long pairCollisions = 0;
+        for (auto p: pairList) if (p.second > 1) pairCollisions++;
+
+        std::map<std::string, std::map<std::string, int> > sepsPerAp;
+        std::map<std::string, std::map<std::string, int> > apsPerSep;
+        for (auto p: pairList) {
+            sepsPerAp[p.first.first][p.first.second] += p.second;
+            apsPerSep[p.first.second][p.first.first] += p.second;
+        }
+        long apOnlyRepeats = 0, sepOnlyRepeats = 0;
+        for (auto p: sepsPerAp) if (p.second.size() > 1) apOnlyRepeats++;
+        for (auto p: apsPerSep) if (p.second.size() > 1) sepOnlyRepeats++;
+
+        std::cout << "Joint ApNonce/SepNonce distribution" << std::endl;
+        std::cout << "===========================================================================" << std::endl;
+        std::cout << "paired records:                              " << sepAmount << std::endl;
+        std::cout << "distinct (ApNonce, SepNonce) pairs:          " << pairList.size() << std::endl;
+        std::cout << "pairs seen more than once:                   " << pairCollisions << std::endl;
+        std::cout << "ApNonces seen with more than one SepNonce:   " << apOnlyRepeats << std::endl;
+        std::cout << "SepNonces seen with more than one ApNonce:   " << sepOnlyRepeats << std::endl;
+        std::cout << "===========================================================================" << std::endl<<std::endl;
+
+        std::cout << "There is a total of "<< sepAmount << " SEP nonces" << std::endl;
+    }
+
     std::cout << "There is a total of "<< amount << " nonces" << std::endl;
 }
+
+void cmd_statistics(const char* filename, const char* dictFilename){
+    NonceCounts counts;
+    std::vector<struct snapshot_segment_t> segments;
+
+    if (snapshot_detect(filename)) {
+        {
+            // a snapshot is read, decoded and counted in one go
+            ProfileScope scope(PROFILE_READ);
+            if (!loadSnapshot(filename, counts, &segments)) return;
+        }
+        ProfileScope scope(PROFILE_OUTPUT);
+        std::cout << "Snapshot of " << segments.size() << " segments" << std::endl;
+        std::cout << "===========================================================================" << std::endl;
+        for (auto& segment: segments) {
+            char created[32];
+            time_t when = (time_t)segment.created;
+            strftime(created, sizeof(created), "%Y-%m-%d %H:%M:%S", localtime(&when));
+            printf("%-32.32s %-16.16s %s %10llu nonces\n", segment.source, segment.host, created, (unsigned long long)segment.records);
+        }
+        std::cout << "===========================================================================" << std::endl << std::endl;
+        printStatistics(counts, dictFilename);
+        return;
+    }
+
+    std::vector<const AnalyzerInfo*> selected;
+    parseAnalyzers("collisions", selected);
+    runAnalyzers(std::vector<const char*>(1, filename), selected, dictFilename);
+}
+
+// Records expected to repeat an earlier one among records drawn from a space of the given size
+static double expectedRepeats(double records, double space){
+    if (std::isinf(space)) return 0;
+    return records + space*std::expm1(-records/space);
+}
+
+// Reads the records at random offsets of the log instead of all of it. An
+// offset lands in a line with a probability proportional to the line's length,
+// so a nonce line is kept with probability shortest/length, which makes all of
+// them equally likely as long as none is shorter than the shortest seen so
+// far. A kept line is remembered and drawing it again is a miss, so the
+// sample is drawn without replacement. Every draw touches one or two pages of
+// the map, which keeps the I/O proportional to the sample.
+int cmd_sample(const char* filename, const SampleSpec& sample){
+    struct stat st;
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        error("ERROR: Unable to open %s: %s\n", filename, strerror(errno));
+        return -1;
+    }
+    if (fstat(fd, &st) < 0) {
+        error("ERROR: Unable to stat %s: %s\n", filename, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    if (st.st_size == 0) {
+        error("ERROR: %s is empty\n", filename);
+        close(fd);
+        return -1;
+    }
+    const char* data = (const char*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        error("ERROR: Unable to map %s: %s\n", filename, strerror(errno));
+        return -1;
+    }
+    madvise((void*)data, st.st_size, MADV_RANDOM);
+
+    const char* end = data + st.st_size;
+    std::mt19937_64 random(sample.seed ? sample.seed : std::random_device()());
+    std::uniform_int_distribution<off_t> offsets(0, st.st_size-1);
+    std::uniform_real_distribution<double> keep(0, 1);
+    std::unordered_set<off_t> kept;
+    SpaceEstimator estimator;
+    auto start = std::chrono::steady_clock::now();
+    double elapsed = 0;
+    size_t shortest = SIZE_MAX;
+    long draws = 0;
+    long misses = 0;
+    double inverseLengths = 0;
+    bool exhausted = false;
+
+    while (estimator.samples() < sample.size) {
+        if ((draws & 255) == 0 && (elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count()) > sample.seconds) break;
+        draws++;
+        const char* at = data + offsets(random);
+        const char* first = at;
+        const char* last = (const char*)memchr(at, '\n', end - at);
+        while (first > data && first[-1] != '\n') first--;
+        last = (last) ? last : end;
+        size_t length = last - first + 1;
+
+        std::string nonce;
+        std::string sepNonce;
+        splitNonceLine(std::string(first, last), nonce, sepNonce);
+        if (nonce.empty()) continue;
+        // a line is hit once per byte, so the sum of 1/length over hits estimates the number of lines
+        inverseLengths += 1.0/length;
+
+        if (length < shortest) shortest = length;
+        else if (keep(random)*length >= shortest) continue;
+        if (!kept.insert(first - data).second) {
+            // nearly every line is in the sample already
+            if (++misses > 1000 && misses > 2*(long)kept.size()) {
+                exhausted = true;
+                break;
+            }
+            continue;
+        }
+        estimator.add(nonce);
+    }
+    if (exhausted) {
+        // the log is no larger than the sample, count all of it
+        NonceCounts counts;
+        estimator = SpaceEstimator();
+        for (const char* line = data; line < end; ) {
+            const char* next = (const char*)memchr(line, '\n', end - line);
+            next = (next) ? next : end;
+            std::string nonce = countNonceLine(std::string(line, next), counts);
+            if (!nonce.empty()) estimator.add(nonce);
+            line = next+1;
+        }
+    }
+    elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    munmap((void*)data, st.st_size);
+
+    long n = estimator.samples();
+    double records = (exhausted) ? n : std::max((double)n, inverseLengths*st.st_size/draws);
+    printf("Sampled %ld of about %.0f nonces (%ld draws, %.2f seconds, %.1f%% of the log)\n", n, records, draws, elapsed,
+           100.0*std::min(1.0, (double)n/records));
+    if (exhausted) std::cout << "The log is smaller than the sample, all of it was counted" << std::endl;
+    if (n < 2) {
+        std::cout << "Not enough nonces in the sample for an estimate" << std::endl;
+        return 0;
+    }
+
+    double low, high;
+    double space = estimator.estimate();
+    double pairs = (double)n*(n-1)/2;
+    estimator.interval(sample.confidence, low, high);
+    std::cout << "===========================================================================" << std::endl;
+    printf("distinct nonces in the sample:               %ld\n", estimator.distinct());
+    printf("nonces repeating one in the sample:          %ld (%.3f%%)\n", n - estimator.distinct(), 100.0*(n - estimator.distinct())/n);
+    printf("colliding pairs in the sample:               %ld of %.0f\n", estimator.collisions(), pairs);
+    printf("probability that two nonces are equal:       %.3g, %.0f%% confidence interval %.3g to %.3g\n",
+           estimator.collisions()/pairs, 100*sample.confidence, 1/high, 1/low);
+    std::cout << "===========================================================================" << std::endl;
+    std::cout << estimateSummary(estimator, sample.confidence) << std::endl;
+    if (!exhausted) {
+        // the interval of the space bounds the repeats, a smaller space means more of them
+        printf("Expected nonces repeating an earlier one in the whole log: %.0f (%.3f%%), %.0f%% confidence interval %.0f to %.0f\n",
+               expectedRepeats(records, space), 100*expectedRepeats(records, space)/records, 100*sample.confidence,
+               expectedRepeats(records, high), expectedRepeats(records, low));
+    }
+    return 0;
+}
+
+// The device model of a log section is the one its "Identified device as ..."
+// header names. The logs have no timestamps, so an entry was first seen when
+// the oldest log it appears in was last written.
+int cmd_index_build(const char* indexFilename, const std::vector<const char*>& logs){
+    std::vector<struct nonce_index_entry_t> entries;
+    // a nonce seen again by the same device model only adds to the count of its entry, keyed by model id and nonce
+    std::unordered_map<std::string, size_t> entryIds;
+    std::vector<std::string> deviceNames;
+    std::map<std::string, uint16_t> deviceIds;
+    const std::string header = "Identified device as ";
+    size_t nonces = 0;
+    size_t tooLong = 0;
+
+    for (auto filename: logs) {
+        std::ifstream log(filename);
+        struct stat st;
+        if (!log || stat(filename, &st) < 0) {
+            error("ERROR: Unable to read %s\n", filename);
+            return -1;
+        }
+
+        std::string device = "unknown";
+        std::string line;
+        while (std::getline(log, line)) {
+            if (line.compare(0, header.size(), header) == 0) {
+                device = line.substr(header.size());
+                device.erase(device.find_last_not_of(' ')+1);
+                continue;
+            }
+
+            std::string nonce;
+            std::string sepNonce;
+            if (!splitNonceLine(line, nonce, sepNonce) || nonce.empty()) continue;
+            if (nonce.size() > NONCE_INDEX_NONCE_SIZE) {
+                tooLong++;
+                continue;
+            }
+
+            auto id = deviceIds.find(device);
+            if (id == deviceIds.end()) {
+                if (deviceNames.size() > UINT16_MAX) {
+                    error("ERROR: Too many device models\n");
+                    return -1;
+                }
+                id = deviceIds.insert(std::make_pair(device, (uint16_t)deviceNames.size())).first;
+                deviceNames.push_back(device);
+            }
+
+            nonces++;
+            std::string key((const char*)&id->second, sizeof(id->second));
+            key += nonce;
+            auto known = entryIds.find(key);
+            if (known != entryIds.end()) {
+                struct nonce_index_entry_t& entry = entries[known->second];
+                if (entry.count < UINT32_MAX) entry.count++;
+                if ((uint64_t)st.st_mtime < entry.first_seen) entry.first_seen = (uint64_t)st.st_mtime;
+                continue;
+            }
+
+            struct nonce_index_entry_t entry;
+            memset(&entry, 0, sizeof(entry));
+            memcpy(entry.nonce, nonce.data(), nonce.size());
+            entry.nonce_size = (uint8_t)nonce.size();
+            entry.device = id->second;
+            entry.count = 1;
+            entry.first_seen = (uint64_t)st.st_mtime;
+            entryIds.insert(std::make_pair(key, entries.size()));
+            entries.push_back(entry);
+        }
+    }
+    entryIds.clear();
+    if (tooLong) {
+        std::cout << "Skipped " << tooLong << " nonces longer than the " << NONCE_INDEX_NONCE_SIZE << " bytes an index entry holds" << std::endl;
+    }
+
+    std::vector<char> devices(deviceNames.size() * NONCE_INDEX_DEVICE_SIZE, 0);
+    for (size_t i = 0; i < deviceNames.size(); i++) {
+        snprintf(&devices[i * NONCE_INDEX_DEVICE_SIZE], NONCE_INDEX_DEVICE_SIZE, "%s", deviceNames[i].c_str());
+    }
+
+    if (nonce_index_write(indexFilename, entries.data(), entries.size(), (const char (*)[NONCE_INDEX_DEVICE_SIZE])devices.data(), (uint32_t)deviceNames.size()) < 0) {
+        return -1;
+    }
+
+    struct nonce_index_t* index = nonce_index_open(indexFilename);
+    if (!index) return -1;
+    std::cout << "Indexed " << nonces << " nonces from " << logs.size() << " logs as " << index->header->entry_count
+              << " entries of " << deviceNames.size() << " device models in " << indexFilename << std::endl;
+    nonce_index_close(index);
+    return 0;
+}
+
+int cmd_index_query(const char* indexFilename, const std::vector<const char*>& nonces){
+    struct nonce_index_t* index = nonce_index_open(indexFilename);
+    if (!index) return -1;
+
+    for (auto token: nonces) {
+        std::string nonce;
+        bool isSep = false;
+        if (!parseNonceToken(token, nonce, isSep)) {
+            std::cout << token << ": not a nonce" << std::endl;
+            continue;
+        }
+
+        const struct nonce_index_entry_t* entry = NULL;
+        uint64_t found = 0;
+        if (nonce_index_may_contain(index, (const unsigned char*)nonce.data(), nonce.size())) {
+            found = nonce_index_find(index, (const unsigned char*)nonce.data(), nonce.size(), &entry);
+        }
+        if (!found) {
+            std::cout << nonceToHex(nonce) << ": never seen" << std::endl;
+            continue;
+        }
+
+        std::cout << nonceToHex(nonce) << ":" << std::endl;
+        for (uint64_t i = 0; i < found; i++, entry++) {
+            char date[32];
+            time_t firstSeen = (time_t)entry->first_seen;
+            strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", localtime(&firstSeen));
+            printf("    %-32s %6u times, first seen %s\n", nonce_index_device(index, entry->device), entry->count, date);
+        }
+    }
+
+    nonce_index_close(index);
+    return 0;
+}
+
+// Nonces that two devices or two iOS versions have in common point at a
+// deterministic generator, so every pair of logs is compared.
+int cmd_compare(const std::vector<const char*>& logs){
+    std::vector<struct nonce_set_t*> sets;
+    int result = 0;
+
+    for (auto filename: logs) {
+        struct nonce_set_t* set = nonce_set_new();
+        if (!set || nonce_set_load(set, filename) < 0) {
+            nonce_set_free(set);
+            result = -1;
+            break;
+        }
+        sets.push_back(set);
+        printf("%-40s %12zu distinct nonces\n", filename, set->count);
+    }
+    std::cout << std::endl;
+
+    for (size_t i = 0; result == 0 && i < sets.size(); i++) {
+        for (size_t j = i+1; j < sets.size(); j++) {
+            std::vector<size_t> matches(std::min(sets[i]->count, sets[j]->count));
+            size_t common = nonce_set_intersect(sets[i], sets[j], matches.data());
+            size_t total = sets[i]->count + sets[j]->count - common;
+
+            std::cout << logs[i] << " vs " << logs[j] << std::endl;
+            printf("    common:            %12zu\n", common);
+            printf("    only in the first: %12zu\n", sets[i]->count - common);
+            printf("    only in the second:%12zu\n", sets[j]->count - common);
+            printf("    Jaccard similarity: %.6f\n", (total) ? (double)common/total : 0.0);
+            for (size_t k = 0; k < common && k < 5; k++) {
+                std::string nonce((const char*)sets[i]->nonces[matches[k]], sets[i]->sizes[matches[k]]);
+                std::cout << "    " << nonceToHex(nonce) << std::endl;
+            }
+            if (common > 5) std::cout << "    ..." << std::endl;
+            std::cout << std::endl;
+        }
+    }
+
+    for (auto set: sets) nonce_set_free(set);
+    return result;
+}
+
+void cmd_periodicity(const char* filename){
+    std::vector<const AnalyzerInfo*> selected;
+    parseAnalyzers("periodicity", selected);
+    runAnalyzers(std::vector<const char*>(1, filename), selected);
+}
+
+static void printGeneratorMatch(uint64_t generator, int hash, const unsigned char* nonce, size_t size, void* user_data){
+    std::string hexNonce((const char*)nonce, size);
+    printf("Generator 0x%016llx -> ApNonce %s (%s)\n", (unsigned long long)generator, nonceToHex(hexNonce).c_str(), gensearch_hash_name(hash));
+    (*(size_t*)user_data)++;
+}
+
+int cmd_generator_search(const char* spec, const std::vector<const char*>& logs){
+    struct gensearch_config_t config;
+    struct nonce_set_t* targets = nonce_set_new();
+    size_t matches = 0;
+
+    if (gensearch_parse_config(spec, &config) < 0 || !targets) {
+        nonce_set_free(targets);
+        return -1;
+    }
+    for (auto filename: logs) {
+        // nonce_set_load finishes the set, adding more logs to it keeps it sorted
+        if (nonce_set_load(targets, filename) < 0) {
+            nonce_set_free(targets);
+            return -1;
+        }
+    }
+    printf("Loaded %zu distinct nonces\n", targets->count);
+
+    uint64_t hashed = gensearch_run(&config, targets, printGeneratorMatch, &matches);
+    idevicerestore_log_flush();
+    printf("Hashed %llu generators, %zu of them produced a collected nonce\n", (unsigned long long)hashed, matches);
+
+    nonce_set_free(targets);
+    return 0;
+}
+
+int cmd_dict_build(const char* dictFilename, const char* spec){
+    struct gensearch_config_t config;
+
+    if (gensearch_parse_config(spec, &config) < 0) return -1;
+    return gendict_build(dictFilename, &config);
+}
+
+// One segment per log; the counts of all logs are written as one sorted run per section.
+int cmd_snapshot(const char* snapshotFilename, const std::vector<const char*>& logs){
+    NonceCounts counts;
+    std::vector<struct snapshot_segment_t> segments;
+    char host[SNAPSHOT_HOST_SIZE] = "";
+
+    gethostname(host, sizeof(host)-1);
+    for (auto filename: logs) {
+        struct snapshot_segment_t segment;
+        int amount = counts.amount;
+        int sepAmount = counts.sepAmount;
+
+        if (!loadNonceLog(filename, counts)) {
+            error("ERROR: Unable to read %s\n", filename);
+            return -1;
+        }
+        memset(&segment, 0, sizeof(segment));
+        snprintf(segment.source, sizeof(segment.source), "%s", filename);
+        snprintf(segment.host, sizeof(segment.host), "%s", host);
+        segment.created = (uint64_t)time(NULL);
+        segment.records = counts.amount - amount;
+        segment.sep_records = counts.sepAmount - sepAmount;
+        segments.push_back(segment);
+    }
+
+    struct snapshot_writer_t* writer = snapshot_writer_new(snapshotFilename);
+    if (!writer) return -1;
+    for (auto& segment: segments) snapshot_writer_add_segment(writer, &segment);
+
+    // what is left after taking the pairs out was seen without the other nonce
+    std::map<std::string, int> loneApNonces = counts.apNonces;
+    std::map<std::string, int> loneSepNonces = counts.sepNonces;
+    for (auto& p: counts.pairs) {
+        loneApNonces[p.first.first] -= p.second;
+        loneSepNonces[p.first.second] -= p.second;
+    }
+
+    struct snapshot_record_t record;
+    memset(&record, 0, sizeof(record));
+    snapshot_writer_begin_section(writer, SNAPSHOT_PAIRS);
+    for (auto& p: counts.pairs) {
+        record.nonce = (const unsigned char*)p.first.first.data();
+        record.size = p.first.first.size();
+        record.sep = (const unsigned char*)p.first.second.data();
+        record.sep_size = p.first.second.size();
+        record.count = p.second;
+        snapshot_writer_add(writer, &record);
+    }
+    record.sep = NULL;
+    record.sep_size = 0;
+    snapshot_writer_begin_section(writer, SNAPSHOT_APNONCES);
+    for (auto& p: loneApNonces) {
+        if (p.second <= 0) continue;
+        record.nonce = (const unsigned char*)p.first.data();
+        record.size = p.first.size();
+        record.count = p.second;
+        snapshot_writer_add(writer, &record);
+    }
+    snapshot_writer_begin_section(writer, SNAPSHOT_SEPNONCES);
+    for (auto& p: loneSepNonces) {
+        if (p.second <= 0) continue;
+        record.nonce = (const unsigned char*)p.first.data();
+        record.size = p.first.size();
+        record.count = p.second;
+        snapshot_writer_add(writer, &record);
+    }
+    if (snapshot_writer_finish(writer) < 0) return -1;
+
+    printf("Wrote %d nonces (%zu distinct) of %zu logs to %s\n", counts.amount, counts.apNonces.size(), logs.size(), snapshotFilename);
+    return 0;
+}
+
+int cmd_merge(const char* snapshotFilename, const std::vector<const char*>& snapshots){
+    if (snapshot_merge(snapshotFilename, snapshots.data(), snapshots.size()) < 0) return -1;
+    printf("Merged %zu snapshots into %s\n", snapshots.size(), snapshotFilename);
+    return 0;
+}
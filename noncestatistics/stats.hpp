@@ -4,9 +4,98 @@
 #include <map>
 #include <vector>
 #include <string>
+#include <unordered_map>
+#include "snapshot.h"
+
+#define STOP_CONTINUE   0
+#define STOP_PRECISION  1
+#define STOP_WEAK       2
+#define STOP_STRONG     3
+
+// When to end a collection early. precision stops once the confidence interval
+// of the nonce space estimate is narrow enough, weak/strong run a sequential
+// probability ratio test of "the space has weak nonces" against "it has strong
+// nonces" with error rates alpha and beta. A value of 0 disables a rule.
+struct StopRule {
+    double precision = 0;
+    double confidence = 0.95;
+    double weak = 0;
+    double strong = 0;
+    double alpha = 0.01;
+    double beta = 0.01;
+};
+
+// Online estimate of the effective nonce space from the number of colliding
+// pairs, N = n(n-1)/2C for n nonces of which C pairs are equal.
+class SpaceEstimator {
+public:
+    void add(const std::string& nonce, long times = 1);
+    long samples() const { return n; }
+    long collisions() const { return c; }
+    long distinct() const { return (long)counts.size(); }
+    long singletons() const { return f1; }
+    long count(const std::string& nonce) const;
+    double estimate() const;
+    void interval(double confidence, double& low, double& high) const;
+    double logLikelihoodRatio(double weak, double strong) const;
+    int check(const StopRule& rule) const;
+
+private:
+    std::unordered_map<std::string, long> counts;
+    long n = 0;
+    long c = 0;
+    long f1 = 0;
+};
+
+// How much of a log --sample reads: nonces are drawn until size of them are
+// in the sample or seconds have passed. A seed of 0 picks a random one.
+struct SampleSpec {
+    long size = 100000;
+    double seconds = 10;
+    double confidence = 0.95;
+    unsigned long long seed = 0;
+};
+
+// What -s counts in a log, or reads back from a snapshot. Nonces are raw bytes.
+struct NonceCounts {
+    std::map<std::string, int> apNonces;
+    std::map<std::string, int> sepNonces;
+    std::map<std::pair<std::string, std::string>, int> pairs;
+    int amount = 0;
+    int sepAmount = 0;
+};
+
+bool parseNonceToken(const std::string& token, std::string& nonce, bool& isSep);
+std::string nonceToHex(const std::string& nonce);
+// z such that a standard normal lies within +-z with the given probability
+double normalQuantile(double confidence);
+bool parseStopRule(const char* spec, StopRule& rule);
+bool parseSampleSpec(const char* spec, SampleSpec& sample);
+std::string estimateSummary(const SpaceEstimator& estimator, double confidence);
 
 std::vector<std::pair<std::string, int> > sortNonceList(std::map<std::string, int>& nonceList);
-void cmd_statistics(const char* filename);
+// the whitespace separated tokens of a line that may be nonces, as offset and length
+void tokenizeNonceLine(const std::string& line, std::vector<std::pair<size_t, size_t> >& tokens);
+// the first ApNonce among the tokens and the nonce after it, false if there is none
+bool decodeNonceTokens(const std::string& line, const std::vector<std::pair<size_t, size_t> >& tokens, std::string& apNonce, std::string& sepNonce);
+// the first ApNonce of the line and the nonce after it, false if it has none
+bool splitNonceLine(const std::string& line, std::string& apNonce, std::string& sepNonce);
+void countNonces(const std::string& apNonce, const std::string& sepNonce, NonceCounts& counts);
+// returns the ApNonce of the line, empty if it has none
+std::string countNonceLine(const std::string& line, NonceCounts& counts);
+bool loadNonceLog(const char* filename, NonceCounts& counts);
+bool loadSnapshot(const char* filename, NonceCounts& counts, std::vector<struct snapshot_segment_t>* segments);
+void printStatistics(NonceCounts& counts, const char* dictFilename = NULL);
+void cmd_statistics(const char* filename, const char* dictFilename = NULL);
+int cmd_sample(const char* filename, const SampleSpec& sample);
+int cmd_index_build(const char* indexFilename, const std::vector<const char*>& logs);
+void cmd_periodicity(const char* filename);
+int cmd_compare(const std::vector<const char*>& logs);
+int cmd_generator_search(const char* spec, const std::vector<const char*>& logs);
+int cmd_dict_build(const char* dictFilename, const char* spec);
+int cmd_snapshot(const char* snapshotFilename, const std::vector<const char*>& logs);
+int cmd_merge(const char* snapshotFilename, const std::vector<const char*>& snapshots);
+int cmd_index_query(const char* indexFilename, const std::vector<const char*>& nonces);
 
 
 #endif /* stats_hpp */
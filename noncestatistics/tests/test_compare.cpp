@@ -0,0 +1,91 @@
+#include <set>
+#include <vector>
+#include "tests.hpp"
+#include "../hex.h"
+#include "../nonce_set.h"
+#include "../stats.hpp"
+
+static void addNonce(struct nonce_set_t* set, const std::string& hex){
+    std::vector<unsigned char> nonce(hex.size()/2);
+    hex_decode(nonce.data(), hex.data(), hex.size());
+    nonce_set_add(set, nonce.data(), nonce.size());
+}
+
+// intersects two sets of the nonces with the given numbers and checks the matches against std::set
+static void checkIntersection(const std::vector<std::string>& a, const std::vector<std::string>& b, int uniqueKeys){
+    struct nonce_set_t* first = nonce_set_new();
+    struct nonce_set_t* second = nonce_set_new();
+    for (auto& nonce: a) addNonce(first, nonce);
+    for (auto& nonce: b) addNonce(second, nonce);
+    nonce_set_finish(first);
+    nonce_set_finish(second);
+    CHECK(first->unique_keys == uniqueKeys);
+
+    std::set<std::string> inFirst(a.begin(), a.end());
+    std::set<std::string> common;
+    for (auto& nonce: b) if (inFirst.count(nonce)) common.insert(nonce);
+
+    std::vector<size_t> matches(first->count);
+    CHECK(first->count == inFirst.size());
+    CHECK(nonce_set_intersect(first, second, matches.data()) == common.size());
+    CHECK(nonce_set_intersect(second, first, NULL) == common.size());
+
+    std::set<std::string> found;
+    for (size_t i = 0; i < common.size(); i++) {
+        std::string nonce((const char*)first->nonces[matches[i]], first->sizes[matches[i]]);
+        found.insert(nonceToHex(nonce));
+    }
+    CHECK(found == common);
+
+    nonce_set_free(first);
+    nonce_set_free(second);
+}
+
+TEST(compareCountsCommonNonces){
+    std::string firstLog = testPath("first.log");
+    std::string secondLog = testPath("second.log");
+    writeFile(firstLog,
+        "Identified device as n71ap, iPhone8,1 \n" +
+        logLine(1, testNonce(1), testNonce(100)) +
+        logLine(2, testNonce(2), testNonce(101)) +
+        logLine(3, testNonce(1), testNonce(102)) +
+        logLine(4, testNonce(3)) +
+        logLine(5, testNonce(4)));
+    writeFile(secondLog,
+        "Identified device as d10ap, iPhone9,1 \n" +
+        logLine(1, testNonce(4)) +
+        logLine(2, testNonce(100)) +
+        logLine(3, testNonce(1)) +
+        logLine(4, testNonce(5), testNonce(2)));
+
+    std::string output = captureOutput([&]{
+        CHECK(cmd_compare({firstLog.c_str(), secondLog.c_str()}) == 0);
+    });
+    // SepNonces don't count, a SepNonce of the first log is an ApNonce of the second
+    CHECK(contains(output, "           4 distinct nonces\n"));
+    CHECK(!contains(output, "           5 distinct nonces\n"));
+    CHECK(contains(output, "common:                       2\n"));
+    CHECK(contains(output, "only in the first:            2\n"));
+    CHECK(contains(output, "only in the second:           2\n"));
+    CHECK(contains(output, "Jaccard similarity: 0.333333"));
+    CHECK(contains(output, testNonce(1)) && contains(output, testNonce(4)));
+    CHECK(!contains(output, "    " + testNonce(2)));
+}
+
+TEST(intersectionMatchesReference){
+    std::vector<std::string> a;
+    std::vector<std::string> b;
+    for (unsigned i = 0; i < 3000; i++) a.push_back(testNonce(i*3));
+    for (unsigned i = 0; i < 2000; i++) b.push_back(testNonce(i*5));
+    // duplicates are dropped by nonce_set_finish
+    a.push_back(testNonce(0));
+    checkIntersection(a, b, 1);
+
+    // a nonce and a longer one with the same first bytes share a key, that takes the slow path
+    a.push_back(testNonce(6, 32));
+    b.push_back(testNonce(6, 32));
+    b.push_back(testNonce(5, 32));
+    checkIntersection(a, b, 0);
+
+    checkIntersection({}, b, 1);
+}
@@ -0,0 +1,81 @@
+#include <vector>
+#include "tests.hpp"
+#include "../hex.h"
+#include "../gendict.h"
+#include "../stats.hpp"
+
+static std::string generatorNonce(uint64_t generator, int hash){
+    unsigned char nonce[GENSEARCH_SHA384_SIZE];
+    char hex[2*GENSEARCH_SHA384_SIZE+1];
+    gensearch_nonce(generator, hash, nonce);
+    hex_encode(hex, nonce, (hash == GENSEARCH_SHA1) ? GENSEARCH_SHA1_SIZE : GENSEARCH_SHA384_SIZE);
+    return hex;
+}
+
+static bool lookupGenerator(const struct gendict_t* dict, uint64_t generator, int hash, size_t size){
+    unsigned char nonce[GENSEARCH_SHA384_SIZE];
+    uint64_t found = 0;
+    int foundHash = 0;
+    gensearch_nonce(generator, hash, nonce);
+    return gendict_lookup(dict, nonce, size, &found, &foundHash) && found == generator && foundHash == hash;
+}
+
+TEST(dictionaryFindsEveryGenerator){
+    std::string dictFile = testPath("generators.dict");
+    struct gensearch_config_t config;
+    CHECK(gensearch_parse_config("low=10,range=0x123400000-0x1234000ff", &config) == 0);
+    captureOutput([&]{
+        CHECK(gendict_build(dictFile.c_str(), &config) == 0);
+    });
+
+    struct gendict_t* dict = gendict_open(dictFile.c_str());
+    CHECK(dict != NULL);
+    if (!dict) return;
+
+    unsigned missing = 0;
+    for (uint64_t generator = 0; generator < 1024; generator++) {
+        if (!lookupGenerator(dict, generator, GENSEARCH_SHA1, GENSEARCH_SHA1_SIZE)) missing++;
+        if (!lookupGenerator(dict, generator, GENSEARCH_SHA384, GENSEARCH_SHA384_SIZE)) missing++;
+    }
+    for (uint64_t generator = 0x123400000; generator <= 0x1234000ff; generator++) {
+        if (!lookupGenerator(dict, generator, GENSEARCH_SHA384, GENSEARCH_SHA384_SIZE)) missing++;
+    }
+    CHECK(missing == 0);
+
+    // generators outside the families, and nonces of the wrong size, are unknown
+    unsigned char nonce[GENSEARCH_SHA384_SIZE];
+    uint64_t generator = 0;
+    int hash = 0;
+    gensearch_nonce(1024, GENSEARCH_SHA1, nonce);
+    CHECK(!gendict_lookup(dict, nonce, GENSEARCH_SHA1_SIZE, &generator, &hash));
+    gensearch_nonce(0x123400100, GENSEARCH_SHA384, nonce);
+    CHECK(!gendict_lookup(dict, nonce, GENSEARCH_SHA384_SIZE, &generator, &hash));
+    gensearch_nonce(7, GENSEARCH_SHA1, nonce);
+    CHECK(!gendict_lookup(dict, nonce, 16, &generator, &hash));
+    gendict_close(dict);
+}
+
+TEST(statisticsNameGenerators){
+    std::string dictFile = testPath("statistics.dict");
+    std::string log = testPath("statistics.log");
+    struct gensearch_config_t config;
+    CHECK(gensearch_parse_config("low=8", &config) == 0);
+    captureOutput([&]{
+        CHECK(gendict_build(dictFile.c_str(), &config) == 0);
+    });
+    writeFile(log,
+        "Identified device as n71ap, iPhone8,1 \n" +
+        logLine(1, generatorNonce(0x2a, GENSEARCH_SHA1)) +
+        logLine(2, testNonce(1)) +
+        logLine(3, generatorNonce(0x2a, GENSEARCH_SHA1)) +
+        logLine(4, generatorNonce(0x2a, GENSEARCH_SHA1)) +
+        logLine(5, testNonce(1)));
+
+    std::string output = captureOutput([&]{
+        cmd_statistics(log.c_str(), dictFile.c_str());
+    });
+    CHECK(contains(output, generatorNonce(0x2a, GENSEARCH_SHA1)));
+    CHECK(contains(output, "generator 0x000000000000002a (SHA-1)"));
+    CHECK(contains(output, testNonce(1)));
+    CHECK(!contains(output, "(SHA-384)"));
+}
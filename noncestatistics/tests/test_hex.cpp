@@ -0,0 +1,72 @@
+#include <string.h>
+#include <string>
+#include "tests.hpp"
+#include "../hex.h"
+
+// every length around the 16 and 32 byte blocks of the vector paths
+#define HEX_MAX_SIZE 100
+
+static std::string referenceHex(const unsigned char* data, size_t size){
+    static const char digits[] = "0123456789abcdef";
+    std::string hex;
+    for (size_t i = 0; i < size; i++) {
+        hex += digits[data[i] >> 4];
+        hex += digits[data[i] & 0xf];
+    }
+    return hex;
+}
+
+static void fillBytes(unsigned char* data, size_t size, unsigned seed){
+    for (size_t i = 0; i < size; i++) {
+        seed = seed*1103515245 + 12345;
+        data[i] = (unsigned char)(seed >> 16);
+    }
+}
+
+TEST(hexEncodeMatchesReference){
+    unsigned char data[HEX_MAX_SIZE];
+    char hex[2*HEX_MAX_SIZE+1];
+
+    for (size_t size = 0; size <= HEX_MAX_SIZE; size++) {
+        fillBytes(data, size, (unsigned)size);
+        memset(hex, 'x', sizeof(hex));
+        hex_encode(hex, data, size);
+        CHECK(std::string(hex) == referenceHex(data, size));
+    }
+}
+
+TEST(hexDecodeRoundTrips){
+    unsigned char data[HEX_MAX_SIZE];
+    unsigned char decoded[HEX_MAX_SIZE];
+
+    for (size_t size = 0; size <= HEX_MAX_SIZE; size++) {
+        fillBytes(data, size, (unsigned)size+1);
+        std::string hex = referenceHex(data, size);
+        CHECK(hex_decode(decoded, hex.data(), hex.size()) == 0);
+        CHECK(memcmp(decoded, data, size) == 0);
+
+        for (auto& c: hex) if (c >= 'a') c -= 'a'-'A';
+        memset(decoded, 0, sizeof(decoded));
+        CHECK(hex_decode(decoded, hex.data(), hex.size()) == 0);
+        CHECK(memcmp(decoded, data, size) == 0);
+    }
+}
+
+TEST(hexDecodeRejectsNonDigits){
+    unsigned char decoded[HEX_MAX_SIZE];
+    const char invalid[] = {'g', 'G', '/', ':', '@', '`', ' ', '\0', (char)0x80};
+
+    for (size_t size = 1; size <= HEX_MAX_SIZE; size += 7) {
+        std::string hex(2*size, 'a');
+        for (size_t pos = 0; pos < hex.size(); pos++) {
+            for (char c: invalid) {
+                std::string bad = hex;
+                bad[pos] = c;
+                CHECK(hex_decode(decoded, bad.data(), bad.size()) == -1);
+                CHECK(hex_span(bad.data(), bad.size()) == pos);
+            }
+        }
+        CHECK(hex_span(hex.data(), hex.size()) == hex.size());
+    }
+    CHECK(hex_decode(decoded, "abc", 3) == -1);
+}
@@ -0,0 +1,96 @@
+#include <vector>
+#include "tests.hpp"
+#include "../hex.h"
+#include "../nonce_index.h"
+#include "../stats.hpp"
+
+static uint64_t findNonce(const struct nonce_index_t* index, const std::string& hex, const struct nonce_index_entry_t** first){
+    std::vector<unsigned char> nonce(hex.size()/2);
+    hex_decode(nonce.data(), hex.data(), hex.size());
+    *first = NULL;
+    if (!nonce_index_may_contain(index, nonce.data(), nonce.size())) return 0;
+    return nonce_index_find(index, nonce.data(), nonce.size(), first);
+}
+
+TEST(indexCountsNoncesPerDeviceModel){
+    std::string log = testPath("index.log");
+    std::string indexFile = testPath("index.idx");
+    writeFile(log,
+        "Identified device as n71ap, iPhone8,1 \n" +
+        logLine(1, testNonce(1), testNonce(100)) +
+        logLine(2, testNonce(2)) +
+        logLine(3, testNonce(1), testNonce(101)) +
+        logLine(4, testNonce(1)) +
+        logLine(5, testNonce(3, 48)) +
+        "Identified device as d10ap, iPhone9,1 \n" +
+        logLine(1, testNonce(1)) +
+        logLine(2, testNonce(4, 32)));
+
+    std::string output = captureOutput([&]{
+        CHECK(cmd_index_build(indexFile.c_str(), {log.c_str()}) == 0);
+    });
+    CHECK(contains(output, "Skipped 1 nonces longer than the 32 bytes"));
+    CHECK(contains(output, "Indexed 6 nonces from 1 logs as 4 entries of 2 device models"));
+
+    struct nonce_index_t* index = nonce_index_open(indexFile.c_str());
+    CHECK(index != NULL);
+    if (!index) return;
+    CHECK(index->header->entry_count == 4);
+
+    const struct nonce_index_entry_t* entry = NULL;
+    CHECK(findNonce(index, testNonce(1), &entry) == 2);
+    if (entry) {
+        uint32_t counts[2] = {0, 0};
+        for (int i = 0; i < 2; i++) {
+            std::string device = nonce_index_device(index, entry[i].device);
+            counts[device == "d10ap, iPhone9,1"] = entry[i].count;
+        }
+        CHECK(counts[0] == 3 && counts[1] == 1);
+    }
+    CHECK(findNonce(index, testNonce(2), &entry) == 1);
+    CHECK(entry && entry->count == 1 && std::string(nonce_index_device(index, entry->device)) == "n71ap, iPhone8,1");
+    CHECK(findNonce(index, testNonce(4, 32), &entry) == 1);
+    CHECK(entry && entry->nonce_size == 32);
+
+    // SepNonces, skipped nonces and prefixes of indexed ones were never seen as ApNonces
+    CHECK(findNonce(index, testNonce(100), &entry) == 0);
+    CHECK(findNonce(index, testNonce(3, 48), &entry) == 0);
+    CHECK(findNonce(index, testNonce(4, 32).substr(0, 40), &entry) == 0);
+    nonce_index_close(index);
+
+    output = captureOutput([&]{
+        CHECK(cmd_index_query(indexFile.c_str(), {testNonce(2).c_str(), testNonce(5).c_str(), "xyz"}) == 0);
+    });
+    CHECK(contains(output, testNonce(2) + ":\n    n71ap, iPhone8,1"));
+    CHECK(contains(output, testNonce(5) + ": never seen"));
+    CHECK(contains(output, "xyz: not a nonce"));
+}
+
+TEST(indexBloomHasNoFalseNegatives){
+    std::string log = testPath("bloom.log");
+    std::string indexFile = testPath("bloom.idx");
+    std::string contents = "Identified device as n71ap, iPhone8,1 \n";
+    for (unsigned i = 0; i < 2000; i++) contents += logLine(i+1, testNonce(i*7919));
+    writeFile(log, contents);
+
+    captureOutput([&]{
+        CHECK(cmd_index_build(indexFile.c_str(), {log.c_str()}) == 0);
+    });
+    struct nonce_index_t* index = nonce_index_open(indexFile.c_str());
+    CHECK(index != NULL);
+    if (!index) return;
+
+    const struct nonce_index_entry_t* entry = NULL;
+    unsigned missing = 0;
+    unsigned falsePositives = 0;
+    for (unsigned i = 0; i < 2000; i++) {
+        if (findNonce(index, testNonce(i*7919), &entry) != 1) missing++;
+        std::vector<unsigned char> other(20);
+        std::string hex = testNonce(i*7919+1);
+        hex_decode(other.data(), hex.data(), hex.size());
+        if (nonce_index_may_contain(index, other.data(), other.size())) falsePositives++;
+    }
+    CHECK(missing == 0);
+    CHECK(falsePositives < 100);
+    nonce_index_close(index);
+}
@@ -0,0 +1,77 @@
+#include <vector>
+#include "tests.hpp"
+#include "../analyzer.hpp"
+
+#define DEVICE_HEADER "Identified device as n71ap, iPhone8,1 \n"
+
+// a log with one collection per sequence, the numbers are the nonces of the reboots
+static std::string periodicityOf(const std::vector<std::vector<unsigned> >& collections){
+    std::string log = testPath("periodicity.log");
+    std::string contents;
+    for (auto& collection: collections) {
+        contents += DEVICE_HEADER;
+        unsigned line = 0;
+        for (auto nonce: collection) contents += logLine(++line, testNonce(nonce), testNonce(nonce+1000000));
+    }
+    writeFile(log, contents);
+
+    std::vector<const AnalyzerInfo*> selected;
+    std::string output = captureOutput([&]{
+        CHECK(parseAnalyzers("periodicity", selected));
+        CHECK(runAnalyzers({log.c_str()}, selected) == 0);
+    });
+    return output;
+}
+
+static std::vector<unsigned> randomNonces(size_t count, unsigned space, unsigned seed){
+    std::vector<unsigned> nonces;
+    for (size_t i = 0; i < count; i++) {
+        seed = seed*1103515245 + 12345;
+        nonces.push_back((seed >> 8) % space);
+    }
+    return nonces;
+}
+
+TEST(periodicityFindsCycle){
+    std::vector<unsigned> cycle;
+    for (unsigned i = 0; i < 60; i++) cycle.push_back(i % 7);
+    std::string output = periodicityOf({cycle, cycle});
+
+    CHECK(contains(output, "reboots:                                     120\n"));
+    CHECK(contains(output, "collections:                                 2\n"));
+    CHECK(contains(output, "distinct nonces:                             7\n"));
+    CHECK(contains(output, "The sequence repeats with a period of 7 reboots (100.00% of positions match)"));
+}
+
+TEST(periodicityFindsReplayedRun){
+    // reboots 50 to 89 come back 200 reboots later, everything else is new
+    std::vector<unsigned> nonces;
+    for (unsigned i = 0; i < 400; i++) nonces.push_back((i >= 250 && i < 290) ? i-200 : i);
+    std::string output = periodicityOf({nonces});
+
+    CHECK(contains(output, "Part of the sequence is replayed with a period of 200 reboots"));
+    CHECK(contains(output, "40 reboots in a row from (" + testPath("periodicity.log") + ", 251) repeat those 200 reboots before"));
+}
+
+TEST(periodicityIgnoresChance){
+    std::string output = periodicityOf({randomNonces(400, 40, 1)});
+
+    CHECK(!contains(output, "No nonce ever repeated"));
+    CHECK(contains(output, "No period found"));
+}
+
+TEST(periodicityKeepsCollectionsApart){
+    // the second collection replays the first, but nothing repeats within either
+    std::vector<unsigned> nonces;
+    for (unsigned i = 0; i < 50; i++) nonces.push_back(i);
+    std::string output = periodicityOf({nonces, nonces});
+
+    CHECK(contains(output, "nonces seen before in their collection:      0\n"));
+    CHECK(contains(output, "No nonce ever repeated, there is nothing periodic about this sequence"));
+}
+
+TEST(periodicityOfConstantNonce){
+    std::string output = periodicityOf({std::vector<unsigned>(30, 5)});
+
+    CHECK(contains(output, "Every reboot gave the same ApNonce, there is no sequence to repeat"));
+}
@@ -0,0 +1,99 @@
+#include <vector>
+#include "tests.hpp"
+#include "../snapshot.h"
+#include "../stats.hpp"
+
+static bool sameCounts(const NonceCounts& a, const NonceCounts& b){
+    return a.apNonces == b.apNonces && a.sepNonces == b.sepNonces && a.pairs == b.pairs &&
+           a.amount == b.amount && a.sepAmount == b.sepAmount;
+}
+
+TEST(mergedSnapshotsCountLikeTheirLogs){
+    std::string firstLog = testPath("shard1.log");
+    std::string secondLog = testPath("shard2.log");
+    std::string first = testPath("shard1.snap");
+    std::string second = testPath("shard2.snap");
+    std::string merged = testPath("merged.snap");
+    std::string twice = testPath("twice.snap");
+    // pairs, ApNonces without a SepNonce and a nonce that is both, split over two hosts
+    writeFile(firstLog,
+        "Identified device as n71ap, iPhone8,1 \n" +
+        logLine(1, testNonce(1), testNonce(100)) +
+        logLine(2, testNonce(1), testNonce(100)) +
+        logLine(3, testNonce(2)) +
+        logLine(4, testNonce(3), testNonce(101)) +
+        logLine(5, testNonce(2)));
+    writeFile(secondLog,
+        "Identified device as n71ap, iPhone8,1 \n" +
+        logLine(1, testNonce(1), testNonce(100)) +
+        logLine(2, testNonce(4, 32)) +
+        logLine(3, testNonce(1)) +
+        logLine(4, testNonce(3), testNonce(102)));
+
+    std::string output = captureOutput([&]{
+        CHECK(cmd_snapshot(first.c_str(), {firstLog.c_str()}) == 0);
+        CHECK(cmd_snapshot(second.c_str(), {secondLog.c_str()}) == 0);
+        CHECK(cmd_merge(merged.c_str(), {first.c_str(), second.c_str()}) == 0);
+        CHECK(cmd_merge(twice.c_str(), {merged.c_str(), merged.c_str()}) == 0);
+    });
+    CHECK(contains(output, "Wrote 5 nonces (3 distinct) of 1 logs"));
+    CHECK(contains(output, "Merged 2 snapshots into " + merged));
+    CHECK(snapshot_detect(merged.c_str()) == 1);
+    CHECK(snapshot_detect(firstLog.c_str()) == 0);
+
+    NonceCounts logs;
+    CHECK(loadNonceLog(firstLog.c_str(), logs));
+    CHECK(loadNonceLog(secondLog.c_str(), logs));
+    CHECK(logs.amount == 9 && logs.sepAmount == 5);
+
+    NonceCounts snapshot;
+    std::vector<struct snapshot_segment_t> segments;
+    CHECK(loadSnapshot(merged.c_str(), snapshot, &segments));
+    CHECK(sameCounts(snapshot, logs));
+    CHECK(segments.size() == 2);
+    if (segments.size() == 2) {
+        CHECK(std::string(segments[0].source) == firstLog && segments[0].records == 5 && segments[0].sep_records == 3);
+        CHECK(std::string(segments[1].source) == secondLog && segments[1].records == 4 && segments[1].sep_records == 2);
+    }
+
+    // merging a snapshot with itself doubles every count
+    NonceCounts doubled;
+    CHECK(loadSnapshot(twice.c_str(), doubled, NULL));
+    CHECK(loadNonceLog(firstLog.c_str(), logs));
+    CHECK(loadNonceLog(secondLog.c_str(), logs));
+    CHECK(sameCounts(doubled, logs));
+}
+
+TEST(snapshotRecordsAreSorted){
+    std::string snapshotFile = testPath("sorted.snap");
+    std::string log = testPath("sorted.log");
+    std::string contents = "Identified device as n71ap, iPhone8,1 \n";
+    for (unsigned i = 0; i < 500; i++) contents += logLine(i+1, testNonce(i*7 % 300), (i % 3) ? testNonce(i % 50 + 1000) : "");
+    writeFile(log, contents);
+    captureOutput([&]{
+        CHECK(cmd_snapshot(snapshotFile.c_str(), {log.c_str()}) == 0);
+    });
+
+    struct snapshot_t* snapshot = snapshot_open(snapshotFile.c_str());
+    CHECK(snapshot != NULL);
+    if (!snapshot) return;
+    uint64_t records = 0;
+    for (int section = 0; section < SNAPSHOT_SECTIONS; section++) {
+        struct snapshot_cursor_t cursor;
+        struct snapshot_record_t previous;
+        int result = 0;
+        bool first = true;
+        snapshot_cursor_init(&cursor, snapshot, section);
+        while ((result = snapshot_cursor_next(&cursor)) == 1) {
+            if (!first) CHECK(snapshot_record_compare(&previous, &cursor.record) < 0);
+            // the cursor's pointers go into the map, they stay valid while it is open
+            previous = cursor.record;
+            first = false;
+            records += cursor.record.count;
+        }
+        CHECK(result == 0);
+    }
+    // every line is in exactly one section, a pair counts once
+    CHECK(records == 500);
+    snapshot_close(snapshot);
+}
@@ -0,0 +1,103 @@
+#include <string>
+#include "tests.hpp"
+#include "../stats.hpp"
+
+// nonce i of a random generator that only has space different nonces, splitmix64
+static std::string spaceNonce(unsigned long i, unsigned long space){
+    unsigned long long x = (i+1)*0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30))*0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27))*0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return std::to_string(x % space);
+}
+
+TEST(estimatorCountsEqualPairs){
+    SpaceEstimator estimator;
+    for (auto nonce: {"a", "b", "a", "c", "a"}) estimator.add(nonce);
+
+    CHECK(estimator.samples() == 5);
+    CHECK(estimator.collisions() == 3);
+    CHECK(estimator.distinct() == 3);
+    CHECK(estimator.singletons() == 2);
+    CHECK(estimator.count("a") == 3);
+    CHECK(estimator.count("d") == 0);
+    CHECK(estimator.estimate() == 10.0/3);
+
+    // b twice more pairs with the one before and with each other
+    estimator.add("b", 2);
+    CHECK(estimator.samples() == 7);
+    CHECK(estimator.collisions() == 6);
+    CHECK(estimator.singletons() == 1);
+
+    double low, high;
+    estimator.interval(0.95, low, high);
+    CHECK(low < estimator.estimate() && estimator.estimate() < high);
+}
+
+TEST(stopRuleParsing){
+    captureOutput([]{
+        StopRule rule;
+        CHECK(parseStopRule("weak=1000", rule));
+        CHECK(rule.weak == 1000 && rule.strong == 4000);
+
+        StopRule precision;
+        CHECK(parseStopRule("precision=0.1,confidence=0.9", precision));
+        CHECK(precision.precision == 0.1 && precision.confidence == 0.9 && precision.weak == 0);
+
+        for (auto spec: {"foo=1", "weak", "weak=10,strong=5", "alpha=2", "confidence=1"}) {
+            StopRule invalid;
+            CHECK(!parseStopRule(spec, invalid));
+        }
+    });
+}
+
+TEST(stopsOnWeakSpace){
+    StopRule rule;
+    rule.weak = 64;
+    rule.strong = 1<<20;
+    SpaceEstimator estimator;
+    int result = STOP_CONTINUE;
+    long i = 0;
+    for (; i < 1000 && result == STOP_CONTINUE; i++) {
+        estimator.add(spaceNonce(i, 64));
+        result = estimator.check(rule);
+    }
+    CHECK(result == STOP_WEAK);
+    CHECK(i < 100);
+}
+
+TEST(stopsOnStrongSpace){
+    StopRule rule;
+    rule.weak = 64;
+    rule.strong = 4096;
+    SpaceEstimator estimator;
+    int result = STOP_CONTINUE;
+    long i = 0;
+    for (; i < 1000 && result == STOP_CONTINUE; i++) {
+        estimator.add(spaceNonce(i, 1UL<<40));
+        result = estimator.check(rule);
+    }
+    // without a single collision the ratio only falls, by log(beta/(1-alpha)) after about 30 nonces
+    CHECK(result == STOP_STRONG);
+    CHECK(estimator.collisions() == 0);
+    CHECK(i > 20 && i < 40);
+}
+
+TEST(stopsOncePrecise){
+    StopRule rule;
+    rule.precision = 0.1;
+    SpaceEstimator estimator;
+    CHECK(estimator.check(rule) == STOP_CONTINUE);
+
+    int result = STOP_CONTINUE;
+    for (long i = 0; i < 100000 && result == STOP_CONTINUE; i++) {
+        estimator.add(spaceNonce(i, 1000));
+        result = estimator.check(rule);
+    }
+    CHECK(result == STOP_PRECISION);
+
+    double low, high;
+    estimator.interval(rule.confidence, low, high);
+    CHECK(high-low <= 2*rule.precision*estimator.estimate());
+    CHECK(low < 1100 && high > 900);
+}
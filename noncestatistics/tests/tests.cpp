@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include "tests.hpp"
+#include "../common.h"
+
+struct TestCase {
+    const char* name;
+    TestFunction run;
+};
+
+static std::vector<TestCase>& testList(){
+    static std::vector<TestCase> tests;
+    return tests;
+}
+
+static std::string testDir;
+static int failures = 0;
+
+TestRegistration::TestRegistration(const char* name, TestFunction run){
+    testList().push_back({name, run});
+}
+
+void checkFailed(const char* file, int line, const char* expression){
+    fprintf(stderr, "%s:%d: CHECK(%s) failed\n", file, line, expression);
+    failures++;
+}
+
+std::string testPath(const std::string& name){
+    return testDir + "/" + name;
+}
+
+void writeFile(const std::string& path, const std::string& contents){
+    std::ofstream file(path.c_str(), std::ios::binary | std::ios::trunc);
+    file << contents;
+}
+
+std::string captureOutput(const std::function<void()>& run){
+    std::string path = testPath("stdout");
+    int saved = dup(STDOUT_FILENO);
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    // info() writes from a thread of its own, what it has queued must go where it was meant to
+    idevicerestore_log_flush();
+    fflush(stdout);
+    std::cout.flush();
+    dup2(fd, STDOUT_FILENO);
+    close(fd);
+    run();
+    idevicerestore_log_flush();
+    fflush(stdout);
+    std::cout.flush();
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+
+    std::ifstream file(path.c_str());
+    std::stringstream output;
+    output << file.rdbuf();
+    return output.str();
+}
+
+bool contains(const std::string& text, const std::string& part){
+    return text.find(part) != std::string::npos;
+}
+
+std::string testNonce(unsigned i, size_t size){
+    char hex[3];
+    std::string nonce;
+    for (size_t byte = 0; byte < size; byte++) {
+        snprintf(hex, sizeof(hex), "%02x", (unsigned)((i >> (8*(byte % 4))) ^ (byte*0x3b)) & 0xff);
+        nonce += hex;
+    }
+    return nonce;
+}
+
+std::string logLine(unsigned line, const std::string& apNonce, const std::string& sepNonce){
+    char number[16];
+    snprintf(number, sizeof(number), "%06u", line);
+    return std::string(number) + "\tApNonce=" + apNonce + (sepNonce.empty() ? "" : " SepNonce=" + sepNonce) + "\n";
+}
+
+int main(int argc, const char* argv[]){
+    const char* tmp = getenv("TMPDIR");
+    std::string pattern = std::string((tmp && *tmp) ? tmp : "/tmp") + "/noncestatistics_tests.XXXXXX";
+    if (!mkdtemp(&pattern[0])) {
+        perror("mkdtemp");
+        return 1;
+    }
+    testDir = pattern;
+
+    int failed = 0;
+    for (auto& test: testList()) {
+        // a name on the command line runs only that test
+        if (argc > 1 && std::string(argv[1]) != test.name) continue;
+        int before = failures;
+        test.run();
+        printf("%s %s\n", (failures == before) ? "PASS" : "FAIL", test.name);
+        if (failures != before) failed++;
+    }
+
+    if (failed) {
+        printf("%d of %zu tests failed, their files are in %s\n", failed, testList().size(), testDir.c_str());
+        return 1;
+    }
+    std::string cleanup = "rm -rf '" + testDir + "'";
+    if (system(cleanup.c_str()) != 0) fprintf(stderr, "Unable to remove %s\n", testDir.c_str());
+    return 0;
+}
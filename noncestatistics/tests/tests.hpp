@@ -0,0 +1,35 @@
+#ifndef tests_hpp
+#define tests_hpp
+
+#include <string>
+#include <functional>
+
+// A tiny test runner for make check. Every TEST registers itself, CHECK
+// reports a failed expression and lets the test go on.
+typedef void (*TestFunction)();
+
+struct TestRegistration {
+    TestRegistration(const char* name, TestFunction run);
+};
+
+void checkFailed(const char* file, int line, const char* expression);
+
+#define CHECK(expression) do { if (!(expression)) checkFailed(__FILE__, __LINE__, #expression); } while (0)
+
+#define TEST(name) \
+    static void name(); \
+    static TestRegistration name##Registration(#name, name); \
+    static void name()
+
+// a path in a directory of the test run, removed once all tests passed
+std::string testPath(const std::string& name);
+void writeFile(const std::string& path, const std::string& contents);
+// what run printed to stdout
+std::string captureOutput(const std::function<void()>& run);
+bool contains(const std::string& text, const std::string& part);
+// the hex digits of a made up nonce of size bytes, different for every i
+std::string testNonce(unsigned i, size_t size = 20);
+// a log line as the collector writes it, sepNonce may be empty
+std::string logLine(unsigned line, const std::string& apNonce, const std::string& sepNonce = "");
+
+#endif /* tests_hpp */
@@ -0,0 +1,207 @@
+/*
+ * timeline.c
+ * Timeline of the collector in the Chrome trace event format
+ *
+ * Every collector of a rig appends its events to the same file, one track
+ * per collecting thread, with timestamps of the monotonic clock all of them
+ * share. A thread collects from one device, so a trace viewer shows the USB
+ * re-enumerations of all devices on one time axis, which is where hub
+ * contention shows up. Simulated devices run on the virtual clock of their
+ * thread instead, which starts over for every thread.
+ *
+ * The file is in the JSON array format without the closing bracket, which
+ * trace viewers accept, so nothing ever has to be rewritten. Events are
+ * formatted into a buffer of the thread that adds them and only written out
+ * when the buffer is full, at the end of the thread or at timeline_stop().
+ * Each write appends whole events, so collectors sharing the file never
+ * interleave inside an event.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include "common.h"
+#include "timeline.h"
+#include "transport.h"
+
+/* all collectors share one process in the viewer, each device is a thread of it */
+#define TIMELINE_PID  1
+
+struct timeline_buffer_t {
+	char data[TIMELINE_BUFFER_SIZE];
+	size_t length;
+	struct timeline_buffer_t* next;
+};
+
+static int timeline_fd = -1;
+static pthread_key_t timeline_key;
+static pthread_once_t timeline_key_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t timeline_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct timeline_buffer_t* timeline_buffers = NULL;
+
+/* a track per thread that collects, thread ids are unique across the collectors sharing the file */
+static int timeline_tid(void) {
+#ifdef __APPLE__
+	uint64_t tid = 0;
+	pthread_threadid_np(NULL, &tid);
+	return (int)tid;
+#elif defined(__linux__)
+	return (int)syscall(SYS_gettid);
+#else
+	return (int)getpid();
+#endif
+}
+
+static void timeline_write(struct timeline_buffer_t* buffer) {
+	size_t written = 0;
+
+	while (written < buffer->length) {
+		ssize_t result = write(timeline_fd, buffer->data + written, buffer->length - written);
+		if (result < 0 && errno == EINTR) continue;
+		if (result <= 0) {
+			error("ERROR: Unable to write the timeline: %s\n", strerror(errno));
+			break;
+		}
+		written += result;
+	}
+	buffer->length = 0;
+}
+
+static void timeline_unlink(struct timeline_buffer_t* buffer) {
+	struct timeline_buffer_t** link = &timeline_buffers;
+
+	while (*link && *link != buffer) link = &(*link)->next;
+	if (*link) *link = buffer->next;
+}
+
+/* runs when a thread that added events ends */
+static void timeline_thread_done(void* data) {
+	struct timeline_buffer_t* buffer = (struct timeline_buffer_t*)data;
+
+	pthread_mutex_lock(&timeline_lock);
+	if (timeline_fd >= 0) timeline_write(buffer);
+	timeline_unlink(buffer);
+	pthread_mutex_unlock(&timeline_lock);
+	free(buffer);
+}
+
+static void timeline_key_create(void) {
+	pthread_key_create(&timeline_key, timeline_thread_done);
+}
+
+static struct timeline_buffer_t* timeline_buffer(void) {
+	struct timeline_buffer_t* buffer = (struct timeline_buffer_t*)pthread_getspecific(timeline_key);
+
+	if (buffer) return buffer;
+	buffer = (struct timeline_buffer_t*)calloc(1, sizeof(struct timeline_buffer_t));
+	if (!buffer) return NULL;
+	pthread_setspecific(timeline_key, buffer);
+	pthread_mutex_lock(&timeline_lock);
+	buffer->next = timeline_buffers;
+	timeline_buffers = buffer;
+	pthread_mutex_unlock(&timeline_lock);
+	return buffer;
+}
+
+/* formats one event, a trailing comma separates it from the next one */
+static void timeline_event(const char* format, ...) {
+	struct timeline_buffer_t* buffer = NULL;
+	va_list args;
+	int length = 0;
+
+	if (timeline_fd < 0 || !(buffer = timeline_buffer())) return;
+	for (;;) {
+		va_start(args, format);
+		length = vsnprintf(buffer->data + buffer->length, TIMELINE_BUFFER_SIZE - buffer->length, format, args);
+		va_end(args);
+		if (length < 0 || (size_t)length >= TIMELINE_BUFFER_SIZE) return;
+		if (buffer->length + length < TIMELINE_BUFFER_SIZE) break;
+		timeline_write(buffer);
+	}
+	buffer->length += length;
+}
+
+int timeline_start(const char* filename) {
+	struct stat st;
+
+	pthread_once(&timeline_key_once, timeline_key_create);
+	timeline_fd = open(filename, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if (timeline_fd < 0) {
+		error("ERROR: Unable to open %s: %s\n", filename, strerror(errno));
+		return -1;
+	}
+
+	/* the first collector to get here opens the array */
+	flock(timeline_fd, LOCK_EX);
+	if (fstat(timeline_fd, &st) == 0 && st.st_size == 0 && write(timeline_fd, "[\n", 2) != 2) {
+		error("ERROR: Unable to write %s: %s\n", filename, strerror(errno));
+		flock(timeline_fd, LOCK_UN);
+		close(timeline_fd);
+		timeline_fd = -1;
+		return -1;
+	}
+	flock(timeline_fd, LOCK_UN);
+	/* a collector that ends on an error still leaves its events */
+	atexit(timeline_stop);
+
+	timeline_event("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"noncestatistics\"}},\n", TIMELINE_PID);
+	return 0;
+}
+
+void timeline_stop(void) {
+	struct timeline_buffer_t* buffer = NULL;
+
+	if (timeline_fd < 0) return;
+	pthread_mutex_lock(&timeline_lock);
+	for (buffer = timeline_buffers; buffer; buffer = buffer->next) {
+		timeline_write(buffer);
+	}
+	close(timeline_fd);
+	timeline_fd = -1;
+	pthread_mutex_unlock(&timeline_lock);
+}
+
+void timeline_track(uint64_t ecid, const char* model) {
+	char name[64];
+	size_t i = 0;
+
+	/* the model goes into a JSON string */
+	snprintf(name, sizeof(name), "ECID 0x%016llx %s", (unsigned long long)ecid, (model) ? model : "");
+	for (i = 0; name[i]; i++) {
+		if (name[i] == '"' || name[i] == '\\' || (unsigned char)name[i] < 0x20) name[i] = '_';
+	}
+	timeline_event("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}},\n",
+	               TIMELINE_PID, timeline_tid(), name);
+}
+
+uint64_t timeline_now(void) {
+	if (timeline_fd < 0) return 0;
+	return transport_now();
+}
+
+void timeline_span(const char* name, uint64_t start, const char* args) {
+	uint64_t now = timeline_now();
+
+	if (!now || !start) return;
+	timeline_event("{\"name\":\"%s\",\"cat\":\"collector\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,\"pid\":%d,\"tid\":%d,\"args\":%s},\n",
+	               name, (unsigned long long)start, (unsigned long long)(now - start), TIMELINE_PID, timeline_tid(), (args) ? args : "{}");
+}
+
+void timeline_instant(const char* name, const char* args) {
+	uint64_t now = timeline_now();
+
+	if (!now) return;
+	timeline_event("{\"name\":\"%s\",\"cat\":\"collector\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%llu,\"pid\":%d,\"tid\":%d,\"args\":%s},\n",
+	               name, (unsigned long long)now, TIMELINE_PID, timeline_tid(), (args) ? args : "{}");
+}
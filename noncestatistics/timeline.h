@@ -0,0 +1,33 @@
+/*
+ * timeline.h
+ * Timeline of the collector in the Chrome trace event format
+ */
+
+#ifndef IDEVICERESTORE_TIMELINE_H
+#define IDEVICERESTORE_TIMELINE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#define TIMELINE_BUFFER_SIZE  65536
+
+/* appends to filename, so the collectors of all devices of a rig can share one timeline */
+int timeline_start(const char* filename);
+/* writes what is left in the buffers, no thread may add events any more */
+void timeline_stop(void);
+/* names the track of this collector after its device */
+void timeline_track(uint64_t ecid, const char* model);
+/* microseconds on the clock of the transport, 0 while there is no timeline */
+uint64_t timeline_now(void);
+/* args is a JSON object or NULL */
+void timeline_span(const char* name, uint64_t start, const char* args);
+void timeline_instant(const char* name, const char* args);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,359 @@
+/*
+ * transport.c
+ * Pluggable device transport for devices in recovery and DFU mode
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <libirecovery.h>
+
+#include "transport.h"
+#include "usb_location.h"
+#include "timeline.h"
+
+/* libirecovery reports attached devices asynchronously, stop once it has been quiet for this long */
+#define IRECV_ENUMERATE_SETTLE_MS  250
+#define IRECV_ENUMERATE_MAX_MS     3000
+
+struct transport_client_private {
+	const struct transport_backend_t* backend;
+	void* handle;
+};
+
+/* recovery and DFU mode used to subscribe to transfer progress on their own clients */
+static int irecv_backend_progress_callback(irecv_client_t client, const irecv_event_t* event) {
+	if (event->type == IRECV_PROGRESS) {
+		//print_progress_bar(event->progress);
+	}
+	return 0;
+}
+
+static void irecv_backend_init(void) {
+	irecv_init();
+}
+
+static irecv_error_t irecv_backend_open_with_ecid(void** handle, uint64_t ecid) {
+	irecv_client_t client = NULL;
+	irecv_error_t err = IRECV_E_SUCCESS;
+
+	/* while a known device is still away from its port there is no point in scanning the bus */
+	if (ecid && usb_location_check(ecid) == USB_LOCATION_ABSENT) {
+		return IRECV_E_UNABLE_TO_CONNECT;
+	}
+
+	err = irecv_open_with_ecid(&client, ecid);
+	if (err == IRECV_E_SUCCESS) {
+		irecv_event_subscribe(client, IRECV_PROGRESS, &irecv_backend_progress_callback, NULL);
+		*handle = client;
+		if (ecid) {
+			usb_location_remember(ecid);
+		}
+	}
+	return err;
+}
+
+static irecv_error_t irecv_backend_close(void* handle) {
+	return irecv_close((irecv_client_t)handle);
+}
+
+static irecv_error_t irecv_backend_get_mode(void* handle, int* mode) {
+	return irecv_get_mode((irecv_client_t)handle, mode);
+}
+
+static const struct irecv_device_info* irecv_backend_get_device_info(void* handle) {
+	return irecv_get_device_info((irecv_client_t)handle);
+}
+
+static irecv_error_t irecv_backend_send_command(void* handle, const char* command) {
+	return irecv_send_command((irecv_client_t)handle, command);
+}
+
+static irecv_error_t irecv_backend_send_buffer(void* handle, unsigned char* buffer, unsigned long length) {
+	return irecv_send_buffer((irecv_client_t)handle, buffer, length, 1);
+}
+
+static irecv_error_t irecv_backend_getenv(void* handle, const char* variable, char** value) {
+	return irecv_getenv((irecv_client_t)handle, variable, value);
+}
+
+static irecv_error_t irecv_backend_reset(void* handle) {
+	return irecv_reset((irecv_client_t)handle);
+}
+
+struct irecv_enumeration_t {
+	pthread_mutex_t lock;
+	struct irecv_device_info* infos;
+	int* modes;
+	unsigned int count;
+};
+
+static uint64_t irecv_now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void irecv_backend_device_event(const irecv_device_event_t* event, void* user_data) {
+	struct irecv_enumeration_t* enumeration = (struct irecv_enumeration_t*)user_data;
+	struct irecv_device_info* infos = NULL;
+	int* modes = NULL;
+
+	if (event->type != IRECV_DEVICE_ADD || !event->device_info) {
+		return;
+	}
+
+	pthread_mutex_lock(&enumeration->lock);
+	infos = (struct irecv_device_info*)realloc(enumeration->infos, (enumeration->count + 1) * sizeof(struct irecv_device_info));
+	if (infos) {
+		enumeration->infos = infos;
+	}
+	modes = (int*)realloc(enumeration->modes, (enumeration->count + 1) * sizeof(int));
+	if (modes) {
+		enumeration->modes = modes;
+	}
+	if (infos && modes) {
+		/* the event's device info is only valid during the callback, keep the identity fields */
+		memset(&infos[enumeration->count], 0, sizeof(struct irecv_device_info));
+		infos[enumeration->count].cpid = event->device_info->cpid;
+		infos[enumeration->count].bdid = event->device_info->bdid;
+		infos[enumeration->count].ecid = event->device_info->ecid;
+		infos[enumeration->count].ibfl = event->device_info->ibfl;
+		infos[enumeration->count].srnm = (event->device_info->srnm) ? strdup(event->device_info->srnm) : NULL;
+		modes[enumeration->count] = event->mode;
+		enumeration->count++;
+	}
+	pthread_mutex_unlock(&enumeration->lock);
+}
+
+static int irecv_backend_enumerate(transport_device_cb_t callback, void* user_data) {
+	struct irecv_enumeration_t enumeration;
+	irecv_device_event_context_t context = NULL;
+	uint64_t start = irecv_now_ms();
+	uint64_t last_change = start;
+	unsigned int seen = 0;
+	unsigned int i = 0;
+
+	memset(&enumeration, 0, sizeof(struct irecv_enumeration_t));
+	pthread_mutex_init(&enumeration.lock, NULL);
+
+	if (irecv_device_event_subscribe(&context, irecv_backend_device_event, &enumeration) != IRECV_E_SUCCESS) {
+		pthread_mutex_destroy(&enumeration.lock);
+		return -1;
+	}
+	while (irecv_now_ms() - last_change < IRECV_ENUMERATE_SETTLE_MS && irecv_now_ms() - start < IRECV_ENUMERATE_MAX_MS) {
+		usleep(10000);
+		pthread_mutex_lock(&enumeration.lock);
+		if (enumeration.count != seen) {
+			seen = enumeration.count;
+			last_change = irecv_now_ms();
+		}
+		pthread_mutex_unlock(&enumeration.lock);
+	}
+	irecv_device_event_unsubscribe(context);
+
+	for (i = 0; i < enumeration.count; i++) {
+		callback(&enumeration.infos[i], enumeration.modes[i], user_data);
+		free(enumeration.infos[i].srnm);
+	}
+	free(enumeration.infos);
+	free(enumeration.modes);
+	pthread_mutex_destroy(&enumeration.lock);
+
+	return 0;
+}
+
+const struct transport_backend_t transport_irecv_backend = {
+	.name = "irecv",
+	.init = irecv_backend_init,
+	.open_with_ecid = irecv_backend_open_with_ecid,
+	.close = irecv_backend_close,
+	.get_mode = irecv_backend_get_mode,
+	.get_device_info = irecv_backend_get_device_info,
+	.send_command = irecv_backend_send_command,
+	.send_buffer = irecv_backend_send_buffer,
+	.getenv = irecv_backend_getenv,
+	.reset = irecv_backend_reset,
+	.enumerate = irecv_backend_enumerate
+};
+
+static const struct transport_backend_t* transport_backend = &transport_irecv_backend;
+
+void transport_set_backend(const struct transport_backend_t* backend) {
+	transport_backend = (backend) ? backend : &transport_irecv_backend;
+}
+
+const struct transport_backend_t* transport_get_backend(void) {
+	return transport_backend;
+}
+
+void transport_init(void) {
+	if (transport_backend->init) {
+		transport_backend->init();
+	}
+}
+
+irecv_error_t transport_open_with_ecid(transport_client_t* client, uint64_t ecid) {
+	void* handle = NULL;
+	irecv_error_t err = IRECV_E_SUCCESS;
+	uint64_t start = timeline_now();
+
+	*client = NULL;
+	err = transport_backend->open_with_ecid(&handle, ecid);
+	if (err != IRECV_E_SUCCESS) {
+		return err;
+	}
+	/* failed attempts are part of the wait for the device */
+	timeline_span("open", start, NULL);
+
+	*client = (transport_client_t)malloc(sizeof(struct transport_client_private));
+	if (*client == NULL) {
+		transport_backend->close(handle);
+		return IRECV_E_OUT_OF_MEMORY;
+	}
+	(*client)->backend = transport_backend;
+	(*client)->handle = handle;
+	return IRECV_E_SUCCESS;
+}
+
+irecv_error_t transport_close(transport_client_t client) {
+	irecv_error_t err = IRECV_E_SUCCESS;
+	if (client) {
+		err = client->backend->close(client->handle);
+		free(client);
+	}
+	return err;
+}
+
+irecv_error_t transport_get_mode(transport_client_t client, int* mode) {
+	if (!client) {
+		return IRECV_E_NO_DEVICE;
+	}
+	return client->backend->get_mode(client->handle, mode);
+}
+
+const struct irecv_device_info* transport_get_device_info(transport_client_t client) {
+	if (!client) {
+		return NULL;
+	}
+	return client->backend->get_device_info(client->handle);
+}
+
+irecv_error_t transport_send_command(transport_client_t client, const char* command) {
+	if (!client) {
+		return IRECV_E_NO_DEVICE;
+	}
+	return client->backend->send_command(client->handle, command);
+}
+
+irecv_error_t transport_send_buffer(transport_client_t client, unsigned char* buffer, unsigned long length) {
+	if (!client) {
+		return IRECV_E_NO_DEVICE;
+	}
+	if (!client->backend->send_buffer) {
+		return IRECV_E_UNSUPPORTED;
+	}
+	return client->backend->send_buffer(client->handle, buffer, length);
+}
+
+irecv_error_t transport_devices_get_device_by_info(const struct irecv_device_info* device_info, irecv_device_t* device) {
+	irecv_device_t devices = NULL;
+	int i = 0;
+
+	*device = NULL;
+	if (!device_info) {
+		return IRECV_E_NO_DEVICE;
+	}
+
+	/* same lookup libirecovery does internally, but usable with any backend */
+	devices = irecv_devices_get_all();
+	for (i = 0; devices[i].product_type != NULL; i++) {
+		if (devices[i].chip_id == device_info->cpid && devices[i].board_id == device_info->bdid) {
+			*device = &devices[i];
+			return IRECV_E_SUCCESS;
+		}
+	}
+
+	return IRECV_E_NO_DEVICE;
+}
+
+irecv_error_t transport_devices_get_device_by_client(transport_client_t client, irecv_device_t* device) {
+	return transport_devices_get_device_by_info(transport_get_device_info(client), device);
+}
+
+irecv_error_t transport_getenv(transport_client_t client, const char* variable, char** value) {
+	*value = NULL;
+	if (!client) {
+		return IRECV_E_NO_DEVICE;
+	}
+	if (!client->backend->getenv) {
+		return IRECV_E_UNSUPPORTED;
+	}
+	return client->backend->getenv(client->handle, variable, value);
+}
+
+irecv_error_t transport_reset(transport_client_t client) {
+	if (!client) {
+		return IRECV_E_NO_DEVICE;
+	}
+	if (!client->backend->reset) {
+		return IRECV_E_UNSUPPORTED;
+	}
+	return client->backend->reset(client->handle);
+}
+
+void transport_usleep(unsigned int usec) {
+	if (transport_backend->sleep) {
+		transport_backend->sleep(usec);
+	} else {
+		usleep(usec);
+	}
+}
+
+int transport_exhausted(void) {
+	return (transport_backend->exhausted) ? transport_backend->exhausted() : 0;
+}
+
+/* microseconds on the monotonic clock, or on the clock of a backend with one of its own */
+uint64_t transport_now(void) {
+	struct timespec ts;
+
+	if (transport_backend->now) {
+		return transport_backend->now();
+	}
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* returns -1 if the backend can't enumerate, callers then fall back to probing each mode */
+int transport_enumerate(transport_device_cb_t callback, void* user_data) {
+	return (transport_backend->enumerate) ? transport_backend->enumerate(callback, user_data) : -1;
+}
+
+/* returns 1 if the device is in normal mode, 0 if not, -1 if the backend can't tell */
+int transport_normal_probe(uint64_t ecid) {
+	return (transport_backend->normal_probe) ? transport_backend->normal_probe(ecid) : -1;
+}
+
+irecv_error_t transport_normal_enter_recovery(uint64_t ecid) {
+	if (!transport_backend->normal_enter_recovery) {
+		return IRECV_E_UNSUPPORTED;
+	}
+	return transport_backend->normal_enter_recovery(ecid);
+}
+
+/* the outcome of the libimobiledevice fallback of the two calls above, a recording keeps it */
+void transport_normal_probed(uint64_t ecid, int found) {
+	if (transport_backend->normal_probed) {
+		transport_backend->normal_probed(ecid, found);
+	}
+}
+
+void transport_normal_entered_recovery(uint64_t ecid, irecv_error_t err) {
+	if (transport_backend->normal_entered_recovery) {
+		transport_backend->normal_entered_recovery(ecid, err);
+	}
+}
@@ -0,0 +1,85 @@
+/*
+ * transport.h
+ * Pluggable device transport for devices in recovery and DFU mode
+ */
+
+#ifndef IDEVICERESTORE_TRANSPORT_H
+#define IDEVICERESTORE_TRANSPORT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <libirecovery.h>
+
+/* enumeration reports devices in normal mode with this instead of an irecv mode */
+#define TRANSPORT_MODE_NORMAL 0
+
+typedef void (*transport_device_cb_t)(const struct irecv_device_info* device_info, int mode, void* user_data);
+
+/*
+ * A backend mirrors the subset of libirecovery the collector needs. Handles
+ * are opaque to the caller; every call returns the libirecovery error codes
+ * so the code in recovery.c and dfu.c does not care which backend is active.
+ */
+struct transport_backend_t {
+	const char* name;
+	void (*init)(void);
+	irecv_error_t (*open_with_ecid)(void** handle, uint64_t ecid);
+	irecv_error_t (*close)(void* handle);
+	irecv_error_t (*get_mode)(void* handle, int* mode);
+	const struct irecv_device_info* (*get_device_info)(void* handle);
+	irecv_error_t (*send_command)(void* handle, const char* command);
+	irecv_error_t (*send_buffer)(void* handle, unsigned char* buffer, unsigned long length);
+	irecv_error_t (*getenv)(void* handle, const char* variable, char** value);
+	/* optional: replaces usleep() between polls, e.g. to skip waits on replay */
+	void (*sleep)(unsigned int usec);
+	/* optional: non-zero once the backend can never produce a device again */
+	int (*exhausted)(void);
+	/* optional: normal mode handling, libimobiledevice is used when NULL */
+	int (*normal_probe)(uint64_t ecid);
+	irecv_error_t (*normal_enter_recovery)(uint64_t ecid);
+	/* optional: USB reset, makes a DFU mode device re-enumerate with a new nonce */
+	irecv_error_t (*reset)(void* handle);
+	/* optional: reports every attached device once without opening any of them */
+	int (*enumerate)(transport_device_cb_t callback, void* user_data);
+	/* optional: told what libimobiledevice found when normal_probe or normal_enter_recovery couldn't tell */
+	void (*normal_probed)(uint64_t ecid, int found);
+	void (*normal_entered_recovery)(uint64_t ecid, irecv_error_t err);
+	/* optional: microseconds on the backend's own clock when it doesn't run in real time, never 0 */
+	uint64_t (*now)(void);
+};
+
+typedef struct transport_client_private* transport_client_t;
+
+extern const struct transport_backend_t transport_irecv_backend;
+
+void transport_set_backend(const struct transport_backend_t* backend);
+const struct transport_backend_t* transport_get_backend(void);
+
+void transport_init(void);
+irecv_error_t transport_open_with_ecid(transport_client_t* client, uint64_t ecid);
+irecv_error_t transport_close(transport_client_t client);
+irecv_error_t transport_get_mode(transport_client_t client, int* mode);
+const struct irecv_device_info* transport_get_device_info(transport_client_t client);
+irecv_error_t transport_send_command(transport_client_t client, const char* command);
+irecv_error_t transport_send_buffer(transport_client_t client, unsigned char* buffer, unsigned long length);
+irecv_error_t transport_getenv(transport_client_t client, const char* variable, char** value);
+irecv_error_t transport_reset(transport_client_t client);
+irecv_error_t transport_devices_get_device_by_info(const struct irecv_device_info* device_info, irecv_device_t* device);
+irecv_error_t transport_devices_get_device_by_client(transport_client_t client, irecv_device_t* device);
+void transport_usleep(unsigned int usec);
+int transport_exhausted(void);
+uint64_t transport_now(void);
+int transport_enumerate(transport_device_cb_t callback, void* user_data);
+int transport_normal_probe(uint64_t ecid);
+irecv_error_t transport_normal_enter_recovery(uint64_t ecid);
+void transport_normal_probed(uint64_t ecid, int found);
+void transport_normal_entered_recovery(uint64_t ecid, irecv_error_t err);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,527 @@
+/*
+ * transport_sim.c
+ * In-process simulated recovery mode devices for the transport layer
+ *
+ * Every virtual device has its own ECID, boots into recovery mode and
+ * generates a new ApNonce each time it receives a "reset" command. While a
+ * device is rebooting it refuses connections, just like a real device that
+ * has not re-enumerated yet, so the collection loop runs unmodified.
+ *
+ * A device whose saved auto-boot variable is true (or that "loses" it, see
+ * fail-autoboot) boots all the way into iOS instead and can only be brought
+ * back with the normal mode enter-recovery hook.
+ *
+ * With mode=dfu the devices sit in DFU mode instead. They don't take
+ * commands; a USB reset makes them re-enumerate after dfu-latency with a
+ * new ApNonce.
+ *
+ * Time is virtual: every thread has a clock of its own that only moves when
+ * the thread sleeps through the transport, so reboot latencies cost no wall
+ * clock time. This works as long as each device is driven by one thread.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <libirecovery.h>
+
+#include "common.h"
+#include "transport_sim.h"
+
+#define SIM_CPID             0x8010
+#define SIM_BDID             0x08
+#define SIM_SEP_NONCE_SIZE   20
+#define SIM_MAX_NONCE_SIZE   32
+#define SIM_CLOCK_EPOCH_US   1000000
+
+struct sim_device_t {
+	uint64_t ecid;
+	uint64_t rng;
+	uint64_t booted_at;
+	unsigned int generation;
+	unsigned int boot_count;
+	int in_normal;
+	int autoboot;
+	int autoboot_pending;
+	char srnm[16];
+	unsigned char ap_nonce[SIM_MAX_NONCE_SIZE];
+	unsigned char sep_nonce[SIM_SEP_NONCE_SIZE];
+};
+
+/* like a libirecovery client, a handle owns the device info it hands out */
+struct sim_handle_t {
+	struct sim_device_t* device;
+	unsigned int generation;
+	char srnm[16];
+	unsigned char ap_nonce[SIM_MAX_NONCE_SIZE];
+	unsigned char sep_nonce[SIM_SEP_NONCE_SIZE];
+	struct irecv_device_info info;
+};
+
+static struct transport_sim_config_t sim_config;
+static struct sim_device_t* sim_devices = NULL;
+static pthread_mutex_t sim_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread uint64_t sim_clock_us = 0;
+
+static uint64_t sim_now_ms(void) {
+	return sim_clock_us / 1000;
+}
+
+static void sim_sleep(unsigned int usec) {
+	sim_clock_us += usec;
+}
+
+/* the timeline takes 0 for "no time", so virtual time is reported from one second on */
+static uint64_t sim_now_us(void) {
+	return SIM_CLOCK_EPOCH_US + sim_clock_us;
+}
+
+static uint64_t splitmix64(uint64_t* state) {
+	uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+static double sim_random(struct sim_device_t* device) {
+	return (splitmix64(&device->rng) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* deterministically stretch a generator value into nonce bytes */
+static void sim_expand(uint64_t value, unsigned char* out, unsigned int size) {
+	uint64_t state = value;
+	unsigned int i = 0;
+	while (i < size) {
+		uint64_t r = splitmix64(&state);
+		unsigned int j;
+		for (j = 0; j < 8 && i < size; j++, i++) {
+			out[i] = (unsigned char)(r >> (8 * j));
+		}
+	}
+}
+
+static uint64_t sim_latency(struct sim_device_t* device, unsigned int base_ms) {
+	uint64_t latency = base_ms;
+	if (sim_config.jitter_ms) {
+		latency += (uint64_t)(sim_random(device) * 2 * sim_config.jitter_ms);
+		latency = (latency > sim_config.jitter_ms) ? latency - sim_config.jitter_ms : 0;
+	}
+	return latency;
+}
+
+static void sim_boot(struct sim_device_t* device) {
+	uint64_t value = 0;
+
+	switch (sim_config.nonce_mode) {
+	case SIM_NONCE_FIXED:
+		value = sim_config.seed;
+		break;
+	case SIM_NONCE_CYCLE:
+		value = sim_config.seed + (device->boot_count % sim_config.nonce_period);
+		break;
+	default:
+		value = splitmix64(&device->rng);
+		if (sim_config.nonce_bits < 64) {
+			value &= (1ULL << sim_config.nonce_bits) - 1;
+		}
+		break;
+	}
+	sim_expand(value, device->ap_nonce, sim_config.nonce_size);
+	sim_expand(splitmix64(&device->rng), device->sep_nonce, SIM_SEP_NONCE_SIZE);
+	device->boot_count++;
+}
+
+static void sim_fill_info(struct sim_device_t* device, struct irecv_device_info* info) {
+	memset(info, 0, sizeof(struct irecv_device_info));
+	info->cpid = SIM_CPID;
+	info->bdid = SIM_BDID;
+	info->ecid = device->ecid;
+	info->srnm = device->srnm;
+	info->ap_nonce = device->ap_nonce;
+	info->ap_nonce_size = sim_config.nonce_size;
+	info->sep_nonce = device->sep_nonce;
+	info->sep_nonce_size = SIM_SEP_NONCE_SIZE;
+}
+
+static struct sim_device_t* sim_find_device(uint64_t ecid) {
+	unsigned int i;
+	if (!sim_devices) {
+		return NULL;
+	}
+	if (ecid == 0) {
+		return &sim_devices[0];
+	}
+	for (i = 0; i < sim_config.devices; i++) {
+		if (sim_devices[i].ecid == ecid) {
+			return &sim_devices[i];
+		}
+	}
+	return NULL;
+}
+
+int transport_sim_parse_config(const char* spec, struct transport_sim_config_t* config) {
+	char* copy = NULL;
+	char* token = NULL;
+	char* saveptr = NULL;
+
+	memset(config, 0, sizeof(struct transport_sim_config_t));
+	config->devices = 1;
+	config->nonce_mode = SIM_NONCE_RANDOM;
+	config->nonce_bits = 64;
+	config->nonce_period = 1;
+	config->nonce_size = 20;
+	config->ios_boot_ms = 20000;
+	config->dfu_latency_ms = (unsigned int)-1;
+	config->seed = (uint64_t)time(NULL);
+
+	if (!spec || !*spec) {
+		return 0;
+	}
+
+	copy = strdup(spec);
+	for (token = strtok_r(copy, ",", &saveptr); token; token = strtok_r(NULL, ",", &saveptr)) {
+		char* value = strchr(token, '=');
+		if (!value) {
+			error("ERROR: Invalid simulator option '%s'\n", token);
+			free(copy);
+			return -1;
+		}
+		*(value++) = '\0';
+
+		if (!strcmp(token, "devices")) {
+			config->devices = (unsigned int)strtoul(value, NULL, 0);
+		} else if (!strcmp(token, "latency")) {
+			config->latency_ms = (unsigned int)strtoul(value, NULL, 0);
+		} else if (!strcmp(token, "jitter")) {
+			config->jitter_ms = (unsigned int)strtoul(value, NULL, 0);
+		} else if (!strcmp(token, "nonce")) {
+			if (!strcmp(value, "random")) {
+				config->nonce_mode = SIM_NONCE_RANDOM;
+			} else if (!strcmp(value, "fixed")) {
+				config->nonce_mode = SIM_NONCE_FIXED;
+			} else if (!strcmp(value, "cycle")) {
+				config->nonce_mode = SIM_NONCE_CYCLE;
+			} else {
+				error("ERROR: Unknown simulated nonce generator '%s'\n", value);
+				free(copy);
+				return -1;
+			}
+		} else if (!strcmp(token, "bits")) {
+			config->nonce_bits = (unsigned int)strtoul(value, NULL, 0);
+		} else if (!strcmp(token, "period")) {
+			config->nonce_period = (unsigned int)strtoul(value, NULL, 0);
+		} else if (!strcmp(token, "size")) {
+			config->nonce_size = (unsigned int)strtoul(value, NULL, 0);
+		} else if (!strcmp(token, "fail-open")) {
+			config->fail_open = strtod(value, NULL);
+		} else if (!strcmp(token, "fail-info")) {
+			config->fail_info = strtod(value, NULL);
+		} else if (!strcmp(token, "fail-command")) {
+			config->fail_command = strtod(value, NULL);
+		} else if (!strcmp(token, "autoboot")) {
+			config->autoboot = (!strcmp(value, "true") || !strcmp(value, "1"));
+		} else if (!strcmp(token, "ios-boot")) {
+			config->ios_boot_ms = (unsigned int)strtoul(value, NULL, 0);
+		} else if (!strcmp(token, "fail-autoboot")) {
+			config->fail_autoboot = strtod(value, NULL);
+		} else if (!strcmp(token, "mode")) {
+			if (!strcmp(value, "recovery")) {
+				config->dfu = 0;
+			} else if (!strcmp(value, "dfu")) {
+				config->dfu = 1;
+			} else {
+				error("ERROR: Unknown simulated device mode '%s'\n", value);
+				free(copy);
+				return -1;
+			}
+		} else if (!strcmp(token, "dfu-latency")) {
+			config->dfu_latency_ms = (unsigned int)strtoul(value, NULL, 0);
+		} else if (!strcmp(token, "seed")) {
+			config->seed = strtoull(value, NULL, 0);
+		} else {
+			error("ERROR: Unknown simulator option '%s'\n", token);
+			free(copy);
+			return -1;
+		}
+	}
+	free(copy);
+
+	if (config->dfu_latency_ms == (unsigned int)-1) {
+		config->dfu_latency_ms = config->latency_ms;
+	}
+
+	if (config->devices == 0 || config->nonce_period == 0 || config->nonce_bits == 0 || config->nonce_bits > 64 ||
+	    config->nonce_size == 0 || config->nonce_size > SIM_MAX_NONCE_SIZE) {
+		error("ERROR: Invalid simulator configuration\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+int transport_sim_configure(const struct transport_sim_config_t* config) {
+	unsigned int i;
+
+	pthread_mutex_lock(&sim_lock);
+	free(sim_devices);
+	sim_config = *config;
+	sim_devices = (struct sim_device_t*)calloc(sim_config.devices, sizeof(struct sim_device_t));
+	if (!sim_devices) {
+		pthread_mutex_unlock(&sim_lock);
+		error("ERROR: Out of memory\n");
+		return -1;
+	}
+
+	for (i = 0; i < sim_config.devices; i++) {
+		struct sim_device_t* device = &sim_devices[i];
+		device->ecid = SIM_ECID_BASE + i;
+		device->rng = sim_config.seed ^ (device->ecid * 0x9e3779b97f4a7c15ULL);
+		snprintf(device->srnm, sizeof(device->srnm), "SIM%08X", i);
+		device->autoboot = device->autoboot_pending = sim_config.autoboot;
+		sim_boot(device);
+	}
+	pthread_mutex_unlock(&sim_lock);
+
+	return 0;
+}
+
+void transport_sim_free(void) {
+	pthread_mutex_lock(&sim_lock);
+	free(sim_devices);
+	sim_devices = NULL;
+	pthread_mutex_unlock(&sim_lock);
+}
+
+static irecv_error_t sim_open_with_ecid(void** handle, uint64_t ecid) {
+	struct sim_device_t* device = NULL;
+	struct sim_handle_t* sim = NULL;
+
+	pthread_mutex_lock(&sim_lock);
+	device = sim_find_device(ecid);
+	if (!device || device->in_normal || sim_now_ms() < device->booted_at) {
+		pthread_mutex_unlock(&sim_lock);
+		return IRECV_E_UNABLE_TO_CONNECT;
+	}
+	if (sim_config.fail_open > 0 && sim_random(device) < sim_config.fail_open) {
+		pthread_mutex_unlock(&sim_lock);
+		return IRECV_E_UNABLE_TO_CONNECT;
+	}
+
+	sim = (struct sim_handle_t*)malloc(sizeof(struct sim_handle_t));
+	if (!sim) {
+		pthread_mutex_unlock(&sim_lock);
+		return IRECV_E_OUT_OF_MEMORY;
+	}
+	sim->device = device;
+	sim->generation = device->generation;
+	pthread_mutex_unlock(&sim_lock);
+
+	*handle = sim;
+	return IRECV_E_SUCCESS;
+}
+
+static irecv_error_t sim_close(void* handle) {
+	free(handle);
+	return IRECV_E_SUCCESS;
+}
+
+static irecv_error_t sim_get_mode(void* handle, int* mode) {
+	struct sim_handle_t* sim = (struct sim_handle_t*)handle;
+	if (sim->generation != sim->device->generation) {
+		return IRECV_E_NO_DEVICE;
+	}
+	*mode = (sim_config.dfu) ? IRECV_K_DFU_MODE : IRECV_K_RECOVERY_MODE_2;
+	return IRECV_E_SUCCESS;
+}
+
+static const struct irecv_device_info* sim_get_device_info(void* handle) {
+	struct sim_handle_t* sim = (struct sim_handle_t*)handle;
+	struct sim_device_t* device = sim->device;
+	const struct irecv_device_info* info = NULL;
+
+	pthread_mutex_lock(&sim_lock);
+	if (sim->generation == device->generation &&
+	    !(sim_config.fail_info > 0 && sim_random(device) < sim_config.fail_info)) {
+		memcpy(sim->srnm, device->srnm, sizeof(sim->srnm));
+		memcpy(sim->ap_nonce, device->ap_nonce, sizeof(sim->ap_nonce));
+		memcpy(sim->sep_nonce, device->sep_nonce, sizeof(sim->sep_nonce));
+		sim_fill_info(device, &sim->info);
+		sim->info.srnm = sim->srnm;
+		sim->info.ap_nonce = sim->ap_nonce;
+		sim->info.sep_nonce = sim->sep_nonce;
+		info = &sim->info;
+	}
+	pthread_mutex_unlock(&sim_lock);
+
+	return info;
+}
+
+static irecv_error_t sim_send_command(void* handle, const char* command) {
+	struct sim_handle_t* sim = (struct sim_handle_t*)handle;
+	struct sim_device_t* device = sim->device;
+
+	pthread_mutex_lock(&sim_lock);
+	if (sim->generation != device->generation) {
+		pthread_mutex_unlock(&sim_lock);
+		return IRECV_E_NO_DEVICE;
+	}
+	if (sim_config.dfu) {
+		pthread_mutex_unlock(&sim_lock);
+		return IRECV_E_UNSUPPORTED;
+	}
+	if (sim_config.fail_command > 0 && sim_random(device) < sim_config.fail_command) {
+		pthread_mutex_unlock(&sim_lock);
+		return IRECV_E_PIPE;
+	}
+
+	if (!strcmp(command, "reset")) {
+		device->generation++;
+		if (device->autoboot || (sim_config.fail_autoboot > 0 && sim_random(device) < sim_config.fail_autoboot)) {
+			device->in_normal = 1;
+			device->booted_at = sim_now_ms() + sim_latency(device, sim_config.latency_ms) + sim_config.ios_boot_ms;
+		} else {
+			device->booted_at = sim_now_ms() + sim_latency(device, sim_config.latency_ms);
+			sim_boot(device);
+		}
+	} else if (!strcmp(command, "setenv auto-boot true")) {
+		device->autoboot_pending = 1;
+	} else if (!strcmp(command, "setenv auto-boot false")) {
+		device->autoboot_pending = 0;
+	} else if (!strcmp(command, "saveenv")) {
+		device->autoboot = device->autoboot_pending;
+	}
+	pthread_mutex_unlock(&sim_lock);
+
+	return IRECV_E_SUCCESS;
+}
+
+static irecv_error_t sim_getenv(void* handle, const char* variable, char** value) {
+	struct sim_handle_t* sim = (struct sim_handle_t*)handle;
+	irecv_error_t err = IRECV_E_SUCCESS;
+
+	pthread_mutex_lock(&sim_lock);
+	if (sim->generation != sim->device->generation) {
+		err = IRECV_E_NO_DEVICE;
+	} else if (sim_config.dfu) {
+		err = IRECV_E_UNSUPPORTED;
+	} else if (!strcmp(variable, "auto-boot")) {
+		*value = strdup((sim->device->autoboot_pending) ? "true" : "false");
+	} else {
+		err = IRECV_E_UNKNOWN_ERROR;
+	}
+	pthread_mutex_unlock(&sim_lock);
+
+	return err;
+}
+
+static int sim_normal_probe(uint64_t ecid) {
+	struct sim_device_t* device = NULL;
+	int found = 0;
+
+	pthread_mutex_lock(&sim_lock);
+	device = sim_find_device(ecid);
+	if (device && device->in_normal && sim_now_ms() >= device->booted_at) {
+		found = 1;
+	}
+	pthread_mutex_unlock(&sim_lock);
+
+	return found;
+}
+
+static irecv_error_t sim_normal_enter_recovery(uint64_t ecid) {
+	struct sim_device_t* device = NULL;
+	irecv_error_t err = IRECV_E_NO_DEVICE;
+
+	pthread_mutex_lock(&sim_lock);
+	device = sim_find_device(ecid);
+	if (device && device->in_normal && sim_now_ms() >= device->booted_at) {
+		/* like lockdownd, this clears auto-boot so the device stays in recovery */
+		device->in_normal = 0;
+		device->autoboot = device->autoboot_pending = 0;
+		device->generation++;
+		device->booted_at = sim_now_ms() + sim_latency(device, sim_config.latency_ms);
+		sim_boot(device);
+		err = IRECV_E_SUCCESS;
+	}
+	pthread_mutex_unlock(&sim_lock);
+
+	return err;
+}
+
+static irecv_error_t sim_reset(void* handle) {
+	struct sim_handle_t* sim = (struct sim_handle_t*)handle;
+	struct sim_device_t* device = sim->device;
+
+	pthread_mutex_lock(&sim_lock);
+	if (sim->generation != device->generation) {
+		pthread_mutex_unlock(&sim_lock);
+		return IRECV_E_NO_DEVICE;
+	}
+	device->generation++;
+	if (sim_config.dfu) {
+		device->booted_at = sim_now_ms() + sim_latency(device, sim_config.dfu_latency_ms);
+		sim_boot(device);
+	}
+	/* in recovery mode a USB reset only re-enumerates, the nonce stays the same */
+	pthread_mutex_unlock(&sim_lock);
+
+	return IRECV_E_SUCCESS;
+}
+
+static int sim_enumerate(transport_device_cb_t callback, void* user_data) {
+	struct irecv_device_info* infos = NULL;
+	int* modes = NULL;
+	unsigned int count = 0;
+	unsigned int i;
+
+	/* snapshot under the lock, the callback may call back into the transport */
+	pthread_mutex_lock(&sim_lock);
+	infos = (struct irecv_device_info*)calloc(sim_config.devices, sizeof(struct irecv_device_info));
+	modes = (int*)calloc(sim_config.devices, sizeof(int));
+	for (i = 0; infos && modes && sim_devices && i < sim_config.devices; i++) {
+		struct sim_device_t* device = &sim_devices[i];
+		if (sim_now_ms() < device->booted_at) {
+			continue;
+		}
+		sim_fill_info(device, &infos[count]);
+		if (device->in_normal) {
+			modes[count] = TRANSPORT_MODE_NORMAL;
+		} else {
+			modes[count] = (sim_config.dfu) ? IRECV_K_DFU_MODE : IRECV_K_RECOVERY_MODE_2;
+		}
+		count++;
+	}
+	pthread_mutex_unlock(&sim_lock);
+
+	for (i = 0; i < count; i++) {
+		callback(&infos[i], modes[i], user_data);
+	}
+	free(infos);
+	free(modes);
+
+	return (sim_devices) ? 0 : -1;
+}
+
+static irecv_error_t sim_send_buffer(void* handle, unsigned char* buffer, unsigned long length) {
+	return IRECV_E_SUCCESS;
+}
+
+const struct transport_backend_t transport_sim_backend = {
+	.name = "sim",
+	.open_with_ecid = sim_open_with_ecid,
+	.close = sim_close,
+	.get_mode = sim_get_mode,
+	.get_device_info = sim_get_device_info,
+	.send_command = sim_send_command,
+	.send_buffer = sim_send_buffer,
+	.getenv = sim_getenv,
+	.sleep = sim_sleep,
+	.normal_probe = sim_normal_probe,
+	.normal_enter_recovery = sim_normal_enter_recovery,
+	.reset = sim_reset,
+	.enumerate = sim_enumerate,
+	.now = sim_now_us
+};
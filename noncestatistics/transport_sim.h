@@ -0,0 +1,52 @@
+/*
+ * transport_sim.h
+ * In-process simulated recovery mode devices for the transport layer
+ */
+
+#ifndef IDEVICERESTORE_TRANSPORT_SIM_H
+#define IDEVICERESTORE_TRANSPORT_SIM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "transport.h"
+
+#define SIM_NONCE_RANDOM     0
+#define SIM_NONCE_FIXED      1
+#define SIM_NONCE_CYCLE      2
+
+#define SIM_ECID_BASE        0x5100000000000ULL
+
+struct transport_sim_config_t {
+	unsigned int devices;
+	unsigned int latency_ms;
+	unsigned int jitter_ms;
+	int nonce_mode;
+	unsigned int nonce_bits;
+	unsigned int nonce_period;
+	unsigned int nonce_size;
+	double fail_open;
+	double fail_info;
+	double fail_command;
+	int autoboot;
+	unsigned int ios_boot_ms;
+	int dfu;
+	unsigned int dfu_latency_ms;
+	double fail_autoboot;
+	uint64_t seed;
+};
+
+extern const struct transport_backend_t transport_sim_backend;
+
+int transport_sim_parse_config(const char* spec, struct transport_sim_config_t* config);
+int transport_sim_configure(const struct transport_sim_config_t* config);
+void transport_sim_free(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
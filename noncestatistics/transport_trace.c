@@ -0,0 +1,559 @@
+/*
+ * transport_trace.c
+ * Record and replay of transport sessions
+ *
+ * A trace is the magic string followed by one record per transport call:
+ * an op byte, the nanoseconds since the previous record, the result code and
+ * op specific fields. Integers are LEB128 varints (results zigzag encoded),
+ * byte strings are a varint length followed by the data.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <libirecovery.h>
+
+#include "common.h"
+#include "transport_trace.h"
+
+struct trace_record_t {
+	int op;
+	uint64_t timestamp;
+	int result;
+	uint64_t value;
+	char* command;
+	char* env;
+	int has_info;
+	struct irecv_device_info info;
+};
+
+static FILE* trace_file = NULL;
+static const struct transport_backend_t* trace_inner = NULL;
+static uint64_t trace_last = 0;
+static __thread uint64_t trace_normal_start = 0;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct trace_record_t* replay_records = NULL;
+static size_t replay_count = 0;
+static size_t replay_pos = 0;
+static int replay_realtime = 0;
+static uint64_t replay_started = 0;
+
+static uint64_t trace_now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void trace_put_varint(uint64_t value) {
+	unsigned char buf[10];
+	int i = 0;
+	do {
+		buf[i] = value & 0x7f;
+		value >>= 7;
+		if (value) {
+			buf[i] |= 0x80;
+		}
+		i++;
+	} while (value);
+	fwrite(buf, 1, i, trace_file);
+}
+
+static void trace_put_bytes(const void* data, size_t size) {
+	trace_put_varint(size);
+	if (size) {
+		fwrite(data, 1, size, trace_file);
+	}
+}
+
+/* records are stamped with the time their call started, which is when replay starts it again */
+static void trace_begin(int op, uint64_t start, int result) {
+	if (start < trace_last) {
+		start = trace_last;
+	}
+	fputc(op, trace_file);
+	trace_put_varint(start - trace_last);
+	trace_put_varint(((uint64_t)result << 1) ^ (uint64_t)(result >> 31));
+	trace_last = start;
+}
+
+static irecv_error_t record_open_with_ecid(void** handle, uint64_t ecid) {
+	uint64_t start = trace_now_ns();
+	irecv_error_t err = trace_inner->open_with_ecid(handle, ecid);
+	pthread_mutex_lock(&trace_lock);
+	trace_begin(TRACE_OP_OPEN, start, err);
+	trace_put_varint(ecid);
+	pthread_mutex_unlock(&trace_lock);
+	return err;
+}
+
+static irecv_error_t record_close(void* handle) {
+	uint64_t start = trace_now_ns();
+	irecv_error_t err = trace_inner->close(handle);
+	pthread_mutex_lock(&trace_lock);
+	trace_begin(TRACE_OP_CLOSE, start, err);
+	pthread_mutex_unlock(&trace_lock);
+	return err;
+}
+
+static irecv_error_t record_get_mode(void* handle, int* mode) {
+	uint64_t start = trace_now_ns();
+	irecv_error_t err = trace_inner->get_mode(handle, mode);
+	pthread_mutex_lock(&trace_lock);
+	trace_begin(TRACE_OP_GET_MODE, start, err);
+	trace_put_varint((err == IRECV_E_SUCCESS) ? (unsigned int)*mode : 0);
+	pthread_mutex_unlock(&trace_lock);
+	return err;
+}
+
+static const struct irecv_device_info* record_get_device_info(void* handle) {
+	uint64_t start = trace_now_ns();
+	const struct irecv_device_info* info = trace_inner->get_device_info(handle);
+	pthread_mutex_lock(&trace_lock);
+	trace_begin(TRACE_OP_GET_INFO, start, (info) ? IRECV_E_SUCCESS : IRECV_E_NO_DEVICE);
+	if (info) {
+		trace_put_varint(info->cpid);
+		trace_put_varint(info->bdid);
+		trace_put_varint(info->ecid);
+		trace_put_varint(info->ibfl);
+		trace_put_bytes(info->srnm, (info->srnm) ? strlen(info->srnm) : 0);
+		trace_put_bytes(info->ap_nonce, (info->ap_nonce) ? info->ap_nonce_size : 0);
+		trace_put_bytes(info->sep_nonce, (info->sep_nonce) ? info->sep_nonce_size : 0);
+	}
+	pthread_mutex_unlock(&trace_lock);
+	return info;
+}
+
+static irecv_error_t record_send_command(void* handle, const char* command) {
+	uint64_t start = trace_now_ns();
+	irecv_error_t err = trace_inner->send_command(handle, command);
+	pthread_mutex_lock(&trace_lock);
+	trace_begin(TRACE_OP_COMMAND, start, err);
+	trace_put_bytes(command, strlen(command));
+	fflush(trace_file);
+	pthread_mutex_unlock(&trace_lock);
+	return err;
+}
+
+static irecv_error_t record_send_buffer(void* handle, unsigned char* buffer, unsigned long length) {
+	uint64_t start = trace_now_ns();
+	irecv_error_t err = (trace_inner->send_buffer) ? trace_inner->send_buffer(handle, buffer, length) : IRECV_E_UNSUPPORTED;
+	pthread_mutex_lock(&trace_lock);
+	trace_begin(TRACE_OP_BUFFER, start, err);
+	trace_put_varint(length);
+	pthread_mutex_unlock(&trace_lock);
+	return err;
+}
+
+static irecv_error_t record_getenv(void* handle, const char* variable, char** value) {
+	uint64_t start = trace_now_ns();
+	irecv_error_t err = (trace_inner->getenv) ? trace_inner->getenv(handle, variable, value) : IRECV_E_UNSUPPORTED;
+	pthread_mutex_lock(&trace_lock);
+	trace_begin(TRACE_OP_GETENV, start, err);
+	trace_put_bytes(variable, strlen(variable));
+	trace_put_bytes(*value, (err == IRECV_E_SUCCESS && *value) ? strlen(*value) : 0);
+	pthread_mutex_unlock(&trace_lock);
+	return err;
+}
+
+/*
+ * Normal mode is recorded by outcome. When the inner backend can't tell,
+ * normal.c asks libimobiledevice and reports what it found through the
+ * normal_probed and normal_entered_recovery hooks, so a trace of real
+ * hardware has what lockdown answered and replay never needs a device.
+ * Those records start when the inner backend was asked.
+ */
+static void record_normal_probed(uint64_t ecid, int found) {
+	uint64_t start = (trace_normal_start) ? trace_normal_start : trace_now_ns();
+	trace_normal_start = 0;
+	pthread_mutex_lock(&trace_lock);
+	trace_begin(TRACE_OP_NORMAL, start, found);
+	trace_put_varint(ecid);
+	pthread_mutex_unlock(&trace_lock);
+}
+
+static void record_normal_entered_recovery(uint64_t ecid, irecv_error_t err) {
+	uint64_t start = (trace_normal_start) ? trace_normal_start : trace_now_ns();
+	trace_normal_start = 0;
+	pthread_mutex_lock(&trace_lock);
+	trace_begin(TRACE_OP_ENTER_REC, start, err);
+	trace_put_varint(ecid);
+	fflush(trace_file);
+	pthread_mutex_unlock(&trace_lock);
+}
+
+static int record_normal_probe(uint64_t ecid) {
+	int found = 0;
+	trace_normal_start = trace_now_ns();
+	found = (trace_inner->normal_probe) ? trace_inner->normal_probe(ecid) : -1;
+	if (found >= 0) {
+		record_normal_probed(ecid, found);
+	}
+	return found;
+}
+
+static irecv_error_t record_normal_enter_recovery(uint64_t ecid) {
+	irecv_error_t err = IRECV_E_UNSUPPORTED;
+	trace_normal_start = trace_now_ns();
+	err = (trace_inner->normal_enter_recovery) ? trace_inner->normal_enter_recovery(ecid) : IRECV_E_UNSUPPORTED;
+	if (err != IRECV_E_UNSUPPORTED) {
+		record_normal_entered_recovery(ecid, err);
+	}
+	return err;
+}
+
+static irecv_error_t record_reset(void* handle) {
+	uint64_t start = trace_now_ns();
+	irecv_error_t err = (trace_inner->reset) ? trace_inner->reset(handle) : IRECV_E_UNSUPPORTED;
+	pthread_mutex_lock(&trace_lock);
+	trace_begin(TRACE_OP_RESET, start, err);
+	fflush(trace_file);
+	pthread_mutex_unlock(&trace_lock);
+	return err;
+}
+
+static void record_init(void) {
+	if (trace_inner->init) {
+		trace_inner->init();
+	}
+}
+
+static void record_sleep(unsigned int usec) {
+	if (trace_inner->sleep) {
+		trace_inner->sleep(usec);
+	} else {
+		usleep(usec);
+	}
+}
+
+static int record_exhausted(void) {
+	return (trace_inner->exhausted) ? trace_inner->exhausted() : 0;
+}
+
+static uint64_t record_now(void) {
+	return (trace_inner->now) ? trace_inner->now() : trace_now_ns() / 1000;
+}
+
+const struct transport_backend_t transport_record_backend = {
+	.name = "record",
+	.init = record_init,
+	.open_with_ecid = record_open_with_ecid,
+	.close = record_close,
+	.get_mode = record_get_mode,
+	.get_device_info = record_get_device_info,
+	.send_command = record_send_command,
+	.send_buffer = record_send_buffer,
+	.getenv = record_getenv,
+	.sleep = record_sleep,
+	.exhausted = record_exhausted,
+	.normal_probe = record_normal_probe,
+	.normal_enter_recovery = record_normal_enter_recovery,
+	.reset = record_reset,
+	/* no .enumerate, discovery falls back to probing each mode, those probes are what gets recorded */
+	.normal_probed = record_normal_probed,
+	.normal_entered_recovery = record_normal_entered_recovery,
+	.now = record_now
+};
+
+int transport_trace_record_start(const char* filename) {
+	trace_file = fopen(filename, "wb");
+	if (!trace_file) {
+		error("ERROR: Unable to open trace file %s\n", filename);
+		return -1;
+	}
+	fwrite(TRACE_MAGIC, 1, strlen(TRACE_MAGIC), trace_file);
+	trace_last = trace_now_ns();
+	trace_inner = transport_get_backend();
+	transport_set_backend(&transport_record_backend);
+	return 0;
+}
+
+static int trace_get_varint(const unsigned char** p, const unsigned char* end, uint64_t* value) {
+	int shift = 0;
+	*value = 0;
+	while (*p < end && shift < 64) {
+		unsigned char c = *((*p)++);
+		*value |= (uint64_t)(c & 0x7f) << shift;
+		if (!(c & 0x80)) {
+			return 0;
+		}
+		shift += 7;
+	}
+	return -1;
+}
+
+static int trace_get_bytes(const unsigned char** p, const unsigned char* end, unsigned char** data, unsigned int* size) {
+	uint64_t length = 0;
+	if (trace_get_varint(p, end, &length) < 0 || length > (uint64_t)(end - *p)) {
+		return -1;
+	}
+	*size = (unsigned int)length;
+	*data = NULL;
+	if (length) {
+		*data = (unsigned char*)malloc(length + 1);
+		memcpy(*data, *p, length);
+		(*data)[length] = '\0';
+		*p += length;
+	}
+	return 0;
+}
+
+static int trace_parse_record(const unsigned char** p, const unsigned char* end, struct trace_record_t* record, uint64_t* clock) {
+	uint64_t delta = 0, result = 0, v = 0;
+	unsigned int size = 0;
+
+	memset(record, 0, sizeof(struct trace_record_t));
+	record->op = *((*p)++);
+	if (trace_get_varint(p, end, &delta) < 0 || trace_get_varint(p, end, &result) < 0) {
+		return -1;
+	}
+	*clock += delta;
+	record->timestamp = *clock;
+	record->result = (int)((result >> 1) ^ (~(result & 1) + 1));
+
+	switch (record->op) {
+	case TRACE_OP_OPEN:
+	case TRACE_OP_GET_MODE:
+	case TRACE_OP_BUFFER:
+	case TRACE_OP_NORMAL:
+	case TRACE_OP_ENTER_REC:
+		return trace_get_varint(p, end, &record->value);
+	case TRACE_OP_GETENV:
+		if (trace_get_bytes(p, end, (unsigned char**)&record->command, &size) < 0) return -1;
+		return trace_get_bytes(p, end, (unsigned char**)&record->env, &size);
+	case TRACE_OP_CLOSE:
+	case TRACE_OP_RESET:
+		return 0;
+	case TRACE_OP_COMMAND:
+		return trace_get_bytes(p, end, (unsigned char**)&record->command, &size);
+	case TRACE_OP_GET_INFO:
+		if (record->result != IRECV_E_SUCCESS) {
+			return 0;
+		}
+		record->has_info = 1;
+		if (trace_get_varint(p, end, &v) < 0) return -1;
+		record->info.cpid = (unsigned int)v;
+		if (trace_get_varint(p, end, &v) < 0) return -1;
+		record->info.bdid = (unsigned int)v;
+		if (trace_get_varint(p, end, &v) < 0) return -1;
+		record->info.ecid = v;
+		if (trace_get_varint(p, end, &v) < 0) return -1;
+		record->info.ibfl = (unsigned int)v;
+		if (trace_get_bytes(p, end, (unsigned char**)&record->info.srnm, &size) < 0) return -1;
+		if (trace_get_bytes(p, end, &record->info.ap_nonce, &record->info.ap_nonce_size) < 0) return -1;
+		if (trace_get_bytes(p, end, &record->info.sep_nonce, &record->info.sep_nonce_size) < 0) return -1;
+		return 0;
+	default:
+		return -1;
+	}
+}
+
+static void replay_free_records(void) {
+	size_t i;
+	for (i = 0; i < replay_count; i++) {
+		free(replay_records[i].command);
+		free(replay_records[i].env);
+		free(replay_records[i].info.srnm);
+		free(replay_records[i].info.ap_nonce);
+		free(replay_records[i].info.sep_nonce);
+	}
+	free(replay_records);
+	replay_records = NULL;
+	replay_count = 0;
+	replay_pos = 0;
+}
+
+/* returns the next record of the given op, pacing it if requested */
+static struct trace_record_t* replay_next(int op) {
+	struct trace_record_t* record = NULL;
+
+	pthread_mutex_lock(&trace_lock);
+	while (replay_pos < replay_count && replay_records[replay_pos].op != op) {
+		debug("DEBUG: trace out of sync, skipping op %d\n", replay_records[replay_pos].op);
+		replay_pos++;
+	}
+	if (replay_pos < replay_count) {
+		record = &replay_records[replay_pos++];
+	}
+	pthread_mutex_unlock(&trace_lock);
+
+	if (record && replay_realtime) {
+		uint64_t now = trace_now_ns();
+		if (replay_started == 0) {
+			replay_started = now - record->timestamp;
+		} else if (replay_started + record->timestamp > now) {
+			uint64_t wait = replay_started + record->timestamp - now;
+			usleep((useconds_t)(wait / 1000));
+		}
+	}
+	return record;
+}
+
+static irecv_error_t replay_open_with_ecid(void** handle, uint64_t ecid) {
+	struct trace_record_t* record = replay_next(TRACE_OP_OPEN);
+	if (!record) {
+		return IRECV_E_NO_DEVICE;
+	}
+	if (record->result == IRECV_E_SUCCESS) {
+		*handle = record;
+	}
+	return (irecv_error_t)record->result;
+}
+
+static irecv_error_t replay_close(void* handle) {
+	struct trace_record_t* record = replay_next(TRACE_OP_CLOSE);
+	return (record) ? (irecv_error_t)record->result : IRECV_E_SUCCESS;
+}
+
+static irecv_error_t replay_get_mode(void* handle, int* mode) {
+	struct trace_record_t* record = replay_next(TRACE_OP_GET_MODE);
+	if (!record) {
+		return IRECV_E_NO_DEVICE;
+	}
+	*mode = (int)record->value;
+	return (irecv_error_t)record->result;
+}
+
+static const struct irecv_device_info* replay_get_device_info(void* handle) {
+	struct trace_record_t* record = replay_next(TRACE_OP_GET_INFO);
+	return (record && record->has_info) ? &record->info : NULL;
+}
+
+static irecv_error_t replay_send_command(void* handle, const char* command) {
+	struct trace_record_t* record = replay_next(TRACE_OP_COMMAND);
+	if (!record) {
+		return IRECV_E_NO_DEVICE;
+	}
+	if (!record->command || strcmp(record->command, command) != 0) {
+		debug("DEBUG: trace expected command '%s', got '%s'\n", (record->command) ? record->command : "", command);
+	}
+	return (irecv_error_t)record->result;
+}
+
+static irecv_error_t replay_send_buffer(void* handle, unsigned char* buffer, unsigned long length) {
+	struct trace_record_t* record = replay_next(TRACE_OP_BUFFER);
+	return (record) ? (irecv_error_t)record->result : IRECV_E_NO_DEVICE;
+}
+
+static irecv_error_t replay_getenv(void* handle, const char* variable, char** value) {
+	struct trace_record_t* record = replay_next(TRACE_OP_GETENV);
+	if (!record) {
+		return IRECV_E_NO_DEVICE;
+	}
+	if (record->result == IRECV_E_SUCCESS && record->env) {
+		*value = strdup(record->env);
+	}
+	return (irecv_error_t)record->result;
+}
+
+/* never "can't tell", that would make normal.c ask libimobiledevice. Older traces have that in place of the outcome */
+static int replay_normal_probe(uint64_t ecid) {
+	struct trace_record_t* record = replay_next(TRACE_OP_NORMAL);
+	return (record && record->result > 0) ? 1 : 0;
+}
+
+static irecv_error_t replay_normal_enter_recovery(uint64_t ecid) {
+	struct trace_record_t* record = replay_next(TRACE_OP_ENTER_REC);
+	if (!record || record->result == IRECV_E_UNSUPPORTED) {
+		return IRECV_E_NO_DEVICE;
+	}
+	return (irecv_error_t)record->result;
+}
+
+static irecv_error_t replay_reset(void* handle) {
+	struct trace_record_t* record = replay_next(TRACE_OP_RESET);
+	return (record) ? (irecv_error_t)record->result : IRECV_E_NO_DEVICE;
+}
+
+static void replay_sleep(unsigned int usec) {
+	/* the recorded timestamps already contain every wait */
+}
+
+static int replay_exhausted(void) {
+	int exhausted = 0;
+	pthread_mutex_lock(&trace_lock);
+	exhausted = (replay_pos >= replay_count);
+	pthread_mutex_unlock(&trace_lock);
+	return exhausted;
+}
+
+const struct transport_backend_t transport_replay_backend = {
+	.name = "replay",
+	.open_with_ecid = replay_open_with_ecid,
+	.close = replay_close,
+	.get_mode = replay_get_mode,
+	.get_device_info = replay_get_device_info,
+	.send_command = replay_send_command,
+	.send_buffer = replay_send_buffer,
+	.getenv = replay_getenv,
+	.sleep = replay_sleep,
+	.exhausted = replay_exhausted,
+	.normal_probe = replay_normal_probe,
+	.normal_enter_recovery = replay_normal_enter_recovery,
+	.reset = replay_reset
+};
+
+int transport_trace_replay_start(const char* filename, int realtime) {
+	void* data = NULL;
+	size_t size = 0;
+	size_t capacity = 0;
+	uint64_t clock = 0;
+	const unsigned char* p = NULL;
+	const unsigned char* end = NULL;
+
+	if (read_file(filename, &data, &size) < 0) {
+		return -1;
+	}
+	if (size < strlen(TRACE_MAGIC) || memcmp(data, TRACE_MAGIC, strlen(TRACE_MAGIC)) != 0) {
+		error("ERROR: %s is not a transport trace\n", filename);
+		free(data);
+		return -1;
+	}
+
+	replay_free_records();
+	p = (const unsigned char*)data + strlen(TRACE_MAGIC);
+	end = (const unsigned char*)data + size;
+	while (p < end) {
+		if (replay_count == capacity) {
+			struct trace_record_t* records = NULL;
+			capacity = (capacity) ? capacity * 2 : 1024;
+			records = (struct trace_record_t*)realloc(replay_records, capacity * sizeof(struct trace_record_t));
+			if (!records) {
+				error("ERROR: Out of memory\n");
+				replay_free_records();
+				free(data);
+				return -1;
+			}
+			replay_records = records;
+		}
+		if (trace_parse_record(&p, end, &replay_records[replay_count], &clock) < 0) {
+			/* a truncated tail is expected when the recording was killed */
+			debug("DEBUG: ignoring truncated trace record at offset %ld\n", (long)(p - (const unsigned char*)data));
+			break;
+		}
+		replay_count++;
+	}
+	free(data);
+
+	info("Loaded %lu trace records from %s\n", (unsigned long)replay_count, filename);
+	replay_realtime = realtime;
+	replay_started = 0;
+	transport_set_backend(&transport_replay_backend);
+	return 0;
+}
+
+void transport_trace_stop(void) {
+	const struct transport_backend_t* backend = transport_get_backend();
+
+	if (backend == &transport_record_backend) {
+		transport_set_backend(trace_inner);
+		fclose(trace_file);
+		trace_file = NULL;
+	} else if (backend == &transport_replay_backend) {
+		transport_set_backend(NULL);
+		replay_free_records();
+	}
+}
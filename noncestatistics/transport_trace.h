@@ -0,0 +1,41 @@
+/*
+ * transport_trace.h
+ * Record and replay of transport sessions
+ */
+
+#ifndef IDEVICERESTORE_TRANSPORT_TRACE_H
+#define IDEVICERESTORE_TRANSPORT_TRACE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "transport.h"
+
+#define TRACE_MAGIC          "NSTRACE1"
+
+#define TRACE_OP_OPEN        1
+#define TRACE_OP_CLOSE       2
+#define TRACE_OP_GET_MODE    3
+#define TRACE_OP_GET_INFO    4
+#define TRACE_OP_COMMAND     5
+#define TRACE_OP_BUFFER      6
+#define TRACE_OP_GETENV      7
+#define TRACE_OP_NORMAL      8
+#define TRACE_OP_ENTER_REC   9
+#define TRACE_OP_RESET       10
+
+extern const struct transport_backend_t transport_record_backend;
+extern const struct transport_backend_t transport_replay_backend;
+
+/* wraps the currently selected backend and logs every call to filename */
+int transport_trace_record_start(const char* filename);
+/* replays filename; realtime != 0 reproduces the recorded pacing */
+int transport_trace_replay_start(const char* filename, int realtime);
+void transport_trace_stop(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,179 @@
+/*
+ * usb_location.c
+ * Remembers where on the USB bus a device was last seen
+ *
+ * irecv_open_with_ecid() opens every Apple device on the bus to compare
+ * ECIDs, and the reconnect loop calls it every 50ms while a device reboots.
+ * libirecovery can't open a device by location, but the kernel already has
+ * the serial string (which contains the ECID) of every port in sysfs. So
+ * once a device has been seen, waiting for it only means reading one sysfs
+ * file, and the bus is scanned once it is back. A full scan still happens
+ * every USB_LOCATION_RESCAN_MS so a device plugged into another port is
+ * found, and a remembered port that shows another device is forgotten.
+ *
+ * Only Linux exposes the serial this way, elsewhere every check is
+ * USB_LOCATION_UNKNOWN and nothing changes.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <dirent.h>
+#endif
+
+#include "common.h"
+#include "usb_location.h"
+
+#ifndef USB_LOCATION_SYSFS
+#define USB_LOCATION_SYSFS "/sys/bus/usb/devices"
+#endif
+
+#ifdef __linux__
+struct usb_location_t {
+	uint64_t ecid;
+	char port[256];
+	uint64_t last_scan;
+};
+
+static struct usb_location_t* usb_locations = NULL;
+static unsigned int usb_location_count = 0;
+static pthread_mutex_t usb_location_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t usb_location_now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* reads the ECID out of the serial string of a port, -1 if there is no iBoot device */
+static int usb_location_read_ecid(const char* port, uint64_t* ecid) {
+	char path[256];
+	char serial[256];
+	char* tag = NULL;
+	FILE* file = NULL;
+	size_t length = 0;
+
+	snprintf(path, sizeof(path), "%s/%s/serial", USB_LOCATION_SYSFS, port);
+	file = fopen(path, "r");
+	if (!file) {
+		return -1;
+	}
+	length = fread(serial, 1, sizeof(serial) - 1, file);
+	fclose(file);
+	serial[length] = '\0';
+
+	tag = strstr(serial, "ECID:");
+	if (!tag) {
+		return -1;
+	}
+	*ecid = strtoull(tag + 5, NULL, 16);
+	return 0;
+}
+
+static struct usb_location_t* usb_location_find(uint64_t ecid) {
+	unsigned int i;
+	for (i = 0; i < usb_location_count; i++) {
+		if (usb_locations[i].ecid == ecid) {
+			return &usb_locations[i];
+		}
+	}
+	return NULL;
+}
+#endif
+
+int usb_location_check(uint64_t ecid) {
+#ifdef __linux__
+	struct usb_location_t* location = NULL;
+	uint64_t port_ecid = 0;
+	uint64_t now = 0;
+	int result = USB_LOCATION_UNKNOWN;
+
+	pthread_mutex_lock(&usb_location_lock);
+	location = usb_location_find(ecid);
+	if (location) {
+		now = usb_location_now_ms();
+		if (usb_location_read_ecid(location->port, &port_ecid) == 0) {
+			if (port_ecid == ecid) {
+				result = USB_LOCATION_PRESENT;
+			} else {
+				debug("Port %s now has device 0x%llx, forgetting it for 0x%llx\n", location->port, (unsigned long long)port_ecid, (unsigned long long)ecid);
+				*location = usb_locations[--usb_location_count];
+			}
+		} else if (now - location->last_scan < USB_LOCATION_RESCAN_MS) {
+			result = USB_LOCATION_ABSENT;
+		} else {
+			location->last_scan = now;
+		}
+	}
+	pthread_mutex_unlock(&usb_location_lock);
+
+	return result;
+#else
+	return USB_LOCATION_UNKNOWN;
+#endif
+}
+
+void usb_location_remember(uint64_t ecid) {
+#ifdef __linux__
+	struct usb_location_t* location = NULL;
+	struct dirent* entry = NULL;
+	uint64_t port_ecid = 0;
+	DIR* dir = NULL;
+
+	pthread_mutex_lock(&usb_location_lock);
+	location = usb_location_find(ecid);
+	if (location && usb_location_read_ecid(location->port, &port_ecid) == 0 && port_ecid == ecid) {
+		pthread_mutex_unlock(&usb_location_lock);
+		return;
+	}
+
+	dir = opendir(USB_LOCATION_SYSFS);
+	while (dir && (entry = readdir(dir)) != NULL) {
+		/* interfaces ("1-2:1.0") have no serial, skip them and the dot entries */
+		if (entry->d_name[0] == '.' || strchr(entry->d_name, ':')) {
+			continue;
+		}
+		if (usb_location_read_ecid(entry->d_name, &port_ecid) < 0 || port_ecid != ecid) {
+			continue;
+		}
+		if (!location) {
+			struct usb_location_t* locations = (struct usb_location_t*)realloc(usb_locations, (usb_location_count + 1) * sizeof(struct usb_location_t));
+			if (!locations) {
+				break;
+			}
+			usb_locations = locations;
+			location = &usb_locations[usb_location_count++];
+			location->ecid = ecid;
+		}
+		snprintf(location->port, sizeof(location->port), "%s", entry->d_name);
+		location->last_scan = usb_location_now_ms();
+		debug("Device 0x%llx is at USB port %s\n", (unsigned long long)ecid, location->port);
+		break;
+	}
+	if (dir) {
+		closedir(dir);
+	}
+	pthread_mutex_unlock(&usb_location_lock);
+#endif
+}
+
+int usb_location_port(uint64_t ecid, char* port, size_t size) {
+#ifdef __linux__
+	struct usb_location_t* location = NULL;
+	int result = -1;
+
+	pthread_mutex_lock(&usb_location_lock);
+	location = usb_location_find(ecid);
+	if (location) {
+		snprintf(port, size, "%s", location->port);
+		result = 0;
+	}
+	pthread_mutex_unlock(&usb_location_lock);
+	return result;
+#else
+	return -1;
+#endif
+}
@@ -0,0 +1,38 @@
+/*
+ * usb_location.h
+ * Remembers where on the USB bus a device was last seen
+ */
+
+#ifndef IDEVICERESTORE_USB_LOCATION_H
+#define IDEVICERESTORE_USB_LOCATION_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define USB_LOCATION_UNKNOWN  -1
+#define USB_LOCATION_ABSENT    0
+#define USB_LOCATION_PRESENT   1
+
+/* how often a device that isn't at its port yet still gets a full bus scan, in case it moved */
+#define USB_LOCATION_RESCAN_MS 1000
+
+/*
+ * Returns USB_LOCATION_PRESENT if the device is back at its remembered port,
+ * USB_LOCATION_ABSENT if it isn't and a bus scan can be skipped, and
+ * USB_LOCATION_UNKNOWN if the caller has to scan the whole bus.
+ */
+int usb_location_check(uint64_t ecid);
+/* looks up the port of a device that was just opened */
+void usb_location_remember(uint64_t ecid);
+/* the sysfs name of the port the device was last seen at, like "1-2.3", -1 if it is not known */
+int usb_location_port(uint64_t ecid, char* port, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
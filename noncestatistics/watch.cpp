@@ -0,0 +1,166 @@
+#include "watch.hpp"
+#include <iostream>
+#include <set>
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+#include "stats.hpp"
+#include "common.h"
+
+#define WATCH_READ_SIZE  65536
+#define WATCH_TOP        20
+
+LogTail::LogTail(const char* filename) : filename(filename){
+#ifdef __linux__
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+    reopen();
+}
+
+LogTail::~LogTail(){
+    if (fd >= 0) close(fd);
+    if (inotifyFd >= 0) close(inotifyFd);
+}
+
+bool LogTail::reopen(){
+    struct stat st;
+
+    if (fd >= 0) close(fd);
+    offset = 0;
+    pending.clear();
+    fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        fd = -1;
+        return false;
+    }
+    inode = st.st_ino;
+#ifdef __linux__
+    if (inotifyFd >= 0) {
+        if (watch >= 0) inotify_rm_watch(inotifyFd, watch);
+        watch = inotify_add_watch(inotifyFd, filename.c_str(), IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF);
+    }
+#endif
+    return true;
+}
+
+void LogTail::wait(int timeoutMs, bool& restarted){
+    struct stat st;
+
+    restarted = false;
+    if (inotifyFd >= 0 && watch >= 0) {
+        struct pollfd pfd = { inotifyFd, POLLIN, 0 };
+        char events[4096];
+        if (poll(&pfd, 1, timeoutMs) > 0) {
+            while (read(inotifyFd, events, sizeof(events)) > 0);
+        }
+    } else if (timeoutMs > 0) {
+        usleep(timeoutMs * 1000);
+    }
+
+    // a log that was moved away may still be written, only a new file at the path replaces it
+    if (stat(filename.c_str(), &st) == 0 && (fd < 0 || st.st_ino != inode)) {
+        restarted = reopen();
+    } else if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size < offset) {
+        restarted = reopen();
+    }
+}
+
+bool LogTail::readLines(const std::function<void(const std::string&)>& onLine){
+    char buffer[WATCH_READ_SIZE];
+    ssize_t length = 0;
+
+    if (fd < 0) return true;
+    while ((length = pread(fd, buffer, sizeof(buffer), offset)) > 0) {
+        size_t start = 0;
+        offset += length;
+        pending.append(buffer, length);
+        for (size_t end = pending.find('\n'); end != std::string::npos; end = pending.find('\n', start)) {
+            onLine(pending.substr(start, end - start));
+            start = end + 1;
+        }
+        pending.erase(0, start);
+    }
+    return length == 0;
+}
+
+// Keeps the counts of the log in memory and redraws the report whenever
+// lines were added. The most frequent nonces are kept ordered as they are
+// counted, so a redraw does not depend on the size of the log.
+int cmd_watch(const char* filename){
+    typedef std::set<std::pair<int, std::string>, std::greater<std::pair<int, std::string> > > Ranking;
+    LogTail tail(filename);
+    NonceCounts counts;
+    SpaceEstimator estimator;
+    Ranking collisions;
+    bool changed = false;
+    bool tty = isatty(STDOUT_FILENO);
+    int timeoutMs = 0;
+
+    auto onLine = [&](const std::string& line){
+        std::string apNonce = countNonceLine(line, counts);
+        if (apNonce.empty()) return;
+        estimator.add(apNonce);
+        int count = counts.apNonces[apNonce];
+        if (count > 2) collisions.erase(std::make_pair(count-1, apNonce));
+        if (count > 1) collisions.insert(std::make_pair(count, apNonce));
+        changed = true;
+    };
+
+    if (!tail.isOpen()) info("Waiting for %s to be created...\n", filename);
+    idevicerestore_log_flush();
+    for (;;) {
+        bool restarted = false;
+        tail.wait(timeoutMs, restarted);
+        timeoutMs = 1000;
+        if (restarted) {
+            counts = NonceCounts();
+            estimator = SpaceEstimator();
+            collisions.clear();
+            changed = true;
+        }
+        if (!tail.readLines(onLine)) {
+            error("ERROR: Unable to read %s: %s\n", filename, strerror(errno));
+            return -1;
+        }
+        if (!changed) continue;
+        changed = false;
+
+        char now[32];
+        time_t t = time(NULL);
+        strftime(now, sizeof(now), "%H:%M:%S", localtime(&t));
+        if (!tty) {
+            printf("%s %d nonces, %zu distinct, %zu collisions. %s\n", now, counts.amount, counts.apNonces.size(), collisions.size(),
+                   estimateSummary(estimator, 0.95).c_str());
+            fflush(stdout);
+            continue;
+        }
+
+        printf("\033[H\033[2J");
+        printf("Watching %s (updated %s)\n\n", filename, now);
+        printf("%d nonces, %zu distinct, %d SEP nonces\n", counts.amount, counts.apNonces.size(), counts.sepAmount);
+        if (counts.amount) std::cout << estimateSummary(estimator, 0.95) << std::endl;
+        std::cout << std::endl << "ApNonce collisions: " << collisions.size() << std::endl;
+        std::cout << "nonce                                     abs. frequency    rel. frequency" << std::endl;
+        std::cout << "===========================================================================" << std::endl;
+        int shown = 0;
+        for (auto p: collisions) {
+            if (shown++ == WATCH_TOP) break;
+            printf("%s         %4d             %2.3f%%\n", nonceToHex(p.second).c_str(), p.first, 100*((float)p.first/counts.amount));
+        }
+        if (collisions.size() > WATCH_TOP) std::cout << "..." << std::endl;
+        std::cout << "===========================================================================" << std::endl;
+        fflush(stdout);
+    }
+    return 0;
+}
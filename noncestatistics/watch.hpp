@@ -0,0 +1,37 @@
+#ifndef watch_hpp
+#define watch_hpp
+
+#include <string>
+#include <functional>
+#include <sys/types.h>
+
+// Follows a log the collector appends to and hands out every complete line
+// once. A line the collector has only partly flushed is kept until its end
+// arrives. Changes are waited for with inotify where there is one, every
+// timeout otherwise.
+class LogTail {
+public:
+    LogTail(const char* filename);
+    ~LogTail();
+    // waits up to timeoutMs for the log to change; restarted is set if it was
+    // truncated or replaced, the lines handed out so far belong to the old one
+    void wait(int timeoutMs, bool& restarted);
+    // calls onLine for every complete line appended since the last call. A log
+    // that isn't there (yet) has no lines, wait() keeps trying to open it
+    bool readLines(const std::function<void(const std::string&)>& onLine);
+    bool isOpen() const { return fd >= 0; }
+
+private:
+    bool reopen();
+    std::string filename;
+    int fd = -1;
+    int inotifyFd = -1;
+    int watch = -1;
+    off_t offset = 0;
+    ino_t inode = 0;
+    std::string pending;
+};
+
+int cmd_watch(const char* filename);
+
+#endif /* watch_hpp */